@@ -0,0 +1,228 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+   Benchmark of pixel crunching routines, not installed. Build with
+   "make webx-bench" and run without arguments.
+*/
+
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "webx_threads.h"
+#include "webx_palette.h"
+#include "webx_quantizer.h"
+
+#define BENCH_WIDTH     1024
+#define BENCH_HEIGHT    1024
+
+/* Smooth gradients with some noise, to resemble a photo. */
+static guchar*
+bench_make_image (gint width,
+                  gint height)
+{
+  guchar       *pixels;
+  guchar       *p;
+  guint32       seed = 1;
+  gint          noise;
+  gint          x, y;
+
+  pixels = g_new (guchar, width * height * 3);
+  p = pixels;
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      {
+        seed = seed * 1103515245 + 12345;
+        noise = (gint) ((seed >> 16) & 31) - 16;
+        *p++ = CLAMP (x * 255 / width + noise, 0, 255);
+        *p++ = CLAMP (y * 255 / height + noise, 0, 255);
+        *p++ = CLAMP ((x + y) * 255 / (width + height) - noise
+                      + 40.0 * sin (x * 0.02) * cos (y * 0.015), 0, 255);
+      }
+
+  return pixels;
+}
+
+static void
+bench_nearest (const guchar *pixels,
+               gint          width,
+               gint          height,
+               gint          num_colors)
+{
+  WebxHistogram        *histogram;
+  WebxPaletteLookup    *lookup;
+  GTimer               *timer;
+  guchar                palette[256 * 3];
+  guchar               *exhaustive;
+  guchar               *indices;
+  const guchar         *p;
+  gdouble               exhaustive_time;
+  gdouble               build_time;
+  gdouble               lookup_time;
+  gint                  n_pixels = width * height;
+  gint                  n_colors;
+  gint                  mismatches = 0;
+  gint                  i;
+
+  histogram = webx_histogram_new (pixels, width, height, width * 3, 3);
+  n_colors = webx_quantizer_make_palette (histogram, num_colors,
+                                          WEBX_COLOR_SPACE_RGB, palette, NULL);
+  webx_histogram_free (histogram);
+
+  exhaustive = g_new (guchar, n_pixels);
+  indices = g_new (guchar, n_pixels);
+  timer = g_timer_new ();
+
+  g_timer_start (timer);
+  for (i = 0, p = pixels; i < n_pixels; i++, p += 3)
+    exhaustive[i] = webx_palette_nearest (palette, n_colors, p[0], p[1], p[2]);
+  exhaustive_time = g_timer_elapsed (timer, NULL);
+
+  g_timer_start (timer);
+  lookup = webx_palette_lookup_new (palette, n_colors);
+  build_time = g_timer_elapsed (timer, NULL);
+  for (i = 0, p = pixels; i < n_pixels; i++, p += 3)
+    indices[i] = webx_palette_lookup_nearest (lookup, p[0], p[1], p[2]);
+  lookup_time = g_timer_elapsed (timer, NULL) - build_time;
+
+  for (i = 0; i < n_pixels; i++)
+    {
+      if (indices[i] != exhaustive[i])
+        mismatches++;
+    }
+
+  g_print ("%3d colors: exhaustive %7.1f ms, lookup %7.1f ms "
+           "(+ %.1f ms build), %.1fx, %d mismatches\n",
+           n_colors, exhaustive_time * 1000.0, lookup_time * 1000.0,
+           build_time * 1000.0, exhaustive_time / (build_time + lookup_time),
+           mismatches);
+
+  webx_palette_lookup_free (lookup);
+  g_timer_destroy (timer);
+  g_free (indices);
+  g_free (exhaustive);
+}
+
+static gdouble
+bench_psnr (const guchar *pixels,
+            const guchar *indices,
+            const guchar *palette,
+            gint          n_pixels)
+{
+  gdouble       error = 0.0;
+  gdouble       d;
+  gint          i, c;
+
+  for (i = 0; i < n_pixels; i++)
+    for (c = 0; c < 3; c++)
+      {
+        d = pixels[i * 3 + c] - palette[indices[i] * 3 + c];
+        error += d * d;
+      }
+  error /= n_pixels * 3.0;
+
+  return 10.0 * log10 (255.0 * 255.0 / MAX (error, 1e-10));
+}
+
+/* Palette trained on all pixels against one trained on subsample,
+ * both remapping all pixels. */
+static void
+bench_training (gint    width,
+                gint    height,
+                gint    num_colors)
+{
+  WebxHistogram        *histogram;
+  GTimer               *timer;
+  guchar               *pixels;
+  guchar               *indices;
+  guchar                palette[256 * 3];
+  gdouble               full_time;
+  gdouble               sampled_time;
+  gdouble               full_psnr;
+  gdouble               sampled_psnr;
+  gint                  n_colors;
+
+  pixels = bench_make_image (width, height);
+  indices = g_new (guchar, width * height);
+  timer = g_timer_new ();
+
+  g_timer_start (timer);
+  histogram = webx_histogram_new (pixels, width, height, width * 3, 3);
+  n_colors = webx_quantizer_make_palette (histogram, num_colors,
+                                          WEBX_COLOR_SPACE_RGB, palette, NULL);
+  webx_histogram_free (histogram);
+  full_time = g_timer_elapsed (timer, NULL);
+  webx_quantizer_remap (pixels, width, height, width * 3, 3,
+                        palette, n_colors, -1, indices);
+  full_psnr = bench_psnr (pixels, indices, palette, width * height);
+
+  g_timer_start (timer);
+  histogram = webx_histogram_new_sampled (pixels, width, height, width * 3, 3,
+                                          WEBX_TRAINING_SAMPLES);
+  n_colors = webx_quantizer_make_palette (histogram, num_colors,
+                                          WEBX_COLOR_SPACE_RGB, palette, NULL);
+  webx_histogram_free (histogram);
+  sampled_time = g_timer_elapsed (timer, NULL);
+  webx_quantizer_remap (pixels, width, height, width * 3, 3,
+                        palette, n_colors, -1, indices);
+  sampled_psnr = bench_psnr (pixels, indices, palette, width * height);
+
+  g_print ("%5dx%-5d %3d colors: full %7.1f ms %.2f dB, "
+           "sampled %7.1f ms %.2f dB\n",
+           width, height, num_colors,
+           full_time * 1000.0, full_psnr,
+           sampled_time * 1000.0, sampled_psnr);
+
+  g_timer_destroy (timer);
+  g_free (indices);
+  g_free (pixels);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  guchar       *pixels;
+
+  if (! g_thread_supported ())
+    g_thread_init (NULL);
+
+  pixels = bench_make_image (BENCH_WIDTH, BENCH_HEIGHT);
+
+  g_print ("nearest palette color, %dx%d pixels, %d threads available\n",
+           BENCH_WIDTH, BENCH_HEIGHT, webx_threads_get_count ());
+  bench_nearest (pixels, BENCH_WIDTH, BENCH_HEIGHT, 16);
+  bench_nearest (pixels, BENCH_WIDTH, BENCH_HEIGHT, 64);
+  bench_nearest (pixels, BENCH_WIDTH, BENCH_HEIGHT, 256);
+
+  g_print ("\npalette training (histogram and clustering)\n");
+  bench_training (2000, 1500, 64);
+  bench_training (2000, 1500, 256);
+  bench_training (6000, 4000, 64);
+  bench_training (6000, 4000, 256);
+
+  g_free (pixels);
+
+  return EXIT_SUCCESS;
+}
@@ -64,6 +64,16 @@ static void     webx_dialog_crop_changed        (GtkWidget     *widget,
                                                  WebxDialog    *dlg);
 static void     webx_dialog_target_resized      (GtkWidget     *widget,
                                                  WebxDialog    *dlg);
+static void     webx_dialog_viewport_changed    (GtkWidget     *widget,
+                                                 GdkRectangle  *viewport,
+                                                 WebxDialog    *dlg);
+static void     webx_dialog_layout_changed      (GtkWidget     *widget,
+                                                 gint           n_panes,
+                                                 WebxDialog    *dlg);
+static void     webx_dialog_update_panes        (WebxDialog    *dlg);
+static void     webx_dialog_pane_update         (WebxDialog    *dlg,
+                                                 guint          pane,
+                                                 WebxPipelineOutput    *output);
 
 static void     webx_dialog_format_set          (WebxDialog    *dlg,
                                                  WebxTarget    *format);
@@ -262,6 +272,9 @@ webx_dialog_new (gint image_ID,
   g_signal_connect_swapped (dlg->pipeline, "output-changed",
                             G_CALLBACK (webx_dialog_update),
                             dlg);
+  g_signal_connect_swapped (dlg->pipeline, "pane-changed",
+                            G_CALLBACK (webx_dialog_pane_update),
+                            dlg);
   g_object_ref_sink (dlg->pipeline);
   
   bg_width = gimp_image_width (image_ID);
@@ -439,6 +452,10 @@ webx_dialog_new (gint image_ID,
                       TRUE, TRUE, 0);
   g_signal_connect (WEBX_PREVIEW (dlg->preview), "crop-changed",
                     G_CALLBACK (webx_dialog_crop_changed), dlg);
+  g_signal_connect (WEBX_PREVIEW (dlg->preview), "viewport-changed",
+                    G_CALLBACK (webx_dialog_viewport_changed), dlg);
+  g_signal_connect (WEBX_PREVIEW (dlg->preview), "layout-changed",
+                    G_CALLBACK (webx_dialog_layout_changed), dlg);
   gtk_widget_show (GTK_WIDGET (dlg->preview));
 
   dlg->progress_bar = gimp_progress_bar_new ();
@@ -507,6 +524,9 @@ webx_dialog_save_dialog (WebxDialog       *dlg)
       saved = webx_pipeline_save_image (WEBX_PIPELINE (dlg->pipeline), filename);
       if (! saved)
         g_message (_("Failed to export the file!")); 
+      else
+        webx_target_finish_export (WEBX_TARGET (dlg->target), filename,
+                                   GTK_WINDOW (dlg));
       g_free (filename);
     }
 
@@ -551,6 +571,7 @@ webx_dialog_format_set (WebxDialog     *dlg,
 
   webx_pipeline_set_target (WEBX_PIPELINE (dlg->pipeline),
                           GTK_OBJECT (dlg->target));
+  webx_dialog_update_panes (dlg);
 }
 
 static void
@@ -592,6 +613,7 @@ webx_dialog_update (WebxDialog         *dlg,
       webx_preview_update (WEBX_PREVIEW (dlg->preview),
                            output->background, output->target,
                            &output->target_rect,
+                           &output->target_region,
                            output->file_size);
       webx_crop_widget_update (WEBX_CROP_WIDGET (dlg->crop),
                                &output->target_rect,
@@ -603,12 +625,18 @@ webx_dialog_update (WebxDialog         *dlg,
     {
       webx_preview_update_target (WEBX_PREVIEW (dlg->preview),
                                   output->target,
+                                  &output->target_region,
                                   output->file_size);
     }
 
-  g_snprintf (text, sizeof (text),
-              _("File size: %02.01f kB"),
-              (gdouble) output->file_size / 1024.0);
+  if (output->file_size_estimated)
+    g_snprintf (text, sizeof (text),
+                _("File size: ~%02.01f kB"),
+                (gdouble) output->file_size / 1024.0);
+  else
+    g_snprintf (text, sizeof (text),
+                _("File size: %02.01f kB"),
+                (gdouble) output->file_size / 1024.0);
   gtk_label_set_text (GTK_LABEL (dlg->file_size_label), text);
 }
 
@@ -659,3 +687,76 @@ webx_dialog_target_resized (GtkWidget   *widget,
   webx_preview_resize (WEBX_PREVIEW (dlg->preview),
                        width, height);
 }
+
+static void
+webx_dialog_viewport_changed (GtkWidget    *widget,
+                              GdkRectangle *viewport,
+                              WebxDialog   *dlg)
+{
+  g_return_if_fail (WEBX_DIALOG (dlg));
+
+  webx_pipeline_set_viewport (WEBX_PIPELINE (dlg->pipeline), viewport);
+}
+
+static void
+webx_dialog_layout_changed (GtkWidget    *widget,
+                            gint          n_panes,
+                            WebxDialog   *dlg)
+{
+  g_return_if_fail (WEBX_DIALOG (dlg));
+
+  webx_dialog_update_panes (dlg);
+}
+
+/* Second pane always shows current format, remaining panes
+ * get the other formats, each with its own settings. */
+static void
+webx_dialog_update_panes (WebxDialog *dlg)
+{
+  WebxPreview  *preview;
+  GSList       *panes = NULL;
+  GSList       *target_list;
+  GSList       *radio_list;
+  const gchar  *name;
+  gint          n_panes;
+  gint          pane;
+
+  preview = WEBX_PREVIEW (dlg->preview);
+  n_panes = webx_preview_get_n_panes (preview);
+
+  pane = 2;
+  for (target_list = dlg->target_list, radio_list = dlg->radio_list;
+       target_list && radio_list;
+       target_list = target_list->next, radio_list = radio_list->next)
+    {
+      if (! target_list->data)
+        continue;
+
+      name = gtk_button_get_label (GTK_BUTTON (radio_list->data));
+      if (target_list->data == dlg->target)
+        {
+          webx_preview_set_pane_name (preview, 1, name);
+        }
+      else if (pane < n_panes)
+        {
+          webx_preview_set_pane_name (preview, pane++, name);
+          panes = g_slist_append (panes, target_list->data);
+        }
+    }
+
+  webx_pipeline_set_pane_targets (WEBX_PIPELINE (dlg->pipeline), panes);
+  g_slist_free (panes);
+}
+
+static void
+webx_dialog_pane_update (WebxDialog         *dlg,
+                         guint               pane,
+                         WebxPipelineOutput *output)
+{
+  g_return_if_fail (WEBX_DIALOG (dlg));
+
+  webx_preview_update_pane (WEBX_PREVIEW (dlg->preview), pane + 2,
+                            output->target,
+                            &output->target_region,
+                            output->file_size);
+}
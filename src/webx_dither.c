@@ -0,0 +1,456 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <glib.h>
+
+#if defined (ARCH_X86) && defined (__SSE2__)
+#define WEBX_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include "webx_threads.h"
+#include "webx_palette.h"
+#include "webx_quantizer.h"
+#include "webx_dither.h"
+
+#define WEBX_ALPHA_THRESHOLD    128
+#define WEBX_BAYER_SIZE         WEBX_DITHER_PATTERN_SIZE
+/* error diffusion rows publish their progress in steps of this */
+#define WEBX_DIFFUSE_CHUNK      32
+#define WEBX_DIFFUSE_PADDING    2
+#define WEBX_MIN_ROWS_PER_JOB   16
+
+typedef struct
+{
+  gint                  dx;
+  gint                  dy;
+  gint                  weight;
+} WebxDitherTap;
+
+typedef struct
+{
+  gint                  denominator;
+  /* rows below current one reached by taps */
+  gint                  rows;
+  gint                  n_taps;
+  WebxDitherTap         taps[6];
+} WebxDitherKernel;
+
+static const WebxDitherKernel webx_dither_floyd_steinberg =
+{
+  16, 1, 4,
+  { { 1, 0, 7 }, { -1, 1, 3 }, { 0, 1, 5 }, { 1, 1, 1 } }
+};
+
+static const WebxDitherKernel webx_dither_sierra_lite =
+{
+  4, 1, 3,
+  { { 1, 0, 2 }, { -1, 1, 1 }, { 0, 1, 1 } }
+};
+
+/* spreads only 6/8 of error, which keeps contrast */
+static const WebxDitherKernel webx_dither_atkinson =
+{
+  8, 2, 6,
+  { { 1, 0, 1 }, { 2, 0, 1 }, { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 },
+    { 0, 2, 1 } }
+};
+
+typedef struct
+{
+  const guchar             *pixels;
+  gint                      width;
+  gint                      height;
+  gint                      rowstride;
+  gint                      bpp;
+  const guchar             *palette;
+  WebxPaletteLookup        *lookup;
+  gint                      transparent;
+  gboolean                  alpha_dither;
+  guchar                   *indices;
+
+  /* ordered dither: offsets for each of WEBX_BAYER_SIZE rows */
+  gint8                    *pattern;
+
+  /* error diffusion */
+  const WebxDitherKernel   *kernel;
+  gint                      strength;
+  gint                     *errors;
+  gint                      error_rows;
+  gint                      error_stride;
+  gint                     *progress;
+} WebxDitherJob;
+
+/* Threshold of Bayer matrix, 0 .. WEBX_BAYER_SIZE^2 - 1. */
+static gint
+webx_dither_bayer (gint x,
+                   gint y)
+{
+  gint  value = 0;
+  gint  bit;
+
+  for (bit = 2; bit >= 0; bit--)
+    {
+      value <<= 2;
+      value |= (((x ^ y) >> bit) & 1) << 1;
+      value |= (y >> bit) & 1;
+    }
+
+  return value;
+}
+
+static inline gboolean
+webx_dither_is_transparent (WebxDitherJob *data,
+                            const guchar  *p,
+                            gint           x,
+                            gint           y)
+{
+  if (data->bpp != 4 || data->transparent < 0)
+    return FALSE;
+
+  if (data->alpha_dither)
+    return p[3] < webx_dither_bayer (x % WEBX_BAYER_SIZE,
+                                     y % WEBX_BAYER_SIZE) * 4 + 2;
+  return p[3] < WEBX_ALPHA_THRESHOLD;
+}
+
+/* dest = src + pattern, saturated to 0 .. 255 */
+static void
+webx_dither_add_pattern (const guchar *src,
+                         const gint8  *pattern,
+                         guchar       *dest,
+                         gint          n)
+{
+  gint          i = 0;
+
+#ifdef WEBX_USE_SSE2
+  {
+    __m128i     bias;
+    __m128i     s;
+
+    /* flip to signed range, so that signed saturation clamps */
+    bias = _mm_set1_epi8 ((gchar) 0x80);
+    for (; i + 16 <= n; i += 16)
+      {
+        s = _mm_loadu_si128 ((const __m128i *) (src + i));
+        s = _mm_xor_si128 (s, bias);
+        s = _mm_adds_epi8 (s, _mm_loadu_si128 ((const __m128i *) (pattern + i)));
+        s = _mm_xor_si128 (s, bias);
+        _mm_storeu_si128 ((__m128i *) (dest + i), s);
+      }
+  }
+#endif
+
+  for (; i < n; i++)
+    dest[i] = CLAMP (src[i] + pattern[i], 0, 255);
+}
+
+static void
+webx_dither_ordered_job (gint           job,
+                         gint           n_jobs,
+                         WebxDitherJob *data)
+{
+  const guchar *src;
+  const guchar *p;
+  guchar       *adjusted;
+  guchar       *dest;
+  gint          row_size = data->width * data->bpp;
+  gint          y1, y2;
+  gint          x, y;
+
+  y1 = data->height * job / n_jobs;
+  y2 = data->height * (job + 1) / n_jobs;
+
+  adjusted = g_new (guchar, row_size);
+  for (y = y1; y < y2; y++)
+    {
+      src = data->pixels + y * data->rowstride;
+      dest = data->indices + y * data->width;
+      webx_dither_add_pattern (src,
+                               data->pattern
+                               + (y % WEBX_BAYER_SIZE) * row_size,
+                               adjusted, row_size);
+
+      for (x = 0; x < data->width; x++)
+        {
+          if (webx_dither_is_transparent (data, src + x * data->bpp, x, y))
+            {
+              dest[x] = data->transparent;
+              continue;
+            }
+
+          p = adjusted + x * data->bpp;
+          dest[x] = webx_palette_lookup_nearest (data->lookup,
+                                                 p[0], p[1], p[2]);
+        }
+    }
+  g_free (adjusted);
+}
+
+static void
+webx_dither_ordered (WebxDitherJob *data,
+                     gint           n_colors,
+                     gdouble        strength)
+{
+  gint8        *row;
+  gdouble       amplitude;
+  gint          row_size = data->width * data->bpp;
+  gint          offset;
+  gint          x, y, c;
+
+  /* about distance between neighbour colors of evenly spread palette */
+  amplitude = strength * 255.0 / pow (n_colors, 1.0 / 3.0);
+  amplitude = MIN (amplitude, 254.0);
+
+  data->pattern = g_new (gint8, WEBX_BAYER_SIZE * row_size);
+  for (y = 0; y < WEBX_BAYER_SIZE; y++)
+    {
+      row = data->pattern + y * row_size;
+      for (x = 0; x < data->width; x++)
+        {
+          offset = ((webx_dither_bayer (x % WEBX_BAYER_SIZE, y) + 0.5)
+                    / (WEBX_BAYER_SIZE * WEBX_BAYER_SIZE) - 0.5)
+                   * amplitude;
+          for (c = 0; c < 3; c++)
+            row[x * data->bpp + c] = offset;
+          if (data->bpp == 4)
+            row[x * data->bpp + 3] = 0;
+        }
+    }
+
+  webx_threads_run ((WebxThreadFunc) webx_dither_ordered_job,
+                    CLAMP (data->height / WEBX_MIN_ROWS_PER_JOB,
+                           1, webx_threads_get_count ()),
+                    data);
+
+  g_free (data->pattern);
+}
+
+static inline gint
+webx_dither_divide (gint value,
+                    gint denominator)
+{
+  if (value >= 0)
+    return (value + denominator / 2) / denominator;
+  return -((-value + denominator / 2) / denominator);
+}
+
+/* Job j takes rows j, j + n_jobs, ... Before pixel x of row y is done,
+ * row y - 1 must be past x + 1, so that all error from above has
+ * arrived. Errors along the row are kept locally, as row above may
+ * still be writing further right in the shared error row. */
+static void
+webx_dither_diffuse_job (gint           job,
+                         gint           n_jobs,
+                         WebxDitherJob *data)
+{
+  const WebxDitherKernel *kernel = data->kernel;
+  const WebxDitherTap    *tap;
+  const guchar           *src;
+  const guchar           *p;
+  const guchar           *color;
+  guchar                 *dest;
+  gint                   *errors;
+  gint                   *below;
+  gint                    carry[WEBX_DIFFUSE_PADDING + 1][3];
+  gint                    value[3];
+  gint                    error[3];
+  gint                    needed;
+  gint                    index;
+  gint                    x, y, c, t, k;
+
+  for (y = job; y < data->height; y += n_jobs)
+    {
+      src = data->pixels + y * data->rowstride;
+      dest = data->indices + y * data->width;
+      errors = data->errors
+               + (y % data->error_rows) * data->error_stride
+               + WEBX_DIFFUSE_PADDING * 3;
+
+      /* rows this far ahead were last used by row y - n_jobs, which
+       * this job has finished already */
+      memset (data->errors
+              + ((y + kernel->rows) % data->error_rows) * data->error_stride,
+              0, data->error_stride * sizeof (gint));
+      memset (carry, 0, sizeof (carry));
+
+      for (x = 0; x < data->width; x++)
+        {
+          if (y > 0 && x % WEBX_DIFFUSE_CHUNK == 0)
+            {
+              needed = MIN (x + WEBX_DIFFUSE_CHUNK + 1, data->width);
+              while (g_atomic_int_get (&data->progress[y - 1]) < needed)
+                g_thread_yield ();
+            }
+
+          p = src + x * data->bpp;
+          if (webx_dither_is_transparent (data, p, x, y))
+            {
+              dest[x] = data->transparent;
+            }
+          else
+            {
+              for (c = 0; c < 3; c++)
+                {
+                  value[c] = p[c] + webx_dither_divide (errors[x * 3 + c]
+                                                        + carry[0][c],
+                                                        kernel->denominator);
+                  value[c] = CLAMP (value[c], 0, 255);
+                }
+
+              index = webx_palette_lookup_nearest (data->lookup, value[0],
+                                                   value[1], value[2]);
+              dest[x] = index;
+              color = data->palette + index * 3;
+              for (c = 0; c < 3; c++)
+                error[c] = (value[c] - color[c]) * data->strength / 256;
+
+              for (t = 0; t < kernel->n_taps; t++)
+                {
+                  tap = &kernel->taps[t];
+                  if (tap->dy == 0)
+                    {
+                      for (c = 0; c < 3; c++)
+                        carry[tap->dx][c] += error[c] * tap->weight;
+                    }
+                  else
+                    {
+                      below = data->errors
+                              + ((y + tap->dy) % data->error_rows)
+                                * data->error_stride
+                              + (WEBX_DIFFUSE_PADDING + x + tap->dx) * 3;
+                      for (c = 0; c < 3; c++)
+                        below[c] += error[c] * tap->weight;
+                    }
+                }
+            }
+
+          for (k = 0; k < WEBX_DIFFUSE_PADDING; k++)
+            memcpy (carry[k], carry[k + 1], sizeof (carry[k]));
+          memset (carry[WEBX_DIFFUSE_PADDING], 0, sizeof (carry[0]));
+
+          if ((x + 1) % WEBX_DIFFUSE_CHUNK == 0)
+            g_atomic_int_set (&data->progress[y], x + 1);
+        }
+
+      g_atomic_int_set (&data->progress[y], data->width);
+    }
+}
+
+static void
+webx_dither_diffuse (WebxDitherJob          *data,
+                     const WebxDitherKernel *kernel,
+                     gdouble                 strength)
+{
+  gint          n_jobs;
+
+  /* more than a job per core would only spin */
+  n_jobs = CLAMP (data->height / WEBX_MIN_ROWS_PER_JOB,
+                  1, webx_threads_get_count ());
+
+  data->kernel = kernel;
+  data->strength = CLAMP (strength, 0.0, 1.0) * 256.0 + 0.5;
+  data->error_rows = n_jobs + kernel->rows;
+  data->error_stride = (data->width + 2 * WEBX_DIFFUSE_PADDING) * 3;
+  data->errors = g_new0 (gint, data->error_rows * data->error_stride);
+  data->progress = g_new0 (gint, data->height);
+
+  webx_threads_run ((WebxThreadFunc) webx_dither_diffuse_job,
+                    n_jobs, data);
+
+  g_free (data->progress);
+  g_free (data->errors);
+}
+
+/* Maps pixels to the first n_colors palette colors, like
+ * webx_quantizer_remap(), but with dithering. strength scales the
+ * dither from 0 (none) to 1 (full). With alpha_dither, pixels are
+ * made transparent by ordered dither of alpha instead of threshold. */
+void
+webx_dither_remap (const guchar   *pixels,
+                   gint            width,
+                   gint            height,
+                   gint            rowstride,
+                   gint            bpp,
+                   const guchar   *palette,
+                   gint            n_colors,
+                   gint            transparent,
+                   WebxDitherType  dither_type,
+                   gdouble         strength,
+                   gboolean        alpha_dither,
+                   guchar         *indices)
+{
+  WebxDitherJob data;
+
+  g_return_if_fail (pixels != NULL);
+  g_return_if_fail (palette != NULL);
+  g_return_if_fail (indices != NULL);
+  g_return_if_fail (bpp == 3 || bpp == 4);
+
+  if (n_colors < 1
+      || (dither_type == WEBX_DITHER_NONE && ! alpha_dither))
+    {
+      webx_quantizer_remap (pixels, width, height, rowstride, bpp,
+                            palette, n_colors, transparent, indices);
+      return;
+    }
+
+  data.pixels = pixels;
+  data.width = width;
+  data.height = height;
+  data.rowstride = rowstride;
+  data.bpp = bpp;
+  data.palette = palette;
+  data.lookup = webx_palette_lookup_new (palette, n_colors);
+  data.transparent = transparent;
+  data.alpha_dither = alpha_dither;
+  data.indices = indices;
+
+  switch (dither_type)
+    {
+    case WEBX_DITHER_FLOYD_STEINBERG:
+      webx_dither_diffuse (&data, &webx_dither_floyd_steinberg, strength);
+      break;
+
+    case WEBX_DITHER_SIERRA_LITE:
+      webx_dither_diffuse (&data, &webx_dither_sierra_lite, strength);
+      break;
+
+    case WEBX_DITHER_ATKINSON:
+      webx_dither_diffuse (&data, &webx_dither_atkinson, strength);
+      break;
+
+    case WEBX_DITHER_ORDERED:
+      webx_dither_ordered (&data, n_colors, strength);
+      break;
+
+    default:
+      /* only alpha is dithered */
+      webx_dither_ordered (&data, n_colors, 0.0);
+      break;
+    }
+
+  webx_palette_lookup_free (data.lookup);
+}
@@ -0,0 +1,55 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+   Dithering of RGB/RGBA pixels to palette. Ordered dither works on
+   independent row bands, error diffusion runs rows on several threads
+   as a wavefront: each row trails the one above it by a few pixels.
+*/
+
+#ifndef __WEBX_DITHER_H__
+#define __WEBX_DITHER_H__
+
+typedef enum
+{
+  WEBX_DITHER_NONE,
+  WEBX_DITHER_FLOYD_STEINBERG,
+  WEBX_DITHER_SIERRA_LITE,
+  WEBX_DITHER_ATKINSON,
+  WEBX_DITHER_ORDERED
+} WebxDitherType;
+
+/* ordered dither pattern repeats after this many pixels both ways */
+#define WEBX_DITHER_PATTERN_SIZE 8
+
+void        webx_dither_remap       (const guchar   *pixels,
+                                     gint            width,
+                                     gint            height,
+                                     gint            rowstride,
+                                     gint            bpp,
+                                     const guchar   *palette,
+                                     gint            n_colors,
+                                     gint            transparent,
+                                     WebxDitherType  dither_type,
+                                     gdouble         strength,
+                                     gboolean        alpha_dither,
+                                     guchar         *indices);
+
+#endif /* __WEBX_DITHER_H__ */
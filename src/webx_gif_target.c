@@ -20,19 +20,38 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <gtk/gtk.h>
 #include <libgimp/gimp.h>
+#include <libgimp/gimpui.h>
 
 #include "webx_main.h"
 #include "webx_gif_target.h"
+#include "webx_gif_writer.h"
+#include "webx_utils.h"
 
 #include "plugin-intl.h"
 
+/* frame delay when layer name doesn't tell */
+#define WEBX_GIF_DEFAULT_DELAY  100
+
+static void     webx_gif_target_destroy       (GtkObject       *object);
 static gboolean webx_gif_target_save_image    (WebxTarget      *widget,
                                                WebxTargetInput *input,
                                                const gchar     *file_name);
+static GdkPixbuf* webx_gif_target_render_preview (WebxTarget   *widget,
+                                               WebxTargetInput *input,
+                                               gint            *file_size);
 static gchar* webx_gif_target_get_unique_name (WebxTarget     *widget);
 static gchar* webx_gif_target_get_extension   (WebxTarget     *widget);
+static gboolean webx_gif_target_uses_frames   (WebxTarget     *widget);
+static gboolean webx_gif_target_needs_whole   (WebxTarget     *widget);
+static void     webx_gif_target_changed       (WebxTarget     *widget);
+static gboolean webx_gif_target_get_frames    (WebxGifTarget   *gif,
+                                               WebxTargetInput *input,
+                                               WebxTargetInput *frames);
 
 G_DEFINE_TYPE (WebxGifTarget, webx_gif_target, WEBX_TYPE_INDEXED_TARGET)
 
@@ -43,14 +62,22 @@ static void
 webx_gif_target_class_init (WebxGifTargetClass *klass)
 {
   GObjectClass         *object_class;
+  GtkObjectClass       *gtk_object_class;
   WebxTargetClass      *target_class;
 
   object_class = G_OBJECT_CLASS (klass);
 
+  gtk_object_class = GTK_OBJECT_CLASS (klass);
+  gtk_object_class->destroy = webx_gif_target_destroy;
+
   target_class = WEBX_TARGET_CLASS (klass);
   target_class->save_image      = webx_gif_target_save_image;
+  target_class->render_preview  = webx_gif_target_render_preview;
   target_class->get_unique_name = webx_gif_target_get_unique_name;
   target_class->get_extension   = webx_gif_target_get_extension;
+  target_class->uses_frames     = webx_gif_target_uses_frames;
+  target_class->needs_whole     = webx_gif_target_needs_whole;
+  target_class->target_changed  = webx_gif_target_changed;
 }
 
 static void
@@ -58,6 +85,21 @@ webx_gif_target_init (WebxGifTarget *gif)
 {
 }
 
+static void
+webx_gif_target_destroy (GtkObject *object)
+{
+  WebxGifTarget        *gif;
+
+  gif = WEBX_GIF_TARGET (object);
+  g_free (gif->frames);
+  gif->frames = NULL;
+  g_free (gif->delays);
+  gif->delays = NULL;
+
+  if (GTK_OBJECT_CLASS (parent_class)->destroy)
+    GTK_OBJECT_CLASS (parent_class)->destroy (object);
+}
+
 GtkWidget*
 webx_gif_target_new (void)
 {
@@ -71,6 +113,15 @@ webx_gif_target_new (void)
                                         row++,
                                         _("_Interlace"),
                                         &gif->interlace);
+  gif->lossiness_o = webx_range_entry_new (WEBX_TARGET (gif),
+                                           row++,
+                                           _("_Lossiness"), 0, 100,
+                                           &gif->lossiness);
+  gif->animation_o = webx_checkbox_new (WEBX_TARGET (gif),
+                                        row++,
+                                        _("_Animate layers"),
+                                        &gif->animation);
+  webx_gif_target_changed (WEBX_TARGET (gif));
 
   return GTK_WIDGET (gif);
 }
@@ -86,8 +137,40 @@ webx_gif_target_save_image (WebxTarget  *widget,
   gint                  image;
   gint                  layer;
   gboolean              save_res;
+  WebxIndexedImage     *quantized;
+  WebxTargetInput       frames;
 
   gif = WEBX_GIF_TARGET (widget);
+
+  if (webx_gif_target_get_frames (gif, input, &frames))
+    {
+      quantized =
+        webx_indexed_target_get_indexed (WEBX_INDEXED_TARGET (widget),
+                                         &frames);
+      if (quantized)
+        {
+          save_res = webx_gif_writer_save_frames (quantized,
+                                                  frames.pixels,
+                                                  frames.rowstride,
+                                                  gif->n_frames,
+                                                  gif->delays,
+                                                  gif->interlace,
+                                                  gif->lossiness, file_name);
+          webx_indexed_image_free (quantized);
+          return save_res;
+        }
+    }
+
+  quantized = webx_indexed_target_get_indexed (WEBX_INDEXED_TARGET (widget),
+                                               input);
+  if (quantized)
+    {
+      save_res = webx_gif_writer_save (quantized, gif->interlace,
+                                       gif->lossiness, file_name);
+      webx_indexed_image_free (quantized);
+      return save_res;
+    }
+
   image = webx_indexed_target_get_image (WEBX_INDEXED_TARGET (widget),
                                          input,
                                          &layer);
@@ -114,6 +197,65 @@ webx_gif_target_save_image (WebxTarget  *widget,
   return save_res;
 }
 
+/* Own palettes are encoded in memory, only file size is needed and
+ * pixels are shown as they are, after lossy compression changed
+ * them. Animation shows its first frame. */
+static GdkPixbuf*
+webx_gif_target_render_preview (WebxTarget      *widget,
+                                WebxTargetInput *input,
+                                gint            *file_size)
+{
+  WebxGifTarget        *gif;
+  WebxIndexedImage     *quantized = NULL;
+  WebxTargetInput       frames;
+  GByteArray           *data;
+  GdkPixbuf            *pixbuf;
+
+  gif = WEBX_GIF_TARGET (widget);
+
+  if (webx_gif_target_get_frames (gif, input, &frames))
+    {
+      quantized =
+        webx_indexed_target_get_indexed (WEBX_INDEXED_TARGET (widget),
+                                         &frames);
+      if (quantized)
+        {
+          data = webx_gif_writer_encode_frames (quantized,
+                                                frames.pixels,
+                                                frames.rowstride,
+                                                gif->n_frames,
+                                                gif->delays,
+                                                gif->interlace,
+                                                gif->lossiness);
+          /* first frame is at the top */
+          quantized->height = input->height;
+        }
+    }
+
+  if (! quantized)
+    {
+      quantized =
+        webx_indexed_target_get_indexed (WEBX_INDEXED_TARGET (widget),
+                                         input);
+      if (! quantized)
+        return WEBX_TARGET_CLASS (parent_class)->render_preview (widget,
+                                                                 input,
+                                                                 file_size);
+
+      data = webx_gif_writer_encode (quantized, gif->interlace,
+                                     gif->lossiness);
+    }
+
+  if (file_size)
+    *file_size = data->len;
+  g_byte_array_free (data, TRUE);
+
+  pixbuf = webx_indexed_image_to_pixbuf (quantized);
+  webx_indexed_image_free (quantized);
+
+  return pixbuf;
+}
+
 static gchar*
 webx_gif_target_get_unique_name (WebxTarget *widget)
 {
@@ -125,3 +267,169 @@ webx_gif_target_get_extension (WebxTarget *widget)
 {
   return "gif";
 }
+
+static gboolean
+webx_gif_target_uses_frames (WebxTarget *widget)
+{
+  return WEBX_GIF_TARGET (widget)->animation;
+}
+
+/* Lossy LZW picks indices along the string it is matching, which
+ * runs over rows of the whole image. */
+static gboolean
+webx_gif_target_needs_whole (WebxTarget *widget)
+{
+  return WEBX_GIF_TARGET (widget)->lossiness > 0;
+}
+
+/* Lossy LZW needs palette made by own quantizer, GIMP converts with
+ * reused and custom palettes. */
+static void
+webx_gif_target_changed (WebxTarget *widget)
+{
+  WebxGifTarget        *gif = WEBX_GIF_TARGET (widget);
+  WebxIndexedTarget    *indexed = WEBX_INDEXED_TARGET (widget);
+
+  if (! gif->lossiness_o)
+    return;
+
+  gimp_scale_entry_set_sensitive (gif->lossiness_o,
+                                  indexed->palette_type != GIMP_REUSE_PALETTE
+                                  && indexed->palette_type
+                                     != GIMP_CUSTOM_PALETTE);
+}
+
+/* Reads frame delay and mode from layer name, the same way GIF
+ * plug-in of GIMP does: "(250ms)" and "(replace)" or "(combine)". */
+static void
+webx_gif_target_parse_layer_name (const gchar *name,
+                                  gint        *delay,
+                                  gboolean    *replace)
+{
+  const gchar  *p;
+  gchar        *end;
+  glong         value;
+
+  *delay = WEBX_GIF_DEFAULT_DELAY;
+  *replace = FALSE;
+  if (! name)
+    return;
+
+  for (p = strchr (name, '('); p; p = strchr (p + 1, '('))
+    {
+      value = strtol (p + 1, &end, 10);
+      if (end > p + 1 && strncmp (end, "ms)", 3) == 0)
+        *delay = CLAMP (value, 0, 655350);
+      else if (strncmp (p, "(replace)", 9) == 0)
+        *replace = TRUE;
+      else if (strncmp (p, "(combine)", 9) == 0)
+        *replace = FALSE;
+    }
+}
+
+/* Puts layer over previous frame. */
+static void
+webx_gif_target_combine (guchar       *frame,
+                         const guchar *previous,
+                         gint          n_pixels)
+{
+  gint          under;
+  gint          alpha;
+  gint          c;
+  gint          i;
+
+  for (i = 0; i < n_pixels; i++, frame += 4, previous += 4)
+    {
+      if (frame[3] == 255)
+        continue;
+
+      under = previous[3] * (255 - frame[3]) / 255;
+      alpha = frame[3] + under;
+      if (alpha == 0)
+        continue;
+
+      for (c = 0; c < 3; c++)
+        frame[c] = (frame[c] * frame[3] + previous[c] * under) / alpha;
+      frame[3] = alpha;
+    }
+}
+
+/* Fills frames with visible layers of frames image as animation
+ * frames from bottom to top, one below another. Frames are read from
+ * GIMP once per pipeline update. Returns FALSE if animation is off or
+ * there is nothing to animate. */
+static gboolean
+webx_gif_target_get_frames (WebxGifTarget   *gif,
+                            WebxTargetInput *input,
+                            WebxTargetInput *frames)
+{
+  GimpDrawable *drawable;
+  GimpPixelRgn  pixel_rgn;
+  gint         *layers;
+  gint          num_layers;
+  gint          frame_size;
+  guchar       *dest;
+  gchar        *name;
+  gboolean      replace;
+  gint          i;
+
+  if (! gif->animation || input->frames_image == -1)
+    return FALSE;
+
+  if (! gif->frames || gif->frames_serial != input->serial)
+    {
+      g_free (gif->frames);
+      g_free (gif->delays);
+
+      layers = gimp_image_get_layers (input->frames_image, &num_layers);
+      frame_size = input->width * input->height * 4;
+      gif->frames = g_new (guchar, (gsize) frame_size * MAX (num_layers, 1));
+      gif->delays = g_new (gint, MAX (num_layers, 1));
+      gif->n_frames = 0;
+
+      for (i = num_layers - 1; i >= 0; i--)
+        {
+          if (! gimp_drawable_get_visible (layers[i])
+              || gimp_drawable_bpp (layers[i]) != 4
+              || gimp_drawable_width (layers[i]) != input->width
+              || gimp_drawable_height (layers[i]) != input->height)
+            continue;
+
+          dest = gif->frames + (gsize) gif->n_frames * frame_size;
+          drawable = gimp_drawable_get (layers[i]);
+          gimp_pixel_rgn_init (&pixel_rgn, drawable, 0, 0,
+                               input->width, input->height, FALSE, FALSE);
+          gimp_pixel_rgn_get_rect (&pixel_rgn, dest, 0, 0,
+                                   input->width, input->height);
+          gimp_drawable_detach (drawable);
+
+          name = gimp_drawable_get_name (layers[i]);
+          webx_gif_target_parse_layer_name (name,
+                                            &gif->delays[gif->n_frames],
+                                            &replace);
+          g_free (name);
+          if (gif->n_frames > 0 && ! replace)
+            webx_gif_target_combine (dest, dest - frame_size,
+                                     input->width * input->height);
+          gif->n_frames++;
+        }
+      g_free (layers);
+
+      gif->frames_serial = input->serial;
+    }
+
+  if (gif->n_frames == 0)
+    return FALSE;
+
+  *frames = *input;
+  frames->height = input->height * gif->n_frames;
+  frames->pixels = gif->frames;
+  frames->rowstride = input->width * 4;
+  frames->bpp = 4;
+  frames->whole_pixels = frames->pixels;
+  frames->whole_width = frames->width;
+  frames->whole_height = frames->height;
+  frames->frames_image = -1;
+
+  return TRUE;
+}
@@ -40,12 +40,26 @@ struct _WebxGifTarget
   WebxIndexedTarget     parent_instance;
 
   gint                  interlace;
+  /* 0 .. 100, how far LZW may stray from exact colors */
+  gint                  lossiness;
+  /* layers are frames of animation */
+  gboolean              animation;
   GtkObject            *interlace_o;
+  GtkObject            *lossiness_o;
+  GtkObject            *animation_o;
+
+  /* composed frames one below another, read from frames image of
+   * input with frames_serial */
+  guchar               *frames;
+  guint                 frames_serial;
+  gint                  n_frames;
+  /* milliseconds */
+  gint                 *delays;
 };
 
 struct _WebxGifTargetClass
 {
-  WebxTargetClass parent_class;
+  WebxIndexedTargetClass parent_class;
 };
 
 GType           webx_gif_target_get_type (void) G_GNUC_CONST;
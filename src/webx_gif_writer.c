@@ -0,0 +1,874 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "webx_threads.h"
+#include "webx_quantizer.h"
+#include "webx_gif_writer.h"
+
+#define WEBX_LZW_MAX_BITS       12
+#define WEBX_LZW_MAX_CODES      (1 << WEBX_LZW_MAX_BITS)
+/* twice the number of codes keeps probe chains short */
+#define WEBX_LZW_HASH_BITS      13
+#define WEBX_LZW_HASH_SIZE      (1 << WEBX_LZW_HASH_BITS)
+/* largest color error allowed by lossiness 100 */
+#define WEBX_LOSSY_MAX_ERROR    80.0
+#define WEBX_GIF_MIN_ROWS_PER_JOB 16
+
+typedef struct
+{
+  GByteArray   *data;
+  /* data sub-block being filled, first byte is its length */
+  guchar        block[256];
+  guint32       bits;
+  gint          n_bits;
+  gint          code_size;
+} WebxLzwWriter;
+
+typedef struct
+{
+  /* prefix code << 8 | index, plus one; 0 is free slot */
+  guint32       keys[WEBX_LZW_HASH_SIZE];
+  guint16       codes[WEBX_LZW_HASH_SIZE];
+} WebxLzwTable;
+
+typedef struct
+{
+  /* for each index, other indices close enough to stand in for it,
+   * nearest first */
+  guchar        near[256][256];
+  gint          n_near[256];
+} WebxLzwNear;
+
+typedef struct
+{
+  gint          index;
+  gint          dist;
+} WebxLzwCandidate;
+
+/* bounding box, empty when x1 <= x0 */
+typedef struct
+{
+  gint          x0, y0;
+  gint          x1, y1;
+} WebxGifBox;
+
+typedef struct
+{
+  /* pixels which differ from previous frame */
+  WebxGifBox    changed;
+  /* pixels which turn transparent, previous frame has to be disposed
+   * of to show them */
+  WebxGifBox    cleared;
+  /* part of screen stored in file, and what is done with it after
+   * delay */
+  WebxGifBox    box;
+  gint          disposal;
+  /* milliseconds */
+  gint          delay;
+  /* previous frame kept in file, -1 for the first one */
+  gint          previous;
+  GByteArray   *data;
+} WebxGifFrame;
+
+typedef struct
+{
+  WebxIndexedImage     *image;
+  /* RGBA pixels image was quantized from */
+  const guchar         *pixels;
+  gint                  rowstride;
+  gint                  frame_height;
+  gint                  n_frames;
+  WebxGifFrame         *frames;
+  /* frames kept in file, in order */
+  gint                 *kept;
+  /* index meaning "leave pixel as it is", -1 if palette has no room */
+  gint                  keep_index;
+  gboolean              interlace;
+  gint                  min_code_size;
+  const WebxLzwNear    *near;
+} WebxGifAnimation;
+
+static void
+webx_lzw_write_code (WebxLzwWriter *writer,
+                     gint           code)
+{
+  writer->bits |= (guint32) code << writer->n_bits;
+  writer->n_bits += writer->code_size;
+  while (writer->n_bits >= 8)
+    {
+      writer->block[++writer->block[0]] = writer->bits & 0xff;
+      writer->bits >>= 8;
+      writer->n_bits -= 8;
+      if (writer->block[0] == 255)
+        {
+          g_byte_array_append (writer->data, writer->block, 256);
+          writer->block[0] = 0;
+        }
+    }
+}
+
+static void
+webx_lzw_flush (WebxLzwWriter *writer)
+{
+  if (writer->n_bits > 0)
+    {
+      writer->block[++writer->block[0]] = writer->bits & 0xff;
+      writer->bits = 0;
+      writer->n_bits = 0;
+    }
+  if (writer->block[0] > 0)
+    g_byte_array_append (writer->data, writer->block, writer->block[0] + 1);
+  writer->block[0] = 0;
+}
+
+static inline guint
+webx_lzw_hash (guint32 key)
+{
+  return (key * 2654435761u) >> (32 - WEBX_LZW_HASH_BITS);
+}
+
+/* Slot of key, or of the free slot where it would go. */
+static inline guint
+webx_lzw_find (const WebxLzwTable *table,
+               guint32             key)
+{
+  guint         hash;
+
+  hash = webx_lzw_hash (key);
+  while (table->keys[hash] && table->keys[hash] != key)
+    hash = (hash + 1) & (WEBX_LZW_HASH_SIZE - 1);
+  return hash;
+}
+
+static gint
+webx_lzw_candidate_compare (const WebxLzwCandidate *a,
+                            const WebxLzwCandidate *b,
+                            gpointer                data)
+{
+  if (a->dist != b->dist)
+    return a->dist - b->dist;
+  return a->index - b->index;
+}
+
+/* Lists of colors within max_error of each other. Transparent index
+ * is never swapped for a color or the other way round. */
+static WebxLzwNear*
+webx_lzw_near_new (const guchar *palette,
+                   gint          n_colors,
+                   gint          transparent,
+                   gdouble       max_error)
+{
+  WebxLzwNear          *near;
+  WebxLzwCandidate      candidates[256];
+  gint                  max_dist;
+  gint                  dist;
+  gint                  d;
+  gint                  n;
+  gint                  i, j, a;
+
+  near = g_new0 (WebxLzwNear, 1);
+  max_dist = max_error * max_error;
+  for (i = 0; i < n_colors; i++)
+    {
+      if (i == transparent)
+        continue;
+
+      n = 0;
+      for (j = 0; j < n_colors; j++)
+        {
+          if (j == i || j == transparent)
+            continue;
+
+          dist = 0;
+          for (a = 0; a < 3; a++)
+            {
+              d = palette[i * 3 + a] - palette[j * 3 + a];
+              dist += d * d;
+            }
+          if (dist > max_dist)
+            continue;
+
+          candidates[n].index = j;
+          candidates[n].dist = dist;
+          n++;
+        }
+
+      g_qsort_with_data (candidates, n, sizeof (WebxLzwCandidate),
+                         (GCompareDataFunc) webx_lzw_candidate_compare,
+                         NULL);
+      for (j = 0; j < n; j++)
+        near->near[i][j] = candidates[j].index;
+      near->n_near[i] = n;
+    }
+
+  return near;
+}
+
+/* Compresses width x height indices (rows rowstride apart) as GIF
+ * image data: LZW minimum code size, data sub-blocks, terminator.
+ * Interlaced images have rows in the four pass order. With near, a
+ * string can also be extended by a close enough color, and such
+ * pixels are changed in indices to what the decoder will see. */
+static void
+webx_gif_write_lzw (GByteArray        *data,
+                    guchar            *indices,
+                    gint               width,
+                    gint               height,
+                    gint               rowstride,
+                    gboolean           interlace,
+                    gint               min_code_size,
+                    const WebxLzwNear *near)
+{
+  static const gint     pass_start[4] = { 0, 4, 2, 1 };
+  static const gint     pass_step[4] = { 8, 8, 4, 2 };
+  WebxLzwWriter         writer;
+  WebxLzwTable         *table;
+  guchar               *row;
+  guchar                byte;
+  guint32               key;
+  guint                 hash;
+  guint                 other;
+  gint                  clear_code;
+  gint                  next_code;
+  gint                  prefix = -1;
+  gint                  pass;
+  gint                  x, y;
+  gint                  i;
+
+  byte = min_code_size;
+  g_byte_array_append (data, &byte, 1);
+
+  writer.data = data;
+  writer.block[0] = 0;
+  writer.bits = 0;
+  writer.n_bits = 0;
+  writer.code_size = min_code_size + 1;
+
+  table = g_new0 (WebxLzwTable, 1);
+  clear_code = 1 << min_code_size;
+  next_code = clear_code + 2;
+  webx_lzw_write_code (&writer, clear_code);
+
+  for (pass = 0; pass < (interlace ? 4 : 1); pass++)
+    for (y = interlace ? pass_start[pass] : 0;
+         y < height;
+         y += interlace ? pass_step[pass] : 1)
+      {
+        row = indices + y * rowstride;
+        for (x = 0; x < width; x++)
+          {
+            if (prefix < 0)
+              {
+                prefix = row[x];
+                continue;
+              }
+
+            /* longest known string, extended by one index */
+            key = (((guint32) prefix << 8) | row[x]) + 1;
+            hash = webx_lzw_find (table, key);
+            if (table->keys[hash])
+              {
+                prefix = table->codes[hash];
+                continue;
+              }
+
+            if (near)
+              {
+                for (i = 0; i < near->n_near[row[x]]; i++)
+                  {
+                    other = webx_lzw_find (table,
+                                           (((guint32) prefix << 8)
+                                            | near->near[row[x]][i]) + 1);
+                    if (table->keys[other])
+                      break;
+                  }
+                if (i < near->n_near[row[x]])
+                  {
+                    row[x] = near->near[row[x]][i];
+                    prefix = table->codes[other];
+                    continue;
+                  }
+              }
+
+            webx_lzw_write_code (&writer, prefix);
+            table->keys[hash] = key;
+            table->codes[hash] = next_code;
+            if (next_code >= (1 << writer.code_size)
+                && writer.code_size < WEBX_LZW_MAX_BITS)
+              writer.code_size++;
+            next_code++;
+
+            if (next_code == WEBX_LZW_MAX_CODES)
+              {
+                /* table is full, start over */
+                webx_lzw_write_code (&writer, clear_code);
+                memset (table->keys, 0, sizeof (table->keys));
+                writer.code_size = min_code_size + 1;
+                next_code = clear_code + 2;
+              }
+
+            prefix = row[x];
+          }
+      }
+
+  if (prefix >= 0)
+    {
+      webx_lzw_write_code (&writer, prefix);
+      /* decoder adds an entry for the last code as well */
+      if (next_code >= (1 << writer.code_size)
+          && writer.code_size < WEBX_LZW_MAX_BITS)
+        writer.code_size++;
+    }
+  webx_lzw_write_code (&writer, clear_code + 1);
+  webx_lzw_flush (&writer);
+  g_free (table);
+
+  byte = 0;
+  g_byte_array_append (data, &byte, 1);
+}
+
+static void
+webx_gif_append_uint16 (GByteArray *data,
+                        gint        value)
+{
+  guchar        buf[2];
+
+  buf[0] = value & 0xff;
+  buf[1] = (value >> 8) & 0xff;
+  g_byte_array_append (data, buf, 2);
+}
+
+/* Color table has power of two entries, at least two. */
+static gint
+webx_gif_table_bits (gint n_colors)
+{
+  gint          table_bits;
+
+  table_bits = 1;
+  while ((1 << table_bits) < n_colors)
+    table_bits++;
+
+  return table_bits;
+}
+
+/* GIF header with logical screen and global color table. Returns
+ * number of bits of the table. */
+static gint
+webx_gif_write_screen (GByteArray   *data,
+                       gint          width,
+                       gint          height,
+                       const guchar *colors,
+                       gint          n_colors)
+{
+  guchar        buf[3];
+  guchar        palette[256 * 3];
+  gint          table_bits;
+
+  table_bits = webx_gif_table_bits (n_colors);
+  memset (palette, 0, sizeof (palette));
+  memcpy (palette, colors, MAX (n_colors, 0) * 3);
+
+  g_byte_array_append (data, (const guchar *) "GIF89a", 6);
+  webx_gif_append_uint16 (data, width);
+  webx_gif_append_uint16 (data, height);
+  buf[0] = 0x80 | ((table_bits - 1) << 4) | (table_bits - 1);
+  buf[1] = 0;                   /* background color */
+  buf[2] = 0;                   /* no aspect ratio */
+  g_byte_array_append (data, buf, 3);
+  g_byte_array_append (data, palette, (1 << table_bits) * 3);
+
+  return table_bits;
+}
+
+/* Graphic control extension, delay is in hundredths of a second. */
+static void
+webx_gif_write_control (GByteArray *data,
+                        gint        disposal,
+                        gint        delay,
+                        gint        transparent)
+{
+  guchar        buf[8];
+
+  buf[0] = 0x21;
+  buf[1] = 0xf9;
+  buf[2] = 4;
+  buf[3] = (disposal << 2) | (transparent >= 0 ? 0x01 : 0);
+  buf[4] = delay & 0xff;
+  buf[5] = (delay >> 8) & 0xff;
+  buf[6] = MAX (transparent, 0);
+  buf[7] = 0;
+  g_byte_array_append (data, buf, 8);
+}
+
+static void
+webx_gif_write_descriptor (GByteArray *data,
+                           gint        x,
+                           gint        y,
+                           gint        width,
+                           gint        height,
+                           gboolean    interlace)
+{
+  guchar        byte;
+
+  byte = 0x2c;
+  g_byte_array_append (data, &byte, 1);
+  webx_gif_append_uint16 (data, x);
+  webx_gif_append_uint16 (data, y);
+  webx_gif_append_uint16 (data, width);
+  webx_gif_append_uint16 (data, height);
+  byte = interlace ? 0x40 : 0;
+  g_byte_array_append (data, &byte, 1);
+}
+
+static WebxLzwNear*
+webx_gif_near_new (const guchar *palette,
+                   gint          n_colors,
+                   gint          transparent,
+                   gint          lossiness)
+{
+  if (lossiness <= 0)
+    return NULL;
+
+  return webx_lzw_near_new (palette, n_colors, transparent,
+                            WEBX_LOSSY_MAX_ERROR * MIN (lossiness, 100)
+                            / 100.0);
+}
+
+/* Encodes image as GIF file in memory. lossiness 0 .. 100 lets LZW
+ * use colors up to that far from the right ones (see
+ * WEBX_LOSSY_MAX_ERROR), image indices are then changed to match the
+ * file. */
+GByteArray*
+webx_gif_writer_encode (WebxIndexedImage *image,
+                        gboolean          interlace,
+                        gint              lossiness)
+{
+  GByteArray   *data;
+  WebxLzwNear  *near;
+  guchar        byte;
+  gint          table_bits;
+
+  g_return_val_if_fail (image != NULL, NULL);
+  g_return_val_if_fail (image->width > 0 && image->height > 0, NULL);
+
+  data = g_byte_array_sized_new (image->width * image->height / 2 + 1024);
+  table_bits = webx_gif_write_screen (data, image->width, image->height,
+                                      image->palette, image->n_colors);
+
+  /* graphic control extension, only for transparent index */
+  if (image->transparent >= 0)
+    webx_gif_write_control (data, 0, 0, image->transparent);
+  webx_gif_write_descriptor (data, 0, 0, image->width, image->height,
+                             interlace);
+
+  near = webx_gif_near_new (image->palette, image->n_colors,
+                            image->transparent, lossiness);
+  webx_gif_write_lzw (data, image->indices, image->width, image->height,
+                      image->width, interlace, MAX (table_bits, 2), near);
+  g_free (near);
+
+  byte = 0x3b;
+  g_byte_array_append (data, &byte, 1);
+
+  return data;
+}
+
+static inline void
+webx_gif_box_add (WebxGifBox *box,
+                  gint        x,
+                  gint        y)
+{
+  if (box->x1 <= box->x0)
+    {
+      box->x0 = x;
+      box->y0 = y;
+      box->x1 = x + 1;
+      box->y1 = y + 1;
+      return;
+    }
+
+  box->x0 = MIN (box->x0, x);
+  box->y0 = MIN (box->y0, y);
+  box->x1 = MAX (box->x1, x + 1);
+  box->y1 = MAX (box->y1, y + 1);
+}
+
+static void
+webx_gif_box_union (WebxGifBox       *box,
+                    const WebxGifBox *other)
+{
+  if (other->x1 <= other->x0)
+    return;
+
+  if (box->x1 <= box->x0)
+    {
+      *box = *other;
+      return;
+    }
+
+  box->x0 = MIN (box->x0, other->x0);
+  box->y0 = MIN (box->y0, other->y0);
+  box->x1 = MAX (box->x1, other->x1);
+  box->y1 = MAX (box->y1, other->y1);
+}
+
+static inline gboolean
+webx_gif_box_contains (const WebxGifBox *box,
+                       gint              x,
+                       gint              y)
+{
+  return x >= box->x0 && x < box->x1 && y >= box->y0 && y < box->y1;
+}
+
+/* Dithering spreads error over the whole stack of frames, so pixels
+ * which are the same in source frames may still get other indices.
+ * Those pixels take index of previous frame, frame by frame, so that
+ * only real changes are stored. Each job does a band of rows. */
+static void
+webx_gif_stable_job (gint              job,
+                     gint              n_jobs,
+                     WebxGifAnimation *anim)
+{
+  const guchar *src;
+  const guchar *src_prev;
+  guchar       *cur;
+  const guchar *prev;
+  gint          width = anim->image->width;
+  gint          y0 = anim->frame_height * job / n_jobs;
+  gint          y1 = anim->frame_height * (job + 1) / n_jobs;
+  gint          frame;
+  gint          x, y;
+
+  for (frame = 1; frame < anim->n_frames; frame++)
+    for (y = y0; y < y1; y++)
+      {
+        src = anim->pixels
+              + ((gsize) frame * anim->frame_height + y) * anim->rowstride;
+        src_prev = src - (gsize) anim->frame_height * anim->rowstride;
+        cur = anim->image->indices
+              + ((gsize) frame * anim->frame_height + y) * width;
+        prev = cur - (gsize) anim->frame_height * width;
+
+        for (x = 0; x < width; x++)
+          if (memcmp (src + x * 4, src_prev + x * 4, 4) == 0)
+            cur[x] = prev[x];
+      }
+}
+
+/* Compares frame with the one before it. */
+static void
+webx_gif_diff_job (gint              job,
+                   gint              n_jobs,
+                   WebxGifAnimation *anim)
+{
+  WebxGifFrame *frame = &anim->frames[job];
+  const guchar *prev;
+  const guchar *cur;
+  gint          width = anim->image->width;
+  gint          transparent = anim->image->transparent;
+  gint          x, y;
+
+  memset (&frame->changed, 0, sizeof (WebxGifBox));
+  memset (&frame->cleared, 0, sizeof (WebxGifBox));
+  if (job == 0)
+    {
+      /* first frame covers whole screen */
+      frame->changed.x1 = width;
+      frame->changed.y1 = anim->frame_height;
+      return;
+    }
+
+  for (y = 0; y < anim->frame_height; y++)
+    {
+      cur = anim->image->indices
+            + ((gsize) job * anim->frame_height + y) * width;
+      prev = cur - (gsize) anim->frame_height * width;
+      for (x = 0; x < width; x++)
+        {
+          if (cur[x] == prev[x])
+            continue;
+
+          webx_gif_box_add (&frame->changed, x, y);
+          if (cur[x] == transparent)
+            webx_gif_box_add (&frame->cleared, x, y);
+        }
+    }
+}
+
+/* Stores part of frame within its box, pixels which are already on
+ * screen become keep_index, and compresses it. */
+static void
+webx_gif_frame_job (gint              job,
+                    gint              n_jobs,
+                    WebxGifAnimation *anim)
+{
+  WebxGifFrame *frame = &anim->frames[anim->kept[job]];
+  WebxGifFrame *prev = NULL;
+  const guchar *cur;
+  const guchar *under;
+  guchar       *sub;
+  guchar       *dest;
+  gint          width = anim->image->width;
+  gint          transparent = anim->image->transparent;
+  gint          box_width;
+  gint          box_height;
+  gint          screen;
+  gint          x, y;
+
+  if (frame->previous >= 0)
+    prev = &anim->frames[frame->previous];
+
+  box_width = frame->box.x1 - frame->box.x0;
+  box_height = frame->box.y1 - frame->box.y0;
+  sub = g_new (guchar, box_width * box_height);
+
+  for (y = 0; y < box_height; y++)
+    {
+      cur = anim->image->indices
+            + ((gsize) anim->kept[job] * anim->frame_height
+               + frame->box.y0 + y) * width + frame->box.x0;
+      under = NULL;
+      if (prev)
+        under = anim->image->indices
+                + ((gsize) frame->previous * anim->frame_height
+                   + frame->box.y0 + y) * width + frame->box.x0;
+      dest = sub + y * box_width;
+
+      for (x = 0; x < box_width; x++)
+        {
+          /* what screen shows before this frame */
+          if (! prev
+              || (prev->disposal == 2
+                  && webx_gif_box_contains (&prev->box,
+                                            frame->box.x0 + x,
+                                            frame->box.y0 + y)))
+            screen = transparent;
+          else
+            screen = under[x];
+
+          if (anim->keep_index >= 0 && cur[x] == screen)
+            dest[x] = anim->keep_index;
+          else
+            dest[x] = cur[x];
+        }
+    }
+
+  frame->data = g_byte_array_sized_new (box_width * box_height / 2 + 64);
+  webx_gif_write_lzw (frame->data, sub, box_width, box_height, box_width,
+                      anim->interlace, anim->min_code_size, anim->near);
+  g_free (sub);
+}
+
+/* Encodes image as animated GIF. Image holds n_frames frames one
+ * below another, each of them as the viewer should see it, delays
+ * are in milliseconds. Pixels are RGBA frames image was quantized
+ * from, pixels which are the same there get the same index as in the
+ * frame before, in image too. Each frame is stored cropped to what changed
+ * since the frame before, with pixels that didn't change made
+ * transparent, and frames which don't change anything are joined
+ * with previous ones. Animation loops forever. Unlike still images,
+ * indices are left as they are in lossy mode. */
+GByteArray*
+webx_gif_writer_encode_frames (WebxIndexedImage *image,
+                               const guchar     *pixels,
+                               gint              rowstride,
+                               gint              n_frames,
+                               const gint       *delays,
+                               gboolean          interlace,
+                               gint              lossiness)
+{
+  WebxGifAnimation      anim;
+  WebxGifFrame         *frame;
+  WebxGifFrame         *next;
+  WebxLzwNear          *near;
+  GByteArray           *data;
+  guchar                palette[256 * 3];
+  guchar                byte;
+  gint                  n_colors;
+  gint                  n_kept;
+  gint                  i;
+
+  g_return_val_if_fail (image != NULL && pixels != NULL, NULL);
+  g_return_val_if_fail (n_frames > 0 && delays != NULL, NULL);
+  g_return_val_if_fail (image->width > 0
+                        && image->height >= n_frames
+                        && image->height % n_frames == 0, NULL);
+
+  anim.image = image;
+  anim.pixels = pixels;
+  anim.rowstride = rowstride;
+  anim.frame_height = image->height / n_frames;
+  anim.n_frames = n_frames;
+  anim.frames = g_new0 (WebxGifFrame, n_frames);
+  anim.kept = g_new (gint, n_frames);
+  anim.interlace = interlace;
+
+  /* unchanged pixels need a transparent index, add one if there is
+   * room for it */
+  n_colors = image->n_colors;
+  memcpy (palette, image->palette, n_colors * 3);
+  anim.keep_index = image->transparent;
+  if (anim.keep_index < 0 && n_colors < 256)
+    {
+      anim.keep_index = n_colors;
+      memset (palette + n_colors * 3, 0, 3);
+      n_colors++;
+    }
+
+  webx_threads_run ((WebxThreadFunc) webx_gif_stable_job,
+                    CLAMP (anim.frame_height / WEBX_GIF_MIN_ROWS_PER_JOB,
+                           1, webx_threads_get_count ()),
+                    &anim);
+  webx_threads_run ((WebxThreadFunc) webx_gif_diff_job, n_frames, &anim);
+
+  /* frames which change nothing only make previous one last longer */
+  n_kept = 0;
+  for (i = 0; i < n_frames; i++)
+    {
+      frame = &anim.frames[i];
+      if (i > 0 && frame->changed.x1 <= frame->changed.x0)
+        {
+          anim.frames[anim.kept[n_kept - 1]].delay += delays[i];
+          continue;
+        }
+
+      frame->delay = delays[i];
+      frame->previous = (n_kept > 0) ? anim.kept[n_kept - 1] : -1;
+      anim.kept[n_kept++] = i;
+    }
+
+  /* a frame is disposed of when the next one needs some of its pixels
+   * transparent again; then the next one has to redraw the whole box
+   * of it */
+  for (i = 0; i < n_kept; i++)
+    {
+      frame = &anim.frames[anim.kept[i]];
+      next = (i + 1 < n_kept) ? &anim.frames[anim.kept[i + 1]] : NULL;
+
+      frame->box = frame->changed;
+      if (frame->previous >= 0
+          && anim.frames[frame->previous].disposal == 2)
+        webx_gif_box_union (&frame->box, &anim.frames[frame->previous].box);
+
+      frame->disposal = 1;
+      if (next && next->cleared.x1 > next->cleared.x0)
+        {
+          frame->disposal = 2;
+          webx_gif_box_union (&frame->box, &next->cleared);
+        }
+    }
+
+  anim.min_code_size = MAX (webx_gif_table_bits (n_colors), 2);
+  near = webx_gif_near_new (palette, n_colors, anim.keep_index, lossiness);
+  anim.near = near;
+
+  webx_threads_run ((WebxThreadFunc) webx_gif_frame_job, n_kept, &anim);
+  g_free (near);
+
+  data = g_byte_array_sized_new (1024);
+  webx_gif_write_screen (data, image->width, anim.frame_height,
+                         palette, n_colors);
+
+  /* loop forever */
+  g_byte_array_append (data,
+                       (const guchar *) "\x21\xff\x0bNETSCAPE2.0\x03\x01", 16);
+  webx_gif_append_uint16 (data, 0);
+  byte = 0;
+  g_byte_array_append (data, &byte, 1);
+
+  for (i = 0; i < n_kept; i++)
+    {
+      frame = &anim.frames[anim.kept[i]];
+      webx_gif_write_control (data, frame->disposal,
+                              MIN ((frame->delay + 5) / 10, 65535),
+                              anim.keep_index);
+      webx_gif_write_descriptor (data, frame->box.x0, frame->box.y0,
+                                 frame->box.x1 - frame->box.x0,
+                                 frame->box.y1 - frame->box.y0,
+                                 interlace);
+      g_byte_array_append (data, frame->data->data, frame->data->len);
+      g_byte_array_free (frame->data, TRUE);
+    }
+
+  byte = 0x3b;
+  g_byte_array_append (data, &byte, 1);
+
+  g_free (anim.frames);
+  g_free (anim.kept);
+
+  return data;
+}
+
+static gboolean
+webx_gif_writer_write (GByteArray  *data,
+                       const gchar *file_name)
+{
+  gboolean      saved;
+
+  if (! data)
+    return FALSE;
+
+  saved = g_file_set_contents (file_name, (const gchar *) data->data,
+                               data->len, NULL);
+  g_byte_array_free (data, TRUE);
+
+  return saved;
+}
+
+gboolean
+webx_gif_writer_save (WebxIndexedImage *image,
+                      gboolean          interlace,
+                      gint              lossiness,
+                      const gchar      *file_name)
+{
+  g_return_val_if_fail (file_name != NULL, FALSE);
+
+  return webx_gif_writer_write (webx_gif_writer_encode (image, interlace,
+                                                        lossiness),
+                                file_name);
+}
+
+gboolean
+webx_gif_writer_save_frames (WebxIndexedImage *image,
+                             const guchar     *pixels,
+                             gint              rowstride,
+                             gint              n_frames,
+                             const gint       *delays,
+                             gboolean          interlace,
+                             gint              lossiness,
+                             const gchar      *file_name)
+{
+  g_return_val_if_fail (file_name != NULL, FALSE);
+
+  return webx_gif_writer_write (webx_gif_writer_encode_frames (image,
+                                                               pixels,
+                                                               rowstride,
+                                                               n_frames,
+                                                               delays,
+                                                               interlace,
+                                                               lossiness),
+                                file_name);
+}
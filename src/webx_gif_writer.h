@@ -0,0 +1,59 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+   GIF writer for indexed images made by own quantizer. LZW strings
+   are found through a hash table keyed by prefix code and next index,
+   so the whole file is made in memory without going through GIMP.
+   Lossy mode lets strings continue over slightly different colors.
+   Animations store each frame cropped to the part which changed in
+   source pixels, so dithering noise is not stored as change.
+*/
+
+#ifndef __WEBX_GIF_WRITER_H__
+#define __WEBX_GIF_WRITER_H__
+
+#include "webx_quantizer.h"
+
+GByteArray*       webx_gif_writer_encode        (WebxIndexedImage *image,
+                                                 gboolean       interlace,
+                                                 gint           lossiness);
+gboolean          webx_gif_writer_save          (WebxIndexedImage *image,
+                                                 gboolean       interlace,
+                                                 gint           lossiness,
+                                                 const gchar   *file_name);
+
+GByteArray*       webx_gif_writer_encode_frames (WebxIndexedImage *image,
+                                                 const guchar  *pixels,
+                                                 gint           rowstride,
+                                                 gint           n_frames,
+                                                 const gint    *delays,
+                                                 gboolean       interlace,
+                                                 gint           lossiness);
+gboolean          webx_gif_writer_save_frames   (WebxIndexedImage *image,
+                                                 const guchar  *pixels,
+                                                 gint           rowstride,
+                                                 gint           n_frames,
+                                                 const gint    *delays,
+                                                 gboolean       interlace,
+                                                 gint           lossiness,
+                                                 const gchar   *file_name);
+
+#endif /* __WEBX_GIF_WRITER_H__ */
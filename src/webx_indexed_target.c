@@ -20,6 +20,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <gtk/gtk.h>
 #include <libgimp/gimp.h>
 #include <libgimp/gimpui.h>
@@ -32,10 +34,36 @@ static GObject* webx_indexed_target_constructor (GType                  type,
                                                  guint                  n_params,
                                                  GObjectConstructParam *params);
 
+static void     webx_indexed_target_destroy     (GtkObject             *object);
+static gboolean webx_indexed_target_uses_pixels (WebxTarget            *widget);
+static void     webx_indexed_target_get_block_size (WebxTarget         *widget,
+                                                    gint               *width,
+                                                    gint               *height);
+
 static void     webx_indexed_target_changed     (WebxIndexedTarget     *indexed);
+static GimpConvertDitherType webx_indexed_target_gimp_dither (WebxIndexedTarget *indexed);
+static void     webx_indexed_target_clear_cache (WebxIndexedTarget     *indexed);
+static gboolean webx_indexed_target_update_palette (WebxIndexedTarget  *indexed,
+                                                    WebxTargetInput    *input);
+static gboolean webx_indexed_target_get_palette (WebxIndexedTarget     *indexed,
+                                                 WebxTargetInput       *input,
+                                                 WebxIndexedImage      *quantized);
+static void     webx_indexed_target_add_transparent (WebxIndexedImage  *quantized);
+static gboolean webx_indexed_target_is_translucent (WebxIndexedTarget  *indexed,
+                                                    WebxTargetInput    *input);
+static void     webx_indexed_target_remove_unused (WebxIndexedImage    *quantized);
+static WebxIndexedImage* webx_indexed_target_quantize (WebxIndexedTarget *indexed,
+                                                       WebxTargetInput   *input);
+static gint     webx_indexed_target_wrap        (WebxIndexedTarget     *indexed,
+                                                 WebxTargetInput       *input,
+                                                 WebxIndexedImage      *quantized,
+                                                 gint                  *layer);
 
 G_DEFINE_TYPE (WebxIndexedTarget, webx_indexed_target, WEBX_TYPE_TARGET)
 
+/* colors of input not counted yet */
+#define WEBX_EXACT_UNKNOWN      -2
+
 #define parent_class webx_indexed_target_parent_class
 
 
@@ -43,14 +71,34 @@ static void
 webx_indexed_target_class_init (WebxIndexedTargetClass *klass)
 {
   GObjectClass         *object_class;
+  GtkObjectClass       *gtk_object_class;
+  WebxTargetClass      *target_class;
 
   object_class = G_OBJECT_CLASS (klass);
   object_class->constructor = webx_indexed_target_constructor;
+
+  gtk_object_class = GTK_OBJECT_CLASS (klass);
+  gtk_object_class->destroy = webx_indexed_target_destroy;
+
+  target_class = WEBX_TARGET_CLASS (klass);
+  target_class->uses_pixels    = webx_indexed_target_uses_pixels;
+  target_class->get_block_size = webx_indexed_target_get_block_size;
 }
 
 static void
 webx_indexed_target_init (WebxIndexedTarget *indexed)
 {
+  indexed->cache_n_colors = -1;
+  indexed->cache_exact_n_colors = WEBX_EXACT_UNKNOWN;
+}
+
+static void
+webx_indexed_target_destroy (GtkObject *object)
+{
+  webx_indexed_target_clear_cache (WEBX_INDEXED_TARGET (object));
+
+  if (GTK_OBJECT_CLASS (parent_class)->destroy)
+    GTK_OBJECT_CLASS (parent_class)->destroy (object);
 }
 
 static GObject*
@@ -120,6 +168,28 @@ webx_indexed_target_constructor (GType                  type,
                     GTK_FILL, GTK_FILL, 0, 0);
   gtk_widget_show (indexed->num_colors_w);
 
+  row++;
+  indexed->perceptual_w = webx_checkbox_new (WEBX_TARGET (indexed), row,
+                                             _("_Perceptual color space"),
+                                             &indexed->perceptual);
+
+  row++;
+  indexed->sampled = TRUE;
+  indexed->sampled_w = webx_checkbox_new (WEBX_TARGET (indexed), row,
+                                          _("_Fast palette for large images"),
+                                          &indexed->sampled);
+
+  if (WEBX_INDEXED_TARGET_GET_CLASS (indexed)->translucent_palette)
+    {
+      row++;
+      indexed->translucent_w = webx_checkbox_new (WEBX_TARGET (indexed), row,
+                                                  _("Partial _transparency"),
+                                                  &indexed->translucent);
+      g_signal_connect_swapped (indexed->translucent_w, "toggled",
+                                G_CALLBACK (webx_indexed_target_changed),
+                                indexed);
+    }
+
   /*
    * web-optimized
    */
@@ -177,15 +247,17 @@ webx_indexed_target_constructor (GType                  type,
                     GTK_FILL, GTK_FILL, 0, 0);
   gtk_widget_show (label);
   combo = gimp_int_combo_box_new (_("None"),
-                                  GIMP_NO_DITHER,
+                                  WEBX_DITHER_NONE,
                                   _("Floyd-Steinberg"),
-                                  GIMP_FS_DITHER,
-                                  _("Floyd-Steinberg 2"),
-                                  GIMP_FSLOWBLEED_DITHER,
-                                  _("Positioned"),
-                                  GIMP_FIXED_DITHER,
+                                  WEBX_DITHER_FLOYD_STEINBERG,
+                                  _("Sierra Lite"),
+                                  WEBX_DITHER_SIERRA_LITE,
+                                  _("Atkinson"),
+                                  WEBX_DITHER_ATKINSON,
+                                  _("Ordered"),
+                                  WEBX_DITHER_ORDERED,
                                   NULL);
-  gimp_int_combo_box_set_active (GIMP_INT_COMBO_BOX (combo), GIMP_NO_DITHER);
+  gimp_int_combo_box_set_active (GIMP_INT_COMBO_BOX (combo), WEBX_DITHER_NONE);
   gtk_table_attach (GTK_TABLE (indexed), combo,
                     1, 3, row, row+1,
                     GTK_SHRINK, GTK_SHRINK, 0, 0);
@@ -195,6 +267,13 @@ webx_indexed_target_constructor (GType                  type,
   indexed->dither_type_w = combo;
   gtk_widget_show (combo);
 
+  row++;
+  indexed->dither_strength = 1.0;
+  indexed->dither_strength_w = webx_percent_entry_new (WEBX_TARGET (indexed),
+                                                       row,
+                                                       _("_Strength"), 0,
+                                                       &indexed->dither_strength);
+
   row++;
   indexed->alpha_dither_w = gtk_check_button_new_with_label (_("Dithering of transparency"));
   gtk_table_attach (GTK_TABLE (indexed), indexed->alpha_dither_w,
@@ -224,6 +303,7 @@ webx_indexed_target_get_image (WebxIndexedTarget       *indexed,
                                WebxTargetInput         *input,
                                gint                    *layer)
 {
+  WebxIndexedImage     *quantized;
   gint          tmp_image;
   gint          tmp_layer;
   gint       *layers;
@@ -240,6 +320,12 @@ webx_indexed_target_get_image (WebxIndexedTarget       *indexed,
       return input->indexed_image;
     }
 
+  if (indexed->palette_type != GIMP_CUSTOM_PALETTE && input->pixels)
+    {
+      quantized = webx_indexed_target_quantize (indexed, input);
+      return webx_indexed_target_wrap (indexed, input, quantized, layer);
+    }
+
   custom_palette = indexed->custom_palette;
   if (! custom_palette)
     custom_palette = "";
@@ -250,7 +336,8 @@ webx_indexed_target_get_image (WebxIndexedTarget       *indexed,
   if (num_colors == 256 && gimp_drawable_has_alpha (tmp_layer))
     num_colors = 255;
   tmp_image = gimp_image_duplicate (tmp_image);
-  converted = gimp_image_convert_indexed (tmp_image, indexed->dither_type,
+  converted = gimp_image_convert_indexed (tmp_image,
+                                          webx_indexed_target_gimp_dither (indexed),
                                           indexed->palette_type,
                                           num_colors,
                                           indexed->alpha_dither,
@@ -272,6 +359,427 @@ webx_indexed_target_get_image (WebxIndexedTarget       *indexed,
   return tmp_image;
 }
 
+/* Indexed pixels made with own quantizer, for writers which don't go
+ * through GIMP. Returns NULL when the palette can only be made by
+ * GIMP. Free with webx_indexed_image_free(). */
+WebxIndexedImage*
+webx_indexed_target_get_indexed (WebxIndexedTarget     *indexed,
+                                 WebxTargetInput       *input)
+{
+  g_return_val_if_fail (WEBX_IS_INDEXED_TARGET (indexed), NULL);
+
+  if (indexed->palette_type == GIMP_REUSE_PALETTE
+      || indexed->palette_type == GIMP_CUSTOM_PALETTE
+      || ! input->pixels)
+    return NULL;
+
+  return webx_indexed_target_quantize (indexed, input);
+}
+
+/* Palettes GIMP makes need rgb or indexed image, see
+ * webx_indexed_target_get_indexed (). */
+static gboolean
+webx_indexed_target_uses_pixels (WebxTarget *widget)
+{
+  WebxIndexedTarget    *indexed = WEBX_INDEXED_TARGET (widget);
+
+  return indexed->palette_type != GIMP_REUSE_PALETTE
+         && indexed->palette_type != GIMP_CUSTOM_PALETTE;
+}
+
+/* Regions start where ordered dither pattern does. */
+static void
+webx_indexed_target_get_block_size (WebxTarget *widget,
+                                    gint       *width,
+                                    gint       *height)
+{
+  *width = WEBX_DITHER_PATTERN_SIZE;
+  *height = WEBX_DITHER_PATTERN_SIZE;
+}
+
+/* Closest GIMP dither, for conversions still done by GIMP. */
+static GimpConvertDitherType
+webx_indexed_target_gimp_dither (WebxIndexedTarget *indexed)
+{
+  switch (indexed->dither_type)
+    {
+    case WEBX_DITHER_NONE:
+      return GIMP_NO_DITHER;
+    case WEBX_DITHER_ORDERED:
+      return GIMP_FIXED_DITHER;
+    default:
+      return GIMP_FS_DITHER;
+    }
+}
+
+/* Forgets palette made for previous input. */
+static void
+webx_indexed_target_clear_cache (WebxIndexedTarget *indexed)
+{
+  if (indexed->histogram)
+    {
+      webx_histogram_free (indexed->histogram);
+      indexed->histogram = NULL;
+    }
+  indexed->cache_pixels = NULL;
+  indexed->cache_n_colors = -1;
+  indexed->cache_exact_n_colors = WEBX_EXACT_UNKNOWN;
+}
+
+/* Makes palette for input pixels, unless the one made last time is
+ * still good. It is made for whole input even when only region of it
+ * is remapped, so that region looks like the exported file. Histogram is kept too, so changing number of colors
+ * doesn't need to count them again. Returns TRUE when input has few
+ * enough colors to use them all (see cache_exact_palette). */
+static gboolean
+webx_indexed_target_update_palette (WebxIndexedTarget *indexed,
+                                    WebxTargetInput   *input)
+{
+  WebxColorSpace        color_space;
+  guchar                previous[256 * 3];
+  guchar                previous_alpha[256];
+  gboolean              translucent;
+  gint                  num_colors;
+
+  translucent = webx_indexed_target_is_translucent (indexed, input);
+  if (indexed->cache_pixels != input->whole_pixels
+      || indexed->cache_width != input->whole_width
+      || indexed->cache_height != input->whole_height
+      || indexed->cache_serial != input->serial
+      || indexed->cache_sampled != indexed->sampled
+      || indexed->cache_translucent != translucent)
+    {
+      webx_indexed_target_clear_cache (indexed);
+      indexed->cache_pixels = input->whole_pixels;
+      indexed->cache_width = input->whole_width;
+      indexed->cache_height = input->whole_height;
+      indexed->cache_serial = input->serial;
+      indexed->cache_sampled = indexed->sampled;
+      indexed->cache_translucent = translucent;
+    }
+
+  /* one quick pass, which gives up early on photos */
+  if (indexed->cache_exact_n_colors == WEBX_EXACT_UNKNOWN)
+    {
+      indexed->cache_exact_n_colors =
+        webx_quantizer_exact_palette (input->whole_pixels,
+                                      input->whole_width,
+                                      input->whole_height,
+                                      input->rowstride, input->bpp, 256,
+                                      indexed->cache_exact_palette,
+                                      translucent ?
+                                      indexed->cache_exact_alpha : NULL,
+                                      &indexed->cache_exact_transparent);
+    }
+
+  if (indexed->cache_exact_n_colors >= 0
+      && indexed->cache_exact_n_colors
+         + (indexed->cache_exact_transparent ? 1 : 0) <= indexed->num_colors)
+    {
+      return TRUE;
+    }
+
+  if (! indexed->histogram)
+    {
+      /* big images train palette on subsample, but remap all pixels */
+      if (translucent)
+        indexed->histogram =
+          webx_histogram_new_with_alpha (input->whole_pixels,
+                                         input->whole_width,
+                                         input->whole_height,
+                                         input->rowstride,
+                                         indexed->sampled ?
+                                         WEBX_TRAINING_SAMPLES : 0);
+      else
+        indexed->histogram =
+          webx_histogram_new_sampled (input->whole_pixels,
+                                      input->whole_width,
+                                      input->whole_height,
+                                      input->rowstride, input->bpp,
+                                      indexed->sampled ?
+                                      WEBX_TRAINING_SAMPLES : 0);
+    }
+
+  if (indexed->cache_n_colors < 0
+      || indexed->cache_num_colors != indexed->num_colors
+      || indexed->cache_perceptual != indexed->perceptual)
+    {
+      /* one entry is left for transparency */
+      num_colors = indexed->num_colors;
+      if (webx_histogram_has_transparent (indexed->histogram))
+        num_colors--;
+
+      color_space = indexed->perceptual ?
+                    WEBX_COLOR_SPACE_OKLAB : WEBX_COLOR_SPACE_RGB;
+      if (indexed->cache_n_colors > 0
+          && indexed->cache_perceptual == indexed->perceptual)
+        {
+          /* only number of colors changed, start from what we have */
+          memcpy (previous, indexed->cache_palette,
+                  indexed->cache_n_colors * 3);
+          memcpy (previous_alpha, indexed->cache_alpha,
+                  indexed->cache_n_colors);
+          indexed->cache_n_colors =
+            webx_quantizer_refine_palette (indexed->histogram, num_colors,
+                                           color_space, previous,
+                                           previous_alpha,
+                                           indexed->cache_n_colors,
+                                           indexed->cache_palette,
+                                           indexed->cache_alpha);
+        }
+      else
+        {
+          indexed->cache_n_colors =
+            webx_quantizer_make_palette (indexed->histogram, num_colors,
+                                         color_space,
+                                         indexed->cache_palette,
+                                         indexed->cache_alpha);
+        }
+      indexed->cache_num_colors = indexed->num_colors;
+      indexed->cache_perceptual = indexed->perceptual;
+    }
+
+  return FALSE;
+}
+
+/* Palette and transparent index for current settings. Fixed palettes
+ * always get transparent index when there is alpha, it is only
+ * a marker for the alpha channel anyway. Returns TRUE when palette
+ * holds every color of input. */
+static gboolean
+webx_indexed_target_get_palette (WebxIndexedTarget *indexed,
+                                 WebxTargetInput   *input,
+                                 WebxIndexedImage  *quantized)
+{
+  guchar       *c;
+  gint          r, g, b;
+
+  switch (indexed->palette_type)
+    {
+    case GIMP_MAKE_PALETTE:
+      if (webx_indexed_target_update_palette (indexed, input))
+        {
+          memcpy (quantized->palette, indexed->cache_exact_palette,
+                  indexed->cache_exact_n_colors * 3);
+          memcpy (quantized->alpha, indexed->cache_exact_alpha,
+                  indexed->cache_exact_n_colors);
+          quantized->n_colors = indexed->cache_exact_n_colors;
+          quantized->has_alpha = indexed->cache_translucent;
+          if (indexed->cache_exact_transparent)
+            webx_indexed_target_add_transparent (quantized);
+          return TRUE;
+        }
+
+      memcpy (quantized->palette, indexed->cache_palette,
+              indexed->cache_n_colors * 3);
+      memcpy (quantized->alpha, indexed->cache_alpha,
+              indexed->cache_n_colors);
+      quantized->n_colors = indexed->cache_n_colors;
+      quantized->has_alpha = indexed->cache_translucent;
+      if (! webx_histogram_has_transparent (indexed->histogram))
+        return FALSE;
+      break;
+
+    case GIMP_WEB_PALETTE:
+      c = quantized->palette;
+      for (r = 0; r < 6; r++)
+        for (g = 0; g < 6; g++)
+          for (b = 0; b < 6; b++)
+            {
+              *c++ = r * 51;
+              *c++ = g * 51;
+              *c++ = b * 51;
+            }
+      quantized->n_colors = 6 * 6 * 6;
+      break;
+
+    case GIMP_MONO_PALETTE:
+    default:
+      memset (quantized->palette, 0, 3);
+      memset (quantized->palette + 3, 255, 3);
+      quantized->n_colors = 2;
+      break;
+    }
+
+  if (input->bpp == 4)
+    webx_indexed_target_add_transparent (quantized);
+
+  return FALSE;
+}
+
+/* Appends fully transparent color to palette. */
+static void
+webx_indexed_target_add_transparent (WebxIndexedImage *quantized)
+{
+  quantized->transparent = quantized->n_colors;
+  memset (quantized->palette + quantized->n_colors * 3, 0, 3);
+  quantized->alpha[quantized->n_colors] = 0;
+  quantized->n_colors++;
+}
+
+/* Whether palette is made with translucent colors for this input. */
+static gboolean
+webx_indexed_target_is_translucent (WebxIndexedTarget *indexed,
+                                    WebxTargetInput   *input)
+{
+  return indexed->translucent
+         && indexed->palette_type == GIMP_MAKE_PALETTE
+         && input->bpp == 4;
+}
+
+/* Drops palette colors no pixel uses, transparent entry stays last. */
+static void
+webx_indexed_target_remove_unused (WebxIndexedImage *quantized)
+{
+  gboolean      used[256];
+  guchar        map[256];
+  gint          n_pixels = quantized->width * quantized->height;
+  gint          n = 0;
+  gint          i;
+
+  memset (used, 0, sizeof (used));
+  for (i = 0; i < n_pixels; i++)
+    used[quantized->indices[i]] = TRUE;
+  if (quantized->transparent >= 0)
+    used[quantized->transparent] = TRUE;
+
+  for (i = 0; i < quantized->n_colors; i++)
+    {
+      if (! used[i])
+        continue;
+
+      map[i] = n;
+      memmove (quantized->palette + n * 3, quantized->palette + i * 3, 3);
+      quantized->alpha[n] = quantized->alpha[i];
+      n++;
+    }
+  if (quantized->transparent >= 0)
+    quantized->transparent = map[quantized->transparent];
+  quantized->n_colors = n;
+
+  for (i = 0; i < n_pixels; i++)
+    quantized->indices[i] = map[quantized->indices[i]];
+}
+
+/* Converts input pixels to indexed ones with own quantizer and
+ * dither. */
+static WebxIndexedImage*
+webx_indexed_target_quantize (WebxIndexedTarget *indexed,
+                              WebxTargetInput   *input)
+{
+  WebxIndexedImage     *quantized;
+  gboolean              lossless;
+  gint                  n_opaque;
+
+  quantized = webx_indexed_image_new (input->width, input->height);
+  lossless = webx_indexed_target_get_palette (indexed, input, quantized);
+
+  n_opaque = quantized->n_colors;
+  if (quantized->transparent >= 0)
+    n_opaque--;
+  if (quantized->has_alpha)
+    {
+      webx_quantizer_remap_alpha (input->pixels, input->width, input->height,
+                                  input->rowstride,
+                                  quantized->palette, quantized->alpha,
+                                  quantized->n_colors, quantized->transparent,
+                                  quantized->indices);
+    }
+  else if (lossless)
+    {
+      /* every color is in palette, nothing to dither */
+      webx_quantizer_remap (input->pixels, input->width, input->height,
+                            input->rowstride, input->bpp,
+                            quantized->palette, n_opaque,
+                            quantized->transparent, quantized->indices);
+    }
+  else
+    {
+      webx_dither_remap (input->pixels, input->width, input->height,
+                         input->rowstride, input->bpp,
+                         quantized->palette, n_opaque,
+                         quantized->transparent,
+                         indexed->dither_type, indexed->dither_strength,
+                         indexed->alpha_dither, quantized->indices);
+    }
+
+  if (indexed->remove_unused)
+    webx_indexed_target_remove_unused (quantized);
+
+  return quantized;
+}
+
+/* Wraps indexed pixels into indexed GIMP image, so that they can be
+ * saved by the usual file plug-ins. Takes ownership of quantized. */
+static gint
+webx_indexed_target_wrap (WebxIndexedTarget *indexed,
+                          WebxTargetInput   *input,
+                          WebxIndexedImage  *quantized,
+                          gint              *layer)
+{
+  GimpDrawable         *drawable;
+  GimpPixelRgn          pixel_rgn;
+  guchar               *buf;
+  guchar               *dest;
+  gint                  n_colors;
+  gint                  bpp;
+  gint                  tmp_image;
+  gint                  tmp_layer;
+  gint                  i;
+
+  /* GIMP keeps transparency in alpha channel, not in palette */
+  n_colors = quantized->n_colors;
+  if (quantized->transparent >= 0)
+    n_colors = quantized->transparent;
+  bpp = (input->bpp == 4) ? 2 : 1;
+
+  tmp_image = gimp_image_new (input->width, input->height, GIMP_INDEXED);
+  gimp_image_undo_disable (tmp_image);
+  gimp_image_set_colormap (tmp_image, quantized->palette, MAX (n_colors, 1));
+  tmp_layer = gimp_layer_new (tmp_image, "Background",
+                              input->width, input->height,
+                              (bpp == 2) ?
+                              GIMP_INDEXEDA_IMAGE : GIMP_INDEXED_IMAGE,
+                              100.0, GIMP_NORMAL_MODE);
+  gimp_image_add_layer (tmp_image, tmp_layer, 0);
+
+  buf = g_new (guchar, input->width * input->height * bpp);
+  dest = buf;
+  for (i = 0; i < input->width * input->height; i++)
+    {
+      if (bpp == 1)
+        {
+          *dest++ = quantized->indices[i];
+        }
+      else if (quantized->indices[i] == quantized->transparent)
+        {
+          *dest++ = 0;
+          *dest++ = 0;
+        }
+      else
+        {
+          *dest++ = quantized->indices[i];
+          *dest++ = 255;
+        }
+    }
+  webx_indexed_image_free (quantized);
+
+  drawable = gimp_drawable_get (tmp_layer);
+  gimp_pixel_rgn_init (&pixel_rgn, drawable, 0, 0,
+                       input->width, input->height, TRUE, FALSE);
+  gimp_pixel_rgn_set_rect (&pixel_rgn, buf, 0, 0,
+                           input->width, input->height);
+  gimp_drawable_flush (drawable);
+  gimp_drawable_detach (drawable);
+  g_free (buf);
+
+  indexed->image = tmp_image;
+  indexed->layer = tmp_layer;
+
+  *layer = tmp_layer;
+  return tmp_image;
+}
+
 void
 webx_indexed_target_free_image (WebxIndexedTarget      *indexed,
                                 WebxTargetInput        *input,
@@ -287,6 +795,8 @@ webx_indexed_target_free_image (WebxIndexedTarget      *indexed,
 static void
 webx_indexed_target_changed (WebxIndexedTarget *indexed)
 {
+  gboolean      translucent;
+
   gtk_widget_set_sensitive (GTK_WIDGET (indexed->remove_unused_w), TRUE);
 
   if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (indexed->reuse_pal_w)))
@@ -309,11 +819,15 @@ webx_indexed_target_changed (WebxIndexedTarget *indexed)
     {
       indexed->palette_type = GIMP_MAKE_PALETTE;
       gtk_widget_set_sensitive (indexed->num_colors_w, TRUE);
+      gtk_widget_set_sensitive (GTK_WIDGET (indexed->perceptual_w), TRUE);
+      gtk_widget_set_sensitive (GTK_WIDGET (indexed->sampled_w), TRUE);
       gtk_widget_set_sensitive (indexed->remove_unused_w, FALSE);
     }
   else
     {
       gtk_widget_set_sensitive (indexed->num_colors_w, FALSE);
+      gtk_widget_set_sensitive (GTK_WIDGET (indexed->perceptual_w), FALSE);
+      gtk_widget_set_sensitive (GTK_WIDGET (indexed->sampled_w), FALSE);
     }
 
   if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (indexed->web_pal_w)))
@@ -326,8 +840,20 @@ webx_indexed_target_changed (WebxIndexedTarget *indexed)
       indexed->palette_type = GIMP_MONO_PALETTE;
     }
 
+  /* translucent palettes are remapped without dithering */
+  translucent = indexed->translucent
+                && indexed->palette_type == GIMP_MAKE_PALETTE;
+  if (indexed->translucent_w)
+    gtk_widget_set_sensitive (GTK_WIDGET (indexed->translucent_w),
+                              indexed->palette_type == GIMP_MAKE_PALETTE);
+  gtk_widget_set_sensitive (indexed->dither_type_w, ! translucent);
+  gtk_widget_set_sensitive (indexed->alpha_dither_w, ! translucent);
+
   gimp_int_combo_box_get_active (GIMP_INT_COMBO_BOX (indexed->dither_type_w),
-                                 &indexed->dither_type);
+                                 (gint *) &indexed->dither_type);
+  gimp_scale_entry_set_sensitive (indexed->dither_strength_w,
+                                  ! translucent
+                                  && indexed->dither_type != WEBX_DITHER_NONE);
   indexed->num_colors = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (indexed->num_colors_w));
 
   indexed->remove_unused = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (indexed->remove_unused_w));
@@ -22,6 +22,8 @@
 #define __WEBX_INDEXED_TARGET_H__
 
 #include "webx_target.h"
+#include "webx_quantizer.h"
+#include "webx_dither.h"
 
 G_BEGIN_DECLS
 
@@ -42,9 +44,17 @@ struct _WebxIndexedTarget
   gint        image;
   gint        layer;
     
-  gint        dither_type;
+  WebxDitherType dither_type;
+  gdouble     dither_strength;
   gint        palette_type;
   gint        num_colors;
+  /* cluster colors in perceptual color space */
+  gboolean    perceptual;
+  /* train palette of large images on subsample of pixels */
+  gboolean    sampled;
+  /* generated palette may have translucent colors, only for formats
+   * which can store them */
+  gboolean    translucent;
     
   gchar      *custom_palette;
 
@@ -53,19 +63,47 @@ struct _WebxIndexedTarget
   GtkWidget  *web_pal_w;
   GtkWidget  *bw_pal_w;
   GtkWidget  *dither_type_w;
+  GtkObject  *dither_strength_w;
   GtkWidget  *num_colors_w;
+  GtkObject  *perceptual_w;
+  GtkObject  *sampled_w;
+  /* NULL unless class has translucent_palette */
+  GtkObject  *translucent_w;
   GtkWidget  *alpha_dither_w;
   GtkWidget  *remove_unused_w;
  
   gboolean    alpha_dither;
   gboolean    remove_unused;
 
+  /* palette made for last input, reused while only dithering
+   * options change */
+  WebxHistogram *histogram;
+  const guchar  *cache_pixels;
+  gint           cache_width;
+  gint           cache_height;
+  guint          cache_serial;
+  gboolean       cache_sampled;
+  gint           cache_num_colors;
+  gboolean       cache_perceptual;
+  gboolean       cache_translucent;
+  gint           cache_n_colors;
+  guchar         cache_palette[256 * 3];
+  guchar         cache_alpha[256];
+  /* all colors of input, when there are at most 256 of them */
+  gint           cache_exact_n_colors;
+  gboolean       cache_exact_transparent;
+  guchar         cache_exact_palette[256 * 3];
+  guchar         cache_exact_alpha[256];
+
   gint        last_row;
 };
 
 struct _WebxIndexedTargetClass
 {
   WebxTargetClass parent_class;
+
+  /* file format can store alpha of each palette color */
+  gboolean        translucent_palette;
 };
 
 GType           webx_indexed_target_get_type    (void) G_GNUC_CONST;
@@ -73,6 +111,8 @@ GType           webx_indexed_target_get_type    (void) G_GNUC_CONST;
 gint            webx_indexed_target_get_image   (WebxIndexedTarget     *indexed,
                                                  WebxTargetInput       *input,
                                                  gint                  *layer);
+WebxIndexedImage* webx_indexed_target_get_indexed (WebxIndexedTarget   *indexed,
+                                                   WebxTargetInput     *input);
 void            webx_indexed_target_free_image  (WebxIndexedTarget     *indexed,
                                                  WebxTargetInput       *input,
                                                  gint                   image);
@@ -0,0 +1,1013 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <jpeglib.h>
+
+#include "webx_threads.h"
+#include "webx_jpeg_engine.h"
+
+#define WEBX_JPEG_DEST_SIZE     4096
+/* candidate scan scripts of progressive files, see below */
+#define WEBX_JPEG_N_SCRIPTS     7
+#define WEBX_JPEG_MAX_SCANS     8
+/* rate of symbols never seen in the first pass, in bits */
+#define WEBX_JPEG_MAX_CODE      16.0
+/* weight of bits against squared error in quantization steps */
+#define WEBX_JPEG_LAMBDA        0.2
+
+/* unquantized DCT coefficients of one component, 64 per block in
+ * natural order, blocks row by row; size is rounded up to whole MCUs */
+typedef struct
+{
+  gint          width_in_blocks;
+  gint          height_in_blocks;
+  gint          h_samp;
+  gint          v_samp;
+  gfloat       *coefs;
+} WebxJpegPlane;
+
+struct _WebxJpegCoefs
+{
+  gint          width;
+  gint          height;
+  WebxJpegPlane planes[3];
+};
+
+typedef struct
+{
+  const guchar *pixels;
+  gint          width;
+  gint          height;
+  gint          rowstride;
+  gint          bpp;
+  guchar        background[3];
+  gint          h_samp;
+  gint          v_samp;
+  gfloat        table[8][8];
+  WebxJpegPlane *planes;
+} WebxJpegTransform;
+
+typedef struct
+{
+  const WebxJpegPlane  *planes;
+  JCOEF                *quantized[3];
+  /* natural order, luma and chroma */
+  guint                 qtables[2][64];
+  /* 1 / qtables, zigzag order */
+  gfloat                scales[2][64];
+  gboolean              trellis;
+  /* bits of each AC symbol, luma and chroma */
+  WebxJpegRates         rates;
+  /* AC symbol counts of each job */
+  guint                *counts;
+} WebxJpegQuantize;
+
+typedef struct
+{
+  const WebxJpegPlane  *planes;
+  JCOEF               **quantized;
+  gint                  width;
+  gint                  height;
+  gint                  quality;
+  gboolean              progressive;
+  gint                  restart;
+  GByteArray           *results[WEBX_JPEG_N_SCRIPTS];
+} WebxJpegWrite;
+
+typedef struct
+{
+  const WebxJpegCoefs  *coefs;
+  const gint           *qualities;
+  gboolean              progressive;
+  gint                  restart;
+  gsize                *sizes;
+} WebxJpegSweep;
+
+typedef struct
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf               setjmp_buffer;
+} WebxJpegError;
+
+typedef struct
+{
+  struct jpeg_destination_mgr pub;
+  GByteArray           *data;
+  JOCTET                buffer[WEBX_JPEG_DEST_SIZE];
+} WebxJpegDest;
+
+static const gint webx_jpeg_zigzag[64] =
+{
+   0,  1,  8, 16,  9,  2,  3, 10,
+  17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34,
+  27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36,
+  29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46,
+  53, 60, 61, 54, 47, 55, 62, 63
+};
+
+/* first AC scan of luma ends at, 0 for libjpeg's script with
+ * successive approximation; chroma AC is split at 2 or sent whole */
+static const gint webx_jpeg_luma_splits[WEBX_JPEG_N_SCRIPTS] =
+  { 0, 2, 5, 8, 2, 5, 8 };
+static const gint webx_jpeg_chroma_splits[WEBX_JPEG_N_SCRIPTS] =
+  { 0, 0, 0, 0, 2, 2, 2 };
+
+
+/* Forward DCT of 8x8 samples (level shifted), rows then columns. */
+static void
+webx_jpeg_dct (const gfloat  table[8][8],
+               const gfloat *samples,
+               gint          stride,
+               gfloat       *coefs)
+{
+  gfloat        rows[64];
+  gfloat        sum;
+  gint          u, v, x, y;
+
+  for (y = 0; y < 8; y++)
+    for (u = 0; u < 8; u++)
+      {
+        sum = 0.0;
+        for (x = 0; x < 8; x++)
+          sum += samples[y * stride + x] * table[u][x];
+        rows[y * 8 + u] = sum;
+      }
+
+  for (v = 0; v < 8; v++)
+    for (u = 0; u < 8; u++)
+      {
+        sum = 0.0;
+        for (y = 0; y < 8; y++)
+          sum += rows[y * 8 + u] * table[v][y];
+        coefs[v * 8 + u] = sum;
+      }
+}
+
+/* JFIF YCbCr of pixel, composed over background. Samples out of image
+ * repeat the edge, like libjpeg pads them. */
+static inline void
+webx_jpeg_get_ycc (const WebxJpegTransform *data,
+                   gint                     x,
+                   gint                     y,
+                   gfloat                  *ycc)
+{
+  const guchar *p;
+  gfloat        rgb[3];
+  gint          alpha;
+  gint          i;
+
+  x = MIN (x, data->width - 1);
+  y = MIN (y, data->height - 1);
+  p = data->pixels + (gsize) y * data->rowstride + x * data->bpp;
+  alpha = (data->bpp == 4) ? p[3] : 255;
+  for (i = 0; i < 3; i++)
+    rgb[i] = (p[i] * alpha + data->background[i] * (255 - alpha)) / 255.0;
+
+  ycc[0] = 0.299 * rgb[0] + 0.587 * rgb[1] + 0.114 * rgb[2];
+  ycc[1] = -0.168736 * rgb[0] - 0.331264 * rgb[1] + 0.5 * rgb[2] + 128.0;
+  ycc[2] = 0.5 * rgb[0] - 0.418688 * rgb[1] - 0.081312 * rgb[2] + 128.0;
+}
+
+/* Converts, downsamples and transforms one MCU row of blocks. */
+static void
+webx_jpeg_transform_job (gint               job,
+                         gint               n_jobs,
+                         WebxJpegTransform *data)
+{
+  WebxJpegPlane        *plane;
+  gfloat               *samples[3];
+  gfloat               *full[2];
+  gfloat                ycc[3];
+  gfloat                sum;
+  gint                  strides[3];
+  gint                  rows[3];
+  gint                  x, y, dx, dy;
+  gint                  c, i, j;
+
+  for (c = 0; c < 3; c++)
+    {
+      plane = &data->planes[c];
+      strides[c] = plane->width_in_blocks * 8;
+      rows[c] = plane->v_samp * 8;
+      samples[c] = g_new (gfloat, strides[c] * rows[c]);
+    }
+  for (c = 0; c < 2; c++)
+    full[c] = g_new (gfloat, strides[0] * rows[0]);
+
+  /* luma at full resolution, chroma averaged over each h x v box */
+  for (y = 0; y < rows[0]; y++)
+    for (x = 0; x < strides[0]; x++)
+      {
+        webx_jpeg_get_ycc (data, x, job * rows[0] + y, ycc);
+        samples[0][y * strides[0] + x] = ycc[0] - 128.0;
+        full[0][y * strides[0] + x] = ycc[1];
+        full[1][y * strides[0] + x] = ycc[2];
+      }
+
+  for (c = 1; c < 3; c++)
+    for (y = 0; y < rows[c]; y++)
+      for (x = 0; x < strides[c]; x++)
+        {
+          sum = 0.0;
+          for (dy = 0; dy < data->v_samp; dy++)
+            for (dx = 0; dx < data->h_samp; dx++)
+              sum += full[c - 1][(y * data->v_samp + dy) * strides[0]
+                                 + x * data->h_samp + dx];
+          samples[c][y * strides[c] + x] =
+            sum / (data->h_samp * data->v_samp) - 128.0;
+        }
+  g_free (full[0]);
+  g_free (full[1]);
+
+  for (c = 0; c < 3; c++)
+    {
+      plane = &data->planes[c];
+      for (j = 0; j < plane->v_samp; j++)
+        for (i = 0; i < plane->width_in_blocks; i++)
+          webx_jpeg_dct (data->table,
+                         samples[c] + j * 8 * strides[c] + i * 8, strides[c],
+                         plane->coefs
+                         + ((gsize) (job * plane->v_samp + j)
+                            * plane->width_in_blocks + i) * 64);
+      g_free (samples[c]);
+    }
+}
+
+static inline gint
+webx_jpeg_bit_size (gint value)
+{
+  gint          size = 0;
+
+  value = ABS (value);
+  while (value)
+    {
+      size++;
+      value >>= 1;
+    }
+
+  return size;
+}
+
+/* Rounds coefficient divided by quantization step, within baseline
+ * range. */
+static inline gint
+webx_jpeg_round (gfloat  coef,
+                 gint    limit)
+{
+  gint          value;
+
+  value = (gint) (fabsf (coef) + 0.5f);
+  value = MIN (value, limit);
+
+  return (coef < 0) ? -value : value;
+}
+
+/* Quantizes AC coefficients of block (zigzag order in z, normalized
+ * by step) choosing for each either rounded value, the one next to it
+ * towards zero, or zero, for least distortion + lambda * bits. State
+ * is position of last non-zero coefficient so far: cost of getting
+ * there is that of the best earlier state, the zeros in between and
+ * the run/size symbol. */
+static void
+webx_jpeg_trellis (const gfloat *z,
+                   const gfloat *rates,
+                   gfloat        lambda,
+                   JCOEF        *out)
+{
+  gfloat        best[64];
+  gint          from[64];
+  gint          values[64];
+  gfloat        zero_sums[65];
+  /* positions that can be last non-zero, 0 for none yet */
+  gint          states[64];
+  gint          n_states;
+  gfloat        base;
+  gfloat        cost;
+  gfloat        end_cost;
+  gfloat        dists[2];
+  gint          candidates[2];
+  gint          sizes[2];
+  gint          n_candidates;
+  gint          run;
+  gint          last;
+  gint          i, j, k, n;
+
+  zero_sums[0] = zero_sums[1] = 0.0;
+  for (k = 1; k < 64; k++)
+    zero_sums[k + 1] = zero_sums[k] + z[k] * z[k];
+
+  best[0] = 0.0;
+  states[0] = 0;
+  n_states = 1;
+  for (k = 1; k < 64; k++)
+    {
+      candidates[0] = webx_jpeg_round (z[k], 1023);
+      if (candidates[0] == 0)
+        continue;
+      n_candidates = 1;
+      if (ABS (candidates[0]) > 1)
+        candidates[n_candidates++] = candidates[0]
+                                     - (candidates[0] > 0 ? 1 : -1);
+      for (i = 0; i < n_candidates; i++)
+        {
+          dists[i] = (z[k] - candidates[i]) * (z[k] - candidates[i]);
+          sizes[i] = webx_jpeg_bit_size (candidates[i]);
+        }
+
+      best[k] = G_MAXFLOAT;
+      for (n = 0; n < n_states; n++)
+        {
+          /* runs over 15 take ZRL symbols */
+          j = states[n];
+          run = k - j - 1;
+          base = best[j] + zero_sums[k] - zero_sums[j + 1]
+                 + lambda * (run / 16) * rates[0xf0];
+          for (i = 0; i < n_candidates; i++)
+            {
+              cost = base + dists[i]
+                     + lambda * rates[((run % 16) << 4) | sizes[i]];
+              if (cost < best[k])
+                {
+                  best[k] = cost;
+                  from[k] = j;
+                  values[k] = candidates[i];
+                }
+            }
+        }
+      states[n_states++] = k;
+    }
+
+  /* block ends after last non-zero coefficient with EOB */
+  last = 0;
+  end_cost = G_MAXFLOAT;
+  for (n = 0; n < n_states; n++)
+    {
+      k = states[n];
+      cost = best[k] + zero_sums[64] - zero_sums[k + 1]
+             + (k < 63 ? lambda * rates[0x00] : 0.0);
+      if (cost < end_cost)
+        {
+          end_cost = cost;
+          last = k;
+        }
+    }
+
+  for (k = 1; k < 64; k++)
+    out[webx_jpeg_zigzag[k]] = 0;
+  for (k = last; k > 0; k = from[k])
+    out[webx_jpeg_zigzag[k]] = values[k];
+}
+
+/* Quantizes blocks of job, counts AC symbols when not trellis yet. */
+static void
+webx_jpeg_quantize_job (gint              job,
+                        gint              n_jobs,
+                        WebxJpegQuantize *data)
+{
+  const WebxJpegPlane  *plane;
+  const gfloat         *coefs;
+  const gfloat         *scales;
+  JCOEF                *out;
+  guint                *counts;
+  gfloat                z[64];
+  gfloat                norm;
+  gfloat                lambda;
+  gsize                 n_blocks;
+  gsize                 first;
+  gsize                 last;
+  gsize                 b;
+  gint                  c, k;
+  gint                  run;
+  gint                  value;
+
+  counts = data->counts + (gsize) job * 2 * 256;
+  memset (counts, 0, 2 * 256 * sizeof (guint));
+
+  for (c = 0; c < 3; c++)
+    {
+      plane = &data->planes[c];
+      scales = data->scales[c > 0];
+      n_blocks = (gsize) plane->width_in_blocks * plane->height_in_blocks;
+      first = n_blocks * job / n_jobs;
+      last = n_blocks * (job + 1) / n_jobs;
+
+      for (b = first; b < last; b++)
+        {
+          coefs = plane->coefs + b * 64;
+          out = data->quantized[c] + b * 64;
+          out[0] = webx_jpeg_round (coefs[0] * scales[0], 2047);
+
+          norm = 0.0;
+          for (k = 1; k < 64; k++)
+            {
+              z[k] = coefs[webx_jpeg_zigzag[k]] * scales[k];
+              norm += coefs[k] * coefs[k];
+            }
+
+          if (data->trellis)
+            {
+              /* busy blocks hide more error, lambda as in mozjpeg */
+              lambda = WEBX_JPEG_LAMBDA / (1.0 + norm / 63.0 / 1448.0);
+              /* chroma error spreads over all pixels of its sample and
+               * smears edges, so it is touched lightly */
+              if (c > 0)
+                lambda /= 4 * data->planes[0].h_samp
+                          * data->planes[0].v_samp;
+              webx_jpeg_trellis (z, data->rates.bits[c > 0], lambda, out);
+              continue;
+            }
+
+          run = 0;
+          for (k = 1; k < 64; k++)
+            {
+              value = webx_jpeg_round (z[k], 1023);
+              out[webx_jpeg_zigzag[k]] = value;
+              if (! value)
+                {
+                  run++;
+                  continue;
+                }
+              for (; run > 15; run -= 16)
+                counts[(c > 0) * 256 + 0xf0]++;
+              counts[(c > 0) * 256
+                     + ((run << 4) | webx_jpeg_bit_size (value))]++;
+              run = 0;
+            }
+          if (run)
+            counts[(c > 0) * 256 + 0x00]++;
+        }
+    }
+}
+
+static void
+webx_jpeg_error_exit (j_common_ptr cinfo)
+{
+  WebxJpegError        *error = (WebxJpegError *) cinfo->err;
+
+  longjmp (error->setjmp_buffer, 1);
+}
+
+static void
+webx_jpeg_output_message (j_common_ptr cinfo)
+{
+}
+
+static void
+webx_jpeg_init_destination (j_compress_ptr cinfo)
+{
+  WebxJpegDest         *dest = (WebxJpegDest *) cinfo->dest;
+
+  dest->pub.next_output_byte = dest->buffer;
+  dest->pub.free_in_buffer = WEBX_JPEG_DEST_SIZE;
+}
+
+static boolean
+webx_jpeg_empty_output_buffer (j_compress_ptr cinfo)
+{
+  WebxJpegDest         *dest = (WebxJpegDest *) cinfo->dest;
+
+  g_byte_array_append (dest->data, dest->buffer, WEBX_JPEG_DEST_SIZE);
+  dest->pub.next_output_byte = dest->buffer;
+  dest->pub.free_in_buffer = WEBX_JPEG_DEST_SIZE;
+
+  return TRUE;
+}
+
+static void
+webx_jpeg_term_destination (j_compress_ptr cinfo)
+{
+  WebxJpegDest         *dest = (WebxJpegDest *) cinfo->dest;
+
+  g_byte_array_append (dest->data, dest->buffer,
+                       WEBX_JPEG_DEST_SIZE - dest->pub.free_in_buffer);
+}
+
+/* Scan script with luma AC split at luma_split and chroma AC at
+ * chroma_split (0 for whole), spectral selection only. */
+static gint
+webx_jpeg_make_script (gint            luma_split,
+                       gint            chroma_split,
+                       jpeg_scan_info *scans)
+{
+  gint          n = 0;
+  gint          c;
+
+  scans[n].comps_in_scan = 3;
+  for (c = 0; c < 3; c++)
+    scans[n].component_index[c] = c;
+  scans[n].Ss = scans[n].Se = 0;
+  n++;
+
+  scans[n].comps_in_scan = 1;
+  scans[n].component_index[0] = 0;
+  scans[n].Ss = 1;
+  scans[n].Se = luma_split;
+  n++;
+
+  for (c = 1; c < 3; c++)
+    {
+      scans[n].comps_in_scan = 1;
+      scans[n].component_index[0] = c;
+      scans[n].Ss = 1;
+      scans[n].Se = chroma_split ? chroma_split : 63;
+      n++;
+    }
+
+  scans[n].comps_in_scan = 1;
+  scans[n].component_index[0] = 0;
+  scans[n].Ss = luma_split + 1;
+  scans[n].Se = 63;
+  n++;
+
+  for (c = 1; c < 3 && chroma_split; c++)
+    {
+      scans[n].comps_in_scan = 1;
+      scans[n].component_index[0] = c;
+      scans[n].Ss = chroma_split + 1;
+      scans[n].Se = 63;
+      n++;
+    }
+
+  for (c = 0; c < n; c++)
+    scans[c].Ah = scans[c].Al = 0;
+
+  return n;
+}
+
+/* Writes quantized coefficients as JPEG file with script of job. */
+static void
+webx_jpeg_write_job (gint           job,
+                     gint           n_jobs,
+                     WebxJpegWrite *data)
+{
+  struct jpeg_compress_struct   cinfo;
+  WebxJpegError                 error;
+  WebxJpegDest                  dest;
+  jvirt_barray_ptr              arrays[3];
+  jpeg_scan_info                scans[WEBX_JPEG_MAX_SCANS];
+  const WebxJpegPlane          *plane;
+  JBLOCKARRAY                   rows;
+  gint                          c, y;
+
+  data->results[job] = NULL;
+  dest.data = g_byte_array_new ();
+
+  cinfo.err = jpeg_std_error (&error.pub);
+  error.pub.error_exit = webx_jpeg_error_exit;
+  error.pub.output_message = webx_jpeg_output_message;
+  if (setjmp (error.setjmp_buffer))
+    {
+      jpeg_destroy_compress (&cinfo);
+      g_byte_array_free (dest.data, TRUE);
+      return;
+    }
+
+  jpeg_create_compress (&cinfo);
+  dest.pub.init_destination = webx_jpeg_init_destination;
+  dest.pub.empty_output_buffer = webx_jpeg_empty_output_buffer;
+  dest.pub.term_destination = webx_jpeg_term_destination;
+  cinfo.dest = &dest.pub;
+
+  cinfo.image_width = data->width;
+  cinfo.image_height = data->height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults (&cinfo);
+  jpeg_set_quality (&cinfo, data->quality, TRUE);
+  for (c = 0; c < 3; c++)
+    {
+      cinfo.comp_info[c].h_samp_factor = data->planes[c].h_samp;
+      cinfo.comp_info[c].v_samp_factor = data->planes[c].v_samp;
+    }
+  cinfo.optimize_coding = TRUE;
+  cinfo.restart_in_rows = data->restart;
+
+  if (data->progressive && webx_jpeg_luma_splits[job] == 0)
+    {
+      jpeg_simple_progression (&cinfo);
+    }
+  else if (data->progressive)
+    {
+      cinfo.scan_info = scans;
+      cinfo.num_scans = webx_jpeg_make_script (webx_jpeg_luma_splits[job],
+                                               webx_jpeg_chroma_splits[job],
+                                               scans);
+    }
+
+  for (c = 0; c < 3; c++)
+    {
+      plane = &data->planes[c];
+      arrays[c] = (*cinfo.mem->request_virt_barray) ((j_common_ptr) &cinfo,
+                                                     JPOOL_IMAGE, FALSE,
+                                                     plane->width_in_blocks,
+                                                     plane->height_in_blocks,
+                                                     plane->v_samp);
+    }
+  (*cinfo.mem->realize_virt_arrays) ((j_common_ptr) &cinfo);
+
+  for (c = 0; c < 3; c++)
+    {
+      plane = &data->planes[c];
+      for (y = 0; y < plane->height_in_blocks; y++)
+        {
+          rows = (*cinfo.mem->access_virt_barray) ((j_common_ptr) &cinfo,
+                                                   arrays[c], y, 1, TRUE);
+          memcpy (rows[0],
+                  data->quantized[c]
+                  + (gsize) y * plane->width_in_blocks * 64,
+                  plane->width_in_blocks * sizeof (JBLOCK));
+        }
+    }
+
+  jpeg_write_coefficients (&cinfo, arrays);
+  jpeg_finish_compress (&cinfo);
+  jpeg_destroy_compress (&cinfo);
+
+  data->results[job] = dest.data;
+}
+
+/* Quantization tables libjpeg makes for quality. */
+static void
+webx_jpeg_get_qtables (gint   quality,
+                       guint  qtables[2][64])
+{
+  struct jpeg_compress_struct   cinfo;
+  struct jpeg_error_mgr         error;
+  gint                          i, k;
+
+  cinfo.err = jpeg_std_error (&error);
+  jpeg_create_compress (&cinfo);
+  cinfo.in_color_space = JCS_RGB;
+  cinfo.input_components = 3;
+  jpeg_set_defaults (&cinfo);
+  jpeg_set_quality (&cinfo, quality, TRUE);
+  for (i = 0; i < 2; i++)
+    for (k = 0; k < 64; k++)
+      qtables[i][k] = cinfo.quant_tbl_ptrs[i]->quantval[k];
+  jpeg_destroy_compress (&cinfo);
+}
+
+/* Converts rgb(a) pixels to YCbCr, downsamples chroma and transforms
+ * all of it, which is what doesn't depend on quality. Alpha is
+ * composed over background (rgb, white if NULL); luma is sampled
+ * h_samp x v_samp times as often as chroma. Free result with
+ * webx_jpeg_engine_free (). */
+WebxJpegCoefs*
+webx_jpeg_engine_transform (const guchar  *pixels,
+                            gint           width,
+                            gint           height,
+                            gint           rowstride,
+                            gint           bpp,
+                            const guchar  *background,
+                            gint           h_samp,
+                            gint           v_samp)
+{
+  WebxJpegCoefs        *coefs;
+  WebxJpegTransform     transform;
+  WebxJpegPlane        *plane;
+  gint                  n_mcu_cols;
+  gint                  n_mcu_rows;
+  gint                  c, i, k;
+
+  g_return_val_if_fail (pixels != NULL, NULL);
+  g_return_val_if_fail (width > 0 && height > 0, NULL);
+  g_return_val_if_fail (bpp == 3 || bpp == 4, NULL);
+  g_return_val_if_fail (h_samp >= 1 && h_samp <= 2, NULL);
+  g_return_val_if_fail (v_samp >= 1 && v_samp <= 2, NULL);
+
+  coefs = g_new (WebxJpegCoefs, 1);
+  coefs->width = width;
+  coefs->height = height;
+
+  transform.pixels = pixels;
+  transform.width = width;
+  transform.height = height;
+  transform.rowstride = rowstride;
+  transform.bpp = bpp;
+  for (c = 0; c < 3; c++)
+    transform.background[c] = background ? background[c] : 255;
+  transform.h_samp = h_samp;
+  transform.v_samp = v_samp;
+  for (i = 0; i < 8; i++)
+    for (k = 0; k < 8; k++)
+      transform.table[i][k] = (i == 0 ? G_SQRT1_2 : 1.0) / 2.0
+                              * cos ((2 * k + 1) * i * G_PI / 16.0);
+  transform.planes = coefs->planes;
+
+  n_mcu_cols = (width + 8 * h_samp - 1) / (8 * h_samp);
+  n_mcu_rows = (height + 8 * v_samp - 1) / (8 * v_samp);
+  for (c = 0; c < 3; c++)
+    {
+      plane = &coefs->planes[c];
+      plane->h_samp = (c == 0) ? h_samp : 1;
+      plane->v_samp = (c == 0) ? v_samp : 1;
+      plane->width_in_blocks = n_mcu_cols * plane->h_samp;
+      plane->height_in_blocks = n_mcu_rows * plane->v_samp;
+      plane->coefs = g_new (gfloat, (gsize) plane->width_in_blocks
+                                    * plane->height_in_blocks * 64);
+    }
+  webx_threads_run ((WebxThreadFunc) webx_jpeg_transform_job, n_mcu_rows,
+                    &transform);
+
+  return coefs;
+}
+
+void
+webx_jpeg_engine_free (WebxJpegCoefs *coefs)
+{
+  gint          c;
+
+  if (! coefs)
+    return;
+
+  for (c = 0; c < 3; c++)
+    g_free (coefs->planes[c].coefs);
+  g_free (coefs);
+}
+
+/* Runs jobs on worker threads, or one after another on calling thread
+ * when that is one of the workers already. */
+static void
+webx_jpeg_run (WebxThreadFunc   func,
+               gint             n_jobs,
+               gpointer         data,
+               gboolean         threaded)
+{
+  gint          job;
+
+  if (threaded)
+    {
+      webx_threads_run (func, n_jobs, data);
+      return;
+    }
+
+  for (job = 0; job < n_jobs; job++)
+    func (job, n_jobs, data);
+}
+
+static void
+webx_jpeg_quantize_init (WebxJpegQuantize    *quantize,
+                         const WebxJpegCoefs *coefs,
+                         gint                 quality,
+                         gint                 n_jobs)
+{
+  const WebxJpegPlane  *plane;
+  gint                  c, i, k;
+
+  quantize->planes = coefs->planes;
+  for (c = 0; c < 3; c++)
+    {
+      plane = &coefs->planes[c];
+      quantize->quantized[c] = g_new (JCOEF, (gsize) plane->width_in_blocks
+                                             * plane->height_in_blocks * 64);
+    }
+  webx_jpeg_get_qtables (quality, quantize->qtables);
+  for (i = 0; i < 2; i++)
+    for (k = 0; k < 64; k++)
+      quantize->scales[i][k] =
+        1.0 / quantize->qtables[i][webx_jpeg_zigzag[k]];
+  quantize->counts = g_new (guint, n_jobs * 2 * 256);
+}
+
+static void
+webx_jpeg_quantize_clear (WebxJpegQuantize *quantize)
+{
+  gint          c;
+
+  for (c = 0; c < 3; c++)
+    g_free (quantize->quantized[c]);
+  g_free (quantize->counts);
+}
+
+/* First pass rounds and counts symbols, which gives trellis the bits
+ * each of them costs. */
+static void
+webx_jpeg_count_rates (WebxJpegQuantize *quantize,
+                       gint              n_jobs,
+                       gboolean          threaded)
+{
+  guint                 totals[2][256];
+  guint                 total;
+  gfloat               *bits;
+  gint                  i, k;
+
+  quantize->trellis = FALSE;
+  webx_jpeg_run ((WebxThreadFunc) webx_jpeg_quantize_job, n_jobs,
+                 quantize, threaded);
+
+  memset (totals, 0, sizeof (totals));
+  for (i = 0; i < n_jobs; i++)
+    for (k = 0; k < 2 * 256; k++)
+      totals[k / 256][k % 256] += quantize->counts[i * 2 * 256 + k];
+  for (i = 0; i < 2; i++)
+    {
+      bits = quantize->rates.bits[i];
+      total = 0;
+      for (k = 0; k < 256; k++)
+        total += totals[i][k];
+      for (k = 0; k < 256; k++)
+        {
+          bits[k] = WEBX_JPEG_MAX_CODE;
+          if (totals[i][k])
+            bits[k] = MIN (-log2 ((gdouble) totals[i][k] / total),
+                           WEBX_JPEG_MAX_CODE);
+          /* magnitude bits follow the code */
+          bits[k] += k & 0x0f;
+        }
+    }
+}
+
+static GByteArray*
+webx_jpeg_compress (const WebxJpegCoefs *coefs,
+                    gint                 quality,
+                    gboolean             progressive,
+                    gint                 restart,
+                    const WebxJpegRates *rates,
+                    gboolean             threaded)
+{
+  WebxJpegQuantize      quantize;
+  WebxJpegWrite         write;
+  GByteArray           *best = NULL;
+  gint                  n_jobs;
+  gint                  n_scripts;
+  gint                  i;
+
+  quality = CLAMP (quality, 1, 100);
+
+  n_jobs = threaded ? webx_threads_get_count () : 1;
+  webx_jpeg_quantize_init (&quantize, coefs, quality, n_jobs);
+  if (rates)
+    quantize.rates = *rates;
+  else
+    webx_jpeg_count_rates (&quantize, n_jobs, threaded);
+
+  quantize.trellis = TRUE;
+  webx_jpeg_run ((WebxThreadFunc) webx_jpeg_quantize_job, n_jobs,
+                 &quantize, threaded);
+
+  write.planes = coefs->planes;
+  write.quantized = quantize.quantized;
+  write.width = coefs->width;
+  write.height = coefs->height;
+  write.quality = quality;
+  write.progressive = progressive;
+  write.restart = MAX (restart, 0);
+  n_scripts = progressive ? WEBX_JPEG_N_SCRIPTS : 1;
+  webx_jpeg_run ((WebxThreadFunc) webx_jpeg_write_job, n_scripts,
+                 &write, threaded);
+
+  /* ties go to what came first */
+  for (i = 0; i < n_scripts; i++)
+    {
+      if (write.results[i] && (! best || write.results[i]->len < best->len))
+        {
+          if (best)
+            g_byte_array_free (best, TRUE);
+          best = write.results[i];
+        }
+      else if (write.results[i])
+        {
+          g_byte_array_free (write.results[i], TRUE);
+        }
+    }
+
+  webx_jpeg_quantize_clear (&quantize);
+
+  return best;
+}
+
+/* Bits trellis quantization assumes for each symbol when coefs are
+ * compressed at quality. Part of image compressed with rates of
+ * whole image gets the same coefficients as it does in whole. */
+void
+webx_jpeg_engine_get_rates (const WebxJpegCoefs *coefs,
+                            gint                 quality,
+                            WebxJpegRates       *rates)
+{
+  WebxJpegQuantize      quantize;
+  gint                  n_jobs;
+
+  g_return_if_fail (coefs != NULL && rates != NULL);
+
+  n_jobs = webx_threads_get_count ();
+  webx_jpeg_quantize_init (&quantize, coefs, CLAMP (quality, 1, 100),
+                           n_jobs);
+  webx_jpeg_count_rates (&quantize, n_jobs, TRUE);
+  *rates = quantize.rates;
+  webx_jpeg_quantize_clear (&quantize);
+}
+
+/* Quantizes and writes transformed image as JPEG file in memory.
+ * quality is 1 .. 100 as in libjpeg, restart is interval of restart
+ * markers in MCU rows, 0 for none. rates are from
+ * webx_jpeg_engine_get_rates (), NULL to count them from coefs.
+ * Returns NULL if libjpeg fails. */
+GByteArray*
+webx_jpeg_engine_compress (const WebxJpegCoefs *coefs,
+                           gint                 quality,
+                           gboolean             progressive,
+                           gint                 restart,
+                           const WebxJpegRates *rates)
+{
+  g_return_val_if_fail (coefs != NULL, NULL);
+
+  return webx_jpeg_compress (coefs, quality, progressive, restart, rates,
+                             TRUE);
+}
+
+static void
+webx_jpeg_sweep_job (gint           job,
+                     gint           n_jobs,
+                     WebxJpegSweep *sweep)
+{
+  GByteArray           *data;
+
+  data = webx_jpeg_compress (sweep->coefs, sweep->qualities[job],
+                             sweep->progressive, sweep->restart, NULL,
+                             FALSE);
+  sweep->sizes[job] = data ? data->len : 0;
+  if (data)
+    g_byte_array_free (data, TRUE);
+}
+
+/* Sizes of files webx_jpeg_engine_compress () would make for each of
+ * n_qualities qualities, 0 where libjpeg fails. Qualities are spread
+ * over worker threads, each compressed on its own. */
+void
+webx_jpeg_engine_sweep (const WebxJpegCoefs *coefs,
+                        const gint          *qualities,
+                        gint                 n_qualities,
+                        gboolean             progressive,
+                        gint                 restart,
+                        gsize               *sizes)
+{
+  WebxJpegSweep         sweep;
+
+  g_return_if_fail (coefs != NULL);
+
+  sweep.coefs = coefs;
+  sweep.qualities = qualities;
+  sweep.progressive = progressive;
+  sweep.restart = restart;
+  sweep.sizes = sizes;
+  webx_threads_run ((WebxThreadFunc) webx_jpeg_sweep_job, n_qualities,
+                    &sweep);
+}
+
+/* Encodes rgb(a) pixels as JPEG file in memory, see
+ * webx_jpeg_engine_transform () and webx_jpeg_engine_compress (). */
+GByteArray*
+webx_jpeg_engine_encode (const guchar  *pixels,
+                         gint           width,
+                         gint           height,
+                         gint           rowstride,
+                         gint           bpp,
+                         const guchar  *background,
+                         gint           quality,
+                         gint           h_samp,
+                         gint           v_samp,
+                         gboolean       progressive,
+                         gint           restart)
+{
+  WebxJpegCoefs        *coefs;
+  GByteArray           *data;
+
+  coefs = webx_jpeg_engine_transform (pixels, width, height, rowstride, bpp,
+                                      background, h_samp, v_samp);
+  if (! coefs)
+    return NULL;
+
+  data = webx_jpeg_engine_compress (coefs, quality, progressive, restart,
+                                    NULL);
+  webx_jpeg_engine_free (coefs);
+
+  return data;
+}
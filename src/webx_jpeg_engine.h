@@ -0,0 +1,87 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+   In-process JPEG encoder for maximum efficiency. Color conversion,
+   downsampling and forward DCT are done here, coefficients are
+   quantized with trellis search trading distortion for bits, the way
+   mozjpeg does it, and libjpeg only writes them with optimized Huffman
+   tables. Progressive files try several scan scripts and keep the
+   smallest.
+
+   Transform doesn't depend on quality, so it can be done once and
+   compressed at many qualities, as in search for file size.
+*/
+
+#ifndef __WEBX_JPEG_ENGINE_H__
+#define __WEBX_JPEG_ENGINE_H__
+
+/* DCT coefficients of image, not quantized yet */
+typedef struct _WebxJpegCoefs WebxJpegCoefs;
+typedef struct _WebxJpegRates WebxJpegRates;
+
+/* bits each AC symbol costs, as trellis quantization weighs them */
+struct _WebxJpegRates
+{
+  /* luma and chroma */
+  gfloat        bits[2][256];
+};
+
+WebxJpegCoefs*    webx_jpeg_engine_transform    (const guchar  *pixels,
+                                                 gint           width,
+                                                 gint           height,
+                                                 gint           rowstride,
+                                                 gint           bpp,
+                                                 const guchar  *background,
+                                                 gint           h_samp,
+                                                 gint           v_samp);
+
+void              webx_jpeg_engine_free         (WebxJpegCoefs *coefs);
+
+void              webx_jpeg_engine_get_rates    (const WebxJpegCoefs *coefs,
+                                                 gint           quality,
+                                                 WebxJpegRates *rates);
+
+GByteArray*       webx_jpeg_engine_compress     (const WebxJpegCoefs *coefs,
+                                                 gint           quality,
+                                                 gboolean       progressive,
+                                                 gint           restart,
+                                                 const WebxJpegRates *rates);
+
+void              webx_jpeg_engine_sweep        (const WebxJpegCoefs *coefs,
+                                                 const gint    *qualities,
+                                                 gint           n_qualities,
+                                                 gboolean       progressive,
+                                                 gint           restart,
+                                                 gsize         *sizes);
+
+GByteArray*       webx_jpeg_engine_encode       (const guchar  *pixels,
+                                                 gint           width,
+                                                 gint           height,
+                                                 gint           rowstride,
+                                                 gint           bpp,
+                                                 const guchar  *background,
+                                                 gint           quality,
+                                                 gint           h_samp,
+                                                 gint           v_samp,
+                                                 gboolean       progressive,
+                                                 gint           restart);
+
+#endif /* __WEBX_JPEG_ENGINE_H__ */
@@ -20,22 +20,42 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <gtk/gtk.h>
 #include <libgimp/gimp.h>
+#include <libgimp/gimpui.h>
 
 #include "webx_main.h"
 #include "webx_jpeg_target.h"
+#include "webx_pixels.h"
 
 #include "plugin-intl.h"
 
+static void     webx_jpeg_target_destroy       (GtkObject              *object);
+static void     webx_jpeg_target_clear_cache   (WebxJpegTarget         *jpeg);
+static void     webx_jpeg_target_changed       (WebxTarget             *widget);
 static gboolean webx_jpeg_target_save_image    (WebxTarget             *widget,
                                                 WebxTargetInput        *input,
                                                 const gchar            *file_name);
+static GdkPixbuf* webx_jpeg_target_render_preview (WebxTarget          *widget,
+                                                   WebxTargetInput     *input,
+                                                   gint                *file_size);
+static void   webx_jpeg_target_subsmp_changed  (GtkWidget              *combo,
+                                                WebxJpegTarget         *jpeg);
+static gboolean webx_jpeg_target_uses_pixels   (WebxTarget             *widget);
 static gchar* webx_jpeg_target_get_unique_name (WebxTarget             *widget);
 static gchar* webx_jpeg_target_get_extension   (WebxTarget             *widget);
+static void   webx_jpeg_target_get_block_size  (WebxTarget             *widget,
+                                                gint                   *width,
+                                                gint                   *height);
 
 G_DEFINE_TYPE (WebxJpegTarget, webx_jpeg_target, WEBX_TYPE_TARGET)
 
+/* target size search tries qualities this far apart, then the ones
+ * between best two */
+#define WEBX_JPEG_QUALITY_STEP  5
+
 #define parent_class webx_jpeg_target_parent_class
 
 
@@ -43,14 +63,22 @@ static void
 webx_jpeg_target_class_init (WebxJpegTargetClass *klass)
 {
   GObjectClass        *object_class;
+  GtkObjectClass      *gtk_object_class;
   WebxTargetClass *target_class;
 
   object_class = G_OBJECT_CLASS (klass);
 
+  gtk_object_class = GTK_OBJECT_CLASS (klass);
+  gtk_object_class->destroy = webx_jpeg_target_destroy;
+
   target_class = WEBX_TARGET_CLASS (klass);
   target_class->save_image      = webx_jpeg_target_save_image;
+  target_class->render_preview  = webx_jpeg_target_render_preview;
+  target_class->uses_pixels     = webx_jpeg_target_uses_pixels;
   target_class->get_unique_name = webx_jpeg_target_get_unique_name;
   target_class->get_extension   = webx_jpeg_target_get_extension;
+  target_class->get_block_size  = webx_jpeg_target_get_block_size;
+  target_class->target_changed  = webx_jpeg_target_changed;
 }
 
 static void
@@ -58,13 +86,15 @@ webx_jpeg_target_init (WebxJpegTarget *jpeg)
 {
   jpeg->quality       = 0.85;
   jpeg->smoothing     = 0.0;
-  jpeg->subsmp        = 0;
+  jpeg->subsmp        = WEBX_JPEG_SUBSMP_AUTO;
   jpeg->restart       = 0;
   jpeg->dct           = 0;
   jpeg->optimize      = TRUE;
   jpeg->progressive   = FALSE;
   jpeg->baseline      = TRUE;
   jpeg->strip_exif    = FALSE;
+  jpeg->max_efficiency = FALSE;
+  jpeg->target_size   = 0;
 
   jpeg->quality_adj     = NULL;
   jpeg->smoothing_adj   = NULL;
@@ -72,12 +102,36 @@ webx_jpeg_target_init (WebxJpegTarget *jpeg)
   jpeg->progressive_adj = NULL;
   jpeg->baseline_adj    = NULL;
   jpeg->strip_exif_adj  = NULL;
+  jpeg->max_efficiency_adj = NULL;
+  jpeg->subsmp_w        = NULL;
+  jpeg->target_size_adj = NULL;
+
+  jpeg->auto_pixels = NULL;
+  jpeg->auto_subsmp = WEBX_JPEG_SUBSMP_AUTO;
+
+  jpeg->whole_pixels = NULL;
+  jpeg->fit_quality = 0;
+  jpeg->rates_quality = 0;
+
+  jpeg->cache_pixels = NULL;
+  jpeg->cache_coefs = NULL;
+}
+
+static void
+webx_jpeg_target_destroy (GtkObject *object)
+{
+  webx_jpeg_target_clear_cache (WEBX_JPEG_TARGET (object));
+
+  if (GTK_OBJECT_CLASS (parent_class)->destroy)
+    GTK_OBJECT_CLASS (parent_class)->destroy (object);
 }
 
 GtkWidget*
 webx_jpeg_target_new (void)
 {
   WebxJpegTarget *jpeg;
+  GtkWidget      *label;
+  GtkWidget      *combo;
   gint            row = 0;
 
   jpeg = g_object_new (WEBX_TYPE_JPEG_TARGET, NULL);
@@ -86,10 +140,42 @@ webx_jpeg_target_new (void)
                                               row++,
                                               _("_Quality"), 6,
                                               &jpeg->quality);
+  jpeg->target_size_adj = webx_range_entry_new (WEBX_TARGET (jpeg),
+                                                row++,
+                                                _("_Target size (KB)"),
+                                                0, 1000,
+                                                &jpeg->target_size);
   jpeg->smoothing_adj = webx_percent_entry_new (WEBX_TARGET (jpeg),
                                                 row++,
                                                 _("_Smoothing"), 0,
                                                 &jpeg->smoothing);
+
+  label = gtk_label_new (_("Subsampling:"));
+  gtk_misc_set_alignment (GTK_MISC (label), 0.0, 0.5);
+  gtk_table_attach (GTK_TABLE (jpeg), label,
+                    0, 1, row, row+1,
+                    GTK_FILL, GTK_FILL, 0, 0);
+  gtk_widget_show (label);
+  combo = gimp_int_combo_box_new (_("Auto"),
+                                  WEBX_JPEG_SUBSMP_AUTO,
+                                  _("4:4:4 (best quality)"),
+                                  2,
+                                  _("4:2:2"),
+                                  1,
+                                  _("4:2:0 (smallest file)"),
+                                  0,
+                                  NULL);
+  gimp_int_combo_box_set_active (GIMP_INT_COMBO_BOX (combo), jpeg->subsmp);
+  gtk_table_attach (GTK_TABLE (jpeg), combo,
+                    1, 3, row, row+1,
+                    GTK_SHRINK, GTK_SHRINK, 0, 0);
+  g_signal_connect (combo, "changed",
+                    G_CALLBACK (webx_jpeg_target_subsmp_changed),
+                    jpeg);
+  jpeg->subsmp_w = combo;
+  gtk_widget_show (combo);
+  row++;
+
   jpeg->optimize_adj = webx_checkbox_new (WEBX_TARGET (jpeg),
                                           row++,
                                           _("_Optimize"),
@@ -106,10 +192,372 @@ webx_jpeg_target_new (void)
                                             row++,
                                             _("Strip _EXIF"),
                                             &jpeg->strip_exif);
+  jpeg->max_efficiency_adj = webx_checkbox_new (WEBX_TARGET (jpeg),
+                                                row++,
+                                                _("_Maximum efficiency"),
+                                                &jpeg->max_efficiency);
+  webx_jpeg_target_changed (WEBX_TARGET (jpeg));
 
   return GTK_WIDGET (jpeg);
 }
 
+static void
+webx_jpeg_target_subsmp_changed (GtkWidget      *combo,
+                                 WebxJpegTarget *jpeg)
+{
+  gimp_int_combo_box_get_active (GIMP_INT_COMBO_BOX (combo), &jpeg->subsmp);
+  webx_target_changed (WEBX_TARGET (jpeg));
+}
+
+/* Quality found for target size and rates may not fit with other
+ * settings. Options built-in encoder has no use for are made
+ * insensitive while it is on, see webx_jpeg_target_use_engine (). */
+static void
+webx_jpeg_target_changed (WebxTarget *widget)
+{
+  WebxJpegTarget *jpeg = WEBX_JPEG_TARGET (widget);
+  gboolean        engine;
+
+  jpeg->fit_quality = 0;
+  jpeg->rates_quality = 0;
+
+  if (! jpeg->max_efficiency_adj)
+    return;
+
+  engine = jpeg->max_efficiency || jpeg->target_size > 0;
+  gimp_scale_entry_set_sensitive (jpeg->quality_adj,
+                                  jpeg->target_size == 0);
+  gimp_scale_entry_set_sensitive (jpeg->smoothing_adj, ! engine);
+  gtk_widget_set_sensitive (GTK_WIDGET (jpeg->optimize_adj), ! engine);
+  gtk_widget_set_sensitive (GTK_WIDGET (jpeg->baseline_adj), ! engine);
+  gtk_widget_set_sensitive (GTK_WIDGET (jpeg->strip_exif_adj), ! engine);
+}
+
+static void
+webx_jpeg_target_clear_cache (WebxJpegTarget *jpeg)
+{
+  webx_jpeg_engine_free (jpeg->cache_coefs);
+  jpeg->cache_coefs = NULL;
+  jpeg->cache_pixels = NULL;
+}
+
+/* Drops what was worked out for other input. */
+static void
+webx_jpeg_target_check_cache (WebxJpegTarget  *jpeg,
+                              WebxTargetInput *input)
+{
+  if (jpeg->cache_pixels != input->pixels
+      || jpeg->cache_width != input->width
+      || jpeg->cache_height != input->height
+      || jpeg->cache_serial != input->serial)
+    {
+      webx_jpeg_target_clear_cache (jpeg);
+      jpeg->cache_pixels = input->pixels;
+      jpeg->cache_width = input->width;
+      jpeg->cache_height = input->height;
+      jpeg->cache_serial = input->serial;
+    }
+}
+
+/* Subsampling to save input with, as file-jpeg-save numbers it. Auto
+ * looks at colored edges of whole input, even when only region of it
+ * is rendered, so that region looks like the exported file; 4:2:0 if
+ * pixels are not at hand. */
+static gint
+webx_jpeg_target_get_subsmp (WebxJpegTarget  *jpeg,
+                             WebxTargetInput *input)
+{
+  gint          h_samp;
+  gint          v_samp;
+
+  if (jpeg->subsmp != WEBX_JPEG_SUBSMP_AUTO)
+    return jpeg->subsmp;
+  if (! input->whole_pixels)
+    return 0;
+
+  if (jpeg->auto_subsmp == WEBX_JPEG_SUBSMP_AUTO
+      || jpeg->auto_pixels != input->whole_pixels
+      || jpeg->auto_width != input->whole_width
+      || jpeg->auto_height != input->whole_height
+      || jpeg->auto_serial != input->serial)
+    {
+      webx_pixels_get_chroma_sampling (input->whole_pixels,
+                                       input->whole_width,
+                                       input->whole_height,
+                                       input->rowstride, input->bpp,
+                                       &h_samp, &v_samp);
+      if (h_samp == 1)
+        jpeg->auto_subsmp = 2;
+      else if (v_samp == 1)
+        jpeg->auto_subsmp = 1;
+      else
+        jpeg->auto_subsmp = 0;
+
+      jpeg->auto_pixels = input->whole_pixels;
+      jpeg->auto_width = input->whole_width;
+      jpeg->auto_height = input->whole_height;
+      jpeg->auto_serial = input->serial;
+    }
+
+  return jpeg->auto_subsmp;
+}
+
+/* Target size needs built-in encoder too, which can try many
+ * qualities quickly. */
+static gboolean
+webx_jpeg_target_use_engine (WebxJpegTarget  *jpeg,
+                             WebxTargetInput *input)
+{
+  return input->pixels != NULL
+         && (jpeg->max_efficiency || jpeg->target_size > 0);
+}
+
+/* Alpha is composed over background color, like flatten does. */
+static void
+webx_jpeg_target_get_background (guchar *background)
+{
+  GimpRGB       color;
+
+  gimp_context_get_background (&color);
+  gimp_rgb_get_uchar (&color, &background[0], &background[1],
+                      &background[2]);
+}
+
+/* Chroma sampling factors of subsmp, as file-jpeg-save numbers it. */
+static void
+webx_jpeg_target_get_sampling (gint  subsmp,
+                               gint *h_samp,
+                               gint *v_samp)
+{
+  switch (subsmp)
+    {
+    case 0:
+      *h_samp = *v_samp = 2;
+      break;
+    case 1:
+      *h_samp = 2;
+      *v_samp = 1;
+      break;
+    case 3:
+      *h_samp = 1;
+      *v_samp = 2;
+      break;
+    default:
+      *h_samp = *v_samp = 1;
+      break;
+    }
+}
+
+/* DCT coefficients of input for built-in encoder. They don't depend
+ * on quality, so they are kept while only that changes. */
+static const WebxJpegCoefs*
+webx_jpeg_target_get_coefs (WebxJpegTarget  *jpeg,
+                            WebxTargetInput *input)
+{
+  guchar        background[3];
+  gint          subsmp;
+  gint          h_samp;
+  gint          v_samp;
+
+  webx_jpeg_target_get_background (background);
+  subsmp = webx_jpeg_target_get_subsmp (jpeg, input);
+
+  webx_jpeg_target_check_cache (jpeg, input);
+  if (jpeg->cache_coefs
+      && jpeg->cache_subsmp == subsmp
+      && memcmp (jpeg->cache_background, background, 3) == 0)
+    return jpeg->cache_coefs;
+
+  webx_jpeg_target_get_sampling (subsmp, &h_samp, &v_samp);
+  webx_jpeg_engine_free (jpeg->cache_coefs);
+  jpeg->cache_coefs = webx_jpeg_engine_transform (input->pixels,
+                                                  input->width,
+                                                  input->height,
+                                                  input->rowstride,
+                                                  input->bpp,
+                                                  background,
+                                                  h_samp, v_samp);
+  jpeg->cache_subsmp = subsmp;
+  memcpy (jpeg->cache_background, background, 3);
+
+  return jpeg->cache_coefs;
+}
+
+/* Highest quality whose file fits in target size, lowest if none
+ * does. Qualities are tried in two sweeps over the same
+ * coefficients, coarse and then between the best two. */
+static gint
+webx_jpeg_target_fit_quality (WebxJpegTarget      *jpeg,
+                              const WebxJpegCoefs *coefs)
+{
+  gint          qualities[100 / WEBX_JPEG_QUALITY_STEP];
+  gsize         sizes[100 / WEBX_JPEG_QUALITY_STEP];
+  gsize         limit;
+  gint          n_qualities;
+  gint          best = 0;
+  gint          i;
+
+  limit = (gsize) jpeg->target_size * 1024;
+
+  n_qualities = 100 / WEBX_JPEG_QUALITY_STEP;
+  for (i = 0; i < n_qualities; i++)
+    qualities[i] = (i + 1) * WEBX_JPEG_QUALITY_STEP;
+  webx_jpeg_engine_sweep (coefs, qualities, n_qualities,
+                          jpeg->progressive, jpeg->restart, sizes);
+  for (i = 0; i < n_qualities; i++)
+    if (sizes[i] > 0 && sizes[i] <= limit)
+      best = qualities[i];
+  if (best == 100)
+    return best;
+
+  n_qualities = WEBX_JPEG_QUALITY_STEP - 1;
+  for (i = 0; i < n_qualities; i++)
+    qualities[i] = best + i + 1;
+  webx_jpeg_engine_sweep (coefs, qualities, n_qualities,
+                          jpeg->progressive, jpeg->restart, sizes);
+  for (i = 0; i < n_qualities; i++)
+    if (sizes[i] > 0 && sizes[i] <= limit)
+      best = qualities[i];
+
+  return MAX (best, 1);
+}
+
+/* Whether input is only region of whole input. */
+static gboolean
+webx_jpeg_target_is_region (WebxTargetInput *input)
+{
+  return input->pixels != input->whole_pixels
+         || input->width != input->whole_width
+         || input->height != input->whole_height;
+}
+
+/* Drops what was found for other whole input. */
+static void
+webx_jpeg_target_check_whole (WebxJpegTarget  *jpeg,
+                              WebxTargetInput *input,
+                              const guchar    *background)
+{
+  if (jpeg->whole_pixels != input->whole_pixels
+      || jpeg->whole_width != input->whole_width
+      || jpeg->whole_height != input->whole_height
+      || jpeg->whole_serial != input->serial
+      || memcmp (jpeg->whole_background, background, 3) != 0)
+    {
+      jpeg->fit_quality = 0;
+      jpeg->rates_quality = 0;
+      jpeg->whole_pixels = input->whole_pixels;
+      jpeg->whole_width = input->whole_width;
+      jpeg->whole_height = input->whole_height;
+      jpeg->whole_serial = input->serial;
+      memcpy (jpeg->whole_background, background, 3);
+    }
+}
+
+/* DCT coefficients of whole input, free with webx_jpeg_engine_free (). */
+static WebxJpegCoefs*
+webx_jpeg_target_transform_whole (WebxJpegTarget  *jpeg,
+                                  WebxTargetInput *input,
+                                  const guchar    *background)
+{
+  gint          h_samp;
+  gint          v_samp;
+
+  webx_jpeg_target_get_sampling (webx_jpeg_target_get_subsmp (jpeg, input),
+                                 &h_samp, &v_samp);
+
+  return webx_jpeg_engine_transform (input->whole_pixels,
+                                     input->whole_width,
+                                     input->whole_height,
+                                     input->rowstride, input->bpp,
+                                     background, h_samp, v_samp);
+}
+
+/* Quality for target size, found on whole input even when only region
+ * of it is encoded: target size is for the exported file, and region
+ * shows what that file looks like. */
+static gint
+webx_jpeg_target_get_quality (WebxJpegTarget      *jpeg,
+                              WebxTargetInput     *input,
+                              const WebxJpegCoefs *coefs)
+{
+  WebxJpegCoefs        *whole = NULL;
+  guchar                background[3];
+
+  webx_jpeg_target_get_background (background);
+  webx_jpeg_target_check_whole (jpeg, input, background);
+  if (jpeg->fit_quality > 0)
+    return jpeg->fit_quality;
+
+  if (webx_jpeg_target_is_region (input))
+    whole = webx_jpeg_target_transform_whole (jpeg, input, background);
+
+  jpeg->fit_quality = webx_jpeg_target_fit_quality (jpeg,
+                                                    whole ? whole : coefs);
+  if (whole)
+    {
+      /* rates are on hand while whole is */
+      webx_jpeg_engine_get_rates (whole, jpeg->fit_quality, &jpeg->rates);
+      jpeg->rates_quality = jpeg->fit_quality;
+      webx_jpeg_engine_free (whole);
+    }
+
+  return jpeg->fit_quality;
+}
+
+/* Rates trellis uses on whole input at quality, for encoding region
+ * of it; NULL when input is whole, its own rates are the same. */
+static const WebxJpegRates*
+webx_jpeg_target_get_rates (WebxJpegTarget  *jpeg,
+                            WebxTargetInput *input,
+                            gint             quality)
+{
+  WebxJpegCoefs        *whole;
+  guchar                background[3];
+
+  if (! webx_jpeg_target_is_region (input))
+    return NULL;
+
+  webx_jpeg_target_get_background (background);
+  webx_jpeg_target_check_whole (jpeg, input, background);
+  if (jpeg->rates_quality != quality)
+    {
+      whole = webx_jpeg_target_transform_whole (jpeg, input, background);
+      if (! whole)
+        return NULL;
+
+      webx_jpeg_engine_get_rates (whole, quality, &jpeg->rates);
+      jpeg->rates_quality = quality;
+      webx_jpeg_engine_free (whole);
+    }
+
+  return &jpeg->rates;
+}
+
+/* Encodes input with built-in encoder, which trellis quantizes
+ * coefficients and tries several progressive scan scripts. Region is
+ * quantized the way it is in whole input. */
+static GByteArray*
+webx_jpeg_target_encode (WebxJpegTarget  *jpeg,
+                         WebxTargetInput *input)
+{
+  const WebxJpegCoefs  *coefs;
+  gint                  quality;
+
+  coefs = webx_jpeg_target_get_coefs (jpeg, input);
+  if (! coefs)
+    return NULL;
+
+  if (jpeg->target_size > 0)
+    quality = webx_jpeg_target_get_quality (jpeg, input, coefs);
+  else
+    quality = CLAMP ((gint) (jpeg->quality * 100.0 + 0.5), 1, 100);
+
+  return webx_jpeg_engine_compress (coefs, quality,
+                                    jpeg->progressive, jpeg->restart,
+                                    webx_jpeg_target_get_rates (jpeg, input,
+                                                                quality));
+}
+
 static gboolean
 webx_jpeg_target_save_image (WebxTarget        *widget,
                              WebxTargetInput   *input,
@@ -123,9 +571,23 @@ webx_jpeg_target_save_image (WebxTarget        *widget,
   gint32          save_image;
   gint32          save_layer;
   gboolean        save_res;
+  GByteArray     *data;
 
   jpeg = WEBX_JPEG_TARGET (widget);
 
+  /* built-in encoder writes no EXIF */
+  if (webx_jpeg_target_use_engine (jpeg, input))
+    {
+      data = webx_jpeg_target_encode (jpeg, input);
+      if (! data)
+        return FALSE;
+
+      save_res = g_file_set_contents (file_name, (const gchar *) data->data,
+                                      data->len, NULL);
+      g_byte_array_free (data, TRUE);
+      return save_res;
+    }
+
   image = input->rgb_image;
   layer = input->rgb_layer;
   if (gimp_drawable_has_alpha (layer) || jpeg->strip_exif)
@@ -159,7 +621,8 @@ webx_jpeg_target_save_image (WebxTarget        *widget,
                           GIMP_PDB_INT32, (gint)jpeg->optimize,
                           GIMP_PDB_INT32, (gint)jpeg->progressive,
                           GIMP_PDB_STRING, "",
-                          GIMP_PDB_INT32, jpeg->subsmp,
+                          GIMP_PDB_INT32,
+                          webx_jpeg_target_get_subsmp (jpeg, input),
                           GIMP_PDB_INT32, (gint)jpeg->baseline,
                           GIMP_PDB_INT32, jpeg->restart,
                           GIMP_PDB_INT32, jpeg->dct,
@@ -177,6 +640,59 @@ webx_jpeg_target_save_image (WebxTarget        *widget,
   return save_res;
 }
 
+/* Built-in encoder works in memory, without temporary file. */
+static GdkPixbuf*
+webx_jpeg_target_render_preview (WebxTarget      *widget,
+                                 WebxTargetInput *input,
+                                 gint            *file_size)
+{
+  WebxJpegTarget       *jpeg;
+  GdkPixbufLoader      *loader;
+  GdkPixbuf            *pixbuf = NULL;
+  GByteArray           *data;
+
+  jpeg = WEBX_JPEG_TARGET (widget);
+
+  if (! webx_jpeg_target_use_engine (jpeg, input))
+    return WEBX_TARGET_CLASS (parent_class)->render_preview (widget, input,
+                                                             file_size);
+
+  data = webx_jpeg_target_encode (jpeg, input);
+  if (file_size)
+    *file_size = data ? data->len : 0;
+  if (! data)
+    return NULL;
+
+  loader = gdk_pixbuf_loader_new_with_type ("jpeg", NULL);
+  if (loader)
+    {
+      if (gdk_pixbuf_loader_write (loader, data->data, data->len, NULL)
+          && gdk_pixbuf_loader_close (loader, NULL))
+        {
+          pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+          if (pixbuf)
+            g_object_ref (pixbuf);
+        }
+      else
+        {
+          gdk_pixbuf_loader_close (loader, NULL);
+        }
+      g_object_unref (loader);
+    }
+  g_byte_array_free (data, TRUE);
+
+  return pixbuf;
+}
+
+/* only built-in encoder, see webx_jpeg_target_use_engine () */
+static gboolean
+webx_jpeg_target_uses_pixels (WebxTarget *widget)
+{
+  WebxJpegTarget *jpeg = WEBX_JPEG_TARGET (widget);
+
+  return jpeg->max_efficiency || jpeg->target_size > 0;
+}
+
 static gchar*
 webx_jpeg_target_get_unique_name (WebxTarget *widget)
 {
@@ -188,3 +704,34 @@ webx_jpeg_target_get_extension (WebxTarget *widget)
 {
   return "jpg";
 }
+
+/* MCU size for luma sampling factors used by file-jpeg-save; auto may
+ * pick any, the largest is multiple of the others */
+static void
+webx_jpeg_target_get_block_size (WebxTarget *widget,
+                                 gint       *width,
+                                 gint       *height)
+{
+  WebxJpegTarget *jpeg = WEBX_JPEG_TARGET (widget);
+
+  switch (jpeg->subsmp)
+    {
+    case WEBX_JPEG_SUBSMP_AUTO:
+    case 0: /* 2x2,1x1,1x1 */
+      *width = 16;
+      *height = 16;
+      break;
+    case 1: /* 2x1,1x1,1x1 */
+      *width = 16;
+      *height = 8;
+      break;
+    case 3: /* 1x2,1x1,1x1 */
+      *width = 8;
+      *height = 16;
+      break;
+    default: /* 1x1,1x1,1x1 */
+      *width = 8;
+      *height = 8;
+      break;
+    }
+}
@@ -22,6 +22,7 @@
 #define __WEBX_JPEG_TARGET_H__
 
 #include "webx_target.h"
+#include "webx_jpeg_engine.h"
 
 G_BEGIN_DECLS
 
@@ -32,6 +33,9 @@ G_BEGIN_DECLS
 #define WEBX_IS_JPEG_TARGET_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), WEBX_TYPE_JPEG_TARGET))
 #define WEBX_JPEG_TARGET_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), WEBX_TYPE_JPEG_TARGET, WebxJpegTargetClass))
 
+/* subsmp picked from content, see webx_pixels_get_chroma_sampling () */
+#define WEBX_JPEG_SUBSMP_AUTO            -1
+
 typedef struct _WebxJpegTargetClass WebxJpegTargetClass;
 typedef struct _WebxJpegTarget      WebxJpegTarget;
 
@@ -48,6 +52,9 @@ struct _WebxJpegTarget
   gboolean    progressive;
   gboolean    baseline;
   gboolean    strip_exif;
+  gboolean    max_efficiency;
+  /* KB, quality is searched for largest file that fits; 0 for none */
+  gint        target_size;
 
   GtkObject  *quality_adj;
   GtkObject  *smoothing_adj;
@@ -55,6 +62,40 @@ struct _WebxJpegTarget
   GtkObject  *progressive_adj;
   GtkObject  *baseline_adj;
   GtkObject  *strip_exif_adj;
+  GtkObject  *max_efficiency_adj;
+  GtkWidget  *subsmp_w;
+  GtkObject  *target_size_adj;
+
+  /* whole input subsampling was auto picked for, regions of it use
+   * the same */
+  const guchar  *auto_pixels;
+  gint           auto_width;
+  gint           auto_height;
+  guint          auto_serial;
+  gint           auto_subsmp;
+
+  /* whole input, regions of it are encoded with quality target size
+   * gave for it and with rates trellis used on it, so they look like
+   * the exported file; forgotten when settings change */
+  const guchar  *whole_pixels;
+  gint           whole_width;
+  gint           whole_height;
+  guint          whole_serial;
+  guchar         whole_background[3];
+  /* 0 until found */
+  gint           fit_quality;
+  /* quality rates are for, 0 for none */
+  gint           rates_quality;
+  WebxJpegRates  rates;
+
+  /* input last transformed by built-in encoder */
+  const guchar  *cache_pixels;
+  gint           cache_width;
+  gint           cache_height;
+  guint          cache_serial;
+  gint           cache_subsmp;
+  guchar         cache_background[3];
+  WebxJpegCoefs *cache_coefs;
 };
 
 struct _WebxJpegTargetClass
@@ -123,6 +123,8 @@ webx_run (gint32 image_ID, gint32 drawable_ID)
 {
   GtkWidget *dlg;
 
+  if (! g_thread_supported ())
+    g_thread_init (NULL);
   gimp_ui_init (PLUG_IN_BINARY, FALSE);
 
   global_image_ID = image_ID;
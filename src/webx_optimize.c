@@ -0,0 +1,182 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include <libgimp/gimp.h>
+
+#include "webx_main.h"
+#include "webx_optimize.h"
+#include "webx_png_writer.h"
+
+#include "plugin-intl.h"
+
+/* how often progress is shown, in ms */
+#define WEBX_OPTIMIZE_INTERVAL  100
+
+typedef struct
+{
+  /* worker thread reads png, writes result and progress */
+  WebxPngProgress       progress;
+  guchar               *png;
+  gsize                 size;
+  GByteArray           *result;
+  gint                  finished;
+  /* dialog and thread, whichever is done last frees it */
+  gint                  ref_count;
+
+  /* main thread only */
+  GtkWidget            *dialog;
+  GtkWidget            *progress_bar;
+  guint                 timeout;
+} WebxOptimize;
+
+static void
+webx_optimize_unref (WebxOptimize *optimize)
+{
+  if (! g_atomic_int_dec_and_test (&optimize->ref_count))
+    return;
+
+  if (optimize->result)
+    g_byte_array_free (optimize->result, TRUE);
+  g_free (optimize->png);
+  g_free (optimize);
+}
+
+static gpointer
+webx_optimize_thread (WebxOptimize *optimize)
+{
+  optimize->result = webx_png_writer_optimize (optimize->png, optimize->size,
+                                               &optimize->progress);
+  g_atomic_int_set (&optimize->finished, TRUE);
+  webx_optimize_unref (optimize);
+
+  return NULL;
+}
+
+static gboolean
+webx_optimize_update (WebxOptimize *optimize)
+{
+  gint          done;
+
+  if (g_atomic_int_get (&optimize->finished))
+    {
+      optimize->timeout = 0;
+      gtk_dialog_response (GTK_DIALOG (optimize->dialog), GTK_RESPONSE_OK);
+      return FALSE;
+    }
+
+  done = g_atomic_int_get (&optimize->progress.done);
+  if (done < 0)
+    gtk_progress_bar_pulse (GTK_PROGRESS_BAR (optimize->progress_bar));
+  else
+    gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (optimize->progress_bar),
+                                   done / 1000.0);
+
+  return TRUE;
+}
+
+/* Compresses exported PNG file as much as possible, file is replaced
+ * only if it gets smaller. Returns when done or cancelled. */
+void
+webx_optimize_png (GtkWindow   *parent,
+                   const gchar *file_name)
+{
+  WebxOptimize *optimize;
+  GtkWidget    *vbox;
+  GtkWidget    *label;
+  gchar        *name;
+  gchar        *text;
+  gint          response;
+
+  g_return_if_fail (file_name != NULL);
+
+  optimize = g_new0 (WebxOptimize, 1);
+  optimize->ref_count = 2;
+  if (! g_file_get_contents (file_name, (gchar **) &optimize->png,
+                             &optimize->size, NULL)
+      || ! g_thread_supported ()
+      || ! g_thread_create ((GThreadFunc) webx_optimize_thread, optimize,
+                            FALSE, NULL))
+    {
+      g_free (optimize->png);
+      g_free (optimize);
+      return;
+    }
+
+  optimize->dialog =
+    gtk_dialog_new_with_buttons (_("Maximum Compression"), parent,
+                                 GTK_DIALOG_MODAL | GTK_DIALOG_NO_SEPARATOR,
+                                 GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+                                 NULL);
+  gtk_window_set_role (GTK_WINDOW (optimize->dialog), PLUG_IN_BINARY);
+  gtk_window_set_resizable (GTK_WINDOW (optimize->dialog), FALSE);
+
+  vbox = gtk_vbox_new (FALSE, 12);
+  gtk_container_set_border_width (GTK_CONTAINER (vbox), 12);
+  gtk_box_pack_start (GTK_BOX (GTK_DIALOG (optimize->dialog)->vbox), vbox,
+                      TRUE, TRUE, 0);
+
+  name = g_filename_display_basename (file_name);
+  text = g_strdup_printf (_("Compressing %s as much as possible. "
+                            "When cancelled, the file stays as exported."),
+                          name);
+  label = gtk_label_new (text);
+  gtk_label_set_line_wrap (GTK_LABEL (label), TRUE);
+  gtk_misc_set_alignment (GTK_MISC (label), 0.0, 0.5);
+  gtk_box_pack_start (GTK_BOX (vbox), label, FALSE, FALSE, 0);
+  g_free (text);
+  g_free (name);
+
+  optimize->progress_bar = gtk_progress_bar_new ();
+  gtk_widget_set_size_request (optimize->progress_bar, 320, -1);
+  gtk_box_pack_start (GTK_BOX (vbox), optimize->progress_bar,
+                      FALSE, FALSE, 0);
+
+  gtk_widget_show_all (optimize->dialog);
+
+  optimize->timeout = g_timeout_add (WEBX_OPTIMIZE_INTERVAL,
+                                     (GSourceFunc) webx_optimize_update,
+                                     optimize);
+  response = gtk_dialog_run (GTK_DIALOG (optimize->dialog));
+  if (optimize->timeout)
+    g_source_remove (optimize->timeout);
+
+  if (response == GTK_RESPONSE_OK)
+    {
+      if (optimize->result
+          && ! g_file_set_contents (file_name,
+                                    (const gchar *) optimize->result->data,
+                                    optimize->result->len, NULL))
+        g_message (_("Failed to export the file!"));
+    }
+  else
+    {
+      /* thread stops at its next piece of work, zopfli pass is kept
+       * short since it can't be stopped */
+      g_atomic_int_set (&optimize->progress.cancelled, TRUE);
+    }
+
+  gtk_widget_destroy (optimize->dialog);
+  webx_optimize_unref (optimize);
+}
@@ -0,0 +1,33 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+   Maximum compression of exported files. It is exhaustive search,
+   which takes a while, so it runs on background thread with progress
+   shown and cancel button; the file as exported stays when cancelled.
+*/
+
+#ifndef __WEBX_OPTIMIZE_H__
+#define __WEBX_OPTIMIZE_H__
+
+void        webx_optimize_png       (GtkWindow   *parent,
+                                     const gchar *file_name);
+
+#endif /* __WEBX_OPTIMIZE_H__ */
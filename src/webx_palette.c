@@ -0,0 +1,226 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "webx_palette.h"
+
+#define WEBX_LOOKUP_CELL_BITS   4
+#define WEBX_LOOKUP_CELL_SIZE   (1 << (8 - WEBX_LOOKUP_CELL_BITS))
+#define WEBX_LOOKUP_AXIS_CELLS  (1 << WEBX_LOOKUP_CELL_BITS)
+#define WEBX_LOOKUP_N_CELLS     (1 << (3 * WEBX_LOOKUP_CELL_BITS))
+
+struct _WebxPaletteLookup
+{
+  gint          palette[256][3];
+  gint          n_colors;
+  /* candidates of cell i are candidates[offsets[i]..offsets[i + 1]) */
+  guint32       offsets[WEBX_LOOKUP_N_CELLS + 1];
+  guchar       *candidates;
+};
+
+/* Finds which colors can be nearest to some color of given cell.
+ * Color can't be nearest if even nearest corner of cell is farther
+ * from it than the farthest corner is from some other color. */
+static gint
+webx_palette_lookup_cell (WebxPaletteLookup *lookup,
+                          gint               cell_r,
+                          gint               cell_g,
+                          gint               cell_b,
+                          gint              *min_dist,
+                          guchar            *candidates)
+{
+  gint          lo[3];
+  gint          hi[3];
+  gint          max_dist;
+  gint          limit = G_MAXINT;
+  gint          n = 0;
+  gint          d, d1, d2;
+  gint          i, a;
+
+  lo[0] = cell_r * WEBX_LOOKUP_CELL_SIZE;
+  lo[1] = cell_g * WEBX_LOOKUP_CELL_SIZE;
+  lo[2] = cell_b * WEBX_LOOKUP_CELL_SIZE;
+  for (a = 0; a < 3; a++)
+    hi[a] = lo[a] + WEBX_LOOKUP_CELL_SIZE - 1;
+
+  for (i = 0; i < lookup->n_colors; i++)
+    {
+      min_dist[i] = 0;
+      max_dist = 0;
+      for (a = 0; a < 3; a++)
+        {
+          d1 = lookup->palette[i][a] - lo[a];
+          d2 = lookup->palette[i][a] - hi[a];
+          if (d2 > 0)
+            d = d2;
+          else if (d1 < 0)
+            d = d1;
+          else
+            d = 0;
+          min_dist[i] += d * d;
+          d1 = ABS (d1);
+          d2 = ABS (d2);
+          d = MAX (d1, d2);
+          max_dist += d * d;
+        }
+      limit = MIN (limit, max_dist);
+    }
+
+  /* keep palette order, so ties resolve as in exhaustive search */
+  for (i = 0; i < lookup->n_colors; i++)
+    {
+      if (min_dist[i] <= limit)
+        candidates[n++] = i;
+    }
+
+  return n;
+}
+
+WebxPaletteLookup*
+webx_palette_lookup_new (const guchar  *palette,
+                         gint           n_colors)
+{
+  WebxPaletteLookup    *lookup;
+  GByteArray           *candidates;
+  gint                  min_dist[256];
+  guchar                cell[256];
+  gint                  n;
+  gint                  r, g, b;
+  gint                  i;
+
+  g_return_val_if_fail (palette != NULL, NULL);
+  g_return_val_if_fail (n_colors > 0 && n_colors <= 256, NULL);
+
+  lookup = g_new (WebxPaletteLookup, 1);
+  lookup->n_colors = n_colors;
+  for (i = 0; i < n_colors; i++)
+    {
+      lookup->palette[i][0] = palette[i * 3];
+      lookup->palette[i][1] = palette[i * 3 + 1];
+      lookup->palette[i][2] = palette[i * 3 + 2];
+    }
+
+  candidates = g_byte_array_new ();
+  i = 0;
+  for (r = 0; r < WEBX_LOOKUP_AXIS_CELLS; r++)
+    for (g = 0; g < WEBX_LOOKUP_AXIS_CELLS; g++)
+      for (b = 0; b < WEBX_LOOKUP_AXIS_CELLS; b++)
+        {
+          n = webx_palette_lookup_cell (lookup, r, g, b, min_dist, cell);
+          lookup->offsets[i++] = candidates->len;
+          g_byte_array_append (candidates, cell, n);
+        }
+  lookup->offsets[i] = candidates->len;
+  lookup->candidates = g_byte_array_free (candidates, FALSE);
+
+  return lookup;
+}
+
+void
+webx_palette_lookup_free (WebxPaletteLookup *lookup)
+{
+  g_return_if_fail (lookup != NULL);
+
+  g_free (lookup->candidates);
+  g_free (lookup);
+}
+
+/* Returns index of palette color nearest to r, g, b (0..255). */
+gint
+webx_palette_lookup_nearest (const WebxPaletteLookup *lookup,
+                             gint                     r,
+                             gint                     g,
+                             gint                     b)
+{
+  const guchar *candidate;
+  const guchar *end;
+  const gint   *c;
+  gint          cell;
+  gint          best;
+  gint          best_dist;
+  gint          dist;
+  gint          d;
+
+  cell = ((r >> (8 - WEBX_LOOKUP_CELL_BITS)) << (2 * WEBX_LOOKUP_CELL_BITS))
+       | ((g >> (8 - WEBX_LOOKUP_CELL_BITS)) << WEBX_LOOKUP_CELL_BITS)
+       | (b >> (8 - WEBX_LOOKUP_CELL_BITS));
+  candidate = lookup->candidates + lookup->offsets[cell];
+  end = lookup->candidates + lookup->offsets[cell + 1];
+
+  best = *candidate;
+  if (end - candidate == 1)
+    return best;
+
+  best_dist = G_MAXINT;
+  for (; candidate < end; candidate++)
+    {
+      c = lookup->palette[*candidate];
+      d = r - c[0];
+      dist = d * d;
+      d = g - c[1];
+      dist += d * d;
+      d = b - c[2];
+      dist += d * d;
+      if (dist < best_dist)
+        {
+          best_dist = dist;
+          best = *candidate;
+        }
+    }
+
+  return best;
+}
+
+/* Exhaustive search, for palettes used too briefly to build lookup. */
+gint
+webx_palette_nearest (const guchar *palette,
+                      gint          n_colors,
+                      gint          r,
+                      gint          g,
+                      gint          b)
+{
+  const guchar *c;
+  gint          best = 0;
+  gint          best_dist = G_MAXINT;
+  gint          dist;
+  gint          d;
+  gint          i;
+
+  for (i = 0; i < n_colors; i++)
+    {
+      c = palette + i * 3;
+      d = r - c[0];
+      dist = d * d;
+      d = g - c[1];
+      dist += d * d;
+      d = b - c[2];
+      dist += d * d;
+      if (dist < best_dist)
+        {
+          best_dist = dist;
+          best = i;
+        }
+    }
+
+  return best;
+}
@@ -0,0 +1,48 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+   Nearest palette color lookup. Color cube is split to coarse cells
+   and each cell keeps list of palette colors which can be nearest to
+   some color inside it, so only few colors are compared per lookup.
+   Results are the same as of exhaustive search.
+*/
+
+#ifndef __WEBX_PALETTE_H__
+#define __WEBX_PALETTE_H__
+
+typedef struct _WebxPaletteLookup       WebxPaletteLookup;
+
+WebxPaletteLookup* webx_palette_lookup_new     (const guchar      *palette,
+                                                gint               n_colors);
+void               webx_palette_lookup_free    (WebxPaletteLookup *lookup);
+
+gint               webx_palette_lookup_nearest (const WebxPaletteLookup *lookup,
+                                                gint               r,
+                                                gint               g,
+                                                gint               b);
+
+gint               webx_palette_nearest        (const guchar      *palette,
+                                                gint               n_colors,
+                                                gint               r,
+                                                gint               g,
+                                                gint               b);
+
+#endif /* __WEBX_PALETTE_H__ */
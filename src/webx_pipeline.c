@@ -35,6 +35,9 @@
 #include "plugin-intl.h"
 
 #define WEBX_PIPELINE_UPDATE_DELAY      150
+/* extra pixels encoded around viewport, so that small
+ * scrolling doesn't require new update */
+#define WEBX_PIPELINE_VIEWPORT_MARGIN   64
 
 static void     webx_pipeline_destroy      (GtkObject  *object);
 static void     webx_pipeline_crop_clip    (WebxPipeline *pipeline);
@@ -43,11 +46,28 @@ static gboolean webx_pipeline_timeout_update     (WebxPipeline     *pipeline);
 
 static void     webx_pipeline_invalidate         (WebxPipeline     *pipeline,
                                                 gboolean        update_all);
+static gboolean webx_pipeline_get_viewport_region (WebxPipeline    *pipeline,
+                                                   GtkObject       *target,
+                                                   gint             margin,
+                                                   GdkRectangle    *region);
+static void     webx_pipeline_set_input_pixels   (WebxPipeline     *pipeline,
+                                                  WebxTargetInput  *input,
+                                                  gint              x,
+                                                  gint              y);
+static void     webx_pipeline_set_input_frames   (WebxPipeline     *pipeline,
+                                                  GtkObject        *target,
+                                                  WebxTargetInput  *input);
+static void     webx_pipeline_render             (WebxPipeline     *pipeline,
+                                                  GtkObject        *target,
+                                                  WebxPipelineOutput *output);
+static void     webx_pipeline_queue_panes        (WebxPipeline     *pipeline);
+static gboolean webx_pipeline_pane_update        (WebxPipeline     *pipeline);
 
 enum
 {
   INVALIDATED,
   OUTPUT_CHANGED,
+  PANE_CHANGED,
   LAST_SIGNAL
 };
 
@@ -68,6 +88,7 @@ webx_pipeline_class_init (WebxPipelineClass *klass)
 
   klass->invalidated = NULL;
   klass->output_changed = NULL;
+  klass->pane_changed = NULL;
 
   webx_pipeline_signals[INVALIDATED] =
       g_signal_new ("invalidated",
@@ -86,6 +107,16 @@ webx_pipeline_class_init (WebxPipelineClass *klass)
                   g_cclosure_marshal_VOID__POINTER,
                   G_TYPE_NONE, 1,
                   G_TYPE_POINTER);
+  webx_pipeline_signals[PANE_CHANGED] =
+    g_signal_new ("pane-changed",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_FIRST,
+                  G_STRUCT_OFFSET (WebxPipelineClass, pane_changed),
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__UINT_POINTER,
+                  G_TYPE_NONE, 2,
+                  G_TYPE_UINT,
+                  G_TYPE_POINTER);
 }
 
 static void
@@ -97,11 +128,19 @@ webx_pipeline_init (WebxPipeline *pipeline)
   pipeline->rgb_layer = -1;
   pipeline->indexed_image = -1;
   pipeline->indexed_layer = -1;
+  pipeline->frames_image = -1;
 
   pipeline->crop_scale_x = 1.0;
   pipeline->crop_scale_y = 1.0;
 
   pipeline->timeout_id = 0;
+
+  pipeline->pane_targets = NULL;
+  pipeline->pane_next = NULL;
+  pipeline->pane_idle_id = 0;
+
+  pipeline->viewport_only = FALSE;
+  memset (&pipeline->region, 0, sizeof (pipeline->region));
 }
 
 GtkObject*
@@ -142,11 +181,24 @@ webx_pipeline_destroy (GtkObject *object)
       gimp_image_delete (pipeline->indexed_image);
       pipeline->indexed_image = -1;
     }
+  if (pipeline->frames_image != -1)
+    {
+      gimp_image_delete (pipeline->frames_image);
+      pipeline->frames_image = -1;
+    }
   if (pipeline->background)
     {
       g_object_unref (pipeline->background);
       pipeline->background = NULL;
     }
+  if (pipeline->pane_idle_id)
+    {
+      g_source_remove (pipeline->pane_idle_id);
+      pipeline->pane_idle_id = 0;
+    }
+  g_slist_free (pipeline->pane_targets);
+  pipeline->pane_targets = NULL;
+  pipeline->pane_next = NULL;
 
   if (GTK_OBJECT_CLASS (parent_class)->destroy)
     GTK_OBJECT_CLASS (parent_class)->destroy (GTK_OBJECT (pipeline));
@@ -326,6 +378,140 @@ webx_pipeline_set_target (WebxPipeline     *pipeline,
   webx_pipeline_invalidate (pipeline, FALSE);
 }
 
+/* Sets targets to be rendered for comparison panes, after main target
+ * is done. Each of them is reported with "pane-changed" signal, pane
+ * number being position in the list. NULL removes all panes. */
+void
+webx_pipeline_set_pane_targets (WebxPipeline *pipeline,
+                                GSList       *targets)
+{
+  g_return_if_fail (WEBX_IS_PIPELINE (pipeline));
+
+  g_slist_free (pipeline->pane_targets);
+  pipeline->pane_targets = g_slist_copy (targets);
+  pipeline->pane_next = NULL;
+
+  /* main target is up to date, render panes only */
+  if (! pipeline->timeout_id && pipeline->rgb_image != -1)
+    webx_pipeline_queue_panes (pipeline);
+}
+
+/* Sets visible part of background. Only that part of target is encoded
+ * for preview then. NULL viewport switches back to whole target. */
+void
+webx_pipeline_set_viewport (WebxPipeline *pipeline,
+                            GdkRectangle *viewport)
+{
+  GdkRectangle  region;
+  GdkRectangle  covered;
+
+  g_return_if_fail (WEBX_IS_PIPELINE (pipeline));
+
+  if (! viewport)
+    {
+      pipeline->viewport_only = FALSE;
+      if (pipeline->region.width)
+        webx_pipeline_invalidate (pipeline, FALSE);
+      return;
+    }
+
+  pipeline->viewport_only = TRUE;
+  pipeline->viewport = *viewport;
+
+  /* last preview was complete, it covers any viewport */
+  if (! pipeline->region.width)
+    return;
+
+  if (! webx_pipeline_get_viewport_region (pipeline, pipeline->target,
+                                           0, &region))
+    {
+      webx_pipeline_invalidate (pipeline, FALSE);
+      return;
+    }
+
+  gdk_rectangle_union (&pipeline->region, &region, &covered);
+  if (covered.width != pipeline->region.width
+      || covered.height != pipeline->region.height)
+    webx_pipeline_invalidate (pipeline, FALSE);
+}
+
+/* Calculates part of target (relative to crop rectangle) which covers
+ * the viewport. Region is aligned to the block grid of target, so it
+ * gets the same compression artifacts as whole image. Returns FALSE
+ * if whole target should be encoded. */
+static gboolean
+webx_pipeline_get_viewport_region (WebxPipeline *pipeline,
+                                   GtkObject    *target,
+                                   gint          margin,
+                                   GdkRectangle *region)
+{
+  GdkRectangle  crop;
+  GdkRectangle  viewport;
+  gint          block_width;
+  gint          block_height;
+  gint          x2, y2;
+
+  if (! pipeline->viewport_only || ! target)
+    return FALSE;
+
+  /* frames are not cropped to viewport */
+  if (webx_target_uses_frames (WEBX_TARGET (target))
+      || webx_target_needs_whole (WEBX_TARGET (target)))
+    return FALSE;
+
+  crop.x = pipeline->crop_offsx;
+  crop.y = pipeline->crop_offsy;
+  crop.width = pipeline->crop_width;
+  crop.height = pipeline->crop_height;
+
+  viewport = pipeline->viewport;
+  viewport.x -= margin;
+  viewport.y -= margin;
+  viewport.width += margin * 2;
+  viewport.height += margin * 2;
+
+  if (! gdk_rectangle_intersect (&viewport, &crop, region))
+    return FALSE;
+
+  /* not worth it when most of target is visible anyway */
+  if ((gdouble) region->width * region->height * 2.0
+      > (gdouble) crop.width * crop.height)
+    return FALSE;
+
+  webx_target_get_block_size (WEBX_TARGET (target),
+                              &block_width, &block_height);
+
+  region->x -= crop.x;
+  region->y -= crop.y;
+  x2 = region->x + region->width;
+  y2 = region->y + region->height;
+  region->x = region->x / block_width * block_width;
+  region->y = region->y / block_height * block_height;
+  x2 = MIN ((x2 + block_width - 1) / block_width * block_width, crop.width);
+  y2 = MIN ((y2 + block_height - 1) / block_height * block_height, crop.height);
+  region->width = x2 - region->x;
+  region->height = y2 - region->y;
+
+  return TRUE;
+}
+
+static gint
+webx_pipeline_crop_duplicate (gint          image,
+                              GdkRectangle *region,
+                              gint         *layer)
+{
+  gint  duplicate;
+
+  duplicate = gimp_image_duplicate (image);
+  gimp_image_undo_disable (duplicate);
+  gimp_image_crop (duplicate,
+                   region->width, region->height,
+                   region->x, region->y);
+  *layer = gimp_image_get_active_layer (duplicate);
+
+  return duplicate;
+}
+
 gboolean
 webx_pipeline_save_image (WebxPipeline *pipeline,
                           gchar        *filename)
@@ -355,6 +541,8 @@ webx_pipeline_save_image (WebxPipeline *pipeline,
   target_input.indexed_layer = pipeline->indexed_layer;
   target_input.width = pipeline->crop_width;
   target_input.height = pipeline->crop_height;
+  webx_pipeline_set_input_pixels (pipeline, &target_input, 0, 0);
+  webx_pipeline_set_input_frames (pipeline, pipeline->target, &target_input);
   result = webx_target_save_image (WEBX_TARGET (pipeline->target),
                                    &target_input,
                                    filename);
@@ -409,6 +597,12 @@ webx_pipeline_invalidate (WebxPipeline *pipeline,
     }
   pipeline->update_count++;
 
+  if (pipeline->pane_idle_id)
+    {
+      g_source_remove (pipeline->pane_idle_id);
+      pipeline->pane_idle_id = 0;
+    }
+
   if (pipeline->timeout_id == 0)
     {
       g_signal_emit (pipeline, webx_pipeline_signals[INVALIDATED], 0);
@@ -457,12 +651,18 @@ webx_pipeline_check_update (WebxPipeline *pipeline)
       gimp_image_delete (pipeline->indexed_image);
       pipeline->indexed_image = -1;
     }
+  if (pipeline->frames_image != -1)
+    {
+      gimp_image_delete (pipeline->frames_image);
+      pipeline->frames_image = -1;
+    }
   if (pipeline->background)
     {
       g_object_unref (pipeline->background);
       pipeline->background = NULL;
     }
 
+  pipeline->serial++;
   pipeline->rgb_image = gimp_image_duplicate (pipeline->user_image);
   gimp_image_undo_disable (pipeline->rgb_image);
   pipeline->rgb_layer =
@@ -520,11 +720,161 @@ webx_pipeline_check_update (WebxPipeline *pipeline)
   return TRUE;
 }
 
+/* Points input at background pixels matching rgb image, starting
+ * at x, y of cropped area. */
+static void
+webx_pipeline_set_input_pixels (WebxPipeline    *pipeline,
+                                WebxTargetInput *input,
+                                gint             x,
+                                gint             y)
+{
+  GdkPixbuf    *background = pipeline->background;
+
+  input->whole_width = pipeline->crop_width;
+  input->whole_height = pipeline->crop_height;
+
+  if (! background)
+    {
+      input->pixels = NULL;
+      input->whole_pixels = NULL;
+      input->serial = pipeline->serial;
+      input->rowstride = 0;
+      input->bpp = 0;
+      return;
+    }
+
+  input->serial = pipeline->serial;
+  input->rowstride = gdk_pixbuf_get_rowstride (background);
+  input->bpp = gdk_pixbuf_get_n_channels (background);
+  input->whole_pixels = gdk_pixbuf_get_pixels (background)
+                        + pipeline->crop_offsy * input->rowstride
+                        + pipeline->crop_offsx * input->bpp;
+  input->pixels = input->whole_pixels
+                  + y * input->rowstride
+                  + x * input->bpp;
+}
+
+/* Gives input the image with animation frames, if target wants them.
+ * Each layer of user image becomes a frame of image size, resized and
+ * cropped the same way as rgb image. It is made once per update. */
+static void
+webx_pipeline_set_input_frames (WebxPipeline    *pipeline,
+                                GtkObject       *target,
+                                WebxTargetInput *input)
+{
+  gint *layers;
+  gint  num_layers;
+  gint  i;
+
+  input->frames_image = -1;
+  if (! webx_target_uses_frames (WEBX_TARGET (target)))
+    return;
+
+  if (pipeline->frames_image == -1)
+    {
+      pipeline->frames_image = gimp_image_duplicate (pipeline->user_image);
+      gimp_image_undo_disable (pipeline->frames_image);
+      if (gimp_image_base_type (pipeline->frames_image) != GIMP_RGB)
+        gimp_image_convert_rgb (pipeline->frames_image);
+
+      /* area outside of layer shows frames below, if any */
+      layers = gimp_image_get_layers (pipeline->frames_image, &num_layers);
+      for (i = 0; i < num_layers; i++)
+        {
+          if (! gimp_drawable_has_alpha (layers[i]))
+            gimp_layer_add_alpha (layers[i]);
+          gimp_layer_resize_to_image_size (layers[i]);
+        }
+      g_free (layers);
+
+      gimp_image_scale (pipeline->frames_image,
+                        pipeline->resize_width, pipeline->resize_height);
+      if (pipeline->crop_width != pipeline->resize_width
+          || pipeline->crop_height != pipeline->resize_height)
+        {
+          gimp_image_crop (pipeline->frames_image,
+                           pipeline->crop_width, pipeline->crop_height,
+                           pipeline->crop_offsx, pipeline->crop_offsy);
+        }
+    }
+
+  input->frames_image = pipeline->frames_image;
+}
+
+/* Renders preview of given target from current rgb/indexed images.
+ * When only viewport is wanted, just that region is encoded. */
+static void
+webx_pipeline_render (WebxPipeline       *pipeline,
+                      GtkObject          *target,
+                      WebxPipelineOutput *output)
+{
+  WebxTargetInput       target_input;
+  GdkRectangle          region;
+
+  if (webx_pipeline_get_viewport_region (pipeline, target,
+                                         WEBX_PIPELINE_VIEWPORT_MARGIN,
+                                         &region))
+    {
+      /* cropped duplicates only for targets saving through GIMP */
+      target_input.rgb_image = -1;
+      target_input.rgb_layer = -1;
+      target_input.indexed_image = -1;
+      target_input.indexed_layer = -1;
+      if (! pipeline->background
+          || ! webx_target_uses_pixels (WEBX_TARGET (target)))
+        {
+          target_input.rgb_image =
+            webx_pipeline_crop_duplicate (pipeline->rgb_image, &region,
+                                          &target_input.rgb_layer);
+          if (pipeline->indexed_image != -1)
+            {
+              target_input.indexed_image =
+                webx_pipeline_crop_duplicate (pipeline->indexed_image,
+                                              &region,
+                                              &target_input.indexed_layer);
+            }
+        }
+      target_input.width = region.width;
+      target_input.height = region.height;
+      webx_pipeline_set_input_pixels (pipeline, &target_input,
+                                      region.x, region.y);
+      target_input.frames_image = -1;
+      output->target = webx_target_render_preview (WEBX_TARGET (target),
+                                                   &target_input,
+                                                   &output->file_size);
+
+      if (target_input.rgb_image != -1)
+        gimp_image_delete (target_input.rgb_image);
+      if (target_input.indexed_image != -1)
+        gimp_image_delete (target_input.indexed_image);
+
+      /* assume rest of image compresses the same way */
+      output->file_size = (gdouble) output->file_size
+                          * pipeline->crop_width * pipeline->crop_height
+                          / (region.width * region.height);
+      output->file_size_estimated = TRUE;
+      output->target_region = region;
+    }
+  else
+    {
+      target_input.rgb_image = pipeline->rgb_image;
+      target_input.rgb_layer = pipeline->rgb_layer;
+      target_input.indexed_image = pipeline->indexed_image;
+      target_input.indexed_layer = pipeline->indexed_layer;
+      target_input.width = pipeline->crop_width;
+      target_input.height = pipeline->crop_height;
+      webx_pipeline_set_input_pixels (pipeline, &target_input, 0, 0);
+      webx_pipeline_set_input_frames (pipeline, target, &target_input);
+      output->target = webx_target_render_preview (WEBX_TARGET (target),
+                                                   &target_input,
+                                                   &output->file_size);
+    }
+}
+
 static void
 webx_pipeline_update (WebxPipeline *pipeline)
 {
   WebxPipelineOutput    output;
-  WebxTargetInput       target_input;
 
   memset (&output, 0, sizeof (output));
 
@@ -543,15 +893,8 @@ webx_pipeline_update (WebxPipeline *pipeline)
       pipeline->update_all = FALSE;
     }
 
-  target_input.rgb_image = pipeline->rgb_image;
-  target_input.rgb_layer = pipeline->rgb_layer;
-  target_input.indexed_image = pipeline->indexed_image;
-  target_input.indexed_layer = pipeline->indexed_layer;
-  target_input.width = pipeline->crop_width;
-  target_input.height = pipeline->crop_height;
-  output.target = webx_target_render_preview (WEBX_TARGET (pipeline->target),
-                                              &target_input,
-                                              &output.file_size);
+  webx_pipeline_render (pipeline, pipeline->target, &output);
+  pipeline->region = output.target_region;
 
   pipeline->update_count = 0;
   pipeline->last_update = 0;
@@ -560,6 +903,59 @@ webx_pipeline_update (WebxPipeline *pipeline)
                  &output);
   if (output.target)
     g_object_unref (output.target);
+
+  webx_pipeline_queue_panes (pipeline);
+}
+
+static void
+webx_pipeline_queue_panes (WebxPipeline *pipeline)
+{
+  if (pipeline->pane_idle_id)
+    g_source_remove (pipeline->pane_idle_id);
+  pipeline->pane_idle_id = 0;
+
+  pipeline->pane_next = pipeline->pane_targets;
+  if (pipeline->pane_next)
+    pipeline->pane_idle_id =
+      g_idle_add ((GSourceFunc) webx_pipeline_pane_update, pipeline);
+}
+
+/* Renders one comparison pane per call, so that each of them is shown
+ * as soon as it's ready and user input is handled in between. Plug-in
+ * talks to GIMP over a single connection, so targets cannot be encoded
+ * concurrently. */
+static gboolean
+webx_pipeline_pane_update (WebxPipeline *pipeline)
+{
+  WebxPipelineOutput    output;
+  guint                 pane;
+
+  if (! pipeline->pane_next || pipeline->update_count)
+    {
+      pipeline->pane_idle_id = 0;
+      return FALSE;
+    }
+
+  memset (&output, 0, sizeof (output));
+  pane = g_slist_position (pipeline->pane_targets, pipeline->pane_next);
+
+  pipeline->updating = TRUE;
+  webx_pipeline_render (pipeline,
+                        GTK_OBJECT (pipeline->pane_next->data),
+                        &output);
+  pipeline->updating = FALSE;
+  pipeline->pane_next = pipeline->pane_next->next;
+
+  g_signal_emit (pipeline, webx_pipeline_signals[PANE_CHANGED], 0,
+                 pane, &output);
+  if (output.target)
+    g_object_unref (output.target);
+
+  if (pipeline->pane_next)
+    return TRUE;
+
+  pipeline->pane_idle_id = 0;
+  return FALSE;
 }
 
 static gboolean
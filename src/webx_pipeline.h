@@ -51,7 +51,13 @@ struct _WebxPipelineOutput
   gint          bg_width;
   gint          bg_height;
 
+  /* part of target which was actually encoded (relative to target_rect);
+   * zero width means whole target */
+  GdkRectangle  target_region;
+
   gint          file_size;
+  /* file size was extrapolated from target_region */
+  gboolean      file_size_estimated;
 };
 
 struct _WebxPipeline
@@ -81,10 +87,26 @@ struct _WebxPipeline
   /* paletted image after resize & crop transformations */
   gint          indexed_image;
   gint          indexed_layer;
+  /* layers of user image as animation frames, made only when a
+   * target asks for them */
+  gint          frames_image;
 
   GdkPixbuf    *background;
+  /* bumped each time images above are regenerated */
+  guint         serial;
 
   GtkObject    *target;
+  /* additional targets, rendered one by one after main
+   * target for comparison panes */
+  GSList       *pane_targets;
+  GSList       *pane_next;
+  guint         pane_idle_id;
+
+  /* visible area of background (when only it should be encoded) */
+  gboolean      viewport_only;
+  GdkRectangle  viewport;
+  /* region of target encoded by last update */
+  GdkRectangle  region;
 
   /* we use this for timeout function to make sure
    * user has stopped editing. If we find the same
@@ -105,6 +127,10 @@ struct _WebxPipelineClass
   void  (* output_changed)     (WebxPipeline             *src,
                                 WebxPipelineOutput     *output,
                                 gpointer                user_data);
+  void  (* pane_changed)       (WebxPipeline             *src,
+                                guint                   pane,
+                                WebxPipelineOutput     *output,
+                                gpointer                user_data);
 };
 
 GType       webx_pipeline_get_type (void) G_GNUC_CONST;
@@ -141,6 +167,12 @@ gboolean     webx_pipeline_crop   (WebxPipeline *pipeline,
 void            webx_pipeline_set_target (WebxPipeline *pipeline,
                                           GtkObject    *target);
 
+void            webx_pipeline_set_pane_targets (WebxPipeline *pipeline,
+                                                GSList       *targets);
+
+void            webx_pipeline_set_viewport (WebxPipeline *pipeline,
+                                            GdkRectangle *viewport);
+
 gboolean        webx_pipeline_save_image (WebxPipeline *pipeline,
                                           gchar        *filename);
 
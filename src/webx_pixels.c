@@ -0,0 +1,656 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#if defined (ARCH_X86) && defined (__SSE2__)
+#define WEBX_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include "webx_pixels.h"
+
+/* Makes colors pale (x / 4 + 127), alpha is left untouched. */
+void
+webx_pixels_dim (guchar *pixels,
+                 gint    width,
+                 gint    height,
+                 gint    rowstride,
+                 gint    channels)
+{
+  gint          i;
+  gint          j;
+  gint          n;
+  guchar       *row;
+
+  g_return_if_fail (pixels != NULL);
+  g_return_if_fail (channels == 3 || channels == 4);
+
+  n = width * channels;
+  for (i = 0; i < height; i++)
+    {
+      row = pixels + i * rowstride;
+      j = 0;
+
+#ifdef WEBX_USE_SSE2
+      {
+        __m128i   alpha_mask;
+        __m128i   low_bits;
+        __m128i   bias;
+
+        if (channels == 4)
+          alpha_mask = _mm_set1_epi32 (0xff000000);
+        else
+          alpha_mask = _mm_setzero_si128 ();
+        low_bits = _mm_set1_epi8 (0x3f);
+        bias = _mm_set1_epi8 (127);
+
+        for (; j + 16 <= n; j += 16)
+          {
+            __m128i   v;
+            __m128i   dim;
+
+            v = _mm_loadu_si128 ((__m128i *) (row + j));
+            /* 16-bit shift leaks bits between bytes, mask them out */
+            dim = _mm_and_si128 (_mm_srli_epi16 (v, 2), low_bits);
+            dim = _mm_add_epi8 (dim, bias);
+            v = _mm_or_si128 (_mm_and_si128 (alpha_mask, v),
+                              _mm_andnot_si128 (alpha_mask, dim));
+            _mm_storeu_si128 ((__m128i *) (row + j), v);
+          }
+      }
+#endif
+
+      for (; j < n; j++)
+        {
+          if (channels == 4 && j % 4 == 3)
+            continue;
+          row[j] = row[j] / 4 + 127;
+        }
+    }
+}
+
+/* Per-pixel difference of two images: largest absolute difference
+ * of channels (alpha included when both images have it). Pixels
+ * invisible in both images are the same whatever their color. When
+ * only one image has alpha, it is composed over background color
+ * first, as the other one was flattened. Result is one byte per
+ * pixel. */
+void
+webx_pixels_diff (const guchar *src1,
+                  gint          rowstride1,
+                  gint          channels1,
+                  const guchar *src2,
+                  gint          rowstride2,
+                  gint          channels2,
+                  const guchar *background,
+                  guchar       *dest,
+                  gint          dest_rowstride,
+                  gint          width,
+                  gint          height)
+{
+  const guchar *p;
+  const guchar *q;
+  const guchar *row1;
+  const guchar *row2;
+  guchar       *drow;
+  guchar       *absdiff;
+  gint          channels;
+  gint          i;
+  gint          j;
+  gint          k;
+  gint          n;
+
+  g_return_if_fail (src1 != NULL && src2 != NULL && dest != NULL);
+  g_return_if_fail (channels1 == 3 || channels1 == 4);
+  g_return_if_fail (channels2 == 3 || channels2 == 4);
+  g_return_if_fail (channels1 == channels2 || background != NULL);
+
+  channels = MIN (channels1, channels2);
+  absdiff = g_new (guchar, width * 3);
+
+  for (i = 0; i < height; i++)
+    {
+      row1 = src1 + i * rowstride1;
+      row2 = src2 + i * rowstride2;
+      drow = dest + i * dest_rowstride;
+      j = 0;
+
+      if (channels1 != channels2)
+        {
+          for (; j < width; j++)
+            {
+              guchar  m = 0;
+              gint    v;
+
+              /* p has alpha, q is flattened */
+              p = (channels1 == 4) ? row1 + j * 4 : row2 + j * 4;
+              q = (channels1 == 4) ? row2 + j * 3 : row1 + j * 3;
+              for (k = 0; k < 3; k++)
+                {
+                  v = (p[k] * p[3] + background[k] * (255 - p[3]) + 127)
+                      / 255;
+                  m = MAX (m, ABS (v - q[k]));
+                }
+              drow[j] = m;
+            }
+          continue;
+        }
+
+      n = width * channels;
+      k = 0;
+
+#ifdef WEBX_USE_SSE2
+      if (channels == 4)
+        {
+          __m128i   low_byte = _mm_set1_epi32 (0xff);
+          __m128i   alpha = _mm_set1_epi32 (0xff000000);
+          __m128i   zero = _mm_setzero_si128 ();
+
+          /* 8 pixels per step, reduced to bytes in registers */
+          for (; j + 8 <= width; j += 8)
+            {
+              __m128i   a, b, d0, d1, hidden;
+
+              /* differences are dropped where both alphas are 0 */
+              a = _mm_loadu_si128 ((__m128i *) (row1 + j * 4));
+              b = _mm_loadu_si128 ((__m128i *) (row2 + j * 4));
+              d0 = _mm_or_si128 (_mm_subs_epu8 (a, b), _mm_subs_epu8 (b, a));
+              hidden = _mm_and_si128 (_mm_or_si128 (a, b), alpha);
+              hidden = _mm_cmpeq_epi32 (hidden, zero);
+              d0 = _mm_andnot_si128 (hidden, d0);
+              a = _mm_loadu_si128 ((__m128i *) (row1 + j * 4 + 16));
+              b = _mm_loadu_si128 ((__m128i *) (row2 + j * 4 + 16));
+              d1 = _mm_or_si128 (_mm_subs_epu8 (a, b), _mm_subs_epu8 (b, a));
+              hidden = _mm_and_si128 (_mm_or_si128 (a, b), alpha);
+              hidden = _mm_cmpeq_epi32 (hidden, zero);
+              d1 = _mm_andnot_si128 (hidden, d1);
+
+              d0 = _mm_max_epu8 (d0, _mm_srli_epi32 (d0, 8));
+              d0 = _mm_max_epu8 (d0, _mm_srli_epi32 (d0, 16));
+              d1 = _mm_max_epu8 (d1, _mm_srli_epi32 (d1, 8));
+              d1 = _mm_max_epu8 (d1, _mm_srli_epi32 (d1, 16));
+              d0 = _mm_packs_epi32 (_mm_and_si128 (d0, low_byte),
+                                    _mm_and_si128 (d1, low_byte));
+              d0 = _mm_packus_epi16 (d0, d0);
+              _mm_storel_epi64 ((__m128i *) (drow + j), d0);
+            }
+        }
+      else
+        {
+          /* interleaved RGB is not reduced easily,
+           * do byte differences only */
+          for (; k + 16 <= n; k += 16)
+            {
+              __m128i   a, b;
+
+              a = _mm_loadu_si128 ((__m128i *) (row1 + k));
+              b = _mm_loadu_si128 ((__m128i *) (row2 + k));
+              _mm_storeu_si128 ((__m128i *) (absdiff + k),
+                                _mm_or_si128 (_mm_subs_epu8 (a, b),
+                                              _mm_subs_epu8 (b, a)));
+            }
+        }
+#endif
+
+      if (channels == 3)
+        {
+          for (; k < n; k++)
+            absdiff[k] = ABS (row1[k] - row2[k]);
+          for (j = 0; j < width; j++)
+            drow[j] = MAX (MAX (absdiff[j * 3], absdiff[j * 3 + 1]),
+                           absdiff[j * 3 + 2]);
+        }
+      else
+        {
+          for (; j < width; j++)
+            {
+              guchar  m = 0;
+
+              if (row1[j * 4 + 3] != 0 || row2[j * 4 + 3] != 0)
+                for (k = 0; k < 4; k++)
+                  m = MAX (m, ABS (row1[j * 4 + k] - row2[j * 4 + k]));
+              drow[j] = m;
+            }
+        }
+    }
+
+  g_free (absdiff);
+}
+
+/* Whether all pixels of rgba buffer are fully opaque. */
+gboolean
+webx_pixels_is_opaque (const guchar *pixels,
+                       gint          width,
+                       gint          height,
+                       gint          rowstride)
+{
+  const guchar *row;
+  guchar        alpha;
+  gint          i;
+  gint          j;
+
+  g_return_val_if_fail (pixels != NULL, FALSE);
+
+  for (i = 0; i < height; i++)
+    {
+      row = pixels + (gsize) i * rowstride;
+      alpha = 255;
+      j = 0;
+
+#ifdef WEBX_USE_SSE2
+      {
+        __m128i   color_mask = _mm_set1_epi32 (0x00ffffff);
+        __m128i   acc = _mm_set1_epi8 (-1);
+
+        for (; j + 4 <= width; j += 4)
+          acc = _mm_and_si128 (acc,
+                               _mm_loadu_si128 ((__m128i *) (row + j * 4)));
+        acc = _mm_or_si128 (acc, color_mask);
+        if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (acc, _mm_set1_epi8 (-1)))
+            != 0xffff)
+          return FALSE;
+      }
+#endif
+
+      for (; j < width; j++)
+        alpha &= row[j * 4 + 3];
+      if (alpha != 255)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+#ifdef WEBX_USE_SSE2
+/* 16-bit shifts leak bits between bytes, masks drop them later */
+#define WEBX_GRAY_DEPTH_STEP(v)                                         \
+  G_STMT_START {                                                        \
+    acc1 = _mm_or_si128 (acc1, _mm_xor_si128 (v, _mm_srli_epi16 (v, 1))); \
+    acc2 = _mm_or_si128 (acc2, _mm_xor_si128 (v, _mm_srli_epi16 (v, 2))); \
+    acc4 = _mm_or_si128 (acc4, _mm_xor_si128 (v, _mm_srli_epi16 (v, 4))); \
+  } G_STMT_END
+#endif
+
+/* Whether rgb(a) pixels are gray (R = G = B) and in how many bits the
+ * gray levels fit exactly: 1, 2, 4 or 8. Returns 0 if not gray. Level
+ * v fits in depth bits if its bits repeat every depth bits, the way
+ * PNG scales levels up, so (v ^ v >> depth) & (0xff >> depth) is 0. */
+gint
+webx_pixels_get_gray_depth (const guchar *pixels,
+                            gint          width,
+                            gint          height,
+                            gint          rowstride,
+                            gint          channels)
+{
+  const guchar *row;
+  const guchar *p;
+  guint         not_gray = 0;
+  guint         miss1 = 0;
+  guint         miss2 = 0;
+  guint         miss4 = 0;
+  gint          i;
+  gint          j;
+  gint          n;
+
+  g_return_val_if_fail (pixels != NULL, 0);
+  g_return_val_if_fail (channels == 3 || channels == 4, 0);
+
+  n = width * channels;
+  for (i = 0; i < height && ! not_gray; i++)
+    {
+      row = pixels + (gsize) i * rowstride;
+      j = 0;
+
+#ifdef WEBX_USE_SSE2
+      {
+        __m128i   acc1 = _mm_setzero_si128 ();
+        __m128i   acc2 = _mm_setzero_si128 ();
+        __m128i   acc4 = _mm_setzero_si128 ();
+        __m128i   color_mask;
+        __m128i   mask1 = _mm_set1_epi8 (0x7f);
+        __m128i   mask2 = _mm_set1_epi8 (0x3f);
+        __m128i   mask4 = _mm_set1_epi8 (0x0f);
+        __m128i   v;
+
+        if (channels == 4)
+          {
+            __m128i   gray_mask = _mm_set1_epi32 (0x0000ffff);
+            __m128i   acc_gray = _mm_setzero_si128 ();
+
+            color_mask = _mm_set1_epi32 (0x00ffffff);
+            for (; j + 16 <= n; j += 16)
+              {
+                v = _mm_loadu_si128 ((__m128i *) (row + j));
+                /* R ^ G and G ^ B in low bytes of each pixel */
+                acc_gray = _mm_or_si128 (acc_gray,
+                                         _mm_xor_si128 (v,
+                                                        _mm_srli_epi32 (v, 8)));
+                v = _mm_and_si128 (v, color_mask);
+                WEBX_GRAY_DEPTH_STEP (v);
+              }
+            acc_gray = _mm_and_si128 (acc_gray, gray_mask);
+            if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (acc_gray,
+                                                   _mm_setzero_si128 ()))
+                != 0xffff)
+              not_gray = 1;
+          }
+        else
+          {
+            __m128i   eq;
+
+            /* 5 pixels per step, R at bytes 0, 3, .. 12 of a, G of b
+             * and B of c are at the same places */
+            for (; j + 18 <= n && ! not_gray; j += 15)
+              {
+                v = _mm_loadu_si128 ((__m128i *) (row + j));
+                eq = _mm_and_si128 (
+                       _mm_cmpeq_epi8 (v, _mm_loadu_si128 ((__m128i *)
+                                                           (row + j + 1))),
+                       _mm_cmpeq_epi8 (v, _mm_loadu_si128 ((__m128i *)
+                                                           (row + j + 2))));
+                if ((_mm_movemask_epi8 (eq) & 0x1249) != 0x1249)
+                  not_gray = 1;
+                WEBX_GRAY_DEPTH_STEP (v);
+              }
+          }
+
+        acc1 = _mm_and_si128 (acc1, mask1);
+        acc2 = _mm_and_si128 (acc2, mask2);
+        acc4 = _mm_and_si128 (acc4, mask4);
+        if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (acc1, _mm_setzero_si128 ()))
+            != 0xffff)
+          miss1 = 1;
+        if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (acc2, _mm_setzero_si128 ()))
+            != 0xffff)
+          miss2 = 1;
+        if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (acc4, _mm_setzero_si128 ()))
+            != 0xffff)
+          miss4 = 1;
+      }
+#endif
+
+      for (; j < n; j += channels)
+        {
+          p = row + j;
+          not_gray |= (p[0] ^ p[1]) | (p[1] ^ p[2]);
+          miss1 |= (p[0] ^ (p[0] >> 1)) & 0x7f;
+          miss2 |= (p[0] ^ (p[0] >> 2)) & 0x3f;
+          miss4 |= (p[0] ^ (p[0] >> 4)) & 0x0f;
+        }
+    }
+
+  if (not_gray)
+    return 0;
+  else if (! miss1)
+    return 1;
+  else if (! miss2)
+    return 2;
+  else if (! miss4)
+    return 4;
+  return 8;
+}
+
+/* Palette index of each pixel of rgb(a) buffer, if there are at most
+ * max_colors (256 at most) colors. colors get each of them packed as
+ * R | G << 8 | B << 16 | A << 24, alpha is 255 without alpha channel.
+ * Indices are one byte per pixel, rows not padded. Returns number of
+ * colors, or -1 if there are more. */
+gint
+webx_pixels_index (const guchar *pixels,
+                   gint          width,
+                   gint          height,
+                   gint          rowstride,
+                   gint          channels,
+                   guchar       *indices,
+                   guint32      *colors,
+                   gint          max_colors)
+{
+  /* open addressing, index -1 marks free slot */
+  guint32       keys[1024];
+  gint16        values[1024];
+  const guchar *p;
+  guint32       color;
+  guint32       last_color = 0;
+  guint         slot;
+  gint          last_index = -1;
+  gint          n_colors = 0;
+  gint          i;
+  gint          j;
+
+  g_return_val_if_fail (pixels != NULL && indices != NULL, -1);
+  g_return_val_if_fail (colors != NULL, -1);
+  g_return_val_if_fail (channels == 3 || channels == 4, -1);
+  g_return_val_if_fail (max_colors > 0 && max_colors <= 256, -1);
+
+  memset (values, 0xff, sizeof (values));
+  for (i = 0; i < height; i++)
+    {
+      p = pixels + (gsize) i * rowstride;
+      for (j = 0; j < width; j++, p += channels)
+        {
+          color = p[0] | (p[1] << 8) | (p[2] << 16)
+                  | ((guint32) (channels == 4 ? p[3] : 255) << 24);
+
+          /* runs of same color are common */
+          if (color != last_color || last_index < 0)
+            {
+              slot = ((color * 2654435761u) >> 22) & 1023;
+              while (values[slot] >= 0 && keys[slot] != color)
+                slot = (slot + 1) & 1023;
+
+              if (values[slot] < 0)
+                {
+                  if (n_colors == max_colors)
+                    return -1;
+                  keys[slot] = color;
+                  values[slot] = n_colors;
+                  colors[n_colors++] = color;
+                }
+
+              last_color = color;
+              last_index = values[slot];
+            }
+
+          indices[(gsize) i * width + j] = last_index;
+        }
+    }
+
+  return n_colors;
+}
+
+/* Sets color of fully transparent pixels of rgba buffer, which can't
+ * be seen but costs space in compressed files when it is random. */
+void
+webx_pixels_clear_transparent (guchar        *pixels,
+                               gint           width,
+                               gint           height,
+                               gint           rowstride,
+                               WebxClearMode  mode)
+{
+  guchar       *row;
+  guchar       *p;
+  gint          i;
+  gint          j;
+
+  g_return_if_fail (pixels != NULL);
+
+  if (mode == WEBX_CLEAR_NONE)
+    return;
+
+  for (i = 0; i < height; i++)
+    {
+      row = pixels + (gsize) i * rowstride;
+      j = 0;
+
+#ifdef WEBX_USE_SSE2
+      {
+        __m128i   alpha_mask = _mm_set1_epi32 (0xff000000);
+        __m128i   v;
+        __m128i   clear;
+        gint      k;
+
+        for (; j + 4 <= width; j += 4)
+          {
+            v = _mm_loadu_si128 ((__m128i *) (row + j * 4));
+            clear = _mm_cmpeq_epi32 (_mm_and_si128 (v, alpha_mask),
+                                     _mm_setzero_si128 ());
+            if (! _mm_movemask_epi8 (clear))
+              continue;
+
+            if (mode == WEBX_CLEAR_ZERO)
+              {
+                _mm_storeu_si128 ((__m128i *) (row + j * 4),
+                                  _mm_andnot_si128 (clear, v));
+                continue;
+              }
+
+            /* each pixel depends on the one before it */
+            for (k = j; k < j + 4; k++)
+              {
+                p = row + k * 4;
+                if (p[3] == 0)
+                  {
+                    if (k > 0)
+                      memcpy (p, p - 4, 3);
+                    else
+                      memset (p, 0, 3);
+                  }
+              }
+          }
+      }
+#endif
+
+      for (; j < width; j++)
+        {
+          p = row + j * 4;
+          if (p[3] != 0)
+            continue;
+
+          if (mode == WEBX_CLEAR_PREVIOUS && j > 0)
+            memcpy (p, p - 4, 3);
+          else
+            memset (p, 0, 3);
+        }
+    }
+}
+
+/* chroma error of averaging, in Cb/Cr levels, that shows as a colored
+ * fringe, and fraction of 2x2 blocks allowed to have it */
+#define WEBX_CHROMA_SMEAR       24
+#define WEBX_CHROMA_SMEAR_RATIO 0.005
+
+/* Cb and Cr of pixel around 0, scaled by alpha as if composed over
+ * gray, since fully transparent pixels don't show. */
+static inline void
+webx_pixels_get_chroma (const guchar *p,
+                        gint          channels,
+                        gint         *chroma)
+{
+  gint          alpha = (channels == 4) ? p[3] : 255;
+
+  chroma[0] = (-43 * p[0] - 85 * p[1] + 128 * p[2]) * alpha / (256 * 255);
+  chroma[1] = (128 * p[0] - 107 * p[1] - 21 * p[2]) * alpha / (256 * 255);
+}
+
+/* Picks how many luma samples per chroma sample JPEG can afford
+ * horizontally and vertically (4:2:0, 4:2:2 or 4:4:4) so that colored
+ * edges don't smear. Each 2x2 block is checked for the error of
+ * averaging its chroma over the whole block and over horizontal pairs;
+ * a few smeared blocks are fine in a photo, not along red text. */
+void
+webx_pixels_get_chroma_sampling (const guchar *pixels,
+                                 gint          width,
+                                 gint          height,
+                                 gint          rowstride,
+                                 gint          channels,
+                                 gint         *h_samp,
+                                 gint         *v_samp)
+{
+  const guchar *rows[2];
+  gint          chroma[4][2];
+  gint          block_sums[2];
+  gint          pair_sums[2][2];
+  gint          block_error;
+  gint          pair_error;
+  gint          error;
+  gint          limit;
+  gint          n_block_smears = 0;
+  gint          n_pair_smears = 0;
+  gint          i, j, k, c;
+
+  limit = (gint) ((gdouble) ((width + 1) / 2) * ((height + 1) / 2)
+                  * WEBX_CHROMA_SMEAR_RATIO);
+
+  for (i = 0; i < height; i += 2)
+    {
+      rows[0] = pixels + (gsize) i * rowstride;
+      rows[1] = pixels + (gsize) MIN (i + 1, height - 1) * rowstride;
+
+      for (j = 0; j < width; j += 2)
+        {
+          for (k = 0; k < 4; k++)
+            webx_pixels_get_chroma (rows[k / 2]
+                                    + MIN (j + k % 2, width - 1) * channels,
+                                    channels, chroma[k]);
+
+          /* errors are multiplied by 4 to stay in integers */
+          block_error = pair_error = 0;
+          for (c = 0; c < 2; c++)
+            {
+              pair_sums[0][c] = chroma[0][c] + chroma[1][c];
+              pair_sums[1][c] = chroma[2][c] + chroma[3][c];
+              block_sums[c] = pair_sums[0][c] + pair_sums[1][c];
+              for (k = 0; k < 4; k++)
+                {
+                  error = ABS (4 * chroma[k][c] - block_sums[c]);
+                  block_error = MAX (block_error, error);
+                  error = ABS (4 * chroma[k][c] - 2 * pair_sums[k / 2][c]);
+                  pair_error = MAX (pair_error, error);
+                }
+            }
+
+          if (block_error > 4 * WEBX_CHROMA_SMEAR)
+            n_block_smears++;
+          if (pair_error > 4 * WEBX_CHROMA_SMEAR)
+            n_pair_smears++;
+        }
+    }
+
+  if (n_block_smears <= limit)
+    {
+      *h_samp = 2;
+      *v_samp = 2;
+    }
+  else if (n_pair_smears <= limit)
+    {
+      *h_samp = 2;
+      *v_samp = 1;
+    }
+  else
+    {
+      *h_samp = 1;
+      *v_samp = 1;
+    }
+}
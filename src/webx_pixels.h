@@ -0,0 +1,90 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+   Kernels working on raw 8-bit RGB/RGBA buffers.
+*/
+
+#ifndef __WEBX_PIXELS_H__
+#define __WEBX_PIXELS_H__
+
+/* what color fully transparent pixels get */
+typedef enum
+{
+  WEBX_CLEAR_NONE,
+  /* black */
+  WEBX_CLEAR_ZERO,
+  /* that of pixel to the left, black at start of row */
+  WEBX_CLEAR_PREVIOUS
+} WebxClearMode;
+
+void        webx_pixels_dim         (guchar      *pixels,
+                                     gint         width,
+                                     gint         height,
+                                     gint         rowstride,
+                                     gint         channels);
+
+void        webx_pixels_diff        (const guchar *src1,
+                                     gint          rowstride1,
+                                     gint          channels1,
+                                     const guchar *src2,
+                                     gint          rowstride2,
+                                     gint          channels2,
+                                     const guchar *background,
+                                     guchar       *dest,
+                                     gint          dest_rowstride,
+                                     gint          width,
+                                     gint          height);
+
+gboolean    webx_pixels_is_opaque   (const guchar *pixels,
+                                     gint          width,
+                                     gint          height,
+                                     gint          rowstride);
+
+gint        webx_pixels_get_gray_depth (const guchar *pixels,
+                                     gint          width,
+                                     gint          height,
+                                     gint          rowstride,
+                                     gint          channels);
+
+gint        webx_pixels_index       (const guchar *pixels,
+                                     gint          width,
+                                     gint          height,
+                                     gint          rowstride,
+                                     gint          channels,
+                                     guchar       *indices,
+                                     guint32      *colors,
+                                     gint          max_colors);
+
+void        webx_pixels_clear_transparent (guchar *pixels,
+                                     gint          width,
+                                     gint          height,
+                                     gint          rowstride,
+                                     WebxClearMode mode);
+
+void        webx_pixels_get_chroma_sampling (const guchar *pixels,
+                                     gint          width,
+                                     gint          height,
+                                     gint          rowstride,
+                                     gint          channels,
+                                     gint         *h_samp,
+                                     gint         *v_samp);
+
+#endif /* __WEBX_PIXELS_H__ */
@@ -20,17 +20,31 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <gtk/gtk.h>
 #include <libgimp/gimp.h>
+#include <libgimp/gimpui.h>
 
 #include "webx_main.h"
 #include "webx_png24_target.h"
+#include "webx_png_writer.h"
+#include "webx_optimize.h"
 
 #include "plugin-intl.h"
 
 static gboolean webx_png24_target_save_image    (WebxTarget            *widget,
                                                  WebxTargetInput       *input,
                                                  const gchar           *file_name);
+static GdkPixbuf* webx_png24_target_render_preview (WebxTarget         *widget,
+                                                   WebxTargetInput    *input,
+                                                   gint               *file_size);
+static void webx_png24_target_finish_export (WebxTarget    *widget,
+                                             const gchar   *file_name,
+                                             GtkWindow     *parent);
+static void webx_png24_target_clear_mode_changed (GtkWidget        *combo,
+                                                  WebxPng24Target  *png24);
+static gboolean webx_png24_target_uses_pixels  (WebxTarget    *widget);
 static gchar* webx_png24_target_get_unique_name (WebxTarget    *widget);
 static gchar* webx_png24_target_get_extension   (WebxTarget    *widget);
 
@@ -49,8 +63,11 @@ webx_png24_target_class_init (WebxPng24TargetClass *klass)
 
   target_class = WEBX_TARGET_CLASS (klass);
   target_class->save_image      = webx_png24_target_save_image;
+  target_class->render_preview  = webx_png24_target_render_preview;
+  target_class->uses_pixels     = webx_png24_target_uses_pixels;
   target_class->get_unique_name = webx_png24_target_get_unique_name;
   target_class->get_extension   = webx_png24_target_get_extension;
+  target_class->finish_export   = webx_png24_target_finish_export;
 }
 
 static void
@@ -71,12 +88,16 @@ webx_png24_target_init (WebxPng24Target *png24)
   png24->comment      = return_vals[8].data.d_int32;
   png24->svtrans      = return_vals[9].data.d_int32;
   gimp_destroy_params (return_vals, n_return_vals);
+
+  png24->effort = 1;
 }
 
 GtkWidget*
 webx_png24_target_new (void)
 {
   WebxPng24Target *png24;
+  GtkWidget       *label;
+  GtkWidget       *combo;
   gint             row = 0;
 
   png24 = g_object_new (WEBX_TYPE_PNG24_TARGET, NULL);
@@ -89,10 +110,80 @@ webx_png24_target_new (void)
                                                row++,
                                                _("_Compression"), 0, 9,
                                                &png24->compression);
+  png24->effort_o = webx_range_entry_new (WEBX_TARGET (png24),
+                                          row++,
+                                          _("_Effort"), 1, WEBX_PNG_MAX_EFFORT,
+                                          &png24->effort);
+
+  label = gtk_label_new (_("Transparent pixels:"));
+  gtk_misc_set_alignment (GTK_MISC (label), 0.0, 0.5);
+  gtk_table_attach (GTK_TABLE (png24), label,
+                    0, 1, row, row+1,
+                    GTK_FILL, GTK_FILL, 0, 0);
+  gtk_widget_show (label);
+  combo = gimp_int_combo_box_new (_("Keep color"),
+                                  WEBX_CLEAR_NONE,
+                                  _("Clear"),
+                                  WEBX_CLEAR_ZERO,
+                                  _("Repeat previous pixel"),
+                                  WEBX_CLEAR_PREVIOUS,
+                                  NULL);
+  gimp_int_combo_box_set_active (GIMP_INT_COMBO_BOX (combo), WEBX_CLEAR_NONE);
+  gtk_table_attach (GTK_TABLE (png24), combo,
+                    1, 3, row, row+1,
+                    GTK_SHRINK, GTK_SHRINK, 0, 0);
+  g_signal_connect (combo, "changed",
+                    G_CALLBACK (webx_png24_target_clear_mode_changed),
+                    png24);
+  png24->clear_mode_w = combo;
+  gtk_widget_show (combo);
+  row++;
+
+  png24->optimize_o = webx_checkbox_new (WEBX_TARGET (png24),
+                                         row++,
+                                         _("_Maximum compression on export"),
+                                         &png24->optimize);
 
   return GTK_WIDGET (png24);
 }
 
+static void
+webx_png24_target_clear_mode_changed (GtkWidget       *combo,
+                                      WebxPng24Target *png24)
+{
+  gimp_int_combo_box_get_active (GIMP_INT_COMBO_BOX (combo),
+                                 (gint *) &png24->clear_mode);
+  webx_target_changed (WEBX_TARGET (png24));
+}
+
+/* Pixels of input to be encoded: input's own, or copy with color of
+ * invisible pixels set, which must be freed. Input pixels point into
+ * larger pixbuf, so the copy is made row by row with rows not padded;
+ * rowstride is set for what is returned. */
+static guchar*
+webx_png24_target_get_pixels (WebxPng24Target *png24,
+                              WebxTargetInput *input,
+                              gint            *rowstride)
+{
+  guchar       *pixels;
+  gint          y;
+
+  *rowstride = input->rowstride;
+  if (png24->clear_mode == WEBX_CLEAR_NONE || input->bpp != 4)
+    return (guchar *) input->pixels;
+
+  *rowstride = input->width * 4;
+  pixels = g_new (guchar, (gsize) *rowstride * input->height);
+  for (y = 0; y < input->height; y++)
+    memcpy (pixels + (gsize) y * *rowstride,
+            input->pixels + (gsize) y * input->rowstride,
+            *rowstride);
+  webx_pixels_clear_transparent (pixels, input->width, input->height,
+                                 *rowstride, png24->clear_mode);
+
+  return pixels;
+}
+
 static gboolean
 webx_png24_target_save_image (WebxTarget       *widget,
                               WebxTargetInput  *input,
@@ -103,9 +194,27 @@ webx_png24_target_save_image (WebxTarget       *widget,
   gint             n_return_vals;
   gint            image;
   gint            layer;
+  guchar         *pixels;
+  gint            rowstride;
   gboolean        save_res;
 
   png24 = WEBX_PNG24_TARGET (widget);
+
+  /* deflated on all cores */
+  if (input->pixels)
+    {
+      pixels = webx_png24_target_get_pixels (png24, input, &rowstride);
+      save_res = webx_png_writer_save_rgb (pixels,
+                                           input->width, input->height,
+                                           rowstride, input->bpp,
+                                           png24->interlace,
+                                           png24->compression,
+                                           png24->effort, file_name);
+      if (pixels != input->pixels)
+        g_free (pixels);
+      return save_res;
+    }
+
   image = input->rgb_image;
   layer = input->rgb_layer;
 
@@ -133,6 +242,57 @@ webx_png24_target_save_image (WebxTarget       *widget,
   return save_res;
 }
 
+/* PNG is lossless, preview shows input pixels and only file size is
+ * needed. Color of invisible pixels doesn't show either. */
+static GdkPixbuf*
+webx_png24_target_render_preview (WebxTarget      *widget,
+                                  WebxTargetInput *input,
+                                  gint            *file_size)
+{
+  WebxPng24Target      *png24;
+  GByteArray           *data;
+  GdkPixbuf            *pixbuf;
+  guchar               *pixels;
+  gint                  rowstride;
+  gint                  y;
+
+  png24 = WEBX_PNG24_TARGET (widget);
+
+  if (! input->pixels)
+    return WEBX_TARGET_CLASS (parent_class)->render_preview (widget, input,
+                                                             file_size);
+
+  pixels = webx_png24_target_get_pixels (png24, input, &rowstride);
+  data = webx_png_writer_encode_rgb (pixels,
+                                     input->width, input->height,
+                                     rowstride, input->bpp,
+                                     png24->interlace, png24->compression,
+                                     png24->effort,
+                                     WEBX_PNG_PREVIEW_TIME_LIMIT);
+  if (pixels != input->pixels)
+    g_free (pixels);
+  if (file_size)
+    *file_size = data ? data->len : 0;
+  if (data)
+    g_byte_array_free (data, TRUE);
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, input->bpp == 4, 8,
+                           input->width, input->height);
+  for (y = 0; y < input->height; y++)
+    memcpy (gdk_pixbuf_get_pixels (pixbuf)
+            + y * gdk_pixbuf_get_rowstride (pixbuf),
+            input->pixels + y * input->rowstride,
+            input->width * input->bpp);
+
+  return pixbuf;
+}
+
+static gboolean
+webx_png24_target_uses_pixels (WebxTarget *widget)
+{
+  return TRUE;
+}
+
 static gchar*
 webx_png24_target_get_unique_name (WebxTarget *widget)
 {
@@ -144,3 +304,13 @@ webx_png24_target_get_extension (WebxTarget *widget)
 {
   return "png";
 }
+
+/* Exhaustive compression of what was exported, see webx_optimize.c */
+static void
+webx_png24_target_finish_export (WebxTarget  *widget,
+                                 const gchar *file_name,
+                                 GtkWindow   *parent)
+{
+  if (WEBX_PNG24_TARGET (widget)->optimize)
+    webx_optimize_png (parent, file_name);
+}
@@ -22,6 +22,7 @@
 #define __WEBX_PNG24_TARGET_H__
 
 #include "webx_target.h"
+#include "webx_pixels.h"
 
 G_BEGIN_DECLS
 
@@ -41,6 +42,12 @@ struct _WebxPng24Target
 
   gint          interlace;
   gint          compression;
+  /* 1 .. WEBX_PNG_MAX_EFFORT */
+  gint          effort;
+  /* exhaustive compression on background thread after export */
+  gint          optimize;
+  /* color of invisible pixels, for better compression */
+  WebxClearMode clear_mode;
   gint          bkgd;
   gint          gama;
   gint          offs;
@@ -51,6 +58,9 @@ struct _WebxPng24Target
 
   GtkObject    *interlace_o;
   GtkObject    *compression_o;
+  GtkObject    *effort_o;
+  GtkObject    *optimize_o;
+  GtkWidget    *clear_mode_w;
 };
 
 struct _WebxPng24TargetClass
@@ -25,12 +25,21 @@
 
 #include "webx_main.h"
 #include "webx_png8_target.h"
+#include "webx_png_writer.h"
+#include "webx_optimize.h"
+#include "webx_utils.h"
 
 #include "plugin-intl.h"
 
 static gboolean webx_png8_target_save_image    (WebxTarget             *widget,
                                                 WebxTargetInput        *input,
                                                 const gchar            *file_name);
+static GdkPixbuf* webx_png8_target_render_preview (WebxTarget          *widget,
+                                                 WebxTargetInput     *input,
+                                                 gint                *file_size);
+static void webx_png8_target_finish_export (WebxTarget    *widget,
+                                            const gchar   *file_name,
+                                            GtkWindow     *parent);
 static gchar* webx_png8_target_get_unique_name (WebxTarget     *widget);
 static gchar* webx_png8_target_get_extension   (WebxTarget     *widget);
 
@@ -44,13 +53,19 @@ webx_png8_target_class_init (WebxPng8TargetClass *klass)
 {
   GObjectClass         *object_class;
   WebxTargetClass      *target_class;
+  WebxIndexedTargetClass *indexed_class;
 
   object_class = G_OBJECT_CLASS (klass);
 
   target_class = WEBX_TARGET_CLASS (klass);
   target_class->save_image      = webx_png8_target_save_image;
+  target_class->render_preview  = webx_png8_target_render_preview;
   target_class->get_unique_name = webx_png8_target_get_unique_name;
   target_class->get_extension   = webx_png8_target_get_extension;
+  target_class->finish_export   = webx_png8_target_finish_export;
+
+  indexed_class = WEBX_INDEXED_TARGET_CLASS (klass);
+  indexed_class->translucent_palette = TRUE;
 }
 
 static void
@@ -71,6 +86,8 @@ webx_png8_target_init (WebxPng8Target *png8)
   png8->comment      = return_vals[8].data.d_int32;
   png8->svtrans      = return_vals[9].data.d_int32;
   gimp_destroy_params (return_vals, n_return_vals);
+
+  png8->effort = 1;
 }
 
 GtkWidget*
@@ -90,6 +107,14 @@ webx_png8_target_new (void)
                                               row++,
                                               _("_Compression"), 0, 9,
                                               &png8->compression);
+  png8->effort_o = webx_range_entry_new (WEBX_TARGET (png8),
+                                         row++,
+                                         _("_Effort"), 1, WEBX_PNG_MAX_EFFORT,
+                                         &png8->effort);
+  png8->optimize_o = webx_checkbox_new (WEBX_TARGET (png8),
+                                        row++,
+                                        _("_Maximum compression on export"),
+                                        &png8->optimize);
 
   return GTK_WIDGET (png8);
 }
@@ -100,6 +125,7 @@ webx_png8_target_save_image (WebxTarget        *widget,
                              const gchar       *file_name)
 {
   WebxPng8Target       *png8;
+  WebxIndexedImage     *quantized;
   GimpParam            *return_vals;
   gint                  n_return_vals;
   gint                  image;
@@ -107,6 +133,20 @@ webx_png8_target_save_image (WebxTarget        *widget,
   gboolean              save_res;
 
   png8 = WEBX_PNG8_TARGET (widget);
+
+  /* own palettes are written here, GIMP would also drop alpha of
+   * translucent colors */
+  quantized = webx_indexed_target_get_indexed (WEBX_INDEXED_TARGET (widget),
+                                               input);
+  if (quantized)
+    {
+      save_res = webx_png_writer_save (quantized, png8->interlace,
+                                       png8->compression, png8->effort,
+                                       file_name);
+      webx_indexed_image_free (quantized);
+      return save_res;
+    }
+
   image = webx_indexed_target_get_image (WEBX_INDEXED_TARGET (widget),
                                          input,
                                          &layer);
@@ -135,6 +175,39 @@ webx_png8_target_save_image (WebxTarget        *widget,
   return save_res;
 }
 
+/* Own palettes are encoded in memory, only file size is needed. */
+static GdkPixbuf*
+webx_png8_target_render_preview (WebxTarget      *widget,
+                                 WebxTargetInput *input,
+                                 gint            *file_size)
+{
+  WebxPng8Target       *png8;
+  WebxIndexedImage     *quantized;
+  GByteArray           *data;
+  GdkPixbuf            *pixbuf;
+
+  png8 = WEBX_PNG8_TARGET (widget);
+
+  quantized = webx_indexed_target_get_indexed (WEBX_INDEXED_TARGET (widget),
+                                               input);
+  if (! quantized)
+    return WEBX_TARGET_CLASS (parent_class)->render_preview (widget, input,
+                                                             file_size);
+
+  data = webx_png_writer_encode (quantized, png8->interlace,
+                                 png8->compression, png8->effort,
+                                 WEBX_PNG_PREVIEW_TIME_LIMIT);
+  if (file_size)
+    *file_size = data ? data->len : 0;
+  if (data)
+    g_byte_array_free (data, TRUE);
+
+  pixbuf = webx_indexed_image_to_pixbuf (quantized);
+  webx_indexed_image_free (quantized);
+
+  return pixbuf;
+}
+
 static gchar*
 webx_png8_target_get_unique_name (WebxTarget *widget)
 {
@@ -146,3 +219,13 @@ webx_png8_target_get_extension (WebxTarget *widget)
 {
   return "png";
 }
+
+/* Exhaustive compression of what was exported, see webx_optimize.c */
+static void
+webx_png8_target_finish_export (WebxTarget  *widget,
+                                const gchar *file_name,
+                                GtkWindow   *parent)
+{
+  if (WEBX_PNG8_TARGET (widget)->optimize)
+    webx_optimize_png (parent, file_name);
+}
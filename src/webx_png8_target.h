@@ -41,6 +41,10 @@ struct _WebxPng8Target
 
   gint                  interlace;
   gint                  compression;
+  /* 1 .. WEBX_PNG_MAX_EFFORT */
+  gint                  effort;
+  /* exhaustive compression on background thread after export */
+  gint                  optimize;
   gint                  bkgd;
   gint                  gama;
   gint                  offs;
@@ -51,11 +55,13 @@ struct _WebxPng8Target
 
   GtkObject            *interlace_o;
   GtkObject            *compression_o;
+  GtkObject            *effort_o;
+  GtkObject            *optimize_o;
 };
 
 struct _WebxPng8TargetClass
 {
-  WebxTargetClass parent_class;
+  WebxIndexedTargetClass parent_class;
 };
 
 GType           webx_png8_target_get_type (void) G_GNUC_CONST;
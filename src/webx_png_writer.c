@@ -0,0 +1,1514 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <stdlib.h>
+
+#include <glib.h>
+#include <zlib.h>
+#ifdef HAVE_ZOPFLI
+#include <zopfli.h>
+#endif
+
+#include "webx_pixels.h"
+#include "webx_threads.h"
+#include "webx_quantizer.h"
+#include "webx_png_writer.h"
+
+/* input of each deflate job; fixed, so that output doesn't depend on
+ * number of threads */
+#define WEBX_DEFLATE_CHUNK      (128 * 1024)
+/* how far back deflate can look */
+#define WEBX_DEFLATE_WINDOW     32768
+/* rows filtered by one job */
+#define WEBX_FILTER_ROWS        64
+/* optimizing checks for cancel and reports progress this often */
+#define WEBX_OPTIMIZE_PIECE     (64 * 1024)
+/* zopfli can't be stopped once started, bytes times iterations it may
+ * spend, a few seconds of work */
+#define WEBX_ZOPFLI_BUDGET      (8 * 1024 * 1024)
+#define WEBX_ZOPFLI_ITERATIONS  15
+
+typedef struct
+{
+  gint          x;
+  gint          y;
+  gint          dx;
+  gint          dy;
+} WebxPngPass;
+
+/* Adam7 interlacing: pixel grid of each pass */
+static const WebxPngPass webx_png_passes[7] =
+{
+  { 0, 0, 8, 8 },
+  { 4, 0, 8, 8 },
+  { 0, 4, 4, 8 },
+  { 2, 0, 4, 4 },
+  { 0, 2, 2, 4 },
+  { 1, 0, 2, 2 },
+  { 0, 1, 1, 2 }
+};
+
+static const WebxPngPass webx_png_no_passes[1] =
+{
+  { 0, 0, 1, 1 }
+};
+
+/* filter of each row chosen by its sum, as libpng does */
+#define WEBX_PNG_FILTER_ADAPTIVE        5
+
+/* filters and zlib strategies tried by each effort, in order; first
+ * one is what effort 1 uses */
+static const gint webx_png_rgb_filters[6] =
+{
+  WEBX_PNG_FILTER_ADAPTIVE, 0, 4, 2, 1, 3
+};
+static const gint webx_png_indexed_filters[6] =
+{
+  0, WEBX_PNG_FILTER_ADAPTIVE, 4, 2, 1, 3
+};
+static const gint webx_png_strategies[3] =
+{
+  Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE
+};
+static const gint webx_png_effort_filters[WEBX_PNG_MAX_EFFORT] = { 1, 2, 6 };
+static const gint webx_png_effort_strategies[WEBX_PNG_MAX_EFFORT] = { 1, 3, 3 };
+
+typedef struct
+{
+  const guchar *raw;
+  gsize         raw_size;
+  gint          level;
+  gint          strategy;
+  gint          n_chunks;
+  /* deflated data and adler32 of each chunk */
+  guchar      **chunks;
+  gsize        *chunk_sizes;
+  uLong        *adlers;
+  gint          failed;
+} WebxDeflateStream;
+
+typedef struct
+{
+  WebxDeflateStream    *streams;
+  gint                  n_streams;
+} WebxDeflateJob;
+
+typedef struct
+{
+  /* where filter type byte of row is in scanlines */
+  gsize         offset;
+  gint          length;
+  /* first row of its pass, there is nothing above it */
+  gboolean      first;
+} WebxPngRow;
+
+typedef struct
+{
+  /* unfiltered scanlines */
+  const guchar         *raw;
+  guchar               *dest;
+  const WebxPngRow     *rows;
+  gint                  n_rows;
+  gint                  max_length;
+  /* bytes per pixel, rounded up */
+  gint                  bpp;
+  gint                  filter;
+} WebxFilterJob;
+
+typedef struct
+{
+  /* filtered scanlines, deflated with each of strategies */
+  const guchar         *filtered;
+  gsize                 raw_size;
+  GByteArray          **results;
+  WebxPngProgress      *progress;
+  /* pieces deflated so far, out of n_pieces of whole search */
+  gint                  done;
+  gint                  n_pieces;
+} WebxOptimizeJob;
+
+static void
+webx_png_append_uint32 (GByteArray *data,
+                        guint32     value)
+{
+  guchar        buf[4];
+
+  buf[0] = value >> 24;
+  buf[1] = value >> 16;
+  buf[2] = value >> 8;
+  buf[3] = value;
+  g_byte_array_append (data, buf, 4);
+}
+
+static void
+webx_png_append_chunk (GByteArray   *data,
+                       const gchar  *type,
+                       const guchar *contents,
+                       gsize         length)
+{
+  guint32       crc;
+
+  webx_png_append_uint32 (data, length);
+  g_byte_array_append (data, (const guchar *) type, 4);
+  if (length > 0)
+    g_byte_array_append (data, contents, length);
+
+  crc = crc32 (0, (const Bytef *) type, 4);
+  if (length > 0)
+    crc = crc32 (crc, contents, length);
+  webx_png_append_uint32 (data, crc);
+}
+
+/* Smallest PNG bit depth which can hold all palette indices. */
+static gint
+webx_png_get_depth (gint n_colors)
+{
+  if (n_colors <= 2)
+    return 1;
+  else if (n_colors <= 4)
+    return 2;
+  else if (n_colors <= 16)
+    return 4;
+  return 8;
+}
+
+/* Unfiltered scanlines of all passes. map gives PNG palette index of
+ * each image index. */
+static guchar*
+webx_png_pack (const WebxIndexedImage *image,
+               const guchar           *map,
+               gint                    depth,
+               gboolean                interlace,
+               gsize                  *size)
+{
+  const WebxPngPass    *passes;
+  const WebxPngPass    *pass;
+  const guchar         *src;
+  guchar               *buf;
+  guchar               *dest;
+  gint                  n_passes;
+  gint                  per_byte = 8 / depth;
+  gint                  pass_width;
+  gint                  pass_height;
+  gint                  row_bytes;
+  gint                  i, x, y;
+
+  passes = interlace ? webx_png_passes : webx_png_no_passes;
+  n_passes = interlace ? 7 : 1;
+
+  *size = 0;
+  for (i = 0; i < n_passes; i++)
+    {
+      pass = &passes[i];
+      pass_width = (image->width - pass->x + pass->dx - 1) / pass->dx;
+      pass_height = (image->height - pass->y + pass->dy - 1) / pass->dy;
+      if (pass_width <= 0 || pass_height <= 0)
+        continue;
+
+      *size += (gsize) pass_height
+               * (1 + (pass_width + per_byte - 1) / per_byte);
+    }
+
+  buf = g_new0 (guchar, MAX (*size, 1));
+  dest = buf;
+  for (i = 0; i < n_passes; i++)
+    {
+      pass = &passes[i];
+      pass_width = (image->width - pass->x + pass->dx - 1) / pass->dx;
+      pass_height = (image->height - pass->y + pass->dy - 1) / pass->dy;
+      if (pass_width <= 0 || pass_height <= 0)
+        continue;
+
+      row_bytes = (pass_width + per_byte - 1) / per_byte;
+      for (y = 0; y < pass_height; y++)
+        {
+          src = image->indices
+                + (pass->y + y * pass->dy) * image->width + pass->x;
+          *dest++ = 0;
+          if (depth == 8)
+            {
+              for (x = 0; x < pass_width; x++)
+                dest[x] = map[src[x * pass->dx]];
+            }
+          else
+            {
+              /* leftmost pixel goes to high bits, buffer is zeroed */
+              for (x = 0; x < pass_width; x++)
+                dest[x / per_byte] |= map[src[x * pass->dx]]
+                                      << (8 - depth * (x % per_byte + 1));
+            }
+          dest += row_bytes;
+        }
+    }
+
+  return buf;
+}
+
+/* Row layout of scanlines: each pass of each row is a row of
+ * bits_per_pixel wide pixels, led by a filter type byte. */
+static WebxPngRow*
+webx_png_get_rows (gint          width,
+                   gint          height,
+                   gint          bits_per_pixel,
+                   gboolean      interlace,
+                   gint         *n_rows,
+                   gsize        *size)
+{
+  const WebxPngPass    *passes;
+  const WebxPngPass    *pass;
+  WebxPngRow           *rows;
+  gint                  n_passes;
+  gint                  pass_width;
+  gint                  pass_height;
+  gint                  i, y;
+
+  passes = interlace ? webx_png_passes : webx_png_no_passes;
+  n_passes = interlace ? 7 : 1;
+
+  *n_rows = 0;
+  for (i = 0; i < n_passes; i++)
+    {
+      pass = &passes[i];
+      pass_width = (width - pass->x + pass->dx - 1) / pass->dx;
+      pass_height = (height - pass->y + pass->dy - 1) / pass->dy;
+      if (pass_width > 0 && pass_height > 0)
+        *n_rows += pass_height;
+    }
+
+  rows = g_new (WebxPngRow, MAX (*n_rows, 1));
+  *n_rows = 0;
+  *size = 0;
+  for (i = 0; i < n_passes; i++)
+    {
+      pass = &passes[i];
+      pass_width = (width - pass->x + pass->dx - 1) / pass->dx;
+      pass_height = (height - pass->y + pass->dy - 1) / pass->dy;
+      if (pass_width <= 0 || pass_height <= 0)
+        continue;
+
+      for (y = 0; y < pass_height; y++)
+        {
+          rows[*n_rows].offset = *size;
+          rows[*n_rows].length = ((gsize) pass_width * bits_per_pixel + 7) / 8;
+          rows[*n_rows].first = (y == 0);
+          *size += 1 + rows[*n_rows].length;
+          (*n_rows)++;
+        }
+    }
+
+  return rows;
+}
+
+static inline guchar
+webx_png_paeth (gint a,
+                gint b,
+                gint c)
+{
+  gint          p = a + b - c;
+  gint          pa = ABS (p - a);
+  gint          pb = ABS (p - b);
+  gint          pc = ABS (p - c);
+
+  if (pa <= pb && pa <= pc)
+    return a;
+  else if (pb <= pc)
+    return b;
+  return c;
+}
+
+/* Applies PNG filter type to row, returns sum of filtered bytes taken
+ * as signed, which is the usual guess of how well it compresses. */
+static guint
+webx_png_filter (gint          type,
+                 const guchar *src,
+                 const guchar *prev,
+                 gint          length,
+                 gint          bpp,
+                 guchar       *dest)
+{
+  guint         sum = 0;
+  gint          a, b, c;
+  gint          i;
+
+  for (i = 0; i < length; i++)
+    {
+      a = (i >= bpp) ? src[i - bpp] : 0;
+      b = prev ? prev[i] : 0;
+      c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+
+      switch (type)
+        {
+        case 0:
+          dest[i] = src[i];
+          break;
+        case 1:
+          dest[i] = src[i] - a;
+          break;
+        case 2:
+          dest[i] = src[i] - b;
+          break;
+        case 3:
+          dest[i] = src[i] - ((a + b) >> 1);
+          break;
+        default:
+          dest[i] = src[i] - webx_png_paeth (a, b, c);
+          break;
+        }
+      sum += ABS ((gint8) dest[i]);
+    }
+
+  return sum;
+}
+
+/* Filters rows of job with the filter of job, or with the one giving
+ * smallest sum for each row. */
+static void
+webx_png_filter_job (gint           job,
+                     gint           n_jobs,
+                     WebxFilterJob *data)
+{
+  const WebxPngRow     *row;
+  const guchar         *src;
+  const guchar         *prev;
+  guchar               *trial;
+  guchar               *best;
+  guchar               *swap;
+  guint                 best_sum;
+  guint                 sum;
+  gint                  best_type;
+  gint                  type;
+  gint                  first;
+  gint                  last;
+  gint                  i;
+
+  first = (gint64) data->n_rows * job / n_jobs;
+  last = (gint64) data->n_rows * (job + 1) / n_jobs;
+  trial = g_new (guchar, MAX (data->max_length, 1));
+  best = g_new (guchar, MAX (data->max_length, 1));
+
+  for (i = first; i < last; i++)
+    {
+      row = &data->rows[i];
+      src = data->raw + row->offset + 1;
+      prev = row->first ? NULL : data->raw + row[-1].offset + 1;
+
+      if (data->filter != WEBX_PNG_FILTER_ADAPTIVE)
+        {
+          data->dest[row->offset] = data->filter;
+          webx_png_filter (data->filter, src, prev, row->length, data->bpp,
+                           data->dest + row->offset + 1);
+          continue;
+        }
+
+      best_type = 0;
+      best_sum = G_MAXUINT;
+      for (type = 0; type < 5; type++)
+        {
+          sum = webx_png_filter (type, src, prev, row->length, data->bpp,
+                                 trial);
+          if (sum < best_sum)
+            {
+              best_sum = sum;
+              best_type = type;
+              swap = best;
+              best = trial;
+              trial = swap;
+            }
+        }
+
+      data->dest[row->offset] = best_type;
+      memcpy (data->dest + row->offset + 1, best, row->length);
+    }
+
+  g_free (trial);
+  g_free (best);
+}
+
+/* Copy of unfiltered scanlines with rows filtered in parallel. */
+static guchar*
+webx_png_filter_rows (const guchar     *raw,
+                      gsize             raw_size,
+                      const WebxPngRow *rows,
+                      gint              n_rows,
+                      gint              bpp,
+                      gint              filter)
+{
+  WebxFilterJob         data;
+  gint                  i;
+
+  data.raw = raw;
+  data.dest = g_new (guchar, MAX (raw_size, 1));
+  data.rows = rows;
+  data.n_rows = n_rows;
+  data.max_length = 0;
+  for (i = 0; i < n_rows; i++)
+    data.max_length = MAX (data.max_length, rows[i].length);
+  data.bpp = bpp;
+  data.filter = filter;
+
+  webx_threads_run ((WebxThreadFunc) webx_png_filter_job,
+                    CLAMP (n_rows / WEBX_FILTER_ROWS,
+                           1, webx_threads_get_count ()),
+                    &data);
+
+  return data.dest;
+}
+
+/* Unfiltered scanlines of all passes of rgb(a) pixels of src_bpp
+ * bytes, keeping bpp of their channels: rgb(a) as it is, rgb of rgba
+ * or (bpp 2) gray and alpha of rgba. */
+static guchar*
+webx_png_pack_rgb (const guchar *pixels,
+                   gint          width,
+                   gint          height,
+                   gint          rowstride,
+                   gint          src_bpp,
+                   gint          bpp,
+                   gboolean      interlace,
+                   gsize        *size)
+{
+  const WebxPngPass    *passes;
+  const WebxPngPass    *pass;
+  const guchar         *src;
+  guchar               *raw;
+  guchar               *dest;
+  gint                  n_passes;
+  gint                  pass_width;
+  gint                  pass_height;
+  gint                  i, x, y;
+
+  passes = interlace ? webx_png_passes : webx_png_no_passes;
+  n_passes = interlace ? 7 : 1;
+
+  *size = 0;
+  for (i = 0; i < n_passes; i++)
+    {
+      pass = &passes[i];
+      pass_width = (width - pass->x + pass->dx - 1) / pass->dx;
+      pass_height = (height - pass->y + pass->dy - 1) / pass->dy;
+      if (pass_width <= 0 || pass_height <= 0)
+        continue;
+
+      *size += (gsize) pass_height * (1 + pass_width * bpp);
+    }
+
+  raw = g_new (guchar, MAX (*size, 1));
+  dest = raw;
+  for (i = 0; i < n_passes; i++)
+    {
+      pass = &passes[i];
+      pass_width = (width - pass->x + pass->dx - 1) / pass->dx;
+      pass_height = (height - pass->y + pass->dy - 1) / pass->dy;
+      if (pass_width <= 0 || pass_height <= 0)
+        continue;
+
+      for (y = 0; y < pass_height; y++)
+        {
+          src = pixels + (gsize) (pass->y + y * pass->dy) * rowstride
+                + pass->x * src_bpp;
+          *dest++ = 0;
+          if (! interlace && bpp == src_bpp)
+            {
+              memcpy (dest, src, pass_width * bpp);
+              dest += pass_width * bpp;
+              continue;
+            }
+
+          for (x = 0; x < pass_width; x++, src += pass->dx * src_bpp)
+            {
+              if (bpp == 2)
+                {
+                  dest[0] = src[0];
+                  dest[1] = src[3];
+                }
+              else
+                {
+                  memcpy (dest, src, bpp);
+                }
+              dest += bpp;
+            }
+        }
+    }
+
+  return raw;
+}
+
+/* Deflates one chunk of one stream as raw deflate data, with previous
+ * window of input as dictionary. Every chunk but the last one ends
+ * with a sync flush, so that chunks can simply be put one after
+ * another. */
+static void
+webx_png_deflate_job (gint            job,
+                      gint            n_jobs,
+                      WebxDeflateJob *data)
+{
+  WebxDeflateStream    *stream;
+  z_stream              z;
+  const guchar         *chunk;
+  guchar               *out;
+  gsize                 start;
+  gsize                 length;
+  gsize                 dict_length;
+  gsize                 out_size;
+  gint                  flush;
+  gint                  ret;
+  gint                  i;
+
+  /* jobs are chunks of all streams, one stream after another */
+  for (i = 0; job >= data->streams[i].n_chunks; i++)
+    job -= data->streams[i].n_chunks;
+  stream = &data->streams[i];
+
+  start = (gsize) job * WEBX_DEFLATE_CHUNK;
+  chunk = stream->raw + start;
+  length = MIN (stream->raw_size - start, WEBX_DEFLATE_CHUNK);
+  flush = (job == stream->n_chunks - 1) ? Z_FINISH : Z_SYNC_FLUSH;
+
+  stream->adlers[job] = adler32 (adler32 (0, NULL, 0), chunk, length);
+
+  memset (&z, 0, sizeof (z));
+  if (deflateInit2 (&z, stream->level, Z_DEFLATED, -15, 8,
+                    stream->strategy) != Z_OK)
+    {
+      g_atomic_int_set (&stream->failed, TRUE);
+      return;
+    }
+
+  if (start > 0)
+    {
+      dict_length = MIN (start, WEBX_DEFLATE_WINDOW);
+      deflateSetDictionary (&z, chunk - dict_length, dict_length);
+    }
+
+  /* flush marker fits in the slack */
+  out_size = deflateBound (&z, length) + 64;
+  out = g_new (guchar, out_size);
+  z.next_in = (Bytef *) chunk;
+  z.avail_in = length;
+  z.next_out = out;
+  z.avail_out = out_size;
+
+  for (;;)
+    {
+      ret = deflate (&z, flush);
+      if (ret == Z_STREAM_END
+          || (ret == Z_OK && flush == Z_SYNC_FLUSH
+              && z.avail_in == 0 && z.avail_out > 0))
+        break;
+      if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+          g_atomic_int_set (&stream->failed, TRUE);
+          break;
+        }
+
+      /* out of room, try again with more */
+      out = g_renew (guchar, out, out_size * 2);
+      z.next_out = out + out_size - z.avail_out;
+      z.avail_out += out_size;
+      out_size *= 2;
+    }
+
+  stream->chunks[job] = out;
+  stream->chunk_sizes[job] = out_size - z.avail_out;
+  deflateEnd (&z);
+}
+
+/* Puts deflated chunks of stream together as zlib stream. */
+static GByteArray*
+webx_png_deflate_join (WebxDeflateStream *stream)
+{
+  /* header with compression level hint, FCHECK included */
+  static const guchar   headers[4][2] =
+  {
+    { 0x78, 0x01 }, { 0x78, 0x5e }, { 0x78, 0x9c }, { 0x78, 0xda }
+  };
+  GByteArray           *data;
+  uLong                 adler;
+  gsize                 length;
+  guchar                buf[4];
+  gint                  i;
+
+  if (stream->level < 2)
+    i = 0;
+  else if (stream->level < 6)
+    i = 1;
+  else if (stream->level == 6)
+    i = 2;
+  else
+    i = 3;
+
+  data = g_byte_array_sized_new (stream->raw_size / 2 + 64);
+  g_byte_array_append (data, headers[i], 2);
+
+  adler = stream->adlers[0];
+  for (i = 0; i < stream->n_chunks; i++)
+    {
+      g_byte_array_append (data, stream->chunks[i], stream->chunk_sizes[i]);
+      if (i > 0)
+        {
+          length = MIN (stream->raw_size - (gsize) i * WEBX_DEFLATE_CHUNK,
+                        WEBX_DEFLATE_CHUNK);
+          adler = adler32_combine (adler, stream->adlers[i], length);
+        }
+    }
+
+  buf[0] = adler >> 24;
+  buf[1] = adler >> 16;
+  buf[2] = adler >> 8;
+  buf[3] = adler;
+  g_byte_array_append (data, buf, 4);
+
+  return data;
+}
+
+/* Makes zlib stream of raw with each of strategies, chunks of all of
+ * them deflated in parallel the way pigz does it. Output is the same
+ * with any number of threads. Failed streams are NULL. */
+static void
+webx_png_deflate (const guchar *raw,
+                  gsize         raw_size,
+                  gint          level,
+                  const gint   *strategies,
+                  gint          n_strategies,
+                  GByteArray  **results)
+{
+  WebxDeflateStream     streams[G_N_ELEMENTS (webx_png_strategies)];
+  WebxDeflateJob        data;
+  gint                  n_jobs = 0;
+  gint                  i, j;
+
+  for (i = 0; i < n_strategies; i++)
+    {
+      streams[i].raw = raw;
+      streams[i].raw_size = raw_size;
+      streams[i].level = CLAMP (level, 0, 9);
+      streams[i].strategy = strategies[i];
+      streams[i].n_chunks = MAX ((raw_size + WEBX_DEFLATE_CHUNK - 1)
+                                 / WEBX_DEFLATE_CHUNK, 1);
+      streams[i].chunks = g_new0 (guchar *, streams[i].n_chunks);
+      streams[i].chunk_sizes = g_new0 (gsize, streams[i].n_chunks);
+      streams[i].adlers = g_new (uLong, streams[i].n_chunks);
+      streams[i].failed = FALSE;
+      n_jobs += streams[i].n_chunks;
+    }
+
+  data.streams = streams;
+  data.n_streams = n_strategies;
+  webx_threads_run ((WebxThreadFunc) webx_png_deflate_job, n_jobs, &data);
+
+  for (i = 0; i < n_strategies; i++)
+    {
+      results[i] = NULL;
+      if (! streams[i].failed)
+        results[i] = webx_png_deflate_join (&streams[i]);
+
+      for (j = 0; j < streams[i].n_chunks; j++)
+        g_free (streams[i].chunks[j]);
+      g_free (streams[i].chunks);
+      g_free (streams[i].chunk_sizes);
+      g_free (streams[i].adlers);
+    }
+}
+
+/* Filters unfiltered scanlines and deflates them with every filter
+ * and strategy effort allows, keeping the smallest zlib stream. Each
+ * filter is deflated with all strategies at once. Search stops after
+ * time_limit seconds, if not 0; the first filter is always tried.
+ * Returns NULL if zlib fails. */
+static GByteArray*
+webx_png_compress (const guchar     *raw,
+                   gsize             raw_size,
+                   const WebxPngRow *rows,
+                   gint              n_rows,
+                   gint              bpp,
+                   const gint       *filters,
+                   gint              compression,
+                   gint              effort,
+                   gdouble           time_limit)
+{
+  GByteArray           *results[G_N_ELEMENTS (webx_png_strategies)];
+  GByteArray           *best = NULL;
+  GTimer               *timer;
+  guchar               *filtered;
+  gint                  n_filters;
+  gint                  n_strategies;
+  gint                  i, j;
+
+  effort = CLAMP (effort, 1, WEBX_PNG_MAX_EFFORT);
+  n_filters = webx_png_effort_filters[effort - 1];
+  n_strategies = webx_png_effort_strategies[effort - 1];
+  /* strategies only matter to compressed data */
+  if (compression <= 0)
+    n_strategies = 1;
+
+  timer = g_timer_new ();
+  for (i = 0; i < n_filters; i++)
+    {
+      if (i > 0 && time_limit > 0.0
+          && g_timer_elapsed (timer, NULL) > time_limit)
+        break;
+
+      filtered = NULL;
+      if (filters[i] != 0)
+        filtered = webx_png_filter_rows (raw, raw_size, rows, n_rows,
+                                         bpp, filters[i]);
+      webx_png_deflate (filtered ? filtered : raw, raw_size, compression,
+                        webx_png_strategies, n_strategies, results);
+      g_free (filtered);
+
+      /* ties go to what came first */
+      for (j = 0; j < n_strategies; j++)
+        {
+          if (results[j] && (! best || results[j]->len < best->len))
+            {
+              if (best)
+                g_byte_array_free (best, TRUE);
+              best = results[j];
+            }
+          else if (results[j])
+            {
+              g_byte_array_free (results[j], TRUE);
+            }
+        }
+    }
+  g_timer_destroy (timer);
+
+  return best;
+}
+
+/* Reverts filters of scanlines in place. Returns FALSE if there is
+ * unknown filter type. */
+static gboolean
+webx_png_unfilter_rows (guchar           *raw,
+                        const WebxPngRow *rows,
+                        gint              n_rows,
+                        gint              bpp)
+{
+  const WebxPngRow     *row;
+  guchar               *src;
+  const guchar         *prev;
+  gint                  type;
+  gint                  a, b, c;
+  gint                  i, j;
+
+  for (i = 0; i < n_rows; i++)
+    {
+      row = &rows[i];
+      type = raw[row->offset];
+      src = raw + row->offset + 1;
+      prev = row->first ? NULL : raw + row[-1].offset + 1;
+      if (type > 4)
+        return FALSE;
+
+      for (j = 0; j < row->length && type != 0; j++)
+        {
+          a = (j >= bpp) ? src[j - bpp] : 0;
+          b = prev ? prev[j] : 0;
+          c = (prev && j >= bpp) ? prev[j - bpp] : 0;
+
+          switch (type)
+            {
+            case 1:
+              src[j] += a;
+              break;
+            case 2:
+              src[j] += b;
+              break;
+            case 3:
+              src[j] += (a + b) >> 1;
+              break;
+            default:
+              src[j] += webx_png_paeth (a, b, c);
+              break;
+            }
+        }
+      raw[row->offset] = 0;
+    }
+
+  return TRUE;
+}
+
+/* Deflates filtered scanlines as single zlib stream with strategy of
+ * job at highest level and memory use, a piece at a time to report
+ * progress and stop when cancelled. Result is NULL if it didn't
+ * finish. */
+static void
+webx_png_optimize_job (gint             job,
+                       gint             n_jobs,
+                       WebxOptimizeJob *data)
+{
+  GByteArray           *result;
+  z_stream              z;
+  gsize                 start;
+  gsize                 length;
+  gint                  flush;
+  gint                  ret;
+  gint                  done;
+
+  data->results[job] = NULL;
+
+  memset (&z, 0, sizeof (z));
+  if (deflateInit2 (&z, Z_BEST_COMPRESSION, Z_DEFLATED, 15, 9,
+                    webx_png_strategies[job]) != Z_OK)
+    return;
+
+  /* bound holds for whole stream however it is fed */
+  result = g_byte_array_new ();
+  g_byte_array_set_size (result, deflateBound (&z, data->raw_size));
+  z.next_out = result->data;
+  z.avail_out = result->len;
+
+  for (start = 0; ! g_atomic_int_get (&data->progress->cancelled);
+       start += length)
+    {
+      length = MIN (data->raw_size - start, WEBX_OPTIMIZE_PIECE);
+      flush = (start + length == data->raw_size) ? Z_FINISH : Z_NO_FLUSH;
+      z.next_in = (Bytef *) data->filtered + start;
+      z.avail_in = length;
+
+      ret = deflate (&z, flush);
+      if (z.avail_in > 0
+          || (flush == Z_FINISH && ret != Z_STREAM_END)
+          || (flush == Z_NO_FLUSH && ret != Z_OK))
+        break;
+
+      done = g_atomic_int_exchange_and_add (&data->done, 1) + 1;
+      g_atomic_int_set (&data->progress->done,
+                        (gint64) done * 1000 / data->n_pieces);
+
+      if (flush == Z_FINISH)
+        {
+          g_byte_array_set_size (result, result->len - z.avail_out);
+          data->results[job] = result;
+          result = NULL;
+          break;
+        }
+    }
+
+  deflateEnd (&z);
+  if (result)
+    g_byte_array_free (result, TRUE);
+}
+
+static guint32
+webx_png_get_uint32 (const guchar *data)
+{
+  return ((guint32) data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+/* Signature and header chunk. */
+static GByteArray*
+webx_png_start (gint            width,
+                gint            height,
+                gint            depth,
+                gint            color_type,
+                gboolean        interlace,
+                gsize           reserve)
+{
+  static const guchar   signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  GByteArray           *data;
+  guchar                header[13];
+
+  header[0] = width >> 24;
+  header[1] = width >> 16;
+  header[2] = width >> 8;
+  header[3] = width;
+  header[4] = height >> 24;
+  header[5] = height >> 16;
+  header[6] = height >> 8;
+  header[7] = height;
+  header[8] = depth;
+  header[9] = color_type;
+  header[10] = 0;               /* deflate */
+  header[11] = 0;               /* adaptive filtering */
+  header[12] = interlace ? 1 : 0;
+
+  data = g_byte_array_sized_new (reserve + 64);
+  g_byte_array_append (data, signature, 8);
+  webx_png_append_chunk (data, "IHDR", header, 13);
+
+  return data;
+}
+
+/* Puts zlib stream into IDAT and closes file. Frees data and returns
+ * NULL if there is no stream. */
+static GByteArray*
+webx_png_finish (GByteArray   *data,
+                 GByteArray   *compressed)
+{
+  if (! compressed)
+    {
+      g_byte_array_free (data, TRUE);
+      return NULL;
+    }
+
+  webx_png_append_chunk (data, "IDAT", compressed->data, compressed->len);
+  webx_png_append_chunk (data, "IEND", NULL, 0);
+  g_byte_array_free (compressed, TRUE);
+
+  return data;
+}
+
+/* Encodes image as PNG file in memory. Palette colors are reordered
+ * so that translucent ones come first and tRNS chunk stays short.
+ * compression is zlib level 0 .. 9, effort 1 .. WEBX_PNG_MAX_EFFORT
+ * how many filters and strategies are tried, for at most time_limit
+ * seconds (0 for no limit). Returns NULL if zlib fails. */
+GByteArray*
+webx_png_writer_encode (const WebxIndexedImage *image,
+                        gboolean                interlace,
+                        gint                    compression,
+                        gint                    effort,
+                        gdouble                 time_limit)
+{
+  GByteArray           *data;
+  GByteArray           *compressed;
+  WebxPngRow           *rows;
+  guchar                palette[256 * 3];
+  guchar                alpha[256];
+  guchar                map[256];
+  guchar               *raw;
+  gsize                 raw_size;
+  gint                  n_rows;
+  gint                  n_colors = 0;
+  gint                  n_translucent = 0;
+  gint                  depth;
+  gint                  opacity;
+  gint                  pass;
+  gint                  i;
+
+  g_return_val_if_fail (image != NULL, NULL);
+  g_return_val_if_fail (image->width > 0 && image->height > 0, NULL);
+
+  /* translucent colors in first pass, opaque in second */
+  for (pass = 0; pass < 2; pass++)
+    for (i = 0; i < image->n_colors; i++)
+      {
+        if (image->has_alpha)
+          opacity = image->alpha[i];
+        else
+          opacity = (i == image->transparent) ? 0 : 255;
+        if ((opacity < 255) != (pass == 0))
+          continue;
+
+        map[i] = n_colors;
+        memcpy (palette + n_colors * 3, image->palette + i * 3, 3);
+        alpha[n_colors] = opacity;
+        n_colors++;
+        if (pass == 0)
+          n_translucent = n_colors;
+      }
+  if (n_colors < 1)
+    {
+      /* PLTE can't be empty */
+      memset (palette, 0, 3);
+      n_colors = 1;
+    }
+
+  depth = webx_png_get_depth (n_colors);
+  raw = webx_png_pack (image, map, depth, interlace, &raw_size);
+  rows = webx_png_get_rows (image->width, image->height, depth, interlace,
+                            &n_rows, &raw_size);
+  compressed = webx_png_compress (raw, raw_size, rows, n_rows, 1,
+                                  webx_png_indexed_filters,
+                                  compression, effort, time_limit);
+  g_free (rows);
+  g_free (raw);
+
+  data = webx_png_start (image->width, image->height, depth,
+                         3,             /* palette color type */
+                         interlace,
+                         (compressed ? compressed->len : 0) + n_colors * 4);
+  webx_png_append_chunk (data, "PLTE", palette, n_colors * 3);
+  if (n_translucent > 0)
+    webx_png_append_chunk (data, "tRNS", alpha, n_translucent);
+
+  return webx_png_finish (data, compressed);
+}
+
+/* Palette image of rgb(a) pixels already indexed, encoded as above. */
+static GByteArray*
+webx_png_encode_palette (guchar        *indices,
+                         const guint32 *colors,
+                         gint           n_colors,
+                         gint           width,
+                         gint           height,
+                         gboolean       opaque,
+                         gboolean       interlace,
+                         gint           compression,
+                         gint           effort,
+                         gdouble        time_limit)
+{
+  WebxIndexedImage      image;
+  gint                  i;
+
+  image.width = width;
+  image.height = height;
+  image.indices = indices;
+  for (i = 0; i < n_colors; i++)
+    {
+      image.palette[i * 3] = colors[i];
+      image.palette[i * 3 + 1] = colors[i] >> 8;
+      image.palette[i * 3 + 2] = colors[i] >> 16;
+      image.alpha[i] = colors[i] >> 24;
+    }
+  image.has_alpha = ! opaque;
+  image.n_colors = n_colors;
+  image.transparent = -1;
+
+  return webx_png_writer_encode (&image, interlace, compression, effort,
+                                 time_limit);
+}
+
+/* Gray levels of gray rgb(a) pixels in depth bits. */
+static GByteArray*
+webx_png_encode_gray (const guchar *pixels,
+                      gint          width,
+                      gint          height,
+                      gint          rowstride,
+                      gint          bpp,
+                      gint          depth,
+                      gboolean      interlace,
+                      gint          compression,
+                      gint          effort,
+                      gdouble       time_limit)
+{
+  WebxIndexedImage      image;
+  GByteArray           *compressed;
+  WebxPngRow           *rows;
+  guchar                map[256];
+  guchar               *raw;
+  gsize                 raw_size;
+  gint                  n_rows;
+  gint                  i, x, y;
+
+  /* packed like palette indices, level mapped to its top bits */
+  image.width = width;
+  image.height = height;
+  image.indices = g_new (guchar, (gsize) width * height);
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      image.indices[(gsize) y * width + x] =
+        pixels[(gsize) y * rowstride + x * bpp];
+  for (i = 0; i < 256; i++)
+    map[i] = i >> (8 - depth);
+
+  raw = webx_png_pack (&image, map, depth, interlace, &raw_size);
+  g_free (image.indices);
+  rows = webx_png_get_rows (width, height, depth, interlace,
+                            &n_rows, &raw_size);
+  compressed = webx_png_compress (raw, raw_size, rows, n_rows, 1,
+                                  (depth < 8) ? webx_png_indexed_filters
+                                              : webx_png_rgb_filters,
+                                  compression, effort, time_limit);
+  g_free (rows);
+  g_free (raw);
+
+  return webx_png_finish (webx_png_start (width, height, depth,
+                                          0,    /* gray */
+                                          interlace,
+                                          compressed ? compressed->len : 0),
+                          compressed);
+}
+
+/* Truecolor or gray and alpha (bpp 2) image of rgb(a) pixels. */
+static GByteArray*
+webx_png_encode_truecolor (const guchar *pixels,
+                           gint          width,
+                           gint          height,
+                           gint          rowstride,
+                           gint          src_bpp,
+                           gint          bpp,
+                           gboolean      interlace,
+                           gint          compression,
+                           gint          effort,
+                           gdouble       time_limit)
+{
+  GByteArray           *compressed;
+  WebxPngRow           *rows;
+  guchar               *raw;
+  gsize                 raw_size;
+  gint                  n_rows;
+  gint                  color_type;
+
+  raw = webx_png_pack_rgb (pixels, width, height, rowstride, src_bpp, bpp,
+                           interlace, &raw_size);
+  rows = webx_png_get_rows (width, height, bpp * 8, interlace,
+                            &n_rows, &raw_size);
+  compressed = webx_png_compress (raw, raw_size, rows, n_rows, bpp,
+                                  webx_png_rgb_filters,
+                                  compression, effort, time_limit);
+  g_free (rows);
+  g_free (raw);
+
+  if (bpp == 2)
+    color_type = 4;             /* gray and alpha */
+  else if (bpp == 3)
+    color_type = 2;             /* rgb */
+  else
+    color_type = 6;             /* rgba */
+
+  return webx_png_finish (webx_png_start (width, height, 8, color_type,
+                                          interlace,
+                                          compressed ? compressed->len : 0),
+                          compressed);
+}
+
+/* Encodes rgb (bpp 3) or rgba (bpp 4) pixels as PNG file in memory,
+ * compression, effort and time_limit are as above. Pixels are written
+ * in the smallest lossless form: alpha is dropped if all of them are
+ * opaque, palette is used if there are 256 colors or less, gray if
+ * R = G = B, in as few bits per pixel as the levels allow. Each of
+ * that takes one scan of pixels. Returns NULL if zlib fails. */
+GByteArray*
+webx_png_writer_encode_rgb (const guchar *pixels,
+                            gint          width,
+                            gint          height,
+                            gint          rowstride,
+                            gint          bpp,
+                            gboolean      interlace,
+                            gint          compression,
+                            gint          effort,
+                            gdouble       time_limit)
+{
+  GByteArray           *data;
+  guint32               colors[256];
+  guchar               *indices;
+  gboolean              opaque;
+  gint                  gray_depth;
+  gint                  n_colors;
+
+  g_return_val_if_fail (pixels != NULL, NULL);
+  g_return_val_if_fail (width > 0 && height > 0, NULL);
+  g_return_val_if_fail (bpp == 3 || bpp == 4, NULL);
+
+  opaque = (bpp == 3)
+           || webx_pixels_is_opaque (pixels, width, height, rowstride);
+  gray_depth = webx_pixels_get_gray_depth (pixels, width, height,
+                                           rowstride, bpp);
+  indices = g_new (guchar, (gsize) width * height);
+  n_colors = webx_pixels_index (pixels, width, height, rowstride, bpp,
+                                indices, colors, 256);
+
+  /* gray needs no palette, so it wins when it's as deep */
+  if (n_colors > 0
+      && ! (opaque && gray_depth > 0
+            && gray_depth <= webx_png_get_depth (n_colors)))
+    data = webx_png_encode_palette (indices, colors, n_colors,
+                                    width, height, opaque, interlace,
+                                    compression, effort, time_limit);
+  else if (gray_depth > 0 && opaque)
+    data = webx_png_encode_gray (pixels, width, height, rowstride, bpp,
+                                 gray_depth, interlace,
+                                 compression, effort, time_limit);
+  else
+    data = webx_png_encode_truecolor (pixels, width, height, rowstride, bpp,
+                                      opaque ? 3 : (gray_depth ? 2 : 4),
+                                      interlace,
+                                      compression, effort, time_limit);
+  g_free (indices);
+
+  return data;
+}
+
+static gboolean
+webx_png_writer_write (GByteArray  *data,
+                       const gchar *file_name)
+{
+  gboolean      saved;
+
+  if (! data)
+    return FALSE;
+
+  saved = g_file_set_contents (file_name, (const gchar *) data->data,
+                               data->len, NULL);
+  g_byte_array_free (data, TRUE);
+
+  return saved;
+}
+
+/* Files are saved without time limit, so that they don't depend on
+ * speed of machine. */
+gboolean
+webx_png_writer_save (const WebxIndexedImage *image,
+                      gboolean                interlace,
+                      gint                    compression,
+                      gint                    effort,
+                      const gchar            *file_name)
+{
+  g_return_val_if_fail (file_name != NULL, FALSE);
+
+  return webx_png_writer_write (webx_png_writer_encode (image, interlace,
+                                                        compression, effort,
+                                                        0.0),
+                                file_name);
+}
+
+gboolean
+webx_png_writer_save_rgb (const guchar *pixels,
+                          gint          width,
+                          gint          height,
+                          gint          rowstride,
+                          gint          bpp,
+                          gboolean      interlace,
+                          gint          compression,
+                          gint          effort,
+                          const gchar  *file_name)
+{
+  g_return_val_if_fail (file_name != NULL, FALSE);
+
+  return webx_png_writer_write (webx_png_writer_encode_rgb (pixels,
+                                                            width, height,
+                                                            rowstride, bpp,
+                                                            interlace,
+                                                            compression,
+                                                            effort, 0.0),
+                                file_name);
+}
+
+/* Deflates image data stream as small as it gets, see below. Returns
+ * NULL if cancelled or data can't be read. */
+static GByteArray*
+webx_png_optimize_stream (const GByteArray *idat,
+                          gint              width,
+                          gint              height,
+                          gint              depth,
+                          gint              color_type,
+                          gboolean          interlace,
+                          WebxPngProgress  *progress)
+{
+  GByteArray           *results[G_N_ELEMENTS (webx_png_strategies)];
+  GByteArray           *best = NULL;
+  WebxOptimizeJob       job;
+  WebxPngRow           *rows;
+  const gint           *filters;
+  guchar               *raw;
+  guchar               *filtered;
+  guchar               *best_filtered = NULL;
+  gsize                 raw_size;
+  uLongf                inflated;
+  gint                  channels;
+  gint                  bpp;
+  gint                  n_rows;
+  gint                  n_filters;
+  gint                  n_strategies;
+  gint                  i, j;
+
+  switch (color_type)
+    {
+    case 0:
+    case 3:
+      channels = 1;
+      break;
+    case 2:
+      channels = 3;
+      break;
+    case 4:
+      channels = 2;
+      break;
+    case 6:
+      channels = 4;
+      break;
+    default:
+      return NULL;
+    }
+  if (depth <= 0 || width <= 0 || height <= 0)
+    return NULL;
+
+  bpp = (channels * depth + 7) / 8;
+  rows = webx_png_get_rows (width, height, channels * depth, interlace,
+                            &n_rows, &raw_size);
+  raw = g_new (guchar, raw_size);
+  inflated = raw_size;
+  if (uncompress (raw, &inflated, idat->data, idat->len) != Z_OK
+      || inflated != raw_size
+      || ! webx_png_unfilter_rows (raw, rows, n_rows, bpp))
+    {
+      g_free (raw);
+      g_free (rows);
+      return NULL;
+    }
+
+  if (color_type == 3 || depth < 8)
+    filters = webx_png_indexed_filters;
+  else
+    filters = webx_png_rgb_filters;
+  n_filters = G_N_ELEMENTS (webx_png_rgb_filters);
+  n_strategies = G_N_ELEMENTS (webx_png_strategies);
+
+  job.raw_size = raw_size;
+  job.results = results;
+  job.progress = progress;
+  job.done = 0;
+  job.n_pieces = n_filters * n_strategies
+    * ((raw_size + WEBX_OPTIMIZE_PIECE - 1) / WEBX_OPTIMIZE_PIECE);
+
+  for (i = 0; i < n_filters && ! g_atomic_int_get (&progress->cancelled);
+       i++)
+    {
+      if (filters[i] != 0)
+        filtered = webx_png_filter_rows (raw, raw_size, rows, n_rows,
+                                         bpp, filters[i]);
+      else
+        filtered = g_memdup (raw, raw_size);
+      job.filtered = filtered;
+      webx_threads_run ((WebxThreadFunc) webx_png_optimize_job,
+                        n_strategies, &job);
+
+      /* ties go to what came first */
+      for (j = 0; j < n_strategies; j++)
+        {
+          if (results[j] && (! best || results[j]->len < best->len))
+            {
+              if (best)
+                g_byte_array_free (best, TRUE);
+              best = results[j];
+              if (filtered)
+                {
+                  g_free (best_filtered);
+                  best_filtered = filtered;
+                  filtered = NULL;
+                }
+            }
+          else if (results[j])
+            {
+              g_byte_array_free (results[j], TRUE);
+            }
+        }
+      g_free (filtered);
+    }
+  g_free (raw);
+  g_free (rows);
+
+#ifdef HAVE_ZOPFLI
+  if (best && ! g_atomic_int_get (&progress->cancelled))
+    {
+      ZopfliOptions     options;
+      unsigned char    *out = NULL;
+      size_t            out_size = 0;
+
+      /* can't tell how far zopfli is */
+      g_atomic_int_set (&progress->done, -1);
+      ZopfliInitOptions (&options);
+      options.numiterations = CLAMP (WEBX_ZOPFLI_BUDGET / MAX (raw_size, 1),
+                                     1, WEBX_ZOPFLI_ITERATIONS);
+      ZopfliCompress (&options, ZOPFLI_FORMAT_ZLIB,
+                      best_filtered, raw_size, &out, &out_size);
+      if (out_size > 0 && out_size < best->len)
+        {
+          g_byte_array_set_size (best, 0);
+          g_byte_array_append (best, out, out_size);
+        }
+      free (out);
+    }
+#endif
+  g_free (best_filtered);
+
+  if (best && g_atomic_int_get (&progress->cancelled))
+    {
+      g_byte_array_free (best, TRUE);
+      best = NULL;
+    }
+
+  return best;
+}
+
+/* Makes PNG file in memory smaller by exhaustive search: image data
+ * is unfiltered, then filtered with every filter and deflated as one
+ * stream with every strategy at highest level. If built with zopfli,
+ * the smallest of those is deflated once more with it, with fewer
+ * iterations for bigger images as it can't be cancelled. Other chunks
+ * are kept as they are. Takes long, progress tells how far it got and
+ * lets another thread cancel it. Returns NULL if cancelled, if file
+ * can't be read or if nothing smaller was found. */
+GByteArray*
+webx_png_writer_optimize (const guchar    *png,
+                          gsize            size,
+                          WebxPngProgress *progress)
+{
+  static const guchar   signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  GByteArray           *idat;
+  GByteArray           *best = NULL;
+  GByteArray           *data = NULL;
+  gsize                 idat_start = 0;
+  gsize                 idat_end = 0;
+  gsize                 pos;
+  guint32               length;
+  gint                  width = 0;
+  gint                  height = 0;
+  gint                  depth = 0;
+  gint                  color_type = -1;
+  gboolean              interlace = FALSE;
+
+  g_return_val_if_fail (png != NULL, NULL);
+  g_return_val_if_fail (progress != NULL, NULL);
+
+  if (size < 8 || memcmp (png, signature, 8) != 0)
+    return NULL;
+
+  /* image data may be split into many chunks, those follow each other */
+  idat = g_byte_array_new ();
+  for (pos = 8; pos + 12 <= size; pos += 12 + length)
+    {
+      length = webx_png_get_uint32 (png + pos);
+      if (length > size - pos - 12)
+        break;
+
+      if (memcmp (png + pos + 4, "IHDR", 4) == 0 && length == 13)
+        {
+          width = webx_png_get_uint32 (png + pos + 8);
+          height = webx_png_get_uint32 (png + pos + 12);
+          depth = png[pos + 16];
+          color_type = png[pos + 17];
+          interlace = (png[pos + 20] == 1);
+        }
+      else if (memcmp (png + pos + 4, "IDAT", 4) == 0)
+        {
+          if (! idat_start)
+            idat_start = pos;
+          idat_end = pos + 12 + length;
+          g_byte_array_append (idat, png + pos + 8, length);
+        }
+    }
+
+  g_atomic_int_set (&progress->done, 0);
+  if (idat_start)
+    best = webx_png_optimize_stream (idat, width, height, depth,
+                                     color_type, interlace, progress);
+
+  if (best && best->len < idat->len)
+    {
+      data = g_byte_array_sized_new (size);
+      g_byte_array_append (data, png, idat_start);
+      webx_png_append_chunk (data, "IDAT", best->data, best->len);
+      g_byte_array_append (data, png + idat_end, size - idat_end);
+    }
+  g_atomic_int_set (&progress->done, 1000);
+
+  if (best)
+    g_byte_array_free (best, TRUE);
+  g_byte_array_free (idat, TRUE);
+
+  return data;
+}
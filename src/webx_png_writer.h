@@ -0,0 +1,87 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+   PNG writer for indexed images made by own quantizer. GIMP's PNG
+   plug-in saves only opaque or fully transparent palette colors, this
+   one writes alpha of each color (tRNS chunk) too. Truecolor images
+   are written here as well, in the smallest lossless form: without
+   alpha, as palette, gray or of fewer bits when pixels allow. Image
+   data is deflated in chunks on all cores, the result doesn't depend
+   on number of threads. Higher effort tries more row filters and zlib
+   strategies and keeps the smallest.
+   Saved files can be optimized once more by exhaustive search, which
+   takes long and is meant to be run on a background thread.
+*/
+
+#ifndef __WEBX_PNG_WRITER_H__
+#define __WEBX_PNG_WRITER_H__
+
+#include "webx_quantizer.h"
+
+/* efforts 1 .. 3 try 1, 6 and 18 filter and strategy combinations */
+#define WEBX_PNG_MAX_EFFORT             3
+/* seconds a preview may spend on trying more of them */
+#define WEBX_PNG_PREVIEW_TIME_LIMIT     0.3
+
+/* shared with thread running webx_png_writer_optimize () */
+typedef struct
+{
+  /* permille done, -1 while it can't be told */
+  gint          done;
+  /* set to TRUE to stop it */
+  gint          cancelled;
+} WebxPngProgress;
+
+GByteArray*       webx_png_writer_encode        (const WebxIndexedImage *image,
+                                                 gboolean       interlace,
+                                                 gint           compression,
+                                                 gint           effort,
+                                                 gdouble        time_limit);
+gboolean          webx_png_writer_save          (const WebxIndexedImage *image,
+                                                 gboolean       interlace,
+                                                 gint           compression,
+                                                 gint           effort,
+                                                 const gchar   *file_name);
+
+GByteArray*       webx_png_writer_encode_rgb    (const guchar  *pixels,
+                                                 gint           width,
+                                                 gint           height,
+                                                 gint           rowstride,
+                                                 gint           bpp,
+                                                 gboolean       interlace,
+                                                 gint           compression,
+                                                 gint           effort,
+                                                 gdouble        time_limit);
+gboolean          webx_png_writer_save_rgb      (const guchar  *pixels,
+                                                 gint           width,
+                                                 gint           height,
+                                                 gint           rowstride,
+                                                 gint           bpp,
+                                                 gboolean       interlace,
+                                                 gint           compression,
+                                                 gint           effort,
+                                                 const gchar   *file_name);
+
+GByteArray*       webx_png_writer_optimize      (const guchar  *png,
+                                                 gsize          size,
+                                                 WebxPngProgress *progress);
+
+#endif /* __WEBX_PNG_WRITER_H__ */
@@ -20,6 +20,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <gtk/gtk.h>
 #include <gdk/gdk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
@@ -27,6 +29,7 @@
 #include <libgimp/gimpui.h>
 
 #include "webx_main.h"
+#include "webx_pixels.h"
 #include "webx_preview.h"
 #include "cursors.h"
 
@@ -35,6 +38,11 @@
 #define WEBX_PREVIEW_PADDING    20
 #define WEBX_NAV_PEN_WIDTH      3
 #define WEBX_THUMBNAIL_SIZE     128
+#define WEBX_TILE_SIZE          128
+/* drop background tiles when there are too many of them */
+#define WEBX_MAX_TILES          256
+/* differences are amplified, so that small errors are visible */
+#define WEBX_DIFF_GAIN          4
 
 #define WEBX_DRAG_HAND          (1<<0)
 #define WEBX_DRAG_LEFT          (1<<1)
@@ -56,6 +64,8 @@ enum
 enum
 {
   CROP_CHANGED,
+  VIEWPORT_CHANGED,
+  LAYOUT_CHANGED,
   LAST_SIGNAL
 };
 
@@ -108,8 +118,47 @@ static void      webx_preview_crop_drag         (WebxPreview    *preview,
 static void      webx_preview_update_cursor     (WebxPreview    *preview,
                                                  gint            x,
                                                  gint            y);
-
-static GdkPixbuf* webx_preview_create_background (GdkPixbuf *src);
+static void      webx_preview_draw_original     (WebxPreview    *preview,
+                                                 GtkWidget      *widget,
+                                                 GdkRectangle   *bg_rect,
+                                                 GdkRectangle   *clipbox);
+static void      webx_preview_draw_target       (WebxPreview    *preview,
+                                                 GtkWidget      *widget,
+                                                 GdkPixbuf      *target,
+                                                 GdkRectangle   *target_region,
+                                                 GHashTable    **diff_tiles,
+                                                 GdkRectangle   *bg_rect,
+                                                 GdkRectangle   *target_rect,
+                                                 GdkRectangle   *clipbox);
+static void      webx_preview_draw_diff         (WebxPreview    *preview,
+                                                 GtkWidget      *widget,
+                                                 GdkPixbuf      *target,
+                                                 GdkRectangle   *target_region,
+                                                 GHashTable     *diff_tiles,
+                                                 GdkRectangle   *target_rect,
+                                                 GdkRectangle   *area);
+static GdkPixbuf* webx_preview_get_diff_tile    (WebxPreview    *preview,
+                                                 GHashTable     *diff_tiles,
+                                                 GdkPixbuf      *target,
+                                                 GdkRectangle   *target_region,
+                                                 gint            tile_x,
+                                                 gint            tile_y,
+                                                 GdkRectangle   *tile_rect);
+static void      webx_preview_clear_diff        (WebxPreviewPane *pane);
+static void      webx_preview_draw_label        (WebxPreview    *preview,
+                                                 GtkWidget      *widget,
+                                                 const gchar    *name,
+                                                 gint            file_size,
+                                                 gboolean        estimated);
+
+static void     webx_preview_draw_background     (WebxPreview  *preview,
+                                                  GtkWidget    *widget,
+                                                  GdkRectangle *bg_rect,
+                                                  GdkRectangle *clipbox);
+static GdkPixbuf* webx_preview_get_background_tile (WebxPreview *preview,
+                                                    gint         tile_x,
+                                                    gint         tile_y);
+static void     webx_preview_clear_background    (WebxPreview  *preview);
 
 static void     webx_preview_get_background_rect (WebxPreview  *preview,
                                                   GdkRectangle *rect);
@@ -118,6 +167,9 @@ static void     webx_preview_get_target_rect     (WebxPreview  *preview,
 static gint     webx_preview_get_drag_type       (WebxPreview  *preview,
                                                   gint          x,
                                                   gint          y);
+static gboolean webx_preview_get_visible_rect    (WebxPreview  *preview,
+                                                  GdkRectangle *rect);
+static void     webx_preview_viewport_changed    (WebxPreview  *preview);
 
 static gboolean webx_preview_nav_button_press   (GtkWidget      *widget,
                                                  GdkEventButton *event,
@@ -132,6 +184,14 @@ static gboolean webx_preview_nav_popup_event    (GtkWidget      *widget,
 static gboolean webx_preview_nav_popup_expose   (GtkWidget      *widget,
                                                  GdkEventExpose *event,
                                                  WebxPreview    *preview);
+static void     webx_preview_nav_thumbnail_size (WebxPreview    *preview,
+                                                 gint           *width,
+                                                 gint           *height);
+static gboolean webx_preview_nav_thumbnail_create (WebxPreview  *preview);
+
+static GdkPixbuf* webx_preview_get_mipmap       (WebxPreview    *preview,
+                                                 gdouble         scale);
+static void     webx_preview_clear_mipmaps      (WebxPreview    *preview);
 
 /* zoom functionality */
 static void     webx_preview_zoom               (WebxPreview   *preview,
@@ -146,6 +206,22 @@ static gint     webx_preview_closest_zoomlevel  (WebxPreview   *preview);
 
 static void     webx_preview_show_toggled       (WebxPreview   *preview);
 
+/* comparison panes */
+static GtkWidget* webx_preview_pane_new         (WebxPreview   *preview,
+                                                 gint           pane);
+static gboolean webx_preview_pane_expose        (GtkWidget      *widget,
+                                                 GdkEventExpose *event,
+                                                 WebxPreview    *preview);
+static void     webx_preview_pane_realize       (GtkWidget      *widget,
+                                                 WebxPreview    *preview);
+static void     webx_preview_layout_combo_changed (GtkWidget    *combo,
+                                                   WebxPreview  *preview);
+static void     webx_preview_scroll_panes       (WebxPreview   *preview,
+                                                 gint           dx,
+                                                 gint           dy);
+static void     webx_preview_queue_draw_panes   (WebxPreview   *preview);
+static void     webx_preview_clear_panes        (WebxPreview   *preview);
+
 G_DEFINE_TYPE (WebxPreview, webx_preview, GTK_TYPE_VBOX)
 
 #define parent_class webx_preview_parent_class
@@ -181,6 +257,24 @@ webx_preview_class_init (WebxPreviewClass *klass)
                   g_cclosure_marshal_VOID__POINTER,
                   G_TYPE_NONE, 1,
                   GDK_TYPE_RECTANGLE);
+  webx_preview_signals[VIEWPORT_CHANGED] =
+    g_signal_new ("viewport-changed",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_FIRST,
+                  G_STRUCT_OFFSET (WebxPreviewClass, viewport_changed),
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__POINTER,
+                  G_TYPE_NONE, 1,
+                  G_TYPE_POINTER);
+  webx_preview_signals[LAYOUT_CHANGED] =
+    g_signal_new ("layout-changed",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_FIRST,
+                  G_STRUCT_OFFSET (WebxPreviewClass, layout_changed),
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__INT,
+                  G_TYPE_NONE, 1,
+                  G_TYPE_INT);
 }
 
 static void
@@ -189,12 +283,18 @@ webx_preview_init (WebxPreview *preview)
   preview->area = NULL;
   preview->width = 0;
   preview->height = 0;
-  preview->background = NULL;
+  preview->background_tiles = NULL;
   preview->target = NULL;
   preview->target_rect.x = 0;
   preview->target_rect.y = 0;
   preview->target_rect.width = 0;
   preview->target_rect.height = 0;
+  preview->target_region.x = 0;
+  preview->target_region.y = 0;
+  preview->target_region.width = 0;
+  preview->target_region.height = 0;
+  preview->file_size = 0;
+  preview->n_panes = 1;
   preview->zoom = 1.0;
   preview->cursor_type = 0;
   preview->drag_mode = 0;
@@ -208,6 +308,7 @@ webx_preview_new (gint width,
   GtkWidget    *image;
   GtkWidget    *button_bar;
   GtkWidget    *button;
+  GtkWidget    *box;
   GtkObject    *adj;
   gchar        *zoom_labels[G_N_ELEMENTS (webx_zoomlevels)+2];
   gint          i;
@@ -224,10 +325,25 @@ webx_preview_new (gint width,
   gtk_box_pack_start (GTK_BOX (preview), preview->table, TRUE, TRUE, 0);
   gtk_widget_show (preview->table);
 
-  preview->area = gtk_drawing_area_new ();
+  /* panes are laid out in two rows, all of them get the same size */
+  box = gtk_vbox_new (TRUE, 2);
   gtk_table_attach (GTK_TABLE (WEBX_PREVIEW (preview)->table),
-                    preview->area, 0, 1, 0, 1,
+                    box, 0, 1, 0, 1,
                     GTK_EXPAND | GTK_FILL, GTK_EXPAND | GTK_FILL, 0, 0);
+  gtk_widget_show (box);
+
+  for (i = 0; i < G_N_ELEMENTS (preview->pane_rows); i++)
+    {
+      preview->pane_rows[i] = gtk_hbox_new (TRUE, 2);
+      gtk_box_pack_start (GTK_BOX (box), preview->pane_rows[i],
+                          TRUE, TRUE, 0);
+    }
+  gtk_widget_show (preview->pane_rows[0]);
+
+  preview->area = gtk_drawing_area_new ();
+  gtk_box_pack_start (GTK_BOX (preview->pane_rows[0]), preview->area,
+                      TRUE, TRUE, 0);
+  preview->panes[0].area = preview->area;
 
   gtk_widget_add_events (GTK_WIDGET (preview->area),
                          GDK_POINTER_MOTION_MASK
@@ -262,6 +378,14 @@ webx_preview_new (gint width,
                     preview);
 
   gtk_widget_show (preview->area);
+
+  for (i = 1; i < WEBX_PREVIEW_MAX_PANES; i++)
+    {
+      preview->panes[i].area = webx_preview_pane_new (preview, i);
+      gtk_box_pack_start (GTK_BOX (preview->pane_rows[i / 2]),
+                          preview->panes[i].area,
+                          TRUE, TRUE, 0);
+    }
   
   adj = gtk_adjustment_new (0, 0, width -1, 1.0,
                             width, width);
@@ -321,6 +445,34 @@ webx_preview_new (gint width,
                             preview);
   gtk_widget_show (preview->show_preview);
 
+  preview->show_diff = gtk_check_button_new_with_label (_("Show errors"));
+  gtk_box_pack_start (GTK_BOX (button_bar), preview->show_diff,
+                      FALSE, FALSE, 0);
+  g_signal_connect_swapped (preview->show_diff, "toggled",
+                            G_CALLBACK (webx_preview_show_toggled),
+                            preview);
+  gtk_widget_show (preview->show_diff);
+
+  preview->visible_only =
+      gtk_check_button_new_with_label (_("Visible area only"));
+  gtk_box_pack_start (GTK_BOX (button_bar), preview->visible_only,
+                      FALSE, FALSE, 0);
+  g_signal_connect_swapped (preview->visible_only, "toggled",
+                            G_CALLBACK (webx_preview_viewport_changed),
+                            preview);
+  gtk_widget_show (preview->visible_only);
+
+  preview->layout_combo = gimp_int_combo_box_new (_("1-Up"), 1,
+                                                  _("2-Up"), 2,
+                                                  _("4-Up"), 4,
+                                                  NULL);
+  gtk_box_pack_start (GTK_BOX (button_bar), preview->layout_combo,
+                      FALSE, FALSE, 4);
+  gtk_widget_show (preview->layout_combo);
+  gimp_int_combo_box_connect (GIMP_INT_COMBO_BOX (preview->layout_combo), 1,
+                              G_CALLBACK (webx_preview_layout_combo_changed),
+                              preview);
+
   preview->progress_bar = gtk_progress_bar_new ();
   gtk_box_pack_start (GTK_BOX (button_bar), preview->progress_bar,
                       TRUE, TRUE, 4);
@@ -384,6 +536,7 @@ static void
 webx_preview_destroy (GtkObject *object)
 {
   WebxPreview *preview;
+  gint         i;
 
   preview = WEBX_PREVIEW (object);
   if (preview->target)
@@ -391,16 +544,30 @@ webx_preview_destroy (GtkObject *object)
       g_object_unref (preview->target);
       preview->target = NULL;
     }
-  if (preview->background)
-    {
-      g_object_unref (preview->background);
-      preview->background = NULL;
-    }
+  webx_preview_clear_background (preview);
   if (preview->original)
     {
       g_object_unref (preview->original);
       preview->original = NULL;
     }
+  if (preview->nav_idle_id)
+    {
+      g_source_remove (preview->nav_idle_id);
+      preview->nav_idle_id = 0;
+    }
+  if (preview->nav_thumbnail)
+    {
+      g_object_unref (preview->nav_thumbnail);
+      preview->nav_thumbnail = NULL;
+    }
+  webx_preview_clear_mipmaps (preview);
+  webx_preview_clear_panes (preview);
+  for (i = 0; i < WEBX_PREVIEW_MAX_PANES; i++)
+    {
+      webx_preview_clear_diff (&preview->panes[i]);
+      g_free (preview->panes[i].name);
+      preview->panes[i].name = NULL;
+    }
 
   if (GTK_OBJECT_CLASS (parent_class)->destroy)
     GTK_OBJECT_CLASS (parent_class)->destroy (GTK_OBJECT (object));
@@ -414,9 +581,14 @@ webx_preview_update_file_size (WebxPreview     *preview,
   if (file_size)
     {
       gchar text[512];
-      g_snprintf (text, sizeof (text),
-                  _("File size: %02.01f kB"),
-                  (gdouble) file_size / 1024.0);
+      if (preview->target_region.width)
+        g_snprintf (text, sizeof (text),
+                    _("File size: ~%02.01f kB (estimated)"),
+                    (gdouble) file_size / 1024.0);
+      else
+        g_snprintf (text, sizeof (text),
+                    _("File size: %02.01f kB"),
+                    (gdouble) file_size / 1024.0);
       gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (preview->progress_bar),
                                      0.0);
       gtk_progress_bar_set_text (GTK_PROGRESS_BAR (preview->progress_bar),
@@ -442,17 +614,22 @@ webx_preview_begin_update (WebxPreview         *preview)
 void
 webx_preview_update_target (WebxPreview        *preview,
                             GdkPixbuf          *target,
+                            GdkRectangle       *target_region,
                             gint                file_size)
 {
   GdkRectangle clipbox;
 
   g_return_if_fail (WEBX_IS_PREVIEW (preview));
+  g_return_if_fail (target_region != NULL);
 
   if (target)
     g_object_ref_sink (G_OBJECT (target));
   if (preview->target)
     g_object_unref (G_OBJECT (preview->target));
   preview->target = target;
+  preview->target_region = *target_region;
+  preview->file_size = file_size;
+  webx_preview_clear_diff (&preview->panes[1]);
 
   webx_preview_get_target_rect (preview, &clipbox);
   clipbox.x -= WEBX_PREVIEW_PADDING;
@@ -463,6 +640,7 @@ webx_preview_update_target (WebxPreview        *preview,
   if (GTK_WIDGET_REALIZED (preview->area))
     gdk_window_invalidate_rect (GDK_WINDOW (preview->area->window),
                                 &clipbox, FALSE);
+  webx_preview_queue_draw_panes (preview);
 
   webx_preview_update_file_size (preview, file_size);
 }
@@ -472,16 +650,24 @@ webx_preview_update (WebxPreview       *preview,
                      GdkPixbuf         *original,
                      GdkPixbuf         *target,
                      GdkRectangle      *target_rect,
+                     GdkRectangle      *target_region,
                      gint               file_size)
 {
+  gint  i;
+
   g_return_if_fail (WEBX_IS_PREVIEW (preview));
   g_return_if_fail (target_rect != NULL);
+  g_return_if_fail (target_region != NULL);
   
   if (target)
     g_object_ref_sink (G_OBJECT (target));
   if (preview->target)
     g_object_unref (G_OBJECT (preview->target));
   preview->target = target;
+  preview->target_region = *target_region;
+  preview->file_size = file_size;
+  for (i = 1; i < WEBX_PREVIEW_MAX_PANES; i++)
+    webx_preview_clear_diff (&preview->panes[i]);
 
   if (original)
     g_object_ref_sink (G_OBJECT (original));
@@ -491,16 +677,29 @@ webx_preview_update (WebxPreview       *preview,
   preview->width = gdk_pixbuf_get_width (original);
   preview->height = gdk_pixbuf_get_height (original);
 
-  if (preview->background)
-    g_object_unref (preview->background);
+  /* navigation thumbnail is prepared when idle,
+   * so that it's ready when popup is opened */
+  webx_preview_clear_mipmaps (preview);
+  if (preview->nav_thumbnail)
+    {
+      g_object_unref (preview->nav_thumbnail);
+      preview->nav_thumbnail = NULL;
+    }
+  if (! preview->nav_idle_id)
+    preview->nav_idle_id =
+      g_idle_add ((GSourceFunc) webx_preview_nav_thumbnail_create, preview);
+
+  /* background is dimmed lazily, only where it is drawn */
+  webx_preview_clear_background (preview);
   if (preview->original)
-    preview->background = webx_preview_create_background (preview->original);
-  else
-    preview->background = NULL;
+    preview->background_tiles =
+      g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                             NULL, g_object_unref);
 
   preview->target_rect = *target_rect;
 
   gtk_widget_queue_draw (preview->area);
+  webx_preview_queue_draw_panes (preview);
 
   webx_preview_update_file_size (preview, file_size);
 }
@@ -519,10 +718,13 @@ webx_preview_resize (WebxPreview  *preview,
       g_object_unref (preview->target);
       preview->target = NULL;
     }
-  if (preview->background)
+  webx_preview_clear_diff (&preview->panes[1]);
+  webx_preview_clear_panes (preview);
+  webx_preview_clear_background (preview);
+  if (preview->nav_thumbnail)
     {
-      g_object_unref (preview->background);
-      preview->background = NULL;
+      g_object_unref (preview->nav_thumbnail);
+      preview->nav_thumbnail = NULL;
     }
 
   webx_preview_get_background_rect (preview, &old_clipbox);
@@ -549,6 +751,7 @@ webx_preview_resize (WebxPreview  *preview,
   gdk_rectangle_union (&old_clipbox, &clipbox, &clipbox);
   if (GTK_WIDGET_REALIZED (preview->area))
       gdk_window_invalidate_rect (preview->area->window, &clipbox, FALSE);
+  webx_preview_queue_draw_panes (preview);
 }
 
 void
@@ -564,6 +767,8 @@ webx_preview_crop (WebxPreview  *preview,
       g_object_unref (preview->target);
       preview->target = NULL;
     }
+  webx_preview_clear_diff (&preview->panes[1]);
+  webx_preview_clear_panes (preview);
 
   webx_preview_get_target_rect (preview, &old_clipbox);
   old_clipbox.x -= WEBX_PREVIEW_PADDING;
@@ -582,47 +787,138 @@ webx_preview_crop (WebxPreview  *preview,
   gdk_rectangle_union (&old_clipbox, &clipbox, &clipbox);
   if (GTK_WIDGET_REALIZED (preview->area))
     gdk_window_invalidate_rect (preview->area->window, &clipbox, FALSE);
+  webx_preview_queue_draw_panes (preview);
+}
+
+/* Draw dimmed original clipped to clipbox. Dimmed tiles are
+ * created at display resolution, only for visible area. */
+static void
+webx_preview_draw_background (WebxPreview  *preview,
+                              GtkWidget    *widget,
+                              GdkRectangle *bg_rect,
+                              GdkRectangle *clipbox)
+{
+  GdkPixbuf    *pixbuf;
+  GdkPixbuf    *tile;
+  GdkRectangle  tile_rect;
+  GdkRectangle  area;
+  gint          tile_x, tile_y;
+  gint          x1, y1, x2, y2;
+
+  if (preview->background_zoom != preview->zoom
+      || g_hash_table_size (preview->background_tiles) > WEBX_MAX_TILES)
+    {
+      g_hash_table_remove_all (preview->background_tiles);
+      preview->background_zoom = preview->zoom;
+    }
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                           clipbox->width, clipbox->height);
+
+  x1 = (clipbox->x - bg_rect->x) / WEBX_TILE_SIZE;
+  y1 = (clipbox->y - bg_rect->y) / WEBX_TILE_SIZE;
+  x2 = (clipbox->x + clipbox->width - 1 - bg_rect->x) / WEBX_TILE_SIZE;
+  y2 = (clipbox->y + clipbox->height - 1 - bg_rect->y) / WEBX_TILE_SIZE;
+
+  for (tile_y = y1; tile_y <= y2; tile_y++)
+    for (tile_x = x1; tile_x <= x2; tile_x++)
+      {
+        tile = webx_preview_get_background_tile (preview, tile_x, tile_y);
+        if (! tile)
+          continue;
+
+        tile_rect.x = bg_rect->x + tile_x * WEBX_TILE_SIZE;
+        tile_rect.y = bg_rect->y + tile_y * WEBX_TILE_SIZE;
+        tile_rect.width = gdk_pixbuf_get_width (tile);
+        tile_rect.height = gdk_pixbuf_get_height (tile);
+        if (! gdk_rectangle_intersect (&tile_rect, clipbox, &area))
+          continue;
+
+        gdk_pixbuf_composite_color (tile, pixbuf,
+                                    area.x - clipbox->x,
+                                    area.y - clipbox->y,
+                                    area.width, area.height,
+                                    tile_rect.x - clipbox->x,
+                                    tile_rect.y - clipbox->y,
+                                    1.0, 1.0,
+                                    GDK_INTERP_NEAREST, 255,
+                                    area.x, area.y,
+                                    16, 0xaaaaaa, 0x555555);
+      }
+
+  gdk_draw_pixbuf (widget->window, preview->area_gc,
+                   pixbuf,
+                   0, 0, clipbox->x, clipbox->y,
+                   clipbox->width, clipbox->height,
+                   GDK_RGB_DITHER_NORMAL,
+                   clipbox->x, clipbox->y);
+
+  g_object_unref (pixbuf);
 }
 
 static GdkPixbuf*
-webx_preview_create_background (GdkPixbuf *src)
+webx_preview_get_background_tile (WebxPreview *preview,
+                                  gint         tile_x,
+                                  gint         tile_y)
 {
-  GdkPixbuf    *dst;
-  guchar       *pixels;
-  guchar       *row;
-  gint          rowstride;
+  GdkPixbuf    *tile;
+  GdkPixbuf    *source;
+  gpointer      key;
+  gdouble       scale_x;
+  gdouble       scale_y;
   gint          width;
   gint          height;
-  gint          i;
-  gint          j;
-  gboolean      has_alpha;
 
-  dst = gdk_pixbuf_copy (src);
+  if (tile_x < 0 || tile_y < 0)
+    return NULL;
+
+  key = GINT_TO_POINTER ((tile_y << 16) | tile_x);
+  tile = g_hash_table_lookup (preview->background_tiles, key);
+  if (tile)
+    return tile;
+
+  width = preview->width * preview->zoom - tile_x * WEBX_TILE_SIZE;
+  height = preview->height * preview->zoom - tile_y * WEBX_TILE_SIZE;
+  width = MIN (width, WEBX_TILE_SIZE);
+  height = MIN (height, WEBX_TILE_SIZE);
+  if (width <= 0 || height <= 0)
+    return NULL;
+
+  scale_x = preview->zoom * preview->width
+            / gdk_pixbuf_get_width (preview->original);
+  scale_y = preview->zoom * preview->height
+            / gdk_pixbuf_get_height (preview->original);
+  source = webx_preview_get_mipmap (preview, MAX (scale_x, scale_y));
+  scale_x *= (gdouble) gdk_pixbuf_get_width (preview->original)
+             / gdk_pixbuf_get_width (source);
+  scale_y *= (gdouble) gdk_pixbuf_get_height (preview->original)
+             / gdk_pixbuf_get_height (source);
+
+  tile = gdk_pixbuf_new (GDK_COLORSPACE_RGB,
+                         gdk_pixbuf_get_has_alpha (source), 8,
+                         width, height);
+  gdk_pixbuf_scale (source, tile,
+                    0, 0, width, height,
+                    - tile_x * WEBX_TILE_SIZE, - tile_y * WEBX_TILE_SIZE,
+                    scale_x, scale_y,
+                    GDK_INTERP_TILES);
+  webx_pixels_dim (gdk_pixbuf_get_pixels (tile),
+                   width, height,
+                   gdk_pixbuf_get_rowstride (tile),
+                   gdk_pixbuf_get_n_channels (tile));
+
+  g_hash_table_insert (preview->background_tiles, key, tile);
+  return tile;
+}
 
-  pixels    = gdk_pixbuf_get_pixels (dst);
-  width     = gdk_pixbuf_get_width (dst);
-  height    = gdk_pixbuf_get_height (dst);
-  rowstride = gdk_pixbuf_get_rowstride (dst);
-  has_alpha = gdk_pixbuf_get_has_alpha (dst);
-  
-  for (i = 0; i < height; i++)
+static void
+webx_preview_clear_background (WebxPreview *preview)
+{
+  if (preview->background_tiles)
     {
-      row = pixels;
-      for (j = 0; j < width; j++)
-        {
-          *row = *row / 4 + 127;
-          row++;
-          *row = *row / 4 + 127;
-          row++;
-          *row = *row / 4 + 127;
-          row++;
-          if (has_alpha)
-            row++;
-        }
-      pixels += rowstride;
+      g_hash_table_destroy (preview->background_tiles);
+      preview->background_tiles = NULL;
     }
-
-  return dst;
 }
 
 /* Centers image coordinates in view  */
@@ -693,6 +989,10 @@ webx_preview_get_drag_type (WebxPreview *preview,
 
   g_return_val_if_fail (WEBX_IS_PREVIEW (preview), 0);
 
+  /* crop is adjusted in single view only */
+  if (preview->n_panes > 1)
+    return WEBX_DRAG_HAND;
+
   webx_preview_get_target_rect (preview, &target_rect);
     
   if (x < target_rect.x - WEBX_PREVIEW_PADDING / 2
@@ -716,6 +1016,50 @@ webx_preview_get_drag_type (WebxPreview *preview,
   return drag_type;
 }
 
+/* Part of background visible in view, in background coordinates */
+static gboolean
+webx_preview_get_visible_rect (WebxPreview  *preview,
+                               GdkRectangle *rect)
+{
+  GdkRectangle    bg_rect;
+  GdkRectangle    view;
+
+  g_return_val_if_fail (WEBX_IS_PREVIEW (preview), FALSE);
+  g_return_val_if_fail (rect != NULL, FALSE);
+
+  webx_preview_get_background_rect (preview, &bg_rect);
+  view.x = 0;
+  view.y = 0;
+  view.width = preview->area->allocation.width;
+  view.height = preview->area->allocation.height;
+  if (! gdk_rectangle_intersect (&view, &bg_rect, &view))
+    return FALSE;
+
+  rect->x = (view.x - bg_rect.x) / preview->zoom;
+  rect->y = (view.y - bg_rect.y) / preview->zoom;
+  rect->width = ceil (view.width / preview->zoom) + 1;
+  rect->height = ceil (view.height / preview->zoom) + 1;
+  return TRUE;
+}
+
+static void
+webx_preview_viewport_changed (WebxPreview *preview)
+{
+  GdkRectangle  viewport;
+
+  if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (preview->visible_only))
+      && webx_preview_get_visible_rect (preview, &viewport))
+    {
+      g_signal_emit (preview, webx_preview_signals[VIEWPORT_CHANGED], 0,
+                     &viewport);
+    }
+  else
+    {
+      g_signal_emit (preview, webx_preview_signals[VIEWPORT_CHANGED], 0,
+                     NULL);
+    }
+}
+
 static gboolean
 webx_preview_area_expose (GtkWidget       *widget,
                           GdkEventExpose  *event,
@@ -736,7 +1080,7 @@ webx_preview_area_expose (GtkWidget       *widget,
   webx_preview_get_target_rect (preview, &target_rect);
 
   /* If we cannot draw anything else, then draw original image */
-  if (!preview->background
+  if (!preview->background_tiles
       && !preview->target
       && preview->original
       && gdk_rectangle_intersect (&event->area, &bg_rect, &clipbox))
@@ -771,84 +1115,32 @@ webx_preview_area_expose (GtkWidget       *widget,
   if ((bg_rect.width != target_rect.width
        || bg_rect.height != target_rect.height
        || !preview->target)
-      && preview->background
+      && preview->background_tiles
       && gdk_rectangle_intersect (&event->area, &bg_rect, &clipbox) )
     {
-      pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
-                               clipbox.width, clipbox.height);
-      gdk_pixbuf_composite_color (preview->background, pixbuf,
-                                  0, 0, clipbox.width, clipbox.height,
-                                  bg_rect.x - clipbox.x, bg_rect.y - clipbox.y,
-                                  preview->zoom,
-                                  preview->zoom,
-                                  GDK_INTERP_TILES, 255,
-                                  clipbox.x, clipbox.y,
-                                  16, 0xaaaaaa, 0x555555);
-
-      gdk_draw_pixbuf (widget->window, gc,
-                       pixbuf,
-                       0, 0, clipbox.x, clipbox.y,
-                       clipbox.width, clipbox.height,
-                       GDK_RGB_DITHER_NORMAL,
-                       clipbox.x, clipbox.y);
-
-      g_object_unref (pixbuf);
+      webx_preview_draw_background (preview, widget, &bg_rect, &clipbox);
     }
 
+  /* with several panes, first one is for original */
   show_preview = 
-      gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (preview->show_preview)); 
+      gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (preview->show_preview))
+      && preview->n_panes == 1;
 
   /* Draw target pixbuf */
   if (preview->target
       && show_preview
       && gdk_rectangle_intersect (&event->area, &target_rect, &clipbox))
     {
-      pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
-                               clipbox.width, clipbox.height);
-      gdk_pixbuf_composite_color (preview->target, pixbuf,
-                                  0, 0, clipbox.width, clipbox.height,
-                                  target_rect.x - clipbox.x,
-                                  target_rect.y - clipbox.y,
-                                  preview->zoom, preview->zoom,
-                                  GDK_INTERP_TILES, 255,
-                                  clipbox.x - target_rect.x,
-                                  clipbox.y - target_rect.y,
-                                  16, 0xaaaaaa, 0x555555);
-
-      gdk_draw_pixbuf (widget->window, gc,
-                       pixbuf,
-                       0, 0, clipbox.x, clipbox.y,
-                       clipbox.width, clipbox.height,
-                       GDK_RGB_DITHER_NORMAL,
-                       clipbox.x, clipbox.y);
-
-      g_object_unref (pixbuf);
-
+      webx_preview_draw_target (preview, widget,
+                                preview->target, &preview->target_region,
+                                &preview->panes[1].diff_tiles,
+                                &bg_rect, &target_rect, &clipbox);
     }
   else if (preview->original
-           && preview->background
+           && preview->background_tiles
            && gdk_rectangle_intersect (&event->area, &target_rect, &clipbox))
     {
-      pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
-                               clipbox.width, clipbox.height);
-      gdk_pixbuf_composite_color (preview->original, pixbuf,
-                                  0, 0, clipbox.width, clipbox.height,
-                                  bg_rect.x - clipbox.x,
-                                  bg_rect.y - clipbox.y,
-                                  preview->zoom, preview->zoom,
-                                  GDK_INTERP_TILES, 255,
-                                  clipbox.x, clipbox.y,
-                                  16, 0xaaaaaa, 0x555555);
-
-      gdk_draw_pixbuf (widget->window, gc,
-                       pixbuf,
-                       0, 0, clipbox.x, clipbox.y,
-                       clipbox.width, clipbox.height,
-                       GDK_RGB_DITHER_NORMAL,
-                       clipbox.x, clipbox.y);
-
-      g_object_unref (pixbuf);
-
+      webx_preview_draw_original (preview, widget, &bg_rect, &clipbox);
     }
 
   if (preview->target
@@ -857,14 +1149,382 @@ webx_preview_area_expose (GtkWidget       *widget,
       webx_preview_draw_outline (preview, &target_rect, FALSE, FALSE);
     }
   else if (preview->original
-      && preview->background)
+      && preview->background_tiles)
     {
       webx_preview_draw_outline (preview, &target_rect, FALSE, TRUE);
     }
 
+  if (preview->n_panes > 1)
+    webx_preview_draw_label (preview, widget, _("Original"), 0, FALSE);
+
   return TRUE;
 }
 
+/* Draw original image (not dimmed) clipped to clipbox. */
+static void
+webx_preview_draw_original (WebxPreview  *preview,
+                            GtkWidget    *widget,
+                            GdkRectangle *bg_rect,
+                            GdkRectangle *clipbox)
+{
+  GdkPixbuf    *pixbuf;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                           clipbox->width, clipbox->height);
+  gdk_pixbuf_composite_color (preview->original, pixbuf,
+                              0, 0, clipbox->width, clipbox->height,
+                              bg_rect->x - clipbox->x,
+                              bg_rect->y - clipbox->y,
+                              preview->zoom, preview->zoom,
+                              GDK_INTERP_TILES, 255,
+                              clipbox->x, clipbox->y,
+                              16, 0xaaaaaa, 0x555555);
+
+  gdk_draw_pixbuf (widget->window, preview->area_gc,
+                   pixbuf,
+                   0, 0, clipbox->x, clipbox->y,
+                   clipbox->width, clipbox->height,
+                   GDK_RGB_DITHER_NORMAL,
+                   clipbox->x, clipbox->y);
+
+  g_object_unref (pixbuf);
+}
+
+/* Draw target clipped to clipbox. When only part of target
+ * was encoded, original is shown around it. */
+static void
+webx_preview_draw_target (WebxPreview  *preview,
+                          GtkWidget    *widget,
+                          GdkPixbuf    *target,
+                          GdkRectangle *target_region,
+                          GHashTable  **diff_tiles,
+                          GdkRectangle *bg_rect,
+                          GdkRectangle *target_rect,
+                          GdkRectangle *clipbox)
+{
+  GdkPixbuf    *pixbuf;
+  GdkRectangle  region_rect;
+  GdkRectangle  area;
+
+  region_rect = *target_rect;
+  if (target_region->width)
+    {
+      if (preview->original)
+        webx_preview_draw_original (preview, widget, bg_rect, clipbox);
+
+      region_rect.x += target_region->x * preview->zoom;
+      region_rect.y += target_region->y * preview->zoom;
+      region_rect.width = target_region->width * preview->zoom;
+      region_rect.height = target_region->height * preview->zoom;
+    }
+
+  if (! gdk_rectangle_intersect (clipbox, &region_rect, &area))
+    return;
+
+  if (preview->original
+      && gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (preview->show_diff)))
+    {
+      if (! *diff_tiles)
+        *diff_tiles = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                             NULL, g_object_unref);
+      webx_preview_draw_diff (preview, widget, target, target_region,
+                              *diff_tiles, target_rect, &area);
+      return;
+    }
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                           area.width, area.height);
+  gdk_pixbuf_composite_color (target, pixbuf,
+                              0, 0, area.width, area.height,
+                              region_rect.x - area.x,
+                              region_rect.y - area.y,
+                              preview->zoom, preview->zoom,
+                              GDK_INTERP_TILES, 255,
+                              area.x - region_rect.x,
+                              area.y - region_rect.y,
+                              16, 0xaaaaaa, 0x555555);
+
+  gdk_draw_pixbuf (widget->window, preview->area_gc,
+                   pixbuf,
+                   0, 0, area.x, area.y,
+                   area.width, area.height,
+                   GDK_RGB_DITHER_NORMAL,
+                   area.x, area.y);
+
+  g_object_unref (pixbuf);
+}
+
+/* Draw error heat map of target over given area. Heat map is made of
+ * tiles in image coordinates, computed only when they become visible
+ * and kept until target changes. */
+static void
+webx_preview_draw_diff (WebxPreview  *preview,
+                        GtkWidget    *widget,
+                        GdkPixbuf    *target,
+                        GdkRectangle *target_region,
+                        GHashTable   *diff_tiles,
+                        GdkRectangle *target_rect,
+                        GdkRectangle *area)
+{
+  GdkPixbuf    *pixbuf;
+  GdkPixbuf    *tile;
+  GdkRectangle  tile_rect;
+  GdkRectangle  rect;
+  GdkRectangle  dest;
+  gint          tile_x, tile_y;
+  gint          x1, y1, x2, y2;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                           area->width, area->height);
+  gdk_pixbuf_fill (pixbuf, 0x000000ff);
+
+  x1 = (area->x - target_rect->x) / preview->zoom / WEBX_TILE_SIZE;
+  y1 = (area->y - target_rect->y) / preview->zoom / WEBX_TILE_SIZE;
+  x2 = (area->x + area->width - 1 - target_rect->x)
+       / preview->zoom / WEBX_TILE_SIZE;
+  y2 = (area->y + area->height - 1 - target_rect->y)
+       / preview->zoom / WEBX_TILE_SIZE;
+
+  for (tile_y = y1; tile_y <= y2; tile_y++)
+    for (tile_x = x1; tile_x <= x2; tile_x++)
+      {
+        tile = webx_preview_get_diff_tile (preview, diff_tiles,
+                                           target, target_region,
+                                           tile_x, tile_y, &tile_rect);
+        if (! tile)
+          continue;
+
+        rect.x = floor (target_rect->x + tile_rect.x * preview->zoom);
+        rect.y = floor (target_rect->y + tile_rect.y * preview->zoom);
+        rect.width = ceil (target_rect->x
+                           + (tile_rect.x + tile_rect.width) * preview->zoom)
+                     - rect.x;
+        rect.height = ceil (target_rect->y
+                            + (tile_rect.y + tile_rect.height) * preview->zoom)
+                      - rect.y;
+        if (! gdk_rectangle_intersect (&rect, area, &dest))
+          continue;
+
+        gdk_pixbuf_scale (tile, pixbuf,
+                          dest.x - area->x, dest.y - area->y,
+                          dest.width, dest.height,
+                          target_rect->x + tile_rect.x * preview->zoom
+                          - area->x,
+                          target_rect->y + tile_rect.y * preview->zoom
+                          - area->y,
+                          preview->zoom, preview->zoom,
+                          GDK_INTERP_NEAREST);
+      }
+
+  gdk_draw_pixbuf (widget->window, preview->area_gc,
+                   pixbuf,
+                   0, 0, area->x, area->y,
+                   area->width, area->height,
+                   GDK_RGB_DITHER_NORMAL,
+                   area->x, area->y);
+
+  g_object_unref (pixbuf);
+}
+
+/* Colors for amplified difference: black, blue, red, yellow, white */
+static const guchar *
+webx_preview_heat_color (gint value)
+{
+  static guchar  colors[256][3];
+  static gboolean initialized = FALSE;
+
+  if (! initialized)
+    {
+      gint  i;
+      gint  v;
+
+      for (i = 0; i < 256; i++)
+        {
+          v = MIN (i * WEBX_DIFF_GAIN, 255);
+          if (v < 64)
+            {
+              colors[i][0] = 0;
+              colors[i][1] = 0;
+              colors[i][2] = v * 4;
+            }
+          else if (v < 128)
+            {
+              colors[i][0] = (v - 64) * 4;
+              colors[i][1] = 0;
+              colors[i][2] = 255 - (v - 64) * 4;
+            }
+          else if (v < 192)
+            {
+              colors[i][0] = 255;
+              colors[i][1] = (v - 128) * 4;
+              colors[i][2] = 0;
+            }
+          else
+            {
+              colors[i][0] = 255;
+              colors[i][1] = 255;
+              colors[i][2] = MIN ((v - 192) * 4, 255);
+            }
+        }
+      initialized = TRUE;
+    }
+
+  return colors[value];
+}
+
+/* Returns heat map tile, tile_rect is set to its position
+ * relative to target (crop rectangle). */
+static GdkPixbuf*
+webx_preview_get_diff_tile (WebxPreview  *preview,
+                            GHashTable   *diff_tiles,
+                            GdkPixbuf    *target,
+                            GdkRectangle *target_region,
+                            gint          tile_x,
+                            gint          tile_y,
+                            GdkRectangle *tile_rect)
+{
+  GdkPixbuf    *tile;
+  GdkRectangle  region;
+  const guchar *original_pixels;
+  const guchar *target_pixels;
+  const guchar *color;
+  guchar       *diff;
+  guchar       *pixels;
+  GimpRGB       bg_color;
+  guchar        background[3];
+  gint          rowstride;
+  gint          channels;
+  gint          x, y;
+  gpointer      key;
+
+  if (tile_x < 0 || tile_y < 0)
+    return NULL;
+
+  if (target_region->width)
+    {
+      region = *target_region;
+    }
+  else
+    {
+      region.x = 0;
+      region.y = 0;
+      region.width = preview->target_rect.width;
+      region.height = preview->target_rect.height;
+    }
+  region.width = MIN (region.width, gdk_pixbuf_get_width (target));
+  region.height = MIN (region.height, gdk_pixbuf_get_height (target));
+
+  tile_rect->x = tile_x * WEBX_TILE_SIZE;
+  tile_rect->y = tile_y * WEBX_TILE_SIZE;
+  tile_rect->width = WEBX_TILE_SIZE;
+  tile_rect->height = WEBX_TILE_SIZE;
+  if (! gdk_rectangle_intersect (tile_rect, &region, tile_rect))
+    return NULL;
+
+  /* original is stale until pipeline catches up */
+  if (preview->target_rect.x + tile_rect->x + tile_rect->width
+      > gdk_pixbuf_get_width (preview->original)
+      || preview->target_rect.y + tile_rect->y + tile_rect->height
+      > gdk_pixbuf_get_height (preview->original))
+    return NULL;
+
+  key = GINT_TO_POINTER ((tile_y << 16) | tile_x);
+  tile = g_hash_table_lookup (diff_tiles, key);
+  if (tile)
+    return tile;
+
+  channels = gdk_pixbuf_get_n_channels (preview->original);
+  original_pixels = gdk_pixbuf_get_pixels (preview->original)
+    + (preview->target_rect.y + tile_rect->y)
+      * gdk_pixbuf_get_rowstride (preview->original)
+    + (preview->target_rect.x + tile_rect->x) * channels;
+  channels = gdk_pixbuf_get_n_channels (target);
+  target_pixels = gdk_pixbuf_get_pixels (target)
+    + (tile_rect->y - region.y) * gdk_pixbuf_get_rowstride (target)
+    + (tile_rect->x - region.x) * channels;
+
+  /* targets without alpha were flattened over background color */
+  gimp_context_get_background (&bg_color);
+  gimp_rgb_get_uchar (&bg_color, &background[0], &background[1],
+                      &background[2]);
+
+  diff = g_new (guchar, tile_rect->width * tile_rect->height);
+  webx_pixels_diff (original_pixels,
+                    gdk_pixbuf_get_rowstride (preview->original),
+                    gdk_pixbuf_get_n_channels (preview->original),
+                    target_pixels,
+                    gdk_pixbuf_get_rowstride (target),
+                    channels,
+                    background,
+                    diff, tile_rect->width,
+                    tile_rect->width, tile_rect->height);
+
+  tile = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                         tile_rect->width, tile_rect->height);
+  pixels = gdk_pixbuf_get_pixels (tile);
+  rowstride = gdk_pixbuf_get_rowstride (tile);
+  for (y = 0; y < tile_rect->height; y++)
+    for (x = 0; x < tile_rect->width; x++)
+      {
+        color = webx_preview_heat_color (diff[y * tile_rect->width + x]);
+        pixels[y * rowstride + x * 3] = color[0];
+        pixels[y * rowstride + x * 3 + 1] = color[1];
+        pixels[y * rowstride + x * 3 + 2] = color[2];
+      }
+  g_free (diff);
+
+  g_hash_table_insert (diff_tiles, key, tile);
+  return tile;
+}
+
+static void
+webx_preview_clear_diff (WebxPreviewPane *pane)
+{
+  if (pane->diff_tiles)
+    {
+      g_hash_table_destroy (pane->diff_tiles);
+      pane->diff_tiles = NULL;
+    }
+}
+
+/* Draw pane caption in top-left corner of the pane. */
+static void
+webx_preview_draw_label (WebxPreview  *preview,
+                         GtkWidget    *widget,
+                         const gchar  *name,
+                         gint          file_size,
+                         gboolean      estimated)
+{
+  PangoLayout  *layout;
+  gchar         text[256];
+  gint          width;
+  gint          height;
+
+  if (! name)
+    return;
+
+  if (file_size && estimated)
+    g_snprintf (text, sizeof (text), _("%s: ~%02.01f kB"),
+                name, (gdouble) file_size / 1024.0);
+  else if (file_size)
+    g_snprintf (text, sizeof (text), _("%s: %02.01f kB"),
+                name, (gdouble) file_size / 1024.0);
+  else
+    g_strlcpy (text, name, sizeof (text));
+
+  layout = gtk_widget_create_pango_layout (widget, text);
+  pango_layout_get_pixel_size (layout, &width, &height);
+
+  gdk_draw_rectangle (widget->window,
+                      widget->style->base_gc[GTK_STATE_NORMAL], TRUE,
+                      0, 0, width + 8, height + 4);
+  gdk_draw_layout (widget->window,
+                   widget->style->text_gc[GTK_STATE_NORMAL],
+                   4, 2, layout);
+
+  g_object_unref (layout);
+}
+
 /* Draw an outline outside target image (which can be cropped)
  * and crop handles. */
 static void
@@ -1088,6 +1748,8 @@ webx_preview_area_size_allocate (GtkWidget     *widget,
   preview->yoffs = adj->value;
   gtk_adjustment_value_changed (GTK_ADJUSTMENT (adj));
   g_signal_handlers_unblock_by_func (adj, webx_preview_vscroll, preview);
+
+  webx_preview_viewport_changed (preview);
 }
 
 static void
@@ -1100,11 +1762,9 @@ webx_preview_hscroll (GtkAdjustment *hadj,
 
   dx = preview->xoffs - (gint)hadj->value;
   preview->xoffs = hadj->value;
-  if (GTK_WIDGET_REALIZED (preview->area))
-    {
-      gdk_window_scroll (preview->area->window, dx, 0);
-      gdk_window_process_updates (preview->area->window, FALSE);
-    }
+  webx_preview_scroll_panes (preview, dx, 0);
+
+  webx_preview_viewport_changed (preview);
 }
 
 static void
@@ -1117,11 +1777,9 @@ webx_preview_vscroll (GtkAdjustment *vadj,
 
   dy = preview->yoffs - (gint)vadj->value;
   preview->yoffs = vadj->value;
-  if (GTK_WIDGET_REALIZED (preview->area))
-    {
-      gdk_window_scroll (preview->area->window, 0, dy);
-      gdk_window_process_updates (preview->area->window, FALSE);
-    }
+  webx_preview_scroll_panes (preview, 0, dy);
+
+  webx_preview_viewport_changed (preview);
 }
 
 
@@ -1257,6 +1915,10 @@ webx_preview_update_cursor (WebxPreview  *preview,
 
   g_return_if_fail (WEBX_IS_PREVIEW (preview));
 
+  /* panes keep hand cursor, set on layout change */
+  if (preview->n_panes > 1)
+    return;
+
   drag_type = webx_preview_get_drag_type (preview, x, y);
   switch (drag_type)
     {
@@ -1324,16 +1986,16 @@ webx_preview_area_button_press (GtkWidget       *widget,
   if (preview->drag_mode & WEBX_DRAG_HAND)
     {
       webx_preview_hand_start (preview);
-      cursor = cursor_get (preview->area, CURSOR_HAND_CLOSED);
+      cursor = cursor_get (widget, CURSOR_HAND_CLOSED);
     }
   else
     {
       webx_preview_crop_start (preview);
     }
 
-  gtk_grab_add (preview->area);
+  gtk_grab_add (widget);
 
-  gdk_pointer_grab (preview->area->window, TRUE,
+  gdk_pointer_grab (widget->window, TRUE,
                     GDK_BUTTON_RELEASE_MASK
                     | GDK_BUTTON_MOTION_MASK
                     | GDK_POINTER_MOTION_HINT_MASK,
@@ -1474,6 +2136,15 @@ webx_preview_nav_button_press (GtkWidget        *widget,
       || event->button != 1)
     return TRUE;
 
+  if (! preview->nav_thumbnail)
+    {
+      if (preview->nav_idle_id)
+        g_source_remove (preview->nav_idle_id);
+      webx_preview_nav_thumbnail_create (preview);
+    }
+  if (! preview->nav_thumbnail)
+    return TRUE;
+
   preview->nav_popup = gtk_window_new (GTK_WINDOW_POPUP);
 
   gtk_window_set_screen (GTK_WINDOW (preview->nav_popup),
@@ -1489,20 +2160,8 @@ webx_preview_nav_button_press (GtkWidget        *widget,
   gtk_container_add (GTK_CONTAINER (outer), inner);
   gtk_widget_show (inner);
 
-  if (preview->width > preview->height)
-    {
-      width = WEBX_THUMBNAIL_SIZE;
-      height = WEBX_THUMBNAIL_SIZE * (gdouble)preview->height / preview->width;
-    }
-  else
-    {
-      width = WEBX_THUMBNAIL_SIZE * (gdouble)preview->width / preview->height;
-      height = WEBX_THUMBNAIL_SIZE;
-    }
+  webx_preview_nav_thumbnail_size (preview, &width, &height);
 
-  preview->nav_thumbnail = gdk_pixbuf_scale_simple (preview->original,
-                                                    width, height,
-                                                    GDK_INTERP_BILINEAR);
   area = gtk_drawing_area_new ();
   gtk_container_add (GTK_CONTAINER (inner), area);
   gtk_widget_set_size_request (area, width, height);
@@ -1603,9 +2262,6 @@ webx_preview_nav_popup_event (GtkWidget         *widget,
 
               gtk_widget_destroy (preview->nav_popup);
               preview->nav_popup = NULL;
-
-              g_object_unref (preview->nav_thumbnail);
-              preview->nav_thumbnail = NULL;
             }
         }
       break;
@@ -1689,6 +2345,101 @@ webx_preview_nav_popup_expose (GtkWidget        *widget,
   return FALSE;
 }
 
+static void
+webx_preview_nav_thumbnail_size (WebxPreview *preview,
+                                 gint        *width,
+                                 gint        *height)
+{
+  if (preview->width > preview->height)
+    {
+      *width = WEBX_THUMBNAIL_SIZE;
+      *height = WEBX_THUMBNAIL_SIZE * (gdouble)preview->height / preview->width;
+    }
+  else
+    {
+      *width = WEBX_THUMBNAIL_SIZE * (gdouble)preview->width / preview->height;
+      *height = WEBX_THUMBNAIL_SIZE;
+    }
+  *width = MAX (*width, 1);
+  *height = MAX (*height, 1);
+}
+
+/* Creates navigation thumbnail from the closest mipmap,
+ * it is kept until original image changes. */
+static gboolean
+webx_preview_nav_thumbnail_create (WebxPreview *preview)
+{
+  GdkPixbuf    *source;
+  gint          width;
+  gint          height;
+
+  preview->nav_idle_id = 0;
+
+  if (preview->nav_thumbnail || ! preview->original)
+    return FALSE;
+
+  webx_preview_nav_thumbnail_size (preview, &width, &height);
+  source = webx_preview_get_mipmap (preview,
+                                    MAX ((gdouble) width / gdk_pixbuf_get_width (preview->original),
+                                         (gdouble) height / gdk_pixbuf_get_height (preview->original)));
+  preview->nav_thumbnail = gdk_pixbuf_scale_simple (source,
+                                                    width, height,
+                                                    GDK_INTERP_BILINEAR);
+  return FALSE;
+}
+
+/* Returns smallest version of original image, which is
+ * still at least of given scale. Missing levels are created
+ * by halving previous level, which is cheap. */
+static GdkPixbuf*
+webx_preview_get_mipmap (WebxPreview *preview,
+                         gdouble      scale)
+{
+  GdkPixbuf    *mipmap;
+  gint          level;
+  gint          width;
+  gint          height;
+
+  g_return_val_if_fail (preview->original != NULL, NULL);
+
+  mipmap = preview->original;
+  width = gdk_pixbuf_get_width (mipmap);
+  height = gdk_pixbuf_get_height (mipmap);
+
+  for (level = 1; level < WEBX_PREVIEW_MAX_MIPMAPS; level++)
+    {
+      if (scale * 2.0 > 1.0 || width < 2 || height < 2)
+        break;
+
+      width /= 2;
+      height /= 2;
+      scale *= 2.0;
+
+      if (! preview->mipmaps[level])
+        preview->mipmaps[level] = gdk_pixbuf_scale_simple (mipmap,
+                                                           width, height,
+                                                           GDK_INTERP_BILINEAR);
+      mipmap = preview->mipmaps[level];
+    }
+
+  return mipmap;
+}
+
+static void
+webx_preview_clear_mipmaps (WebxPreview *preview)
+{
+  gint  level;
+
+  for (level = 0; level < WEBX_PREVIEW_MAX_MIPMAPS; level++)
+    {
+      if (preview->mipmaps[level])
+        {
+          g_object_unref (preview->mipmaps[level]);
+          preview->mipmaps[level] = NULL;
+        }
+    }
+}
+
 static void
 webx_preview_zoom (WebxPreview *preview,
                    gdouble      level)
@@ -1822,4 +2573,263 @@ static void
 webx_preview_show_toggled (WebxPreview *preview)
 {
   gtk_widget_queue_draw (preview->area);
+  webx_preview_queue_draw_panes (preview);
+}
+
+static GtkWidget*
+webx_preview_pane_new (WebxPreview *preview,
+                       gint         pane)
+{
+  GtkWidget    *area;
+
+  area = gtk_drawing_area_new ();
+  g_object_set_data (G_OBJECT (area), "webx-pane", GINT_TO_POINTER (pane));
+
+  gtk_widget_add_events (area,
+                         GDK_POINTER_MOTION_MASK
+                         | GDK_POINTER_MOTION_HINT_MASK
+                         | GDK_BUTTON_PRESS_MASK
+                         | GDK_BUTTON_RELEASE_MASK
+                         | GDK_SCROLL_MASK);
+
+  g_signal_connect (area, "expose-event",
+                    G_CALLBACK (webx_preview_pane_expose),
+                    preview);
+  g_signal_connect (area, "realize",
+                    G_CALLBACK (webx_preview_pane_realize),
+                    preview);
+  /* panes can only be scrolled, so handlers of main area are fine */
+  g_signal_connect (area, "button-press-event",
+                    G_CALLBACK (webx_preview_area_button_press),
+                    preview);
+  g_signal_connect (area, "button-release-event",
+                    G_CALLBACK (webx_preview_area_button_release),
+                    preview);
+  g_signal_connect (area, "motion-notify-event",
+                    G_CALLBACK (webx_preview_area_motion_notify),
+                    preview);
+  g_signal_connect (area, "scroll-event",
+                    G_CALLBACK (webx_preview_area_scroll),
+                    preview);
+
+  return area;
+}
+
+static gboolean
+webx_preview_pane_expose (GtkWidget       *widget,
+                          GdkEventExpose  *event,
+                          WebxPreview     *preview)
+{
+  WebxPreviewPane  *pane;
+  GdkPixbuf        *target;
+  GdkRectangle     *target_region;
+  GdkRectangle      bg_rect;
+  GdkRectangle      target_rect;
+  GdkRectangle      clipbox;
+  gint              file_size;
+
+  g_return_val_if_fail (WEBX_IS_PREVIEW (preview), TRUE);
+
+  pane = &preview->panes[GPOINTER_TO_INT (g_object_get_data (G_OBJECT (widget),
+                                                             "webx-pane"))];
+  if (pane == &preview->panes[1])
+    {
+      target = preview->target;
+      target_region = &preview->target_region;
+      file_size = preview->file_size;
+    }
+  else
+    {
+      target = pane->target;
+      target_region = &pane->target_region;
+      file_size = pane->file_size;
+    }
+
+  webx_preview_get_background_rect (preview, &bg_rect);
+  webx_preview_get_target_rect (preview, &target_rect);
+
+  if ((bg_rect.width != target_rect.width
+       || bg_rect.height != target_rect.height
+       || ! target)
+      && preview->background_tiles
+      && gdk_rectangle_intersect (&event->area, &bg_rect, &clipbox))
+    {
+      webx_preview_draw_background (preview, widget, &bg_rect, &clipbox);
+    }
+
+  if (target
+      && gdk_rectangle_intersect (&event->area, &target_rect, &clipbox))
+    {
+      webx_preview_draw_target (preview, widget,
+                                target, target_region, &pane->diff_tiles,
+                                &bg_rect, &target_rect, &clipbox);
+    }
+
+  webx_preview_draw_label (preview, widget, pane->name,
+                           target ? file_size : 0,
+                           target_region->width != 0);
+
+  return TRUE;
+}
+
+static void
+webx_preview_pane_realize (GtkWidget    *widget,
+                           WebxPreview  *preview)
+{
+  GdkCursor    *cursor;
+
+  cursor = cursor_get (widget, CURSOR_HAND_OPEN);
+  gdk_window_set_cursor (widget->window, cursor);
+  gdk_cursor_unref (cursor);
+}
+
+static void
+webx_preview_layout_combo_changed (GtkWidget   *combo,
+                                   WebxPreview *preview)
+{
+  GdkCursor    *cursor;
+  gint          n_panes;
+  gint          i;
+
+  if (! gimp_int_combo_box_get_active (GIMP_INT_COMBO_BOX (combo), &n_panes)
+      || n_panes == preview->n_panes)
+    return;
+
+  preview->n_panes = n_panes;
+  for (i = 1; i < WEBX_PREVIEW_MAX_PANES; i++)
+    {
+      if (i < n_panes)
+        gtk_widget_show (preview->panes[i].area);
+      else
+        gtk_widget_hide (preview->panes[i].area);
+    }
+  if (n_panes > 2)
+    gtk_widget_show (preview->pane_rows[1]);
+  else
+    gtk_widget_hide (preview->pane_rows[1]);
+
+  /* crop handles are available in single view only */
+  if (GTK_WIDGET_REALIZED (preview->area))
+    {
+      cursor = cursor_get (preview->area, CURSOR_HAND_OPEN);
+      gdk_window_set_cursor (preview->area->window, cursor);
+      gdk_cursor_unref (cursor);
+    }
+  preview->cursor_type = GDK_FLEUR;
+
+  webx_preview_clear_panes (preview);
+  gtk_widget_queue_draw (preview->area);
+
+  g_signal_emit (preview, webx_preview_signals[LAYOUT_CHANGED], 0,
+                 n_panes);
+}
+
+/* Scroll contents of all panes. Captions stay in place, so with several
+ * panes they are redrawn rather than scrolled. */
+static void
+webx_preview_scroll_panes (WebxPreview *preview,
+                           gint         dx,
+                           gint         dy)
+{
+  GtkWidget    *area;
+  gint          i;
+
+  for (i = 0; i < preview->n_panes; i++)
+    {
+      area = preview->panes[i].area;
+      if (! GTK_WIDGET_REALIZED (area))
+        continue;
+
+      if (preview->n_panes == 1)
+        gdk_window_scroll (area->window, dx, dy);
+      else
+        gdk_window_invalidate_rect (area->window, NULL, FALSE);
+      gdk_window_process_updates (area->window, FALSE);
+    }
+}
+
+static void
+webx_preview_queue_draw_panes (WebxPreview *preview)
+{
+  gint  i;
+
+  for (i = 1; i < preview->n_panes; i++)
+    gtk_widget_queue_draw (preview->panes[i].area);
+}
+
+static void
+webx_preview_clear_panes (WebxPreview *preview)
+{
+  gint  i;
+
+  for (i = 2; i < WEBX_PREVIEW_MAX_PANES; i++)
+    {
+      if (preview->panes[i].target)
+        {
+          g_object_unref (preview->panes[i].target);
+          preview->panes[i].target = NULL;
+        }
+      webx_preview_clear_diff (&preview->panes[i]);
+    }
+}
+
+gint
+webx_preview_get_n_panes (WebxPreview *preview)
+{
+  g_return_val_if_fail (WEBX_IS_PREVIEW (preview), 1);
+
+  return preview->n_panes;
+}
+
+void
+webx_preview_set_pane_name (WebxPreview *preview,
+                            gint         pane,
+                            const gchar *name)
+{
+  WebxPreviewPane  *p;
+
+  g_return_if_fail (WEBX_IS_PREVIEW (preview));
+  g_return_if_fail (pane > 0 && pane < WEBX_PREVIEW_MAX_PANES);
+
+  p = &preview->panes[pane];
+  if (p->name && name && ! strcmp (p->name, name))
+    return;
+
+  g_free (p->name);
+  p->name = g_strdup (name);
+
+  /* target of other format is no longer valid */
+  if (p->target)
+    {
+      g_object_unref (p->target);
+      p->target = NULL;
+    }
+  webx_preview_clear_diff (p);
+  gtk_widget_queue_draw (p->area);
+}
+
+void
+webx_preview_update_pane (WebxPreview  *preview,
+                          gint          pane,
+                          GdkPixbuf    *target,
+                          GdkRectangle *target_region,
+                          gint          file_size)
+{
+  WebxPreviewPane  *p;
+
+  g_return_if_fail (WEBX_IS_PREVIEW (preview));
+  g_return_if_fail (pane > 1 && pane < WEBX_PREVIEW_MAX_PANES);
+  g_return_if_fail (target_region != NULL);
+
+  p = &preview->panes[pane];
+  if (target)
+    g_object_ref_sink (G_OBJECT (target));
+  if (p->target)
+    g_object_unref (G_OBJECT (p->target));
+  p->target = target;
+  p->target_region = *target_region;
+  p->file_size = file_size;
+  webx_preview_clear_diff (p);
+
+  gtk_widget_queue_draw (p->area);
 }
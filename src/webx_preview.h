@@ -30,10 +30,26 @@ G_BEGIN_DECLS
 #define WEBX_IS_PREVIEW_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), WEBX_TYPE_PREVIEW))
 #define WEBX_PREVIEW_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((klass), WEBX_TYPE_PREVIEW, WebxPreviewClass))
 
+#define WEBX_PREVIEW_MAX_MIPMAPS     16
+#define WEBX_PREVIEW_MAX_PANES       4
+
 
 typedef struct _WebxPreview      WebxPreview;
 typedef struct _WebxPreviewClass WebxPreviewClass;
 
+/* Comparison pane. First pane shows original image, second one
+ * main target; the rest have targets of their own. */
+typedef struct
+{
+  GtkWidget            *area;
+  GdkPixbuf            *target;
+  GdkRectangle          target_region;
+  gint                  file_size;
+  gchar                *name;
+  /* error heat map tiles, created on demand */
+  GHashTable           *diff_tiles;
+} WebxPreviewPane;
+
 
 struct _WebxPreview
 {
@@ -47,21 +63,36 @@ struct _WebxPreview
   GtkWidget            *zoom_in;
   GtkWidget            *zoom_out;
   GtkWidget            *show_preview;
+  GtkWidget            *show_diff;
+  GtkWidget            *visible_only;
+  GtkWidget            *layout_combo;
   GtkWidget            *progress_bar;
   GdkCursor            *cursor_move;
   GdkPixbuf            *target;
-  GdkPixbuf            *background;
   GdkPixbuf            *original;
+  /* dimmed original, created on demand by tiles at current zoom */
+  GHashTable           *background_tiles;
+  gdouble               background_zoom;
   GdkGC                *area_gc;
+  /* panes share zoom & scroll offsets */
+  WebxPreviewPane       panes[WEBX_PREVIEW_MAX_PANES];
+  GtkWidget            *pane_rows[2];
+  gint                  n_panes;
+  /* original halved n times, built on demand */
+  GdkPixbuf            *mipmaps[WEBX_PREVIEW_MAX_MIPMAPS];
   
   GtkWidget            *nav_icon;
   GtkWidget            *nav_popup;
   GdkGC                *nav_gc;
   GdkPixbuf            *nav_thumbnail;
+  guint                 nav_idle_id;
 
   gint                  width;
   gint                  height;
   GdkRectangle          target_rect;
+  /* encoded part of target, zero width if all of it */
+  GdkRectangle          target_region;
+  gint                  file_size;
   gdouble               zoom;
   gint                  zoom_mode;
   gint                  cursor_type;
@@ -86,9 +117,15 @@ struct _WebxPreviewClass
 {
   GtkVBoxClass          parent_class;
 
-  void (*crop_changed) (GtkWidget    *widget,
-                        GdkRectangle *new_crop,
-                        gpointer      user_data);
+  void (*crop_changed)     (GtkWidget    *widget,
+                            GdkRectangle *new_crop,
+                            gpointer      user_data);
+  void (*viewport_changed) (GtkWidget    *widget,
+                            GdkRectangle *viewport,
+                            gpointer      user_data);
+  void (*layout_changed)   (GtkWidget    *widget,
+                            gint          n_panes,
+                            gpointer      user_data);
 };
 
 GType      webx_preview_get_type      (void) G_GNUC_CONST;
@@ -100,11 +137,23 @@ void       webx_preview_begin_update  (WebxPreview  *preview);
 
 void       webx_preview_update_target (WebxPreview  *preview,
                                        GdkPixbuf    *target,
+                                       GdkRectangle *target_region,
                                        gint          file_size);
 void       webx_preview_update        (WebxPreview  *preview,
                                        GdkPixbuf    *background,
                                        GdkPixbuf    *target,
                                        GdkRectangle *target_rect,
+                                       GdkRectangle *target_region,
+                                       gint          file_size);
+
+gint       webx_preview_get_n_panes   (WebxPreview  *preview);
+void       webx_preview_set_pane_name (WebxPreview  *preview,
+                                       gint          pane,
+                                       const gchar  *name);
+void       webx_preview_update_pane   (WebxPreview  *preview,
+                                       gint          pane,
+                                       GdkPixbuf    *target,
+                                       GdkRectangle *target_region,
                                        gint          file_size);
 
 void       webx_preview_resize        (WebxPreview  *preview,
@@ -0,0 +1,1632 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "webx_threads.h"
+#include "webx_palette.h"
+#include "webx_quantizer.h"
+
+#define WEBX_HISTOGRAM_BITS     5
+#define WEBX_HISTOGRAM_SIZE     (1 << (3 * WEBX_HISTOGRAM_BITS))
+/* translucent colors are rare, coarser bins are enough for them */
+#define WEBX_ALPHA_HISTOGRAM_BITS 4
+#define WEBX_ALPHA_HISTOGRAM_SIZE (1 << (4 * WEBX_ALPHA_HISTOGRAM_BITS))
+#define WEBX_ALPHA_THRESHOLD    128
+#define WEBX_KMEANS_ITERATIONS  8
+/* refining palette which already fits needs only few */
+#define WEBX_WARM_ITERATIONS    2
+/* colors are premultiplied RGB and alpha, which is 255 for opaque */
+#define WEBX_CHANNELS           4
+/* sums of colors, weight, sums of squared colors */
+#define WEBX_STATS_SIZE         (2 * WEBX_CHANNELS + 1)
+#define WEBX_STATS_WEIGHT       WEBX_CHANNELS
+/* Smallest amount of work worth giving to a separate thread. */
+#define WEBX_MIN_ROWS_PER_JOB   16
+#define WEBX_MIN_POINTS_PER_JOB 1024
+/* Oklab is scaled to have about the range of 8-bit RGB */
+#define WEBX_OKLAB_SCALE        255.0f
+#define WEBX_LINEAR_TABLE_SIZE  4096
+/* hash of distinct colors, kept at most quarter full */
+#define WEBX_EXACT_TABLE_BITS   10
+
+typedef struct
+{
+  guint64               count;
+  guint64               sum[4];
+} WebxHistogramBin;
+
+struct _WebxHistogram
+{
+  WebxHistogramBin     *bins;
+  /* translucent colors, NULL unless made with alpha */
+  WebxHistogramBin     *alpha_bins;
+  guint64               n_transparent;
+};
+
+typedef struct
+{
+  gfloat                c[WEBX_CHANNELS];
+  gfloat                weight;
+} WebxColorPoint;
+
+typedef struct
+{
+  gint                  start;
+  gint                  end;
+  gint                  axis;
+  gdouble               sse;
+} WebxColorBox;
+
+typedef struct
+{
+  const guchar         *pixels;
+  gint                  width;
+  gint                  height;
+  gint                  rowstride;
+  gint                  bpp;
+  WebxHistogramBin     *bins[WEBX_MAX_THREADS];
+  WebxHistogramBin     *alpha_bins[WEBX_MAX_THREADS];
+  guint64               n_transparent[WEBX_MAX_THREADS];
+  gboolean              with_alpha;
+  /* only one pixel of each step x step block is counted */
+  gint                  step;
+  gint                  n_histograms;
+} WebxHistogramJob;
+
+typedef struct
+{
+  const WebxColorPoint *points;
+  gint                  n_points;
+  const gfloat         *centroids;
+  gint                  n_centroids;
+  /* per job: cluster stats for each centroid */
+  gdouble              *sums[WEBX_MAX_THREADS];
+} WebxKMeansJob;
+
+typedef struct
+{
+  const guchar         *pixels;
+  gint                  width;
+  gint                  height;
+  gint                  rowstride;
+  gint                  bpp;
+  WebxPaletteLookup    *lookup;
+  gint                  transparent;
+  guchar               *indices;
+} WebxRemapJob;
+
+typedef struct
+{
+  const guchar         *pixels;
+  gint                  width;
+  gint                  height;
+  gint                  rowstride;
+  /* opaque palette colors only, NULL if there are none */
+  WebxPaletteLookup    *lookup;
+  guchar                lookup_map[256];
+  /* premultiplied palette colors and their alpha */
+  gint                  colors[256 * 4];
+  gint                  n_colors;
+  gint                  transparent;
+  guchar               *indices;
+} WebxAlphaRemapJob;
+
+static gfloat webx_srgb_to_linear_table[256];
+static gfloat webx_linear_to_srgb_table[WEBX_LINEAR_TABLE_SIZE + 1];
+
+static gint
+webx_quantizer_get_jobs (gint    units,
+                         gint    min_units)
+{
+  return CLAMP (units / min_units, 1, webx_threads_get_count ());
+}
+
+/* Without alpha_bins, pixels with alpha below half are transparent
+ * and others opaque. With them, only alpha 0 is transparent. */
+static inline void
+webx_histogram_add (WebxHistogramBin *bins,
+                    WebxHistogramBin *alpha_bins,
+                    const guchar     *p,
+                    gint              bpp,
+                    guint64          *n_transparent)
+{
+  WebxHistogramBin     *bin;
+  gint                  index;
+
+  if (bpp == 4 && p[3] < (alpha_bins ? 1 : WEBX_ALPHA_THRESHOLD))
+    {
+      (*n_transparent)++;
+      return;
+    }
+
+  if (alpha_bins && p[3] < 255)
+    {
+      index = ((p[0] >> (8 - WEBX_ALPHA_HISTOGRAM_BITS))
+               << (3 * WEBX_ALPHA_HISTOGRAM_BITS))
+            | ((p[1] >> (8 - WEBX_ALPHA_HISTOGRAM_BITS))
+               << (2 * WEBX_ALPHA_HISTOGRAM_BITS))
+            | ((p[2] >> (8 - WEBX_ALPHA_HISTOGRAM_BITS))
+               << WEBX_ALPHA_HISTOGRAM_BITS)
+            | (p[3] >> (8 - WEBX_ALPHA_HISTOGRAM_BITS));
+      bin = &alpha_bins[index];
+      bin->count++;
+      /* premultiplied, scaled by 255 */
+      bin->sum[0] += p[0] * p[3];
+      bin->sum[1] += p[1] * p[3];
+      bin->sum[2] += p[2] * p[3];
+      bin->sum[3] += p[3];
+      return;
+    }
+
+  index = ((p[0] >> (8 - WEBX_HISTOGRAM_BITS)) << (2 * WEBX_HISTOGRAM_BITS))
+        | ((p[1] >> (8 - WEBX_HISTOGRAM_BITS)) << WEBX_HISTOGRAM_BITS)
+        | (p[2] >> (8 - WEBX_HISTOGRAM_BITS));
+  bin = &bins[index];
+  bin->count++;
+  bin->sum[0] += p[0];
+  bin->sum[1] += p[1];
+  bin->sum[2] += p[2];
+}
+
+static void
+webx_histogram_job (gint              job,
+                    gint              n_jobs,
+                    WebxHistogramJob *data)
+{
+  WebxHistogramBin     *bins;
+  WebxHistogramBin     *alpha_bins = NULL;
+  const guchar         *row;
+  guint64               n_transparent = 0;
+  guint32               hash;
+  gint                  step = data->step;
+  gint                  n_rows;
+  gint                  n_columns;
+  gint                  y1, y2;
+  gint                  x, y;
+  gint                  bx, by;
+
+  bins = g_new0 (WebxHistogramBin, WEBX_HISTOGRAM_SIZE);
+  if (data->with_alpha)
+    alpha_bins = g_new0 (WebxHistogramBin, WEBX_ALPHA_HISTOGRAM_SIZE);
+
+  if (step == 1)
+    {
+      y1 = data->height * job / n_jobs;
+      y2 = data->height * (job + 1) / n_jobs;
+      for (y = y1; y < y2; y++)
+        {
+          row = data->pixels + y * data->rowstride;
+          for (x = 0; x < data->width; x++)
+            webx_histogram_add (bins, alpha_bins, row + x * data->bpp,
+                                data->bpp, &n_transparent);
+        }
+    }
+  else
+    {
+      /* one pixel from each step x step block, at pseudo random
+       * position, so that regular patterns can't alias with step */
+      n_rows = (data->height + step - 1) / step;
+      n_columns = (data->width + step - 1) / step;
+      y1 = n_rows * job / n_jobs;
+      y2 = n_rows * (job + 1) / n_jobs;
+      for (by = y1; by < y2; by++)
+        for (bx = 0; bx < n_columns; bx++)
+          {
+            hash = ((guint32) bx * 73856093u) ^ ((guint32) by * 19349663u);
+            hash *= 2654435761u;
+            x = MIN (bx * step + (gint) ((hash >> 8) % step), data->width - 1);
+            y = MIN (by * step + (gint) ((hash >> 20) % step), data->height - 1);
+            webx_histogram_add (bins, alpha_bins,
+                                data->pixels + y * data->rowstride
+                                + x * data->bpp,
+                                data->bpp, &n_transparent);
+          }
+    }
+
+  data->bins[job] = bins;
+  data->alpha_bins[job] = alpha_bins;
+  data->n_transparent[job] = n_transparent;
+}
+
+/* Folds per job histograms into the first one, each job takes its
+ * own range of bins. */
+static void
+webx_histogram_merge_job (gint              job,
+                          gint              n_jobs,
+                          WebxHistogramJob *data)
+{
+  WebxHistogramBin     *dest = data->bins[0];
+  WebxHistogramBin     *src;
+  gint                  i1, i2;
+  gint                  i, j;
+
+  i1 = WEBX_HISTOGRAM_SIZE / n_jobs * job;
+  i2 = WEBX_HISTOGRAM_SIZE / n_jobs * (job + 1);
+
+  for (j = 1; j < data->n_histograms; j++)
+    {
+      src = data->bins[j];
+      for (i = i1; i < i2; i++)
+        {
+          dest[i].count += src[i].count;
+          dest[i].sum[0] += src[i].sum[0];
+          dest[i].sum[1] += src[i].sum[1];
+          dest[i].sum[2] += src[i].sum[2];
+        }
+    }
+
+  if (! data->with_alpha)
+    return;
+
+  dest = data->alpha_bins[0];
+  i1 = WEBX_ALPHA_HISTOGRAM_SIZE / n_jobs * job;
+  i2 = WEBX_ALPHA_HISTOGRAM_SIZE / n_jobs * (job + 1);
+  for (j = 1; j < data->n_histograms; j++)
+    {
+      src = data->alpha_bins[j];
+      for (i = i1; i < i2; i++)
+        {
+          dest[i].count += src[i].count;
+          dest[i].sum[0] += src[i].sum[0];
+          dest[i].sum[1] += src[i].sum[1];
+          dest[i].sum[2] += src[i].sum[2];
+          dest[i].sum[3] += src[i].sum[3];
+        }
+    }
+}
+
+static WebxHistogram*
+webx_histogram_build (const guchar *pixels,
+                      gint          width,
+                      gint          height,
+                      gint          rowstride,
+                      gint          bpp,
+                      gint          step,
+                      gboolean      with_alpha)
+{
+  WebxHistogram        *histogram;
+  WebxHistogramJob      data;
+  gint                  n_jobs;
+  gint                  n_merge_jobs;
+  gint                  i;
+
+  data.pixels = pixels;
+  data.width = width;
+  data.height = height;
+  data.rowstride = rowstride;
+  data.bpp = bpp;
+  data.step = step;
+  data.with_alpha = with_alpha;
+
+  n_jobs = webx_quantizer_get_jobs (height / step, WEBX_MIN_ROWS_PER_JOB);
+  webx_threads_run ((WebxThreadFunc) webx_histogram_job, n_jobs, &data);
+  data.n_histograms = n_jobs;
+  if (n_jobs > 1)
+    {
+      /* bin count is a power of two, keep the split even */
+      n_merge_jobs = 1;
+      while (n_merge_jobs * 2 <= n_jobs)
+        n_merge_jobs *= 2;
+      webx_threads_run ((WebxThreadFunc) webx_histogram_merge_job,
+                        n_merge_jobs, &data);
+    }
+
+  histogram = g_new (WebxHistogram, 1);
+  histogram->bins = data.bins[0];
+  histogram->alpha_bins = data.alpha_bins[0];
+  histogram->n_transparent = 0;
+  for (i = 0; i < n_jobs; i++)
+    {
+      histogram->n_transparent += data.n_transparent[i];
+      if (i > 0)
+        {
+          g_free (data.bins[i]);
+          g_free (data.alpha_bins[i]);
+        }
+    }
+
+  return histogram;
+}
+
+/* Counts colors of RGB or RGBA pixels. Pixels with alpha below half
+ * are counted as transparent and are not part of the histogram. */
+WebxHistogram*
+webx_histogram_new (const guchar *pixels,
+                    gint          width,
+                    gint          height,
+                    gint          rowstride,
+                    gint          bpp)
+{
+  g_return_val_if_fail (pixels != NULL, NULL);
+  g_return_val_if_fail (bpp == 3 || bpp == 4, NULL);
+
+  return webx_histogram_build (pixels, width, height, rowstride, bpp, 1,
+                               FALSE);
+}
+
+static WebxHistogram*
+webx_histogram_new_real (const guchar *pixels,
+                         gint          width,
+                         gint          height,
+                         gint          rowstride,
+                         gint          bpp,
+                         gint          max_samples,
+                         gboolean      with_alpha)
+{
+  WebxHistogram        *histogram;
+  const guchar         *row;
+  gint                  threshold;
+  gint                  step;
+  gint                  x, y;
+
+  step = 1;
+  if (max_samples > 0 && (gdouble) width * height > max_samples)
+    step = ceil (sqrt ((gdouble) width * height / max_samples));
+
+  histogram = webx_histogram_build (pixels, width, height, rowstride, bpp,
+                                    step, with_alpha);
+
+  threshold = with_alpha ? 1 : WEBX_ALPHA_THRESHOLD;
+  if (step > 1 && bpp == 4 && ! histogram->n_transparent)
+    {
+      for (y = 0; y < height && ! histogram->n_transparent; y++)
+        {
+          row = pixels + y * rowstride;
+          for (x = 0; x < width; x++)
+            {
+              if (row[x * 4 + 3] < threshold)
+                {
+                  histogram->n_transparent = 1;
+                  break;
+                }
+            }
+        }
+    }
+
+  return histogram;
+}
+
+/* Like webx_histogram_new(), but counts only about max_samples pixels
+ * spread evenly over the image, when it has more. Transparency is
+ * still checked on all pixels, a missed transparent pixel would end up
+ * opaque. */
+WebxHistogram*
+webx_histogram_new_sampled (const guchar *pixels,
+                            gint          width,
+                            gint          height,
+                            gint          rowstride,
+                            gint          bpp,
+                            gint          max_samples)
+{
+  g_return_val_if_fail (pixels != NULL, NULL);
+  g_return_val_if_fail (bpp == 3 || bpp == 4, NULL);
+
+  return webx_histogram_new_real (pixels, width, height, rowstride, bpp,
+                                  max_samples, FALSE);
+}
+
+/* Like webx_histogram_new_sampled(), but for palettes with alpha:
+ * only fully transparent RGBA pixels are counted as transparent,
+ * translucent ones keep their alpha. */
+WebxHistogram*
+webx_histogram_new_with_alpha (const guchar *pixels,
+                               gint          width,
+                               gint          height,
+                               gint          rowstride,
+                               gint          max_samples)
+{
+  g_return_val_if_fail (pixels != NULL, NULL);
+
+  return webx_histogram_new_real (pixels, width, height, rowstride, 4,
+                                  max_samples, TRUE);
+}
+
+void
+webx_histogram_free (WebxHistogram *histogram)
+{
+  g_return_if_fail (histogram != NULL);
+
+  g_free (histogram->bins);
+  g_free (histogram->alpha_bins);
+  g_free (histogram);
+}
+
+gboolean
+webx_histogram_has_transparent (WebxHistogram *histogram)
+{
+  g_return_val_if_fail (histogram != NULL, FALSE);
+
+  return histogram->n_transparent > 0;
+}
+
+static gint
+webx_color_point_compare (const WebxColorPoint *a,
+                          const WebxColorPoint *b,
+                          gint                 *axis)
+{
+  if (a->c[*axis] < b->c[*axis])
+    return -1;
+  else if (a->c[*axis] > b->c[*axis])
+    return 1;
+  return 0;
+}
+
+static void
+webx_color_box_update (WebxColorBox         *box,
+                       const WebxColorPoint *points)
+{
+  const WebxColorPoint *p;
+  gdouble               weight = 0.0;
+  gdouble               s1[WEBX_CHANNELS] = { 0.0, 0.0, 0.0, 0.0 };
+  gdouble               s2[WEBX_CHANNELS] = { 0.0, 0.0, 0.0, 0.0 };
+  gdouble               variance;
+  gdouble               max_variance = -1.0;
+  gint                  i, a;
+
+  for (i = box->start; i < box->end; i++)
+    {
+      p = &points[i];
+      weight += p->weight;
+      for (a = 0; a < WEBX_CHANNELS; a++)
+        {
+          s1[a] += p->weight * p->c[a];
+          s2[a] += p->weight * p->c[a] * p->c[a];
+        }
+    }
+
+  box->sse = 0.0;
+  box->axis = 0;
+  for (a = 0; a < WEBX_CHANNELS; a++)
+    {
+      variance = s2[a] - s1[a] * s1[a] / weight;
+      box->sse += variance;
+      if (variance > max_variance)
+        {
+          max_variance = variance;
+          box->axis = a;
+        }
+    }
+
+  if (box->end - box->start < 2)
+    box->sse = 0.0;
+}
+
+/* Splits box at weighted median of its widest axis, upper half goes
+ * to other. */
+static void
+webx_color_box_split (WebxColorBox   *box,
+                      WebxColorBox   *other,
+                      WebxColorPoint *points)
+{
+  gdouble       half = 0.0;
+  gdouble       weight = 0.0;
+  gint          split;
+  gint          i;
+
+  g_qsort_with_data (points + box->start, box->end - box->start,
+                     sizeof (WebxColorPoint),
+                     (GCompareDataFunc) webx_color_point_compare,
+                     &box->axis);
+
+  for (i = box->start; i < box->end; i++)
+    half += points[i].weight;
+  half /= 2.0;
+
+  for (i = box->start; i < box->end - 1; i++)
+    {
+      weight += points[i].weight;
+      if (weight >= half)
+        break;
+    }
+  split = MIN (i + 1, box->end - 1);
+
+  other->start = split;
+  other->end = box->end;
+  box->end = split;
+
+  webx_color_box_update (box, points);
+  webx_color_box_update (other, points);
+}
+
+static void
+webx_kmeans_job (gint           job,
+                 gint           n_jobs,
+                 WebxKMeansJob *data)
+{
+  const WebxColorPoint *p;
+  const gfloat         *c;
+  gdouble              *sums = data->sums[job];
+  gdouble              *s;
+  gfloat                d0, d1, d2, d3;
+  gfloat                dist, best_dist;
+  gint                  best;
+  gint                  i1, i2;
+  gint                  i, k;
+
+  i1 = data->n_points * job / n_jobs;
+  i2 = data->n_points * (job + 1) / n_jobs;
+
+  memset (sums, 0, data->n_centroids * WEBX_STATS_SIZE * sizeof (gdouble));
+  for (i = i1; i < i2; i++)
+    {
+      p = &data->points[i];
+      best = 0;
+      best_dist = G_MAXFLOAT;
+      for (k = 0; k < data->n_centroids; k++)
+        {
+          c = data->centroids + k * WEBX_CHANNELS;
+          d0 = p->c[0] - c[0];
+          d1 = p->c[1] - c[1];
+          d2 = p->c[2] - c[2];
+          d3 = p->c[3] - c[3];
+          dist = d0 * d0 + d1 * d1 + d2 * d2 + d3 * d3;
+          if (dist < best_dist)
+            {
+              best_dist = dist;
+              best = k;
+            }
+        }
+
+      s = sums + best * WEBX_STATS_SIZE;
+      s[0] += p->weight * p->c[0];
+      s[1] += p->weight * p->c[1];
+      s[2] += p->weight * p->c[2];
+      s[3] += p->weight * p->c[3];
+      s[4] += p->weight;
+      s[5] += p->weight * p->c[0] * p->c[0];
+      s[6] += p->weight * p->c[1] * p->c[1];
+      s[7] += p->weight * p->c[2] * p->c[2];
+      s[8] += p->weight * p->c[3] * p->c[3];
+    }
+}
+
+/* Assigns points to nearest centroids. For each centroid, stats get
+ * weighted sum of colors, total weight and weighted sum of squared
+ * colors of its points (WEBX_STATS_SIZE values). */
+static void
+webx_quantizer_cluster (const WebxColorPoint *points,
+                        gint                  n_points,
+                        const gfloat         *centroids,
+                        gint                  n_centroids,
+                        gdouble              *stats)
+{
+  WebxKMeansJob data;
+  gint          n_jobs;
+  gint          i, j;
+
+  data.points = points;
+  data.n_points = n_points;
+  data.centroids = centroids;
+  data.n_centroids = n_centroids;
+
+  n_jobs = webx_quantizer_get_jobs (n_points, WEBX_MIN_POINTS_PER_JOB);
+  for (j = 0; j < n_jobs; j++)
+    data.sums[j] = g_new (gdouble, n_centroids * WEBX_STATS_SIZE);
+
+  webx_threads_run ((WebxThreadFunc) webx_kmeans_job, n_jobs, &data);
+
+  memset (stats, 0, n_centroids * WEBX_STATS_SIZE * sizeof (gdouble));
+  for (j = 0; j < n_jobs; j++)
+    {
+      for (i = 0; i < n_centroids * WEBX_STATS_SIZE; i++)
+        stats[i] += data.sums[j][i];
+      g_free (data.sums[j]);
+    }
+}
+
+/* Moves centroids to the mean of points nearest to them until they
+ * settle, or for at most given number of iterations. */
+static void
+webx_quantizer_kmeans (const WebxColorPoint *points,
+                       gint                  n_points,
+                       gfloat               *centroids,
+                       gint                  n_centroids,
+                       gint                  iterations)
+{
+  gdouble      *stats;
+  gdouble      *s;
+  gdouble       moved;
+  gdouble       d;
+  gint          iteration;
+  gint          a, k;
+
+  stats = g_new (gdouble, n_centroids * WEBX_STATS_SIZE);
+  for (iteration = 0; iteration < iterations; iteration++)
+    {
+      webx_quantizer_cluster (points, n_points, centroids, n_centroids,
+                              stats);
+
+      moved = 0.0;
+      for (k = 0; k < n_centroids; k++)
+        {
+          s = stats + k * WEBX_STATS_SIZE;
+          if (s[WEBX_STATS_WEIGHT] <= 0.0)
+            continue;
+
+          for (a = 0; a < WEBX_CHANNELS; a++)
+            {
+              d = s[a] / s[WEBX_STATS_WEIGHT]
+                  - centroids[k * WEBX_CHANNELS + a];
+              moved = MAX (moved, d * d);
+              centroids[k * WEBX_CHANNELS + a] = s[a] / s[WEBX_STATS_WEIGHT];
+            }
+        }
+
+      /* less than half a level, rounding would hide further moves */
+      if (moved < 0.25)
+        break;
+    }
+  g_free (stats);
+}
+
+static void
+webx_quantizer_init_tables (void)
+{
+  static gboolean       initialized = FALSE;
+  gdouble               v;
+  gint                  i;
+
+  if (initialized)
+    return;
+
+  for (i = 0; i < 256; i++)
+    {
+      v = i / 255.0;
+      if (v <= 0.04045)
+        v = v / 12.92;
+      else
+        v = pow ((v + 0.055) / 1.055, 2.4);
+      webx_srgb_to_linear_table[i] = v;
+    }
+
+  for (i = 0; i <= WEBX_LINEAR_TABLE_SIZE; i++)
+    {
+      v = (gdouble) i / WEBX_LINEAR_TABLE_SIZE;
+      if (v <= 0.0031308)
+        v = v * 12.92;
+      else
+        v = 1.055 * pow (v, 1.0 / 2.4) - 0.055;
+      webx_linear_to_srgb_table[i] = v * 255.0;
+    }
+
+  initialized = TRUE;
+}
+
+/* 0 .. 255 to 0 .. 1, interpolated between table entries */
+static inline gfloat
+webx_srgb_to_linear (gfloat v)
+{
+  gint  i;
+
+  v = CLAMP (v, 0.0f, 255.0f);
+  i = MIN ((gint) v, 254);
+  return webx_srgb_to_linear_table[i]
+         + (webx_srgb_to_linear_table[i + 1] - webx_srgb_to_linear_table[i])
+           * (v - i);
+}
+
+/* 0 .. 1 to 0 .. 255 */
+static inline gfloat
+webx_linear_to_srgb (gfloat v)
+{
+  gint  i;
+
+  v = CLAMP (v, 0.0f, 1.0f) * WEBX_LINEAR_TABLE_SIZE;
+  i = MIN ((gint) v, WEBX_LINEAR_TABLE_SIZE - 1);
+  return webx_linear_to_srgb_table[i]
+         + (webx_linear_to_srgb_table[i + 1] - webx_linear_to_srgb_table[i])
+           * (v - i);
+}
+
+static void
+webx_rgb_to_oklab (gfloat *c)
+{
+  gfloat        r, g, b;
+  gfloat        l, m, s;
+
+  r = webx_srgb_to_linear (c[0]);
+  g = webx_srgb_to_linear (c[1]);
+  b = webx_srgb_to_linear (c[2]);
+
+  l = cbrtf (0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b);
+  m = cbrtf (0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b);
+  s = cbrtf (0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b);
+
+  c[0] = (0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s)
+         * WEBX_OKLAB_SCALE;
+  c[1] = (1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s)
+         * WEBX_OKLAB_SCALE;
+  c[2] = (0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s)
+         * WEBX_OKLAB_SCALE;
+}
+
+static void
+webx_oklab_to_rgb (gfloat *c)
+{
+  gfloat        L, a, b;
+  gfloat        l, m, s;
+
+  L = c[0] / WEBX_OKLAB_SCALE;
+  a = c[1] / WEBX_OKLAB_SCALE;
+  b = c[2] / WEBX_OKLAB_SCALE;
+
+  l = L + 0.3963377774f * a + 0.2158037573f * b;
+  m = L - 0.1055613458f * a - 0.0638541728f * b;
+  s = L - 0.0894841775f * a - 1.2914855480f * b;
+  l = l * l * l;
+  m = m * m * m;
+  s = s * s * s;
+
+  c[0] = webx_linear_to_srgb (4.0767416621f * l - 3.3077115913f * m
+                              + 0.2309699292f * s);
+  c[1] = webx_linear_to_srgb (-1.2684380046f * l + 2.6097574011f * m
+                              - 0.3413193965f * s);
+  c[2] = webx_linear_to_srgb (-0.0041960863f * l - 0.7034186147f * m
+                              + 1.7076147010f * s);
+}
+
+/* Premultiplied color to premultiplied Oklab, in place. */
+static void
+webx_quantizer_to_oklab (gfloat *c)
+{
+  gfloat        f;
+  gint          a;
+
+  f = 255.0f / MAX (c[3], 1.0f);
+  for (a = 0; a < 3; a++)
+    c[a] *= f;
+  webx_rgb_to_oklab (c);
+  f = c[3] / 255.0f;
+  for (a = 0; a < 3; a++)
+    c[a] *= f;
+}
+
+static void
+webx_quantizer_from_oklab (gfloat *c)
+{
+  gfloat        f;
+  gint          a;
+
+  f = 255.0f / MAX (c[3], 1.0f);
+  for (a = 0; a < 3; a++)
+    c[a] *= f;
+  webx_oklab_to_rgb (c);
+  f = c[3] / 255.0f;
+  for (a = 0; a < 3; a++)
+    c[a] *= f;
+}
+
+/* Histogram bins as points, in premultiplied sRGB. */
+static WebxColorPoint*
+webx_quantizer_get_points (WebxHistogram *histogram,
+                           gint          *n_points)
+{
+  WebxHistogramBin     *bin;
+  WebxColorPoint       *points;
+  WebxColorPoint       *p;
+  gint                  i, a;
+
+  *n_points = 0;
+  for (i = 0; i < WEBX_HISTOGRAM_SIZE; i++)
+    if (histogram->bins[i].count)
+      (*n_points)++;
+  if (histogram->alpha_bins)
+    {
+      for (i = 0; i < WEBX_ALPHA_HISTOGRAM_SIZE; i++)
+        if (histogram->alpha_bins[i].count)
+          (*n_points)++;
+    }
+
+  points = g_new (WebxColorPoint, MAX (*n_points, 1));
+  p = points;
+  for (i = 0; i < WEBX_HISTOGRAM_SIZE; i++)
+    {
+      bin = &histogram->bins[i];
+      if (! bin->count)
+        continue;
+
+      p->weight = bin->count;
+      for (a = 0; a < 3; a++)
+        p->c[a] = (gdouble) bin->sum[a] / bin->count;
+      p->c[3] = 255.0f;
+      p++;
+    }
+
+  if (histogram->alpha_bins)
+    {
+      for (i = 0; i < WEBX_ALPHA_HISTOGRAM_SIZE; i++)
+        {
+          bin = &histogram->alpha_bins[i];
+          if (! bin->count)
+            continue;
+
+          p->weight = bin->count;
+          for (a = 0; a < 3; a++)
+            p->c[a] = (gdouble) bin->sum[a] / (255.0 * bin->count);
+          p->c[3] = (gdouble) bin->sum[3] / bin->count;
+          p++;
+        }
+    }
+
+  return points;
+}
+
+/* Writes centroids as straight RGB colors, and their opacity to alpha
+ * unless it is NULL. */
+static void
+webx_quantizer_write_palette (gfloat         *centroids,
+                              gint            n_centroids,
+                              WebxColorSpace  color_space,
+                              guchar         *palette,
+                              guchar         *alpha)
+{
+  gfloat       *c;
+  gfloat        f;
+  gint          k, a;
+
+  for (k = 0; k < n_centroids; k++)
+    {
+      c = centroids + k * WEBX_CHANNELS;
+      if (color_space == WEBX_COLOR_SPACE_OKLAB)
+        webx_quantizer_from_oklab (c);
+
+      f = 255.0f / MAX (c[3], 1.0f);
+      for (a = 0; a < 3; a++)
+        palette[k * 3 + a] = CLAMP (c[a] * f + 0.5f, 0.0f, 255.0f);
+      if (alpha)
+        alpha[k] = CLAMP (c[3] + 0.5f, 1.0f, 255.0f);
+    }
+}
+
+/* Picks at most num_colors colors representing the histogram, writes
+ * them to palette as RGB triplets and returns how many were picked.
+ * Colors are clustered in given color space. For histograms made with
+ * alpha, opacity of colors is written to alpha. */
+gint
+webx_quantizer_make_palette (WebxHistogram  *histogram,
+                             gint            num_colors,
+                             WebxColorSpace  color_space,
+                             guchar         *palette,
+                             guchar         *alpha)
+{
+  WebxColorPoint       *points;
+  WebxColorBox         *boxes;
+  gfloat               *centroids;
+  gdouble               sum[WEBX_CHANNELS + 1];
+  gdouble               max_sse;
+  gint                  n_points;
+  gint                  n_boxes;
+  gint                  best;
+  gint                  i, k, a;
+
+  g_return_val_if_fail (histogram != NULL, 0);
+  g_return_val_if_fail (palette != NULL, 0);
+  g_return_val_if_fail (alpha != NULL || ! histogram->alpha_bins, 0);
+
+  num_colors = MIN (num_colors, 256);
+  if (num_colors < 1)
+    return 0;
+
+  points = webx_quantizer_get_points (histogram, &n_points);
+  if (n_points <= num_colors)
+    {
+      centroids = g_new (gfloat, MAX (n_points, 1) * WEBX_CHANNELS);
+      for (i = 0; i < n_points; i++)
+        memcpy (centroids + i * WEBX_CHANNELS, points[i].c,
+                WEBX_CHANNELS * sizeof (gfloat));
+      webx_quantizer_write_palette (centroids, n_points,
+                                    WEBX_COLOR_SPACE_RGB, palette, alpha);
+
+      g_free (centroids);
+      g_free (points);
+      return n_points;
+    }
+
+  if (color_space == WEBX_COLOR_SPACE_OKLAB)
+    {
+      webx_quantizer_init_tables ();
+      for (i = 0; i < n_points; i++)
+        webx_quantizer_to_oklab (points[i].c);
+    }
+
+  /* median cut gives the starting palette ... */
+  boxes = g_new (WebxColorBox, num_colors);
+  boxes[0].start = 0;
+  boxes[0].end = n_points;
+  webx_color_box_update (&boxes[0], points);
+  n_boxes = 1;
+  while (n_boxes < num_colors)
+    {
+      best = -1;
+      max_sse = 0.0;
+      for (k = 0; k < n_boxes; k++)
+        {
+          if (boxes[k].sse > max_sse)
+            {
+              max_sse = boxes[k].sse;
+              best = k;
+            }
+        }
+      if (best < 0)
+        break;
+
+      webx_color_box_split (&boxes[best], &boxes[n_boxes], points);
+      n_boxes++;
+    }
+
+  centroids = g_new (gfloat, n_boxes * WEBX_CHANNELS);
+  for (k = 0; k < n_boxes; k++)
+    {
+      memset (sum, 0, sizeof (sum));
+      for (i = boxes[k].start; i < boxes[k].end; i++)
+        {
+          for (a = 0; a < WEBX_CHANNELS; a++)
+            sum[a] += points[i].weight * points[i].c[a];
+          sum[WEBX_CHANNELS] += points[i].weight;
+        }
+      for (a = 0; a < WEBX_CHANNELS; a++)
+        centroids[k * WEBX_CHANNELS + a] = sum[a] / sum[WEBX_CHANNELS];
+    }
+
+  /* ... which k-means then refines */
+  webx_quantizer_kmeans (points, n_points, centroids, n_boxes,
+                         WEBX_KMEANS_ITERATIONS);
+  webx_quantizer_write_palette (centroids, n_boxes, color_space, palette,
+                                alpha);
+
+  g_free (centroids);
+  g_free (boxes);
+  g_free (points);
+
+  return n_boxes;
+}
+
+/* Moves centroids to means of their clusters and drops the ones
+ * without any points. Returns how many are left. */
+static gint
+webx_quantizer_drop_empty (gfloat  *centroids,
+                           gdouble *stats,
+                           gint     n_centroids)
+{
+  gdouble      *s;
+  gint          n = 0;
+  gint          k, a;
+
+  for (k = 0; k < n_centroids; k++)
+    {
+      s = stats + k * WEBX_STATS_SIZE;
+      if (s[WEBX_STATS_WEIGHT] <= 0.0)
+        continue;
+
+      memmove (stats + n * WEBX_STATS_SIZE, s,
+               WEBX_STATS_SIZE * sizeof (gdouble));
+      for (a = 0; a < WEBX_CHANNELS; a++)
+        centroids[n * WEBX_CHANNELS + a] = s[a] / s[WEBX_STATS_WEIGHT];
+      n++;
+    }
+
+  return n;
+}
+
+/* Merges two clusters whose merge adds least error (Ward's
+ * criterion). */
+static void
+webx_quantizer_merge_closest (gfloat  *centroids,
+                              gdouble *stats,
+                              gint     n_centroids)
+{
+  gdouble      *si;
+  gdouble      *sj;
+  gdouble       cost;
+  gdouble       best_cost = G_MAXDOUBLE;
+  gdouble       dist;
+  gdouble       d;
+  gint          best_i = 0;
+  gint          best_j = 1;
+  gint          i, j, a;
+
+  for (i = 0; i < n_centroids; i++)
+    {
+      si = stats + i * WEBX_STATS_SIZE;
+      for (j = i + 1; j < n_centroids; j++)
+        {
+          sj = stats + j * WEBX_STATS_SIZE;
+          dist = 0.0;
+          for (a = 0; a < WEBX_CHANNELS; a++)
+            {
+              d = centroids[i * WEBX_CHANNELS + a]
+                  - centroids[j * WEBX_CHANNELS + a];
+              dist += d * d;
+            }
+          cost = si[WEBX_STATS_WEIGHT] * sj[WEBX_STATS_WEIGHT]
+                 / (si[WEBX_STATS_WEIGHT] + sj[WEBX_STATS_WEIGHT]) * dist;
+          if (cost < best_cost)
+            {
+              best_cost = cost;
+              best_i = i;
+              best_j = j;
+            }
+        }
+    }
+
+  si = stats + best_i * WEBX_STATS_SIZE;
+  sj = stats + best_j * WEBX_STATS_SIZE;
+  for (a = 0; a < WEBX_STATS_SIZE; a++)
+    si[a] += sj[a];
+  for (a = 0; a < WEBX_CHANNELS; a++)
+    centroids[best_i * WEBX_CHANNELS + a] = si[a] / si[WEBX_STATS_WEIGHT];
+
+  /* last one takes place of the merged one */
+  n_centroids--;
+  memmove (sj, stats + n_centroids * WEBX_STATS_SIZE,
+           WEBX_STATS_SIZE * sizeof (gdouble));
+  memmove (centroids + best_j * WEBX_CHANNELS,
+           centroids + n_centroids * WEBX_CHANNELS,
+           WEBX_CHANNELS * sizeof (gfloat));
+}
+
+/* Splits cluster with most error in two along its widest axis, the
+ * new one is added at the end. Stats of both halves are just guessed,
+ * next k-means pass sorts them out. */
+static gboolean
+webx_quantizer_split_widest (gfloat  *centroids,
+                             gdouble *stats,
+                             gint     n_centroids)
+{
+  gdouble      *s;
+  gdouble       variance[WEBX_CHANNELS];
+  gdouble       sse;
+  gdouble       max_sse = 0.5;
+  gdouble       spread;
+  gint          best = -1;
+  gint          axis;
+  gint          k, a;
+
+  for (k = 0; k < n_centroids; k++)
+    {
+      s = stats + k * WEBX_STATS_SIZE;
+      if (s[WEBX_STATS_WEIGHT] <= 0.0)
+        continue;
+
+      sse = 0.0;
+      for (a = 0; a < WEBX_CHANNELS; a++)
+        sse += s[WEBX_STATS_WEIGHT + 1 + a]
+               - s[a] * s[a] / s[WEBX_STATS_WEIGHT];
+      if (sse > max_sse)
+        {
+          max_sse = sse;
+          best = k;
+        }
+    }
+  if (best < 0)
+    return FALSE;
+
+  s = stats + best * WEBX_STATS_SIZE;
+  axis = 0;
+  for (a = 0; a < WEBX_CHANNELS; a++)
+    {
+      variance[a] = (s[WEBX_STATS_WEIGHT + 1 + a]
+                     - s[a] * s[a] / s[WEBX_STATS_WEIGHT])
+                    / s[WEBX_STATS_WEIGHT];
+      if (variance[a] > variance[axis])
+        axis = a;
+    }
+  spread = sqrt (MAX (variance[axis], 0.0));
+
+  for (a = 0; a < WEBX_STATS_SIZE; a++)
+    s[a] /= 2.0;
+  memcpy (stats + n_centroids * WEBX_STATS_SIZE, s,
+          WEBX_STATS_SIZE * sizeof (gdouble));
+  memcpy (centroids + n_centroids * WEBX_CHANNELS,
+          centroids + best * WEBX_CHANNELS,
+          WEBX_CHANNELS * sizeof (gfloat));
+  centroids[best * WEBX_CHANNELS + axis] -= spread;
+  centroids[n_centroids * WEBX_CHANNELS + axis] += spread;
+
+  return TRUE;
+}
+
+/* Like webx_quantizer_make_palette(), but starts from previous
+ * palette made for the same histogram. Clusters are merged or split
+ * to get num_colors, and then refined by few k-means passes only.
+ * previous_alpha is needed for histograms made with alpha. */
+gint
+webx_quantizer_refine_palette (WebxHistogram  *histogram,
+                               gint            num_colors,
+                               WebxColorSpace  color_space,
+                               const guchar   *previous,
+                               const guchar   *previous_alpha,
+                               gint            n_previous,
+                               guchar         *palette,
+                               guchar         *alpha)
+{
+  WebxColorPoint       *points;
+  gfloat               *centroids;
+  gfloat               *c;
+  gdouble              *stats;
+  gint                  n_points;
+  gint                  n_centroids;
+  gint                  i, k, a;
+
+  g_return_val_if_fail (histogram != NULL, 0);
+  g_return_val_if_fail (palette != NULL, 0);
+  g_return_val_if_fail (alpha != NULL || ! histogram->alpha_bins, 0);
+
+  num_colors = MIN (num_colors, 256);
+  if (num_colors < 1)
+    return 0;
+  /* after big jumps starting over is both faster and better */
+  if (! previous || n_previous < 1
+      || (histogram->alpha_bins && ! previous_alpha)
+      || ABS (num_colors - n_previous) > n_previous / 4)
+    {
+      return webx_quantizer_make_palette (histogram, num_colors,
+                                          color_space, palette, alpha);
+    }
+
+  points = webx_quantizer_get_points (histogram, &n_points);
+  if (n_points <= num_colors)
+    {
+      g_free (points);
+      return webx_quantizer_make_palette (histogram, num_colors,
+                                          color_space, palette, alpha);
+    }
+
+  if (color_space == WEBX_COLOR_SPACE_OKLAB)
+    webx_quantizer_init_tables ();
+
+  n_centroids = MAX (num_colors, n_previous);
+  centroids = g_new (gfloat, n_centroids * WEBX_CHANNELS);
+  stats = g_new (gdouble, n_centroids * WEBX_STATS_SIZE);
+  for (k = 0; k < n_previous; k++)
+    {
+      c = centroids + k * WEBX_CHANNELS;
+      c[3] = (histogram->alpha_bins) ? previous_alpha[k] : 255.0f;
+      for (a = 0; a < 3; a++)
+        c[a] = previous[k * 3 + a] * c[3] / 255.0f;
+      if (color_space == WEBX_COLOR_SPACE_OKLAB)
+        webx_quantizer_to_oklab (c);
+    }
+
+  if (color_space == WEBX_COLOR_SPACE_OKLAB)
+    {
+      for (i = 0; i < n_points; i++)
+        webx_quantizer_to_oklab (points[i].c);
+    }
+
+  webx_quantizer_cluster (points, n_points, centroids, n_previous, stats);
+  n_centroids = webx_quantizer_drop_empty (centroids, stats, n_previous);
+
+  while (n_centroids > num_colors)
+    webx_quantizer_merge_closest (centroids, stats, n_centroids--);
+  while (n_centroids < num_colors
+         && webx_quantizer_split_widest (centroids, stats, n_centroids))
+    n_centroids++;
+
+  webx_quantizer_kmeans (points, n_points, centroids, n_centroids,
+                         WEBX_WARM_ITERATIONS);
+  webx_quantizer_write_palette (centroids, n_centroids, color_space,
+                                palette, alpha);
+
+  g_free (stats);
+  g_free (centroids);
+  g_free (points);
+
+  return n_centroids;
+}
+
+/* Collects distinct colors of opaque pixels into palette and returns
+ * their number, or -1 as soon as there are more than max_colors.
+ * transparent is set when some pixel has alpha below half. If alpha
+ * is not NULL, RGBA colors are collected instead with their opacity
+ * written to alpha, and only alpha 0 is transparent. */
+gint
+webx_quantizer_exact_palette (const guchar *pixels,
+                              gint          width,
+                              gint          height,
+                              gint          rowstride,
+                              gint          bpp,
+                              gint          max_colors,
+                              guchar       *palette,
+                              guchar       *alpha,
+                              gboolean     *transparent)
+{
+  guint64       table[1 << WEBX_EXACT_TABLE_BITS];
+  const guchar *row;
+  const guchar *p;
+  guint32       color;
+  guint32       last_color = 0;
+  guint         hash;
+  gint          threshold;
+  gint          opacity;
+  gint          n_colors = 0;
+  gint          x, y;
+
+  g_return_val_if_fail (pixels != NULL, -1);
+  g_return_val_if_fail (bpp == 3 || bpp == 4, -1);
+  g_return_val_if_fail (max_colors <= 256, -1);
+
+  /* entries are color + 1, zero is free slot */
+  memset (table, 0, sizeof (table));
+  *transparent = FALSE;
+  threshold = alpha ? 1 : WEBX_ALPHA_THRESHOLD;
+
+  for (y = 0; y < height; y++)
+    {
+      row = pixels + y * rowstride;
+      for (x = 0; x < width; x++)
+        {
+          p = row + x * bpp;
+          opacity = 255;
+          if (bpp == 4)
+            {
+              if (p[3] < threshold)
+                {
+                  *transparent = TRUE;
+                  continue;
+                }
+              if (alpha)
+                opacity = p[3];
+            }
+
+          /* alpha 0 is never collected, so 0 can't be a color */
+          color = ((guint32) p[0] << 24) | (p[1] << 16) | (p[2] << 8)
+                  | opacity;
+          if (color == last_color)
+            continue;
+          last_color = color;
+
+          hash = (color * 2654435761u) >> (32 - WEBX_EXACT_TABLE_BITS);
+          while (table[hash] && table[hash] != (guint64) color + 1)
+            hash = (hash + 1) & ((1 << WEBX_EXACT_TABLE_BITS) - 1);
+          if (table[hash])
+            continue;
+
+          if (n_colors == max_colors)
+            return -1;
+          table[hash] = (guint64) color + 1;
+          palette[n_colors * 3] = p[0];
+          palette[n_colors * 3 + 1] = p[1];
+          palette[n_colors * 3 + 2] = p[2];
+          if (alpha)
+            alpha[n_colors] = opacity;
+          n_colors++;
+        }
+    }
+
+  return n_colors;
+}
+
+static void
+webx_remap_job (gint          job,
+                gint          n_jobs,
+                WebxRemapJob *data)
+{
+  const guchar *row;
+  const guchar *p;
+  guchar       *dest;
+  guint32       color;
+  guint32       last_color = G_MAXUINT32;
+  gint          last_index = 0;
+  gint          y1, y2;
+  gint          x, y;
+
+  y1 = data->height * job / n_jobs;
+  y2 = data->height * (job + 1) / n_jobs;
+
+  for (y = y1; y < y2; y++)
+    {
+      row = data->pixels + y * data->rowstride;
+      dest = data->indices + y * data->width;
+      for (x = 0; x < data->width; x++)
+        {
+          p = row + x * data->bpp;
+          if (data->bpp == 4 && data->transparent >= 0
+              && p[3] < WEBX_ALPHA_THRESHOLD)
+            {
+              dest[x] = data->transparent;
+              continue;
+            }
+
+          /* flat areas are common, reuse previous lookup */
+          color = (p[0] << 16) | (p[1] << 8) | p[2];
+          if (color != last_color)
+            {
+              last_color = color;
+              last_index = webx_palette_lookup_nearest (data->lookup,
+                                                        p[0], p[1], p[2]);
+            }
+          dest[x] = last_index;
+        }
+    }
+}
+
+/* Maps each pixel to the nearest of the first n_colors palette
+ * colors. If transparent is not -1, pixels with alpha below half get
+ * that index instead. */
+void
+webx_quantizer_remap (const guchar *pixels,
+                      gint          width,
+                      gint          height,
+                      gint          rowstride,
+                      gint          bpp,
+                      const guchar *palette,
+                      gint          n_colors,
+                      gint          transparent,
+                      guchar       *indices)
+{
+  WebxRemapJob  data;
+
+  g_return_if_fail (pixels != NULL);
+  g_return_if_fail (palette != NULL);
+  g_return_if_fail (indices != NULL);
+  g_return_if_fail (bpp == 3 || bpp == 4);
+
+  if (n_colors < 1)
+    {
+      /* nothing but transparent pixels */
+      memset (indices, MAX (transparent, 0), width * height);
+      return;
+    }
+
+  data.pixels = pixels;
+  data.width = width;
+  data.height = height;
+  data.rowstride = rowstride;
+  data.bpp = bpp;
+  data.lookup = webx_palette_lookup_new (palette, n_colors);
+  data.transparent = transparent;
+  data.indices = indices;
+
+  webx_threads_run ((WebxThreadFunc) webx_remap_job,
+                    webx_quantizer_get_jobs (height, WEBX_MIN_ROWS_PER_JOB),
+                    &data);
+
+  webx_palette_lookup_free (data.lookup);
+}
+
+/* Nearest premultiplied palette color, by exhaustive search. */
+static gint
+webx_alpha_remap_nearest (const WebxAlphaRemapJob *data,
+                          const guchar            *p)
+{
+  const gint   *c;
+  gint          pr, pg, pb;
+  gint          d0, d1, d2, d3;
+  gint          dist;
+  gint          best_dist = G_MAXINT;
+  gint          best = 0;
+  gint          i;
+
+  pr = (p[0] * p[3] + 127) / 255;
+  pg = (p[1] * p[3] + 127) / 255;
+  pb = (p[2] * p[3] + 127) / 255;
+  for (i = 0; i < data->n_colors; i++)
+    {
+      if (i == data->transparent)
+        continue;
+
+      c = data->colors + i * 4;
+      d0 = pr - c[0];
+      d1 = pg - c[1];
+      d2 = pb - c[2];
+      d3 = p[3] - c[3];
+      dist = d0 * d0 + d1 * d1 + d2 * d2 + d3 * d3;
+      if (dist < best_dist)
+        {
+          best_dist = dist;
+          best = i;
+        }
+    }
+
+  return best;
+}
+
+static void
+webx_alpha_remap_job (gint               job,
+                      gint               n_jobs,
+                      WebxAlphaRemapJob *data)
+{
+  const guchar *row;
+  const guchar *p;
+  guchar       *dest;
+  guint32       color;
+  guint32       last_color = 0;
+  gint          last_index = MAX (data->transparent, 0);
+  gint          y1, y2;
+  gint          x, y;
+
+  y1 = data->height * job / n_jobs;
+  y2 = data->height * (job + 1) / n_jobs;
+
+  for (y = y1; y < y2; y++)
+    {
+      row = data->pixels + y * data->rowstride;
+      dest = data->indices + y * data->width;
+      for (x = 0; x < data->width; x++)
+        {
+          p = row + x * 4;
+          if (p[3] == 0 && data->transparent >= 0)
+            {
+              dest[x] = data->transparent;
+              continue;
+            }
+
+          color = ((guint32) p[0] << 24) | (p[1] << 16) | (p[2] << 8)
+                  | p[3];
+          if (color != last_color)
+            {
+              last_color = color;
+              /* opaque pixels stay opaque while there are such colors */
+              if (p[3] == 255 && data->lookup)
+                {
+                  last_index = webx_palette_lookup_nearest (data->lookup,
+                                                            p[0], p[1], p[2]);
+                  last_index = data->lookup_map[last_index];
+                }
+              else
+                {
+                  last_index = webx_alpha_remap_nearest (data, p);
+                }
+            }
+          dest[x] = last_index;
+        }
+    }
+}
+
+/* Like webx_quantizer_remap(), but for RGBA pixels and palette with
+ * opacity of each color in alpha. Translucent pixels are mapped to
+ * nearest color by premultiplied RGBA, only pixels with alpha 0 get
+ * transparent index. */
+void
+webx_quantizer_remap_alpha (const guchar *pixels,
+                            gint          width,
+                            gint          height,
+                            gint          rowstride,
+                            const guchar *palette,
+                            const guchar *alpha,
+                            gint          n_colors,
+                            gint          transparent,
+                            guchar       *indices)
+{
+  WebxAlphaRemapJob    *data;
+  guchar                opaque[256 * 3];
+  gint                  n_opaque = 0;
+  gint                  i, a;
+
+  g_return_if_fail (pixels != NULL);
+  g_return_if_fail (palette != NULL);
+  g_return_if_fail (alpha != NULL);
+  g_return_if_fail (indices != NULL);
+
+  if (n_colors < 1 || (n_colors == 1 && transparent == 0))
+    {
+      memset (indices, MAX (transparent, 0), width * height);
+      return;
+    }
+
+  data = g_new (WebxAlphaRemapJob, 1);
+  data->pixels = pixels;
+  data->width = width;
+  data->height = height;
+  data->rowstride = rowstride;
+  data->n_colors = n_colors;
+  data->transparent = transparent;
+  data->indices = indices;
+
+  for (i = 0; i < n_colors; i++)
+    {
+      for (a = 0; a < 3; a++)
+        data->colors[i * 4 + a] = (palette[i * 3 + a] * alpha[i] + 127) / 255;
+      data->colors[i * 4 + 3] = alpha[i];
+
+      if (alpha[i] == 255 && i != transparent)
+        {
+          memcpy (opaque + n_opaque * 3, palette + i * 3, 3);
+          data->lookup_map[n_opaque++] = i;
+        }
+    }
+  data->lookup = NULL;
+  if (n_opaque > 0)
+    data->lookup = webx_palette_lookup_new (opaque, n_opaque);
+
+  webx_threads_run ((WebxThreadFunc) webx_alpha_remap_job,
+                    webx_quantizer_get_jobs (height, WEBX_MIN_ROWS_PER_JOB),
+                    data);
+
+  if (data->lookup)
+    webx_palette_lookup_free (data->lookup);
+  g_free (data);
+}
+
+/* Converts RGB or RGBA pixels to an image with at most num_colors
+ * colors, one of which is reserved for transparency when needed. */
+WebxIndexedImage*
+webx_quantizer_quantize (const guchar *pixels,
+                         gint          width,
+                         gint          height,
+                         gint          rowstride,
+                         gint          bpp,
+                         gint          num_colors)
+{
+  WebxHistogram    *histogram;
+  WebxIndexedImage *image;
+  gboolean          transparent;
+  gint              n_opaque;
+
+  g_return_val_if_fail (pixels != NULL, NULL);
+  g_return_val_if_fail (bpp == 3 || bpp == 4, NULL);
+  g_return_val_if_fail (num_colors >= 2 && num_colors <= 256, NULL);
+
+  histogram = webx_histogram_new (pixels, width, height, rowstride, bpp);
+  transparent = webx_histogram_has_transparent (histogram);
+
+  image = webx_indexed_image_new (width, height);
+  n_opaque = webx_quantizer_make_palette (histogram,
+                                          transparent ?
+                                          num_colors - 1 : num_colors,
+                                          WEBX_COLOR_SPACE_RGB,
+                                          image->palette, NULL);
+  webx_histogram_free (histogram);
+
+  image->n_colors = n_opaque;
+  if (transparent)
+    {
+      image->transparent = n_opaque;
+      memset (image->palette + n_opaque * 3, 0, 3);
+      image->n_colors++;
+    }
+
+  webx_quantizer_remap (pixels, width, height, rowstride, bpp,
+                        image->palette, n_opaque, image->transparent,
+                        image->indices);
+
+  return image;
+}
+
+WebxIndexedImage*
+webx_indexed_image_new (gint    width,
+                        gint    height)
+{
+  WebxIndexedImage *image;
+
+  image = g_new0 (WebxIndexedImage, 1);
+  image->width = width;
+  image->height = height;
+  image->indices = g_new (guchar, MAX (width * height, 1));
+  image->transparent = -1;
+
+  return image;
+}
+
+void
+webx_indexed_image_free (WebxIndexedImage *image)
+{
+  g_return_if_fail (image != NULL);
+
+  g_free (image->indices);
+  g_free (image);
+}
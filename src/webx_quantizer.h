@@ -0,0 +1,131 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+   Native color quantization: histogram of image colors, palette
+   selection (median cut refined by k-means, optionally with alpha)
+   and remapping of pixels to the palette. Each stage is split across
+   worker threads.
+*/
+
+#ifndef __WEBX_QUANTIZER_H__
+#define __WEBX_QUANTIZER_H__
+
+/* palette trained on this many pixels is about as good as on all */
+#define WEBX_TRAINING_SAMPLES   (1 << 20)
+
+typedef struct _WebxHistogram           WebxHistogram;
+typedef struct _WebxIndexedImage        WebxIndexedImage;
+
+typedef enum
+{
+  WEBX_COLOR_SPACE_RGB,
+  /* perceptually uniform Oklab */
+  WEBX_COLOR_SPACE_OKLAB
+} WebxColorSpace;
+
+struct _WebxIndexedImage
+{
+  gint          width;
+  gint          height;
+  /* palette index for each pixel, rows are not padded */
+  guchar       *indices;
+
+  guchar        palette[256 * 3];
+  /* opacity of each palette color, used only if has_alpha */
+  guchar        alpha[256];
+  gboolean      has_alpha;
+  gint          n_colors;
+  /* palette index of transparent color or -1 */
+  gint          transparent;
+};
+
+WebxHistogram*    webx_histogram_new            (const guchar  *pixels,
+                                                 gint           width,
+                                                 gint           height,
+                                                 gint           rowstride,
+                                                 gint           bpp);
+WebxHistogram*    webx_histogram_new_sampled    (const guchar  *pixels,
+                                                 gint           width,
+                                                 gint           height,
+                                                 gint           rowstride,
+                                                 gint           bpp,
+                                                 gint           max_samples);
+WebxHistogram*    webx_histogram_new_with_alpha (const guchar  *pixels,
+                                                 gint           width,
+                                                 gint           height,
+                                                 gint           rowstride,
+                                                 gint           max_samples);
+void              webx_histogram_free           (WebxHistogram *histogram);
+gboolean          webx_histogram_has_transparent (WebxHistogram *histogram);
+
+gint              webx_quantizer_make_palette   (WebxHistogram *histogram,
+                                                 gint           num_colors,
+                                                 WebxColorSpace color_space,
+                                                 guchar        *palette,
+                                                 guchar        *alpha);
+gint              webx_quantizer_refine_palette (WebxHistogram *histogram,
+                                                 gint           num_colors,
+                                                 WebxColorSpace color_space,
+                                                 const guchar  *previous,
+                                                 const guchar  *previous_alpha,
+                                                 gint           n_previous,
+                                                 guchar        *palette,
+                                                 guchar        *alpha);
+gint              webx_quantizer_exact_palette  (const guchar  *pixels,
+                                                 gint           width,
+                                                 gint           height,
+                                                 gint           rowstride,
+                                                 gint           bpp,
+                                                 gint           max_colors,
+                                                 guchar        *palette,
+                                                 guchar        *alpha,
+                                                 gboolean      *transparent);
+void              webx_quantizer_remap          (const guchar  *pixels,
+                                                 gint           width,
+                                                 gint           height,
+                                                 gint           rowstride,
+                                                 gint           bpp,
+                                                 const guchar  *palette,
+                                                 gint           n_colors,
+                                                 gint           transparent,
+                                                 guchar        *indices);
+void              webx_quantizer_remap_alpha    (const guchar  *pixels,
+                                                 gint           width,
+                                                 gint           height,
+                                                 gint           rowstride,
+                                                 const guchar  *palette,
+                                                 const guchar  *alpha,
+                                                 gint           n_colors,
+                                                 gint           transparent,
+                                                 guchar        *indices);
+
+WebxIndexedImage* webx_quantizer_quantize       (const guchar  *pixels,
+                                                 gint           width,
+                                                 gint           height,
+                                                 gint           rowstride,
+                                                 gint           bpp,
+                                                 gint           num_colors);
+
+WebxIndexedImage* webx_indexed_image_new        (gint           width,
+                                                 gint           height);
+void              webx_indexed_image_free       (WebxIndexedImage *image);
+
+#endif /* __WEBX_QUANTIZER_H__ */
@@ -38,6 +38,9 @@ enum
 static GdkPixbuf* webx_target_real_render_preview (WebxTarget          *widget,
                                                    WebxTargetInput     *input,
                                                    gint                *file_size);
+static void       webx_target_real_get_block_size (WebxTarget          *widget,
+                                                   gint                *width,
+                                                   gint                *height);
 
 
 static void   webx_percent_entry_update (GtkObject *object,
@@ -64,6 +67,11 @@ webx_target_class_init (WebxTargetClass *klass)
   klass->render_preview = webx_target_real_render_preview;
   klass->get_unique_name = NULL;
   klass->get_extension   = NULL;
+  klass->get_block_size  = webx_target_real_get_block_size;
+  klass->uses_frames     = NULL;
+  klass->uses_pixels     = NULL;
+  klass->needs_whole     = NULL;
+  klass->finish_export   = NULL;
 
   klass->target_changed  = NULL;
 
@@ -165,6 +173,81 @@ webx_target_get_extension (WebxTarget  *widget)
   return WEBX_TARGET_GET_CLASS (widget)->get_extension (widget);
 }
 
+/* Size of the block grid the encoder works on. Partial previews
+ * must be aligned to it to show the same artifacts as full image. */
+void
+webx_target_get_block_size (WebxTarget  *widget,
+                            gint        *width,
+                            gint        *height)
+{
+  g_return_if_fail (WEBX_IS_TARGET (widget));
+  g_return_if_fail (width != NULL && height != NULL);
+
+  WEBX_TARGET_GET_CLASS (widget)->get_block_size (widget, width, height);
+}
+
+static void
+webx_target_real_get_block_size (WebxTarget  *widget,
+                                 gint        *width,
+                                 gint        *height)
+{
+  *width = 1;
+  *height = 1;
+}
+
+/* Whether target wants layers of image as animation frames, as
+ * frames_image of its input. */
+gboolean
+webx_target_uses_frames (WebxTarget  *widget)
+{
+  g_return_val_if_fail (WEBX_IS_TARGET (widget), FALSE);
+
+  if (! WEBX_TARGET_GET_CLASS (widget)->uses_frames)
+    return FALSE;
+
+  return WEBX_TARGET_GET_CLASS (widget)->uses_frames (widget);
+}
+
+/* Whether target renders preview from pixels of its input alone, when
+ * they are available, without reading rgb or indexed image. */
+gboolean
+webx_target_uses_pixels (WebxTarget  *widget)
+{
+  g_return_val_if_fail (WEBX_IS_TARGET (widget), FALSE);
+
+  if (! WEBX_TARGET_GET_CLASS (widget)->uses_pixels)
+    return FALSE;
+
+  return WEBX_TARGET_GET_CLASS (widget)->uses_pixels (widget);
+}
+
+/* Whether preview of a region would not look like that part of the
+ * whole image, so target must always be rendered whole. */
+gboolean
+webx_target_needs_whole (WebxTarget  *widget)
+{
+  g_return_val_if_fail (WEBX_IS_TARGET (widget), FALSE);
+
+  if (! WEBX_TARGET_GET_CLASS (widget)->needs_whole)
+    return FALSE;
+
+  return WEBX_TARGET_GET_CLASS (widget)->needs_whole (widget);
+}
+
+/* Called after file_name was exported, so that target can work on the
+ * file some more with parent window still open. */
+void
+webx_target_finish_export (WebxTarget  *widget,
+                           const gchar *file_name,
+                           GtkWindow   *parent)
+{
+  g_return_if_fail (WEBX_IS_TARGET (widget));
+  g_return_if_fail (file_name != NULL);
+
+  if (WEBX_TARGET_GET_CLASS (widget)->finish_export)
+    WEBX_TARGET_GET_CLASS (widget)->finish_export (widget, file_name, parent);
+}
+
 GtkObject*
 webx_percent_entry_new (WebxTarget *target,
                         gint        row,
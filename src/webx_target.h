@@ -45,6 +45,22 @@ struct _WebxTargetInput
 
   gint  width;
   gint  height;
+
+  /* rgb(a) pixels of rgb_layer, NULL if not available */
+  const guchar *pixels;
+  gint          rowstride;
+  gint          bpp;
+  /* changes whenever pixels are regenerated */
+  guint         serial;
+  /* whole target when pixels are only the region of it which is
+   * rendered, the same as pixels, width and height otherwise */
+  const guchar *whole_pixels;
+  gint          whole_width;
+  gint          whole_height;
+
+  /* one layer per animation frame, resized and cropped like
+   * rgb_image; -1 unless target uses frames */
+  gint          frames_image;
 };
 
 struct _WebxTarget
@@ -64,6 +80,15 @@ struct _WebxTargetClass
                                    gint                *file_size);
   gchar*     (* get_unique_name)  (WebxTarget  *widget);
   gchar*     (* get_extension)    (WebxTarget  *widget);
+  void       (* get_block_size)   (WebxTarget  *widget,
+                                   gint        *width,
+                                   gint        *height);
+  gboolean   (* uses_frames)      (WebxTarget  *widget);
+  gboolean   (* uses_pixels)      (WebxTarget  *widget);
+  gboolean   (* needs_whole)      (WebxTarget  *widget);
+  void       (* finish_export)    (WebxTarget          *widget,
+                                   const gchar         *file_name,
+                                   GtkWindow           *parent);
 
   void       (* target_changed) (WebxTarget  *widget);
 };
@@ -80,6 +105,15 @@ GdkPixbuf* webx_target_render_preview  (WebxTarget             *widget,
                                         gint                   *file_size);
 gchar*     webx_target_get_unique_name (WebxTarget  *widget);
 gchar*     webx_target_get_extension   (WebxTarget  *widget);
+void       webx_target_get_block_size  (WebxTarget  *widget,
+                                        gint        *width,
+                                        gint        *height);
+gboolean   webx_target_uses_frames     (WebxTarget  *widget);
+gboolean   webx_target_uses_pixels     (WebxTarget  *widget);
+gboolean   webx_target_needs_whole     (WebxTarget  *widget);
+void       webx_target_finish_export   (WebxTarget             *widget,
+                                        const gchar            *file_name,
+                                        GtkWindow              *parent);
 
 
 /* convenience routines */
@@ -0,0 +1,137 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#ifndef G_OS_WIN32
+#include <unistd.h>
+#endif
+
+#include "webx_threads.h"
+
+typedef struct
+{
+  WebxThreadFunc        func;
+  gpointer              data;
+  gint                  n_jobs;
+  gint                  remaining;
+  GMutex               *mutex;
+  GCond                *cond;
+} WebxThreadsBatch;
+
+typedef struct
+{
+  WebxThreadsBatch     *batch;
+  gint                  job;
+} WebxThreadsJob;
+
+static GThreadPool *webx_threads_pool = NULL;
+G_LOCK_DEFINE_STATIC (webx_threads_pool);
+
+/* Number of jobs worth splitting work into. */
+gint
+webx_threads_get_count (void)
+{
+  static gint count = 0;
+
+  if (! count)
+    {
+#if defined (_SC_NPROCESSORS_ONLN)
+      count = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+      count = CLAMP (count, 1, WEBX_MAX_THREADS);
+    }
+
+  return count;
+}
+
+static void
+webx_threads_worker (WebxThreadsJob *job,
+                     gpointer        user_data)
+{
+  WebxThreadsBatch     *batch = job->batch;
+
+  batch->func (job->job, batch->n_jobs, batch->data);
+
+  g_mutex_lock (batch->mutex);
+  if (--batch->remaining == 0)
+    g_cond_signal (batch->cond);
+  g_mutex_unlock (batch->mutex);
+}
+
+/* Runs func for each job number in [0, n_jobs) and returns when all
+ * of them are done. Calling thread takes the first job itself. */
+void
+webx_threads_run (WebxThreadFunc  func,
+                  gint            n_jobs,
+                  gpointer        data)
+{
+  WebxThreadsBatch      batch;
+  WebxThreadsJob       *jobs;
+  gint                  i;
+
+  g_return_if_fail (func != NULL);
+
+  /* batches may come from background threads too */
+  G_LOCK (webx_threads_pool);
+  if (n_jobs > 1 && ! webx_threads_pool && g_thread_supported ())
+    {
+      webx_threads_pool = g_thread_pool_new ((GFunc) webx_threads_worker,
+                                             NULL,
+                                             webx_threads_get_count (),
+                                             FALSE, NULL);
+    }
+  G_UNLOCK (webx_threads_pool);
+
+  if (n_jobs <= 1 || ! webx_threads_pool)
+    {
+      for (i = 0; i < n_jobs; i++)
+        func (i, n_jobs, data);
+      return;
+    }
+
+  batch.func = func;
+  batch.data = data;
+  batch.n_jobs = n_jobs;
+  batch.remaining = n_jobs - 1;
+  batch.mutex = g_mutex_new ();
+  batch.cond = g_cond_new ();
+
+  jobs = g_new (WebxThreadsJob, n_jobs);
+  for (i = 1; i < n_jobs; i++)
+    {
+      jobs[i].batch = &batch;
+      jobs[i].job = i;
+      g_thread_pool_push (webx_threads_pool, &jobs[i], NULL);
+    }
+
+  func (0, n_jobs, data);
+
+  g_mutex_lock (batch.mutex);
+  while (batch.remaining)
+    g_cond_wait (batch.cond, batch.mutex);
+  g_mutex_unlock (batch.mutex);
+
+  g_mutex_free (batch.mutex);
+  g_cond_free (batch.cond);
+  g_free (jobs);
+}
@@ -0,0 +1,41 @@
+/* Save for Web plug-in for The GIMP
+ *
+ * Copyright (C) 2006-2007, Aurimas Juška
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St. 5th Floor Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+   Runs independent jobs on a pool of worker threads. Jobs must not
+   call GIMP or GTK+, they are for pixel crunching only.
+*/
+
+#ifndef __WEBX_THREADS_H__
+#define __WEBX_THREADS_H__
+
+#define WEBX_MAX_THREADS        16
+
+typedef void (* WebxThreadFunc) (gint          job,
+                                 gint          n_jobs,
+                                 gpointer      data);
+
+gint        webx_threads_get_count  (void);
+
+void        webx_threads_run        (WebxThreadFunc  func,
+                                     gint            n_jobs,
+                                     gpointer        data);
+
+#endif /* __WEBX_THREADS_H__ */
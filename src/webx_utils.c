@@ -67,6 +67,46 @@ webx_image_to_pixbuf (gint image)
   return webx_drawable_to_pixbuf (layer);
 }
 
+/* Pixbuf with colors of indexed pixels, with alpha channel if the
+ * palette has transparent or translucent colors. */
+GdkPixbuf*
+webx_indexed_image_to_pixbuf (const WebxIndexedImage *image)
+{
+  GdkPixbuf       *pixbuf;
+  gboolean         has_alpha;
+  const guchar    *src;
+  guchar          *dest;
+  gint             bpp;
+  gint             i;
+
+  has_alpha = image->has_alpha || image->transparent >= 0;
+  bpp = has_alpha ? 4 : 3;
+
+  dest = g_malloc (image->width * image->height * bpp);
+  pixbuf = gdk_pixbuf_new_from_data (dest, GDK_COLORSPACE_RGB,
+                                     has_alpha, 8,
+                                     image->width, image->height,
+                                     image->width * bpp,
+                                     (GdkPixbufDestroyNotify)g_free, NULL);
+
+  for (i = 0; i < image->width * image->height; i++)
+    {
+      src = image->palette + image->indices[i] * 3;
+      *dest++ = src[0];
+      *dest++ = src[1];
+      *dest++ = src[2];
+      if (! has_alpha)
+        continue;
+
+      if (image->has_alpha)
+        *dest++ = image->alpha[image->indices[i]];
+      else
+        *dest++ = (image->indices[i] == image->transparent) ? 0 : 255;
+    }
+
+  return pixbuf;
+}
+
 gint
 webx_get_file_size (const gchar *file_name)
 {
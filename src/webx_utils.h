@@ -21,8 +21,11 @@
 #ifndef __WEBX_UTILS_H__
 #define __WEBX_UTILS_H__
 
+#include "webx_quantizer.h"
+
 GdkPixbuf*  webx_drawable_to_pixbuf (gint drawable);
 GdkPixbuf*  webx_image_to_pixbuf    (gint image);
+GdkPixbuf*  webx_indexed_image_to_pixbuf (const WebxIndexedImage *image);
 
 gint        webx_get_file_size      (const gchar *file_name);
 